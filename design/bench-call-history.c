@@ -0,0 +1,314 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Benchmark for recording call history (`hxr_thread_frame_entrance_` and
+// `hxr_callsite_*` in hexer.c).
+//
+// This calls a small recursive function (a binary tree of calls, 4 deep, so
+// each call has a parent, siblings, and children) many times:
+//
+// * "off":     the function has no HXR_ENTER_FUNCTION.
+// * "history": the function starts with HXR_ENTER_FUNCTION, which bumps its
+//                callsite's call count and records a 16-byte entry in the
+//                thread's ring (callsite id, depth from the frame address,
+//                store), and folds the calls that
+//                have returned into the ones before them when they repeat.
+//                Every tree is the same, so nearly everything folds. It also
+//                counts the call against its call path, which is cached in
+//                the calling frame for the second call of each pair.
+//
+// The difference, divided by the number of calls, is the cost per call.
+//
+// hexer.c can't be compiled on its own yet, so the code below is a trimmed
+// copy of the one in hexer.c. Keep them in sync if either changes.
+//
+// Build and run:
+//   cc -O2 -o bench-call-history bench-call-history.c && ./bench-call-history
+//
+// Add -DFRAME_TIMING=1 to also time each frame with the TSC, the way
+// HXR_ENABLE_FRAME_TIMING does (x86 only). Add -DMAX_PATHS=0 to leave out
+// the call paths, the way HXR_PROFILE_MAX_PATHS=0 does.
+
+#define N_TREES         (1000000)
+#define N_RUNS          (5)
+#define TREE_DEPTH      (4)
+#define HISTORY_MAX     (256)
+#define DEPTH_MAX       (128)
+#define TABLE_SIZE      (4096)
+#define PATH_PROBES     (16)
+#define PATH_LOST       (0xFFFFFFFFu)
+
+#ifndef MAX_PATHS
+#define MAX_PATHS       (8192)
+#endif
+
+#ifndef FRAME_TIMING
+#define FRAME_TIMING    (0)
+#endif
+
+typedef struct entry
+{
+	uint32_t  callsite;
+	uint32_t  depth;
+	uint64_t  count;
+} entry;
+
+typedef struct frame
+{
+	const void  *address;
+	size_t      entry;
+	uint32_t    path;
+	uint32_t    last_callsite;
+	uint32_t    last_path;
+#if FRAME_TIMING
+	struct callsite  *site;
+	uint64_t         start;
+	uint64_t         child;
+#endif
+} frame;
+
+typedef struct thread
+{
+	entry       history[HISTORY_MAX];
+	size_t      pos;
+	size_t      count;
+	frame       frames[DEPTH_MAX + 1];
+	size_t      depth;
+} thread;
+
+typedef struct callsite
+{
+	const char  *file;
+	const char  *function;
+	int         line;
+	size_t      calls;
+	size_t      id;
+#if FRAME_TIMING
+	uint64_t    inclusive;
+	uint64_t    exclusive;
+#endif
+} callsite;
+
+static callsite  *table[TABLE_SIZE];
+static size_t    n_ids;
+
+typedef struct path
+{
+	size_t    state;
+	uint32_t  parent;
+	uint32_t  callsite;
+	size_t    count;
+} path;
+
+#if MAX_PATHS > 0
+static path    paths[MAX_PATHS];
+static size_t  lost;
+#endif
+
+__attribute__((noinline))
+static size_t register_site(callsite *site)
+{
+	size_t id = __atomic_load_n(&site->id, __ATOMIC_SEQ_CST);
+	if ( id != 0 )
+		return id;
+	id = __atomic_fetch_add(&n_ids, 1, __ATOMIC_SEQ_CST) + 1;
+	__atomic_store_n(&table[id - 1], site, __ATOMIC_RELEASE);
+	size_t expected = 0;
+	if ( !__atomic_compare_exchange_n(&site->id, &expected, id, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) )
+		id = expected;
+	return id;
+}
+
+#if MAX_PATHS > 0
+__attribute__((noinline))
+static uint32_t get_path(uint32_t parent, uint32_t site)
+{
+	if ( parent == PATH_LOST )
+		return PATH_LOST;
+	uint64_t key   = ((uint64_t)parent << 32) | site;
+	size_t   start = (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32);
+	for ( size_t i = 0; i < PATH_PROBES; i++ )
+	{
+		size_t slot = (start + i) & (MAX_PATHS - 1);
+		path   *p   = &paths[slot];
+		size_t state = __atomic_load_n(&p->state, __ATOMIC_SEQ_CST);
+		if ( state == 0 ) {
+			size_t expected = 0;
+			if ( __atomic_compare_exchange_n(&p->state, &expected, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ) {
+				p->parent   = parent;
+				p->callsite = site;
+				__atomic_store_n(&p->state, 2, __ATOMIC_SEQ_CST);
+				return (uint32_t)(slot + 1);
+			}
+			state = expected;
+		}
+		while ( state == 1 )
+			state = __atomic_load_n(&p->state, __ATOMIC_SEQ_CST);
+		if ( p->parent == parent && p->callsite == site )
+			return (uint32_t)(slot + 1);
+	}
+	return PATH_LOST;
+}
+#endif
+
+static size_t fold(thread *t, size_t start, size_t end)
+{
+	size_t len = end - start;
+	if ( len + len > t->count )
+		return end;
+	entry *prev = &t->history[(start - len) & (HISTORY_MAX - 1)];
+	entry *next = &t->history[start & (HISTORY_MAX - 1)];
+	if ( prev->callsite != next->callsite || prev->depth != next->depth )
+		return end;
+	for ( size_t i = 1; i < len; i++ ) {
+		const entry *a = &t->history[(start - len + i) & (HISTORY_MAX - 1)];
+		const entry *b = &t->history[(start + i) & (HISTORY_MAX - 1)];
+		if ( a->callsite != b->callsite || a->depth != b->depth || a->count != b->count )
+			return end;
+	}
+	prev->count += next->count;
+	t->count -= len;
+	return start;
+}
+
+__attribute__((noinline))
+static void frame_entrance(thread **frame_id, const void *frame_address, callsite *site)
+{
+	__atomic_store_n(&site->calls, __atomic_load_n(&site->calls, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+	size_t id = __atomic_load_n(&site->id, __ATOMIC_SEQ_CST);
+	if ( id == 0 )
+		id = register_site(site);
+	thread *t = *frame_id;
+	const char *frame = frame_address;
+	size_t depth = t->depth;
+	size_t end   = t->pos;
+#if FRAME_TIMING
+	uint64_t now = __builtin_ia32_rdtsc();
+#endif
+	while ( (const char*)t->frames[depth].address <= frame ) {
+		end = fold(t, t->frames[depth].entry, end);
+#if FRAME_TIMING
+		struct frame *f = &t->frames[depth];
+		uint64_t inclusive = now - f->start;
+		uint64_t exclusive = inclusive > f->child ? inclusive - f->child : 0;
+		__atomic_store_n(&f->site->inclusive, __atomic_load_n(&f->site->inclusive, __ATOMIC_RELAXED) + inclusive, __ATOMIC_RELAXED);
+		__atomic_store_n(&f->site->exclusive, __atomic_load_n(&f->site->exclusive, __ATOMIC_RELAXED) + exclusive, __ATOMIC_RELAXED);
+		t->frames[depth - 1].child += inclusive;
+#endif
+		depth--;
+	}
+
+	uint32_t p = PATH_LOST;
+#if MAX_PATHS > 0
+	struct frame *parent = &t->frames[depth];
+	if ( parent->last_callsite == (uint32_t)id )
+		p = parent->last_path;
+	else {
+		p = get_path(parent->path, (uint32_t)id);
+		parent->last_callsite = (uint32_t)id;
+		parent->last_path     = p;
+	}
+	size_t *count = p == PATH_LOST ? &lost : &paths[p - 1].count;
+	__atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+#endif
+
+	entry *e = &t->history[end & (HISTORY_MAX - 1)];
+	e->callsite = (uint32_t)id;
+	e->depth    = (uint32_t)depth;
+	e->count    = 1;
+	t->pos = end + 1;
+	if ( t->count < HISTORY_MAX )
+		t->count++;
+
+	if ( depth < DEPTH_MAX ) {
+		depth++;
+		t->frames[depth].address = frame;
+		t->frames[depth].entry   = end;
+		t->frames[depth].path    = p;
+		t->frames[depth].last_callsite = 0;
+#if FRAME_TIMING
+		t->frames[depth].site  = site;
+		t->frames[depth].start = now;
+		t->frames[depth].child = 0;
+#endif
+	}
+	t->depth = depth;
+}
+
+#define ENTER_FUNCTION(t) \
+	do { \
+		static callsite site_ = { __FILE__, __func__, __LINE__, 0, 0 }; \
+		frame_entrance(&(t), __builtin_frame_address(0), &site_); \
+	} while (0)
+
+static volatile size_t sink;
+
+// The recursive calls go through pointers so that the compiler can't turn
+// the second one into a loop (which would run both in the same frame).
+static size_t tree_off(thread *t, int depth);
+static size_t tree_history(thread *t, int depth);
+static size_t (*volatile call_off)(thread*, int)     = &tree_off;
+static size_t (*volatile call_history)(thread*, int) = &tree_history;
+
+__attribute__((noinline))
+static size_t tree_off(thread *t, int depth)
+{
+	size_t n = 1;
+	if ( depth > 0 ) {
+		n += call_off(t, depth - 1);
+		n += call_off(t, depth - 1);
+	}
+	return n;
+}
+
+__attribute__((noinline))
+static size_t tree_history(thread *t, int depth)
+{
+	ENTER_FUNCTION(t);
+	size_t n = 1;
+	if ( depth > 0 ) {
+		n += call_history(t, depth - 1);
+		n += call_history(t, depth - 1);
+	}
+	return n;
+}
+
+static double now_seconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, const char *argv[])
+{
+	static thread  th;
+	th.frames[0].address = (const void*)~(uintptr_t)0;
+	static const char *names[] = { "off", "history" };
+	double best[2] = { 1e30, 1e30 };
+	size_t calls = 0;
+
+	for ( int run = 0; run < N_RUNS; run++ )
+	{
+		for ( int mode = 0; mode < 2; mode++ )
+		{
+			size_t n = 0;
+			double start = now_seconds();
+			for ( int i = 0; i < N_TREES; i++ )
+				n += mode == 0 ? tree_off(&th, TREE_DEPTH) : tree_history(&th, TREE_DEPTH);
+			double elapsed = now_seconds() - start;
+			if ( elapsed < best[mode] )
+				best[mode] = elapsed;
+			sink = n;
+			calls = n;
+		}
+	}
+
+	printf("%zu calls\n", calls);
+	for ( int mode = 0; mode < 2; mode++ )
+		printf("  %-8s %8.3f ms  %5.2f ns/call\n", names[mode], best[mode] * 1e3, best[mode] * 1e9 / calls);
+	printf("  recording costs %.2f ns/call\n", (best[1] - best[0]) * 1e9 / calls);
+	printf("  %zu entries in the ring (%zu written)\n", th.count, calls * N_RUNS);
+	return 0;
+}
@@ -0,0 +1,373 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+// Benchmark for the buffered descriptor stream (`hxr_fdstream_*` in hexer.c).
+//
+// This renders the `elephant_in_way` message from the README many thousands
+// of times, the same way `hxr_send_message_text_` does (one `write_iov` call
+// per message), through:
+//
+// * "fprintf":     `fprintf` for every piece of the message, which is what
+//                    the renderer did before `write_iov`, with an `fflush`
+//                    after each message so that it's on its way to the file
+//                    like with the first fdstream policy.
+// * "fstream":     `fwrite` for every fragment under one `flockfile`, like
+//                    `fstream_write_iov`, and an `fflush` after each message.
+// * "fstream-nf":  the same, but leaving buffering entirely to stdio.
+// * "fd/message":  an fdstream with HXR_FDSTREAM_FLUSH_EACH_MESSAGE.
+// * "fd/16k":      an fdstream with HXR_FDSTREAM_FLUSH_THRESHOLD at 16 KiB.
+// * "fd/explicit": an fdstream with HXR_FDSTREAM_FLUSH_EXPLICIT, flushed
+//                    once at the end.
+//
+// Every run writes to /dev/null (to see the CPU cost) and to a temporary
+// file (to see the system call cost too), and the best of N_RUNS is shown.
+// "flushes" counts the `fflush`/`writev` calls made by the streams; the
+// writes that stdio makes on its own when its buffer fills aren't counted.
+//
+// hexer.c can't be compiled on its own yet, so the stream code below is a
+// trimmed copy of the one in hexer.c. Keep them in sync if either changes.
+//
+// Build and run:
+//   cc -O2 -o bench-fdstream bench-fdstream.c && ./bench-fdstream
+
+#define N_MESSAGES      (200000)
+#define N_RUNS          (5)
+#define BUFFER_SIZE     (16384)
+#define MAX_IOV         (64)
+#define DIRECT_MIN      (1024)
+
+#define FLUSH_EACH_MESSAGE  (0)
+#define FLUSH_THRESHOLD     (1)
+#define FLUSH_EXPLICIT      (2)
+
+static size_t n_syscalls;
+
+// ----- the stream interface -----
+
+typedef struct stream stream;
+typedef struct fragment
+{
+	const char  *base;
+	size_t      len;
+} fragment;
+
+typedef struct stream_vtbl
+{
+	ssize_t (*write_iov)(stream*, const fragment *iov, size_t iov_count);
+	void    (*end_message)(stream*);
+} stream_vtbl;
+
+struct stream
+{
+	stream_vtbl  *vtable;
+};
+
+// ----- fstream strategy -----
+
+typedef struct fstream
+{
+	stream  base;
+	FILE    *fd;
+	int     flush_each;
+} fstream;
+
+static ssize_t fstream_write_iov(stream *s, const fragment *iov, size_t iov_count)
+{
+	FILE *fd = ((fstream*)s)->fd;
+	size_t total = 0;
+	flockfile(fd);
+	for ( size_t i = 0; i < iov_count; i++ ) {
+		fwrite(iov[i].base, 1, iov[i].len, fd);
+		total += iov[i].len;
+	}
+	funlockfile(fd);
+	return (ssize_t)total;
+}
+
+static void fstream_end_message(stream *s)
+{
+	fstream *fs = (fstream*)s;
+	if ( fs->flush_each ) {
+		fflush(fs->fd);
+		n_syscalls++;
+	}
+}
+
+static stream_vtbl fstream_vtbl = { &fstream_write_iov, &fstream_end_message };
+
+// ----- fdstream strategy -----
+
+typedef struct fdstream
+{
+	stream        base;
+	int           fd;
+	int           flush_policy;
+	size_t        flush_threshold;
+	char          buf[BUFFER_SIZE];
+	size_t        buf_len;
+	struct iovec  iov[MAX_IOV];
+	int           iov_count;
+	size_t        pending;
+	int           in_message;
+	int           has_direct;
+} fdstream;
+
+static void fd_flush(fdstream *out)
+{
+	struct iovec *iov = out->iov;
+	int iov_count = out->iov_count;
+	while ( iov_count > 0 )
+	{
+		ssize_t rc = writev(out->fd, iov, iov_count);
+		n_syscalls++;
+		if ( rc < 0 )
+			break;
+		size_t written = (size_t)rc;
+		while ( iov_count > 0 && written >= iov->iov_len ) {
+			written -= iov->iov_len;
+			iov++;
+			iov_count--;
+		}
+		if ( iov_count > 0 ) {
+			iov->iov_base = (char*)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	out->iov_count = 0;
+	out->pending = 0;
+	out->buf_len = 0;
+	out->has_direct = 0;
+}
+
+static void fd_push_iov(fdstream *out, const char *ptr, size_t len)
+{
+	if ( out->iov_count == MAX_IOV )
+		fd_flush(out);
+	out->iov[out->iov_count].iov_base = (void*)ptr;
+	out->iov[out->iov_count].iov_len  = len;
+	out->iov_count++;
+	out->pending += len;
+}
+
+static void fd_claim(fdstream *out, char *dest, size_t len)
+{
+	struct iovec *last = out->iov_count > 0 ? &out->iov[out->iov_count-1] : NULL;
+	out->buf_len += len;
+	if ( last != NULL && (char*)last->iov_base + last->iov_len == dest ) {
+		last->iov_len += len;
+		out->pending += len;
+	}
+	else if ( len > 0 )
+		fd_push_iov(out, dest, len);
+}
+
+static int fd_should_flush(fdstream *out)
+{
+	if ( out->has_direct )
+		return 1;
+	switch ( out->flush_policy )
+	{
+		case FLUSH_EACH_MESSAGE: return 1;
+		case FLUSH_THRESHOLD:    return out->pending >= out->flush_threshold;
+		default:                 return 0;
+	}
+}
+
+static void fd_put(fdstream *out, const char *text, size_t len)
+{
+	if ( len < DIRECT_MIN ) {
+		if ( len > BUFFER_SIZE - out->buf_len || out->iov_count == MAX_IOV )
+			fd_flush(out);
+		memcpy(out->buf + out->buf_len, text, len);
+		fd_claim(out, out->buf + out->buf_len, len);
+	}
+	else {
+		fd_push_iov(out, text, len);
+		out->has_direct = 1;
+	}
+}
+
+static ssize_t fdstream_write_iov(stream *s, const fragment *iov, size_t iov_count)
+{
+	fdstream *out = (fdstream*)s;
+	size_t total = 0;
+	for ( size_t i = 0; i < iov_count; i++ ) {
+		if ( iov[i].len > 0 )
+			fd_put(out, iov[i].base, iov[i].len);
+		total += iov[i].len;
+	}
+	return (ssize_t)total;
+}
+
+static void fdstream_end_message(stream *s)
+{
+	fdstream *out = (fdstream*)s;
+	if ( fd_should_flush(out) )
+		fd_flush(out);
+}
+
+static stream_vtbl fdstream_vtbl = { &fdstream_write_iov, &fdstream_end_message };
+
+// ----- the benchmark -----
+
+static const char *summary_text =
+	"Object did not continue to move. There is an elephant in the way.";
+static const char *suggestion_text =
+	"Either lure the elephant away with some food, request the help "
+	"of a staff assistant, or do something else for a few hours "
+	"before coming back to this.";
+
+static double now_seconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#define ADD(ptr, n_bytes) \
+	do { iov[n].base = (ptr); iov[n].len = (n_bytes); n++; } while (0)
+#define ADD_STR(str)  ADD((str), strlen(str))
+
+// Same layout and fragments as `hxr_send_message_text_`.
+static void send_message(stream *s, int i, const char *details)
+{
+	fragment iov[20];
+	size_t n = 0;
+	char line_buf[24];
+	char *line_end = line_buf + sizeof(line_buf);
+	char *line = line_end;
+	unsigned value = 100 + i % 50;
+	do {
+		*--line = (char)('0' + value % 10);
+		value /= 10;
+	} while ( value != 0 );
+
+	ADD_STR("elephant.c");
+	ADD(":", 1);
+	ADD(line, (size_t)(line_end - line));
+	ADD(": ", 2);
+	ADD_STR("error");
+	ADD(": ", 2);
+	ADD_STR(summary_text);
+	ADD(" [", 2);
+	ADD_STR("elephant_in_way");
+	ADD("]", 1);
+	ADD("\n", 1);
+	ADD_STR(details);
+	ADD("Suggestion: ", 12);
+	ADD_STR(suggestion_text);
+	ADD("\n", 1);
+	s->vtable->write_iov(s, iov, n);
+	s->vtable->end_message(s);
+}
+
+// The old way: several formatted writes per message.
+static void send_message_fprintf(FILE *fd, int i, const char *details)
+{
+	fprintf(fd, "%s:%zd: %s: %s", "elephant.c", (ssize_t)(100 + i % 50), "error", summary_text);
+	fprintf(fd, " [%s]", "elephant_in_way");
+	fprintf(fd, "%s", "\n");
+	fprintf(fd, "%s%s", "", details);
+	fprintf(fd, "%s%s\n", "Suggestion: ", suggestion_text);
+	fflush(fd);
+	n_syscalls++;
+}
+
+typedef struct result
+{
+	double  seconds;
+	size_t  syscalls;
+} result;
+
+static result run(int strategy, const char *path)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	FILE *file = NULL;
+	fstream fs;
+	static fdstream fds;
+	stream *s;
+
+	if ( strategy <= 2 ) {
+		file = fdopen(fd, "w");
+		fs.base.vtable = &fstream_vtbl;
+		fs.fd = file;
+		fs.flush_each = (strategy != 2);
+		s = &fs.base;
+	}
+	else {
+		memset(&fds, 0, sizeof(fds));
+		fds.base.vtable = &fdstream_vtbl;
+		fds.fd = fd;
+		fds.flush_policy = strategy - 3;
+		fds.flush_threshold = BUFFER_SIZE;
+		s = &fds.base;
+	}
+
+	char details[256];
+	n_syscalls = 0;
+	double start = now_seconds();
+	for ( int i = 0; i < N_MESSAGES; i++ )
+	{
+		snprintf(details, sizeof(details),
+			"There is a %d kg elephant in front of the frictionless ramp.\n"
+			"The %d kg object is unable to proceed towards the ramp.\n",
+			6000 + i % 1000, 3);
+		if ( strategy == 0 )
+			send_message_fprintf(file, i, details);
+		else
+			send_message(s, i, details);
+	}
+	if ( file != NULL ) {
+		fflush(file);
+		n_syscalls++;
+	}
+	else
+		fd_flush(&fds);
+	result r = { now_seconds() - start, n_syscalls };
+
+	if ( file != NULL )
+		fclose(file);
+	else
+		close(fd);
+	return r;
+}
+
+int main(int argc, const char *argv[])
+{
+	static const char *names[] = { "fprintf", "fstream", "fstream-nf", "fd/message", "fd/16k", "fd/explicit" };
+	char tmp_path[] = "/tmp/bench-fdstream-XXXXXX";
+	int tmp_fd = mkstemp(tmp_path);
+	if ( tmp_fd < 0 ) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(tmp_fd);
+
+	const char *paths[] = { "/dev/null", tmp_path };
+	printf("%d messages\n", N_MESSAGES);
+	for ( int p = 0; p < 2; p++ )
+	{
+		printf("to %s:\n", p == 0 ? "/dev/null" : "a temporary file");
+		for ( int strategy = 0; strategy < 6; strategy++ )
+		{
+			result r = run(strategy, paths[p]);
+			for ( int i = 1; i < N_RUNS; i++ ) {
+				result again = run(strategy, paths[p]);
+				if ( again.seconds < r.seconds )
+					r = again;
+			}
+			printf("  %-12s %8.3f ms  %6.1f ns/msg  %7zu flushes\n",
+				names[strategy], r.seconds * 1e3, r.seconds * 1e9 / N_MESSAGES, r.syscalls);
+		}
+	}
+
+	unlink(tmp_path);
+	return 0;
+}
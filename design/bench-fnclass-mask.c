@@ -0,0 +1,177 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Benchmark for turning function classes off while running, and for
+// sampling them (`hxr_call_history_fnclasses_` in hexer.h, and
+// `hxr_set_call_history_fnclasses` and `hxr_set_fnclass_sample_period` in
+// hexer.c).
+//
+// This calls a small function many times. It starts with HXR_ENTER_FUNCTION
+// for HXR_FNCLASS_HOTPATH, and is run five ways:
+//
+// * "none":     the function has no HXR_ENTER_FUNCTION.
+// * "compiled": HOTPATH isn't in HXR_CALL_HISTORY_FNCLASSES, so the whole
+//                 thing is compiled out. This should be the same as "none".
+// * "off":      HOTPATH is compiled in, but turned off while running. This
+//                 costs a load of the class mask and a branch that isn't
+//                 taken; nothing is called.
+// * "on":       HOTPATH is on, so `hxr_thread_frame_entrance_` is called
+//                 (here, a stand-in that only checks the thread's classes
+//                 and counts the call).
+// * "sampled":  HOTPATH is on, but sampled 1 in 100. Each call goes into
+//                 `hxr_thread_frame_entrance_`, which counts down and
+//                 returns for 99 of every 100.
+//
+// hexer.c can't be compiled on its own yet, so the code below is a trimmed
+// copy of the one in hexer.c. Keep them in sync if either changes.
+//
+// Build and run:
+//   cc -O2 -o bench-fnclass-mask bench-fnclass-mask.c && ./bench-fnclass-mask
+//
+// To see what "off" costs, look at `work_off` in the assembly
+// (cc -O2 -S bench-fnclass-mask.c): a load, a test, and a forward jump to
+// the out-of-line call.
+
+#define N_CALLS         (100000000)
+#define N_RUNS          (5)
+
+#define FNCLASS_NORMAL   ((size_t)0x0001ULL)
+#define FNCLASS_HOTPATH  ((size_t)0x0004ULL)
+
+#define CALL_HISTORY_FNCLASSES  (FNCLASS_NORMAL | FNCLASS_HOTPATH)
+
+#define UNLIKELY(x)  (__builtin_expect(!!(x), 0))
+
+typedef struct thread
+{
+	size_t  fnclasses_on;
+	size_t  fnclasses_off;
+	size_t  sample_countdown[64];
+	size_t  calls;
+} thread;
+
+typedef struct callsite
+{
+	const char  *file;
+	const char  *function;
+	int         line;
+	size_t      func_classification;
+	size_t      call_count;
+	size_t      id;
+} callsite;
+
+size_t         call_history_fnclasses_ = CALL_HISTORY_FNCLASSES;
+static size_t  fnclasses_process       = CALL_HISTORY_FNCLASSES;
+static size_t  sample_periods[64];
+static size_t  fnclasses_sampled;
+
+__attribute__((noinline))
+void frame_entrance(thread **frame_id, const void *frame_address, callsite *site)
+{
+	thread *t = *frame_id;
+	size_t classes = (__atomic_load_n(&fnclasses_process, __ATOMIC_RELAXED) & ~t->fnclasses_off)
+	               | t->fnclasses_on;
+	if ( (site->func_classification & classes) == 0 )
+		return;
+
+	size_t weight  = 1;
+	size_t sampled = site->func_classification & __atomic_load_n(&fnclasses_sampled, __ATOMIC_RELAXED);
+	if ( sampled != 0 )
+	{
+		unsigned bit = (unsigned)__builtin_ctzll(sampled);
+		if ( --t->sample_countdown[bit] != 0 )
+			return;
+		weight = __atomic_load_n(&sample_periods[bit], __ATOMIC_RELAXED);
+		t->sample_countdown[bit] = weight;
+	}
+
+	__atomic_store_n(&site->call_count, __atomic_load_n(&site->call_count, __ATOMIC_RELAXED) + weight, __ATOMIC_RELAXED);
+	t->calls++;
+}
+
+#define ENTER_FUNCTION(t, func_classification, compiled_classes) \
+	do { \
+		if ( ((func_classification) & (compiled_classes)) \
+		&&   UNLIKELY((func_classification) & call_history_fnclasses_) ) \
+		{ \
+			static callsite site_ = { __FILE__, __func__, __LINE__, (func_classification), 0, 0 }; \
+			frame_entrance(&(t), __builtin_frame_address(0), &site_); \
+		} \
+	} while (0)
+
+static volatile size_t sink;
+
+#define WORK(t, x)  ((x) * 2654435761u + (size_t)(t))
+
+__attribute__((noinline))
+static size_t work_none(thread *t, size_t x)
+{
+	return WORK(t, x);
+}
+
+__attribute__((noinline))
+static size_t work_compiled(thread *t, size_t x)
+{
+	ENTER_FUNCTION(t, FNCLASS_HOTPATH, FNCLASS_NORMAL);
+	return WORK(t, x);
+}
+
+__attribute__((noinline))
+static size_t work_off(thread *t, size_t x)
+{
+	ENTER_FUNCTION(t, FNCLASS_HOTPATH, CALL_HISTORY_FNCLASSES);
+	return WORK(t, x);
+}
+
+static double now_seconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, const char *argv[])
+{
+	static const char *names[] = { "none", "compiled", "off", "on", "sampled" };
+	static thread  th;
+	double best[5] = { 1e30, 1e30, 1e30, 1e30, 1e30 };
+	for ( int i = 0; i < 64; i++ )
+		th.sample_countdown[i] = 1;
+
+	for ( int run = 0; run < N_RUNS; run++ )
+	{
+		for ( int mode = 0; mode < 5; mode++ )
+		{
+			// "off", "on" and "sampled" run the same code; only the masks
+			// differ.
+			call_history_fnclasses_ = mode >= 3 ? CALL_HISTORY_FNCLASSES : FNCLASS_NORMAL;
+			fnclasses_process       = call_history_fnclasses_;
+			fnclasses_sampled       = mode == 4 ? FNCLASS_HOTPATH : 0;
+			sample_periods[2]       = 100;
+
+			size_t n = 0;
+			double start = now_seconds();
+			for ( size_t i = 0; i < N_CALLS; i++ )
+			{
+				switch ( mode )
+				{
+					case 0:  n += work_none(&th, i);     break;
+					case 1:  n += work_compiled(&th, i); break;
+					default: n += work_off(&th, i);      break;
+				}
+			}
+			double elapsed = now_seconds() - start;
+			if ( elapsed < best[mode] )
+				best[mode] = elapsed;
+			sink = n;
+		}
+	}
+
+	printf("%d calls\n", N_CALLS);
+	for ( int mode = 0; mode < 5; mode++ )
+		printf("  %-9s %8.3f ms  %5.2f ns/call  (%+.2f ns)\n", names[mode], best[mode] * 1e3,
+			best[mode] * 1e9 / N_CALLS, (best[mode] - best[0]) * 1e9 / N_CALLS);
+	printf("  %zu calls recorded\n", th.calls);
+	return 0;
+}
@@ -0,0 +1,256 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Benchmark for the per-thread message arena (`hxr_arena_` in hexer.c).
+//
+// This compares two ways of building the `elephant_in_way` message from the
+// README many thousands of times, then throwing all of the messages away
+// (like `hxr_clear_messages` does):
+//
+// * "malloc": one trip through an allocator vtable for the message struct and
+//     for every text field. This is what `hxr_default_malloc` would cost us.
+// * "arena":  a bump allocator with retained chunks that is rewound in O(1).
+//
+// hexer.c can't be compiled on its own yet, so the arena code below is a
+// trimmed copy of the one in hexer.c. Keep them in sync if either changes.
+//
+// Build and run:
+//   cc -O2 -o bench-message-arena bench-message-arena.c && ./bench-message-arena
+
+#define CHUNK_SIZE      (4096)
+#define N_MESSAGES      (10000)
+#define N_ROUNDS        (200)
+
+typedef struct message
+{
+	struct message  *next;
+	uint32_t        type_and_flags;
+	const char      *id;
+	const char      *summary;
+	const char      *details;
+	const char      *suggestion;
+} message;
+
+// ----- malloc strategy -----
+
+typedef struct allocator
+{
+	void *(*allocate)(size_t);
+	void  (*free)(void *);
+} allocator;
+
+static void *default_malloc(size_t n) { return malloc(n); }
+static void  default_free(void *p)    { free(p); }
+
+static allocator  the_allocator = { &default_malloc, &default_free };
+
+static char *malloc_strdup(allocator *a, const char *text)
+{
+	size_t len = strlen(text);
+	char *result = a->allocate(len+1);
+	memcpy(result, text, len+1);
+	return result;
+}
+
+static char *malloc_format(allocator *a, const char *fmtstr, ...)
+{
+	va_list vargs;
+	va_start(vargs, fmtstr);
+	int rc = vsnprintf(NULL, 0, fmtstr, vargs);
+	va_end(vargs);
+
+	char *result = a->allocate(rc+1);
+	va_start(vargs, fmtstr);
+	vsnprintf(result, rc+1, fmtstr, vargs);
+	va_end(vargs);
+	return result;
+}
+
+// ----- arena strategy -----
+
+#define ALIGNMENT      (2*sizeof(void*))
+#define ALIGN_UP(n)    (((n) + (ALIGNMENT-1)) & ~(size_t)(ALIGNMENT-1))
+
+typedef struct chunk
+{
+	struct chunk  *next;
+	size_t        capacity;
+} chunk;
+
+#define CHUNK_HEADER_SIZE  ALIGN_UP(sizeof(chunk))
+#define CHUNK_DATA(c)      (((char*)(c)) + CHUNK_HEADER_SIZE)
+
+typedef struct arena
+{
+	chunk  *first;
+	chunk  *current;
+	char   *cursor;
+	char   *limit;
+} arena;
+
+static void arena_enter_chunk(arena *ar, chunk *c)
+{
+	ar->current = c;
+	ar->cursor  = CHUNK_DATA(c);
+	ar->limit   = ar->cursor + c->capacity;
+}
+
+static void *arena_grow(arena *ar, allocator *a, size_t n)
+{
+	chunk *next = ar->current ? ar->current->next : NULL;
+	if ( next == NULL || next->capacity < n )
+	{
+		size_t capacity = CHUNK_SIZE < n ? n : CHUNK_SIZE;
+		chunk *c = a->allocate(CHUNK_HEADER_SIZE + capacity);
+		c->capacity = capacity;
+		if ( ar->current == NULL ) {
+			c->next = ar->first;
+			ar->first = c;
+		} else {
+			c->next = ar->current->next;
+			ar->current->next = c;
+		}
+		next = c;
+	}
+	arena_enter_chunk(ar, next);
+	void *result = ar->cursor;
+	ar->cursor += n;
+	return result;
+}
+
+static inline void *arena_alloc(arena *ar, allocator *a, size_t n)
+{
+	n = ALIGN_UP(n);
+	if ( (size_t)(ar->limit - ar->cursor) >= n ) {
+		void *result = ar->cursor;
+		ar->cursor += n;
+		return result;
+	}
+	return arena_grow(ar, a, n);
+}
+
+static char *arena_strdup(arena *ar, allocator *a, const char *text)
+{
+	size_t len = strlen(text);
+	char *result = arena_alloc(ar, a, len+1);
+	memcpy(result, text, len+1);
+	return result;
+}
+
+static char *arena_format(arena *ar, allocator *a, const char *fmtstr, ...)
+{
+	size_t available = (size_t)(ar->limit - ar->cursor);
+	va_list vargs;
+	va_start(vargs, fmtstr);
+	int rc = vsnprintf(ar->cursor, available, fmtstr, vargs);
+	va_end(vargs);
+
+	size_t needed = (size_t)rc + 1;
+	if ( ALIGN_UP(needed) <= available )
+		return arena_alloc(ar, a, needed);
+
+	char *result = arena_alloc(ar, a, needed);
+	va_start(vargs, fmtstr);
+	vsnprintf(result, needed, fmtstr, vargs);
+	va_end(vargs);
+	return result;
+}
+
+// ----- the benchmark -----
+
+static const char *summary_text =
+	"Object did not continue to move. There is an elephant in the way.";
+static const char *suggestion_text =
+	"Either lure the elephant away with some food, request the help "
+	"of a staff assistant, or do something else for a few hours "
+	"before coming back to this.";
+static const char *details_fmt =
+	"There is a %d kg elephant in front of the frictionless ramp.\n"
+	"The %d kg object is unable to proceed towards the ramp.\n";
+
+static double now_seconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t n_mallocs;
+static void *counting_malloc(size_t n) { n_mallocs++; return malloc(n); }
+
+int main(int argc, const char *argv[])
+{
+	the_allocator.allocate = &counting_malloc;
+
+	// malloc-per-field
+	n_mallocs = 0;
+	double start = now_seconds();
+	for ( int round = 0; round < N_ROUNDS; round++ )
+	{
+		message *queue = NULL;
+		for ( int i = 0; i < N_MESSAGES; i++ )
+		{
+			message *msg = the_allocator.allocate(sizeof(message));
+			msg->type_and_flags = 3;
+			msg->id         = malloc_strdup(&the_allocator, "elephant_in_way");
+			msg->summary    = malloc_strdup(&the_allocator, summary_text);
+			msg->details    = malloc_format(&the_allocator, details_fmt, 6000 + i, 3);
+			msg->suggestion = malloc_strdup(&the_allocator, suggestion_text);
+			msg->next = queue;
+			queue = msg;
+		}
+
+		// Equivalent of hxr_clear_messages.
+		while ( queue != NULL ) {
+			message *next = queue->next;
+			the_allocator.free((void*)queue->id);
+			the_allocator.free((void*)queue->summary);
+			the_allocator.free((void*)queue->details);
+			the_allocator.free((void*)queue->suggestion);
+			the_allocator.free(queue);
+			queue = next;
+		}
+	}
+	double malloc_time = now_seconds() - start;
+	size_t malloc_count = n_mallocs;
+
+	// arena
+	n_mallocs = 0;
+	arena ar = { NULL, NULL, NULL, NULL };
+	start = now_seconds();
+	for ( int round = 0; round < N_ROUNDS; round++ )
+	{
+		message *queue = NULL;
+		for ( int i = 0; i < N_MESSAGES; i++ )
+		{
+			message *msg = arena_alloc(&ar, &the_allocator, sizeof(message));
+			msg->type_and_flags = 3;
+			msg->id         = arena_strdup(&ar, &the_allocator, "elephant_in_way");
+			msg->summary    = arena_strdup(&ar, &the_allocator, summary_text);
+			msg->details    = arena_format(&ar, &the_allocator, details_fmt, 6000 + i, 3);
+			msg->suggestion = arena_strdup(&ar, &the_allocator, suggestion_text);
+			msg->next = queue;
+			queue = msg;
+		}
+
+		// Equivalent of hxr_clear_messages.
+		if ( ar.first != NULL )
+			arena_enter_chunk(&ar, ar.first);
+	}
+	double arena_time = now_seconds() - start;
+	size_t arena_count = n_mallocs;
+
+	size_t total = (size_t)N_ROUNDS * N_MESSAGES;
+	printf("%zu messages (%d rounds of %d, cleared after each round)\n",
+		total, N_ROUNDS, N_MESSAGES);
+	printf("  malloc: %8.3f ms  %6.1f ns/msg  %zu mallocs\n",
+		malloc_time * 1e3, malloc_time * 1e9 / total, malloc_count);
+	printf("  arena:  %8.3f ms  %6.1f ns/msg  %zu mallocs\n",
+		arena_time * 1e3, arena_time * 1e9 / total, arena_count);
+
+	return 0;
+}
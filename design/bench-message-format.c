@@ -0,0 +1,213 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Benchmark for the message prefix caches (`hxr_format_cache_` and
+// `hxr_format_static_fields_` in hexer.c).
+//
+// This builds the prefix for the format "%I %h %e[%p] %u:%g " for many
+// messages reported 10 microseconds apart (so 100000 of them share each
+// second), the way `hxr_format_prefixes_` does:
+//
+// * "lookup": every field is looked up (gethostname, readlink, getpid, ...)
+//     and the timestamp is rendered for every message.
+// * "cached": the process fields are looked up once, and the timestamp text
+//     is only rendered when the second changes. Everything else is copying.
+//
+// hexer.c can't be compiled on its own yet, so the code below is a trimmed
+// copy of the one in hexer.c. Keep them in sync if either changes.
+//
+// Build and run:
+//   cc -O2 -o bench-message-format bench-message-format.c && ./bench-message-format
+
+#define N_MESSAGES      (1000000)
+#define N_RUNS          (5)
+#define PREFIX_MAX      (512)
+
+enum { HOSTNAME, PID, UID, GID, EXE, N_FIELDS };
+
+static size_t n_syscalls;
+
+static inline void put(char *buf, size_t *len, const char *text, size_t n)
+{
+	size_t room = PREFIX_MAX - *len;
+	if ( n > room )
+		n = room;
+	memcpy(buf + *len, text, n);
+	*len += n;
+}
+
+static void put_decimal(char *buf, size_t *len, uint64_t value)
+{
+	char digits[24];
+	char *end = digits + sizeof(digits);
+	char *p = end;
+	do {
+		*--p = (char)('0' + value % 10);
+		value /= 10;
+	} while ( value != 0 );
+	put(buf, len, p, (size_t)(end - p));
+}
+
+static void lookup_field(char *buf, size_t *len, int field)
+{
+	char path[PREFIX_MAX];
+	n_syscalls++;
+	switch ( field )
+	{
+		case PID: put_decimal(buf, len, (uint64_t)getpid()); return;
+		case UID: put_decimal(buf, len, (uint64_t)getuid()); return;
+		case GID: put_decimal(buf, len, (uint64_t)getgid()); return;
+		case HOSTNAME:
+			gethostname(path, sizeof(path));
+			path[sizeof(path)-1] = '\0';
+			put(buf, len, path, strlen(path));
+			return;
+		case EXE:
+		{
+			ssize_t rc = readlink("/proc/self/exe", path, sizeof(path));
+			size_t name = rc > 0 ? (size_t)rc : 0;
+			size_t end = name;
+			while ( name > 0 && path[name-1] != '/' )
+				name--;
+			put(buf, len, path + name, end - name);
+			return;
+		}
+	}
+}
+
+typedef struct cache
+{
+	uint64_t  second;
+	char      datetime[32];
+	size_t    datetime_len;
+} cache;
+
+static inline void two_digits(char *out, uint32_t value)
+{
+	out[0] = (char)('0' + value / 10);
+	out[1] = (char)('0' + value % 10);
+}
+
+static void cache_time(cache *c, uint64_t ns)
+{
+	uint64_t  secs = ns / 1000000000u;
+	if ( secs == c->second )
+		return;
+
+	uint64_t  z    = secs / 86400u + 719468u;
+	uint32_t  sod  = (uint32_t)(secs % 86400u);
+	uint64_t  era  = z / 146097u;
+	uint32_t  doe  = (uint32_t)(z - era * 146097u);
+	uint32_t  yoe  = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+	uint32_t  doy  = doe - (365*yoe + yoe/4 - yoe/100);
+	uint32_t  mp   = (5*doy + 2) / 153;
+	uint32_t  day  = doy - (153*mp + 2)/5 + 1;
+	uint32_t  mon  = mp < 10 ? mp + 3 : mp - 9;
+	uint64_t  year = era * 400 + yoe + (mon <= 2);
+
+	size_t n = 0;
+	put_decimal(c->datetime, &n, year);
+	c->datetime[n++] = '-';
+	two_digits(c->datetime + n, mon);             n += 2;
+	c->datetime[n++] = '-';
+	two_digits(c->datetime + n, day);             n += 2;
+	c->datetime[n++] = 'T';
+	two_digits(c->datetime + n, sod / 3600);      n += 2;
+	c->datetime[n++] = ':';
+	two_digits(c->datetime + n, sod / 60 % 60);   n += 2;
+	c->datetime[n++] = ':';
+	two_digits(c->datetime + n, sod % 60);        n += 2;
+	c->datetime[n++] = 'Z';
+	c->datetime_len = n;
+	c->second = secs;
+}
+
+typedef struct static_fields
+{
+	int     ready;
+	size_t  len[N_FIELDS];
+	char    text[N_FIELDS][PREFIX_MAX];
+} static_fields;
+
+static static_fields  the_fields;
+
+static inline void field(char *buf, size_t *len, int f, int use_cache)
+{
+	if ( use_cache )
+		put(buf, len, the_fields.text[f], the_fields.len[f]);
+	else
+		lookup_field(buf, len, f);
+}
+
+// "%I %h %e[%p] %u:%g "
+static size_t build_prefix(char *buf, uint64_t ns, int use_cache)
+{
+	static cache  c;
+	size_t len = 0;
+	if ( !use_cache )
+		c.second = ~(uint64_t)0;
+	cache_time(&c, ns);
+
+	if ( use_cache && !the_fields.ready ) {
+		for ( int f = 0; f < N_FIELDS; f++ ) {
+			the_fields.len[f] = 0;
+			lookup_field(the_fields.text[f], &the_fields.len[f], f);
+		}
+		the_fields.ready = 1;
+	}
+
+	put(buf, &len, c.datetime, c.datetime_len);
+	put(buf, &len, " ", 1);
+	field(buf, &len, HOSTNAME, use_cache);
+	put(buf, &len, " ", 1);
+	field(buf, &len, EXE, use_cache);
+	put(buf, &len, "[", 1);
+	field(buf, &len, PID, use_cache);
+	put(buf, &len, "] ", 2);
+	field(buf, &len, UID, use_cache);
+	put(buf, &len, ":", 1);
+	field(buf, &len, GID, use_cache);
+	put(buf, &len, " ", 1);
+	return len;
+}
+
+static double now_seconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, const char *argv[])
+{
+	static const char *names[] = { "lookup", "cached" };
+	char buf[PREFIX_MAX];
+	uint64_t start_ns = 1602000000ull * 1000000000u;
+
+	printf("%d messages\n", N_MESSAGES);
+	for ( int use_cache = 0; use_cache < 2; use_cache++ )
+	{
+		double best = 1e30;
+		size_t total = 0;
+		size_t syscalls = 0;
+		for ( int run = 0; run < N_RUNS; run++ )
+		{
+			the_fields.ready = 0;
+			n_syscalls = 0;
+			double start = now_seconds();
+			for ( int i = 0; i < N_MESSAGES; i++ )
+				total += build_prefix(buf, start_ns + (uint64_t)i * 10000u, use_cache);
+			double elapsed = now_seconds() - start;
+			if ( elapsed < best )
+				best = elapsed;
+			syscalls = n_syscalls;
+		}
+		printf("  %-7s %8.3f ms  %6.1f ns/msg  %8zu lookups  (%zu bytes)\n",
+			names[use_cache], best * 1e3, best * 1e9 / N_MESSAGES, syscalls, total);
+	}
+	return 0;
+}
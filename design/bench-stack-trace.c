@@ -0,0 +1,267 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Benchmark for the stack traces captured at HXR_BEGIN_ERROR
+// (`hxr_stack_*` and `hxr_symbolize_` in hexer.c).
+//
+// A call chain DEPTH deep ends in a stand-in for `hxr_begin_`, which
+// captures the stack. That is measured two ways:
+//
+// * "frame pointers": following the chain of saved frame pointers, checked
+//                       against the thread's stack bounds
+//                       (HXR_STACK_TRACE_FRAME_POINTERS=1).
+// * "backtrace":      glibc's `backtrace` (HXR_STACK_TRACE_FRAME_POINTERS=0).
+//
+// Then turning one return address into text is measured:
+//
+// * "dladdr":  what it costs without the cache (the look-up and formatting).
+// * "cached":  what it costs once the address is in the cache.
+//
+// hexer.c can't be compiled on its own yet, so the code below is a trimmed
+// copy of the one in hexer.c. Keep them in sync if either changes.
+//
+// The capture times include making the calls. Frame pointers are needed for
+// the first way to see past the first frame, and -rdynamic for `dladdr` to
+// find names for the functions in the executable.
+//
+// Build and run:
+//   cc -O2 -fno-omit-frame-pointer -rdynamic -o bench-stack-trace bench-stack-trace.c -ldl && ./bench-stack-trace
+
+#define N_CAPTURES   (100000)
+#define N_LOOKUPS    (1000000)
+#define N_RUNS       (5)
+#define DEPTH        (10)
+#define MAX_FRAMES   (32)
+#define LINE_MAX_    (256)
+#define CACHE_SIZE   (1024)
+#define CACHE_PROBES (16)
+
+static uintptr_t  stack_low, stack_high;
+
+static void stack_bounds(void)
+{
+	pthread_attr_t attr;
+	void   *addr;
+	size_t size;
+	pthread_getattr_np(pthread_self(), &attr);
+	pthread_attr_getstack(&attr, &addr, &size);
+	pthread_attr_destroy(&attr);
+	stack_low  = (uintptr_t)addr;
+	stack_high = (uintptr_t)addr + size;
+}
+
+static size_t unwind_fp(const void *frame, const void **pcs, size_t max)
+{
+	size_t n = 0;
+	const uintptr_t *fp = frame;
+	while ( n < max )
+	{
+		uintptr_t addr = (uintptr_t)fp;
+		if ( addr < stack_low || addr > stack_high - 2 * sizeof(uintptr_t) || (addr & (sizeof(uintptr_t) - 1)) != 0 )
+			break;
+		if ( fp[1] == 0 )
+			break;
+		pcs[n++] = (const void*)fp[1];
+		const uintptr_t *next = (const uintptr_t*)fp[0];
+		if ( next <= fp )
+			break;
+		fp = next;
+	}
+	return n;
+}
+
+static size_t unwind_backtrace(const void *caller_pc, const void **pcs, size_t max)
+{
+	void *found[MAX_FRAMES + 8];
+	int  count = backtrace(found, MAX_FRAMES + 8);
+	int  start = 0;
+	size_t n = 0;
+	while ( start < count && found[start] != caller_pc )
+		start++;
+	if ( start == count )
+		start = 0;
+	for ( int i = start; i < count && n < max; i++ )
+		pcs[n++] = found[i];
+	return n;
+}
+
+static const void  *pcs[MAX_FRAMES];
+static size_t      n_pcs;
+static int         use_backtrace;
+
+__attribute__((noinline))
+static void begin(void)
+{
+	const void *frames[MAX_FRAMES];
+	if ( use_backtrace )
+		n_pcs = unwind_backtrace(__builtin_return_address(0), frames, MAX_FRAMES);
+	else
+		n_pcs = unwind_fp(__builtin_frame_address(0), frames, MAX_FRAMES);
+	memcpy(pcs, frames, n_pcs * sizeof(frames[0]));
+}
+
+__attribute__((noinline))
+static void chain(int depth)
+{
+	if ( depth > 0 )
+		chain(depth - 1);
+	else
+		begin();
+	__asm__ volatile("");
+}
+
+static void put(char *buf, size_t *len, const char *text)
+{
+	size_t n = strlen(text);
+	if ( n > LINE_MAX_ - *len )
+		n = LINE_MAX_ - *len;
+	memcpy(buf + *len, text, n);
+	*len += n;
+}
+
+static void put_hex(char *buf, size_t *len, uintptr_t value)
+{
+	char digits[2 * sizeof(uintptr_t) + 2];
+	char *end = digits + sizeof(digits), *p = end;
+	do {
+		*--p = "0123456789abcdef"[value % 16];
+		value /= 16;
+	} while ( value != 0 );
+	*--p = 'x';
+	*--p = '0';
+	if ( (size_t)(end - p) <= LINE_MAX_ - *len ) {
+		memcpy(buf + *len, p, (size_t)(end - p));
+		*len += (size_t)(end - p);
+	}
+}
+
+static size_t symbol_format(char *buf, const void *pc)
+{
+	size_t  len = 0;
+	Dl_info info;
+	if ( dladdr((const char*)pc - 1, &info) == 0 || info.dli_fname == NULL ) {
+		put_hex(buf, &len, (uintptr_t)pc);
+		return len;
+	}
+	const char *module = strrchr(info.dli_fname, '/');
+	module = module != NULL ? module + 1 : info.dli_fname;
+	if ( info.dli_sname != NULL && info.dli_saddr != NULL ) {
+		put(buf, &len, info.dli_sname);
+		put(buf, &len, "+");
+		put_hex(buf, &len, (uintptr_t)pc - (uintptr_t)info.dli_saddr);
+		put(buf, &len, " (");
+		put(buf, &len, module);
+		put(buf, &len, ")");
+	} else {
+		put(buf, &len, module);
+		put(buf, &len, "+");
+		put_hex(buf, &len, (uintptr_t)pc - (uintptr_t)info.dli_fbase);
+	}
+	return len;
+}
+
+typedef struct entry
+{
+	size_t      pc;
+	const char  *text;
+} entry;
+
+static entry   cache[CACHE_SIZE];
+static char    pool[65536];
+static size_t  pool_used;
+
+static const char *symbolize(const void *pc, char *buf)
+{
+	size_t key   = (size_t)(uintptr_t)pc;
+	size_t start = (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 32);
+	entry  *owned = NULL;
+	for ( size_t i = 0; i < CACHE_PROBES; i++ )
+	{
+		entry *e = &cache[(start + i) & (CACHE_SIZE - 1)];
+		size_t e_pc = __atomic_load_n(&e->pc, __ATOMIC_SEQ_CST);
+		if ( e_pc == 0 ) {
+			size_t expected = 0;
+			if ( __atomic_compare_exchange_n(&e->pc, &expected, key, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ) {
+				owned = e;
+				break;
+			}
+			e_pc = expected;
+		}
+		if ( e_pc == key ) {
+			const char *text = __atomic_load_n(&e->text, __ATOMIC_ACQUIRE);
+			if ( text != NULL )
+				return text;
+			break;
+		}
+	}
+	size_t len = symbol_format(buf, pc);
+	buf[len] = '\0';
+	if ( owned != NULL && pool_used + len + 1 <= sizeof(pool) ) {
+		char *text = pool + pool_used;
+		pool_used += len + 1;
+		memcpy(text, buf, len + 1);
+		__atomic_store_n(&owned->text, text, __ATOMIC_RELEASE);
+		return text;
+	}
+	return buf;
+}
+
+static double now_seconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static volatile size_t sink;
+
+int main(int argc, const char *argv[])
+{
+	stack_bounds();
+	backtrace((void**)pcs, 1);  // Loads libgcc_s; see `hxr_stack_module_init_`.
+
+	static const char *names[] = { "frame pointers", "backtrace" };
+	for ( use_backtrace = 0; use_backtrace < 2; use_backtrace++ )
+	{
+		double best = 1e30;
+		for ( int run = 0; run < N_RUNS; run++ )
+		{
+			double start = now_seconds();
+			for ( int i = 0; i < N_CAPTURES; i++ )
+				chain(DEPTH);
+			double elapsed = now_seconds() - start;
+			if ( elapsed < best )
+				best = elapsed;
+		}
+		printf("  %-15s %2zu frames  %8.1f ns/capture\n", names[use_backtrace], n_pcs, best * 1e9 / N_CAPTURES);
+	}
+
+	char buf[LINE_MAX_ + 1];
+	const void *pc = pcs[1];
+	double best_uncached = 1e30, best_cached = 1e30;
+	for ( int run = 0; run < N_RUNS; run++ )
+	{
+		double start = now_seconds();
+		for ( int i = 0; i < N_LOOKUPS; i++ )
+			sink += symbol_format(buf, pc);
+		double elapsed = now_seconds() - start;
+		if ( elapsed < best_uncached )
+			best_uncached = elapsed;
+
+		start = now_seconds();
+		for ( int i = 0; i < N_LOOKUPS; i++ )
+			sink += (size_t)symbolize(pc, buf);
+		elapsed = now_seconds() - start;
+		if ( elapsed < best_cached )
+			best_cached = elapsed;
+	}
+	printf("  %-15s %8.1f ns/address\n", "dladdr", best_uncached * 1e9 / N_LOOKUPS);
+	printf("  %-15s %8.1f ns/address  (%s)\n", "cached", best_cached * 1e9 / N_LOOKUPS, symbolize(pc, buf));
+	return 0;
+}
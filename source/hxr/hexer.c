@@ -1,3 +1,9 @@
+// For `dladdr` and `pthread_getattr_np`, which native stack traces use.
+// This has to come before any system header is included.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#	define _GNU_SOURCE
+#endif
+
 #include "hexer.h"
 
 #include <stdarg.h>
@@ -17,6 +23,127 @@
 #	define _HXR_HAVE_TLS 0
 #endif
 
+// Minimal atomics for the few process-wide tables that threads can race on
+// (ex: `hxr_msgid_*`). Without them, those tables are only safe to use from
+// one thread at a time.
+#if defined(__GNUC__) || defined(__clang__)
+#	define _HXR_HAVE_ATOMICS 1
+static inline void *hxr_atomic_load_ptr_(void *const *p) {
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+// Returns the value that was in `*p` before the exchange was attempted.
+static inline void *hxr_atomic_cas_ptr_(void **p, void *expected, void *desired) {
+	__atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+	return expected;
+}
+// The size_t versions are sequentially consistent.
+static inline size_t hxr_atomic_load_size_(const size_t *p) {
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+static inline void hxr_atomic_store_size_(size_t *p, size_t v) {
+	__atomic_store_n(p, v, __ATOMIC_SEQ_CST);
+}
+static inline size_t hxr_atomic_cas_size_(size_t *p, size_t expected, size_t desired) {
+	__atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return expected;
+}
+// Returns the value that was in `*p` before `v` was added.
+static inline size_t hxr_atomic_fetch_add_size_(size_t *p, size_t v) {
+	return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST);
+}
+// For counters that don't order anything else.
+static inline size_t hxr_atomic_load_relaxed_size_(const size_t *p) {
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+static inline void hxr_atomic_store_relaxed_size_(size_t *p, size_t v) {
+	__atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+static inline uint64_t hxr_atomic_load_relaxed_u64_(const uint64_t *p) {
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+static inline void hxr_atomic_store_relaxed_u64_(uint64_t *p, uint64_t v) {
+	__atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+#elif defined(_MSC_VER)
+#	include <intrin.h>
+#	define _HXR_HAVE_ATOMICS 1
+static inline void *hxr_atomic_load_ptr_(void *const *p) {
+	return *(void *const volatile *)p;
+}
+static inline void *hxr_atomic_cas_ptr_(void **p, void *expected, void *desired) {
+	return _InterlockedCompareExchangePointer((void *volatile *)p, desired, expected);
+}
+static inline size_t hxr_atomic_load_size_(const size_t *p) {
+	return *(const volatile size_t *)p;
+}
+static inline void hxr_atomic_store_size_(size_t *p, size_t v) {
+	_InterlockedExchangePointer((void *volatile *)p, (void*)v);
+}
+static inline size_t hxr_atomic_cas_size_(size_t *p, size_t expected, size_t desired) {
+	return (size_t)_InterlockedCompareExchangePointer((void *volatile *)p, (void*)desired, (void*)expected);
+}
+static inline size_t hxr_atomic_fetch_add_size_(size_t *p, size_t v) {
+#	if defined(_WIN64)
+	return (size_t)_InterlockedExchangeAdd64((__int64 volatile *)p, (__int64)v);
+#	else
+	return (size_t)_InterlockedExchangeAdd((long volatile *)p, (long)v);
+#	endif
+}
+static inline size_t hxr_atomic_load_relaxed_size_(const size_t *p) {
+	return *(const volatile size_t *)p;
+}
+static inline void hxr_atomic_store_relaxed_size_(size_t *p, size_t v) {
+	*(volatile size_t *)p = v;
+}
+// These can tear on 32-bit targets; they're only used for statistics.
+static inline uint64_t hxr_atomic_load_relaxed_u64_(const uint64_t *p) {
+	return *(const volatile uint64_t *)p;
+}
+static inline void hxr_atomic_store_relaxed_u64_(uint64_t *p, uint64_t v) {
+	*(volatile uint64_t *)p = v;
+}
+#else
+#	define _HXR_HAVE_ATOMICS 0
+static inline void *hxr_atomic_load_ptr_(void *const *p) {
+	return *p;
+}
+static inline void *hxr_atomic_cas_ptr_(void **p, void *expected, void *desired) {
+	void *prev = *p;
+	if ( prev == expected )
+		*p = desired;
+	return prev;
+}
+static inline size_t hxr_atomic_load_size_(const size_t *p) {
+	return *p;
+}
+static inline void hxr_atomic_store_size_(size_t *p, size_t v) {
+	*p = v;
+}
+static inline size_t hxr_atomic_cas_size_(size_t *p, size_t expected, size_t desired) {
+	size_t prev = *p;
+	if ( prev == expected )
+		*p = desired;
+	return prev;
+}
+static inline size_t hxr_atomic_fetch_add_size_(size_t *p, size_t v) {
+	size_t prev = *p;
+	*p = prev + v;
+	return prev;
+}
+static inline size_t hxr_atomic_load_relaxed_size_(const size_t *p) {
+	return *p;
+}
+static inline void hxr_atomic_store_relaxed_size_(size_t *p, size_t v) {
+	*p = v;
+}
+static inline uint64_t hxr_atomic_load_relaxed_u64_(const uint64_t *p) {
+	return *p;
+}
+static inline void hxr_atomic_store_relaxed_u64_(uint64_t *p, uint64_t v) {
+	*p = v;
+}
+#endif
+
 TODO: Don't just check for HXR_ENABLE_FILE_IO being defined, or for being non-zero.
 It might be undefined, or it might be set to 0. Check for both. If that's too
 tricky to do everywhere, then define a derivative macro (or macros) that can
@@ -42,6 +169,8 @@ typedef struct S_HXR__LIBC_VTBL
 	void (vsyslog*)(int, const char *, va_list);
 	#endif
 
+	uint64_t  (*timestamp)(void);
+
 } hxr_libc_vtbl_;
 
 // Internal-use function that is probably usually `printf`. Avoid using it if
@@ -59,6 +188,7 @@ static void hxr_init_libc_vtbl_()
 	hxr_libc_vtbl_instance_.vfprintf  = &HXR_VFPRINTF_DEFAULT;
 	hxr_libc_vtbl_instance_.vsnprintf = &HXR_VSNPRINTF_DEFAULT;
 	hxr_libc_vtbl_instance_.vsyslog   = &HXR_VSYSLOG_DEFAULT;
+	hxr_libc_vtbl_instance_.timestamp = &HXR_TIMESTAMP_DEFAULT;
 	HXR(debugf_) = &HXR_DEBUGF_DEFAULT;
 }
 
@@ -86,6 +216,24 @@ int HXR(debugf_noop)(const char *str, ...)
 	return -1;
 }
 
+uint64_t HXR(timestamp_noop)(void)
+{
+	return 0;
+}
+
+#if (HXR_ENABLE_LIBC) || (HXR_DOCUMENTATION_BUILD)
+#include <time.h>
+uint64_t HXR(timestamp_default)(void)
+{
+#if defined(CLOCK_REALTIME)
+	struct timespec ts;
+	if ( clock_gettime(CLOCK_REALTIME, &ts) == 0 )
+		return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+	return (uint64_t)time(NULL) * 1000000000u;
+}
+#endif
+
 // -------------------------------------
 
 typedef struct S_HXR__MESSENGER_VTBL
@@ -178,6 +326,336 @@ static void hxr_allocator_init_(hxr_allocator *new_allocator)
 	new_allocator->free       = &hxr_default_free;
 }
 
+// ===== Message Arena : hxr_arena_* =====
+/// Per-thread bump allocator that backs all feedback message structure
+/// and text.
+///
+/// Building a message is the hot path for code that emits many errors
+/// (ex: a parser reporting every bad token), so we don't want to pay one
+/// trip through the `hxr_allocator` vtable for every field of every message.
+/// Instead, chunks of `HXR_MESSAGE_ARENA_CHUNK_SIZE` bytes are requested from
+/// the allocator only when the arena grows, and individual allocations are
+/// just a pointer bump.
+///
+/// Chunks are never returned to the allocator until the thread is freed.
+/// `hxr_arena_reset_` rewinds to the first chunk in O(1) and the existing
+/// chunks get reused, so a thread that has warmed up will not call
+/// `malloc` at all while building messages.
+
+// Alignment for every arena allocation. This is enough for pointers,
+// size_t, and doubles on all of the platforms we care about.
+#define HXR_ARENA_ALIGNMENT_  (2*sizeof(void*))
+#define HXR_ARENA_ALIGN_UP_(n) \
+	(((n) + (HXR_ARENA_ALIGNMENT_-1)) & ~(size_t)(HXR_ARENA_ALIGNMENT_-1))
+
+typedef struct S_HXR__ARENA_CHUNK
+{
+	struct S_HXR__ARENA_CHUNK  *next;
+	size_t                     capacity;  // Usable bytes after the header.
+} hxr_arena_chunk_;
+
+#define HXR_ARENA_CHUNK_HEADER_SIZE_  HXR_ARENA_ALIGN_UP_(sizeof(hxr_arena_chunk_))
+#define HXR_ARENA_CHUNK_DATA_(chunk)  (((char*)(chunk)) + HXR_ARENA_CHUNK_HEADER_SIZE_)
+
+typedef struct S_HXR__ARENA
+{
+	hxr_arena_chunk_  *first;
+	hxr_arena_chunk_  *current;
+	char              *cursor;
+	char              *limit;
+} hxr_arena_;
+
+static void hxr_arena_init_(hxr_arena_ *arena)
+{
+	arena->first   = NULL;
+	arena->current = NULL;
+	arena->cursor  = NULL;
+	arena->limit   = NULL;
+}
+
+// Moves the arena onto `chunk` and makes all of its memory available.
+static void hxr_arena_enter_chunk_(hxr_arena_ *arena, hxr_arena_chunk_ *chunk)
+{
+	arena->current = chunk;
+	arena->cursor  = HXR_ARENA_CHUNK_DATA_(chunk);
+	arena->limit   = arena->cursor + chunk->capacity;
+}
+
+// Slow path for `hxr_arena_alloc_`. Only called when the current chunk
+// doesn't have room for `num_bytes`.
+static void *hxr_arena_grow_(hxr_thread *t, hxr_arena_ *arena, hxr_allocator *allocator, size_t num_bytes)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+
+	// Reuse a chunk left over from before the last reset, if it's big enough.
+	hxr_arena_chunk_ *next = NULL;
+	if ( arena->current != NULL )
+		next = arena->current->next;
+
+	if ( next == NULL || next->capacity < num_bytes )
+	{
+		size_t capacity = HXR_MESSAGE_ARENA_CHUNK_SIZE;
+		if ( capacity < num_bytes )
+			capacity = num_bytes;
+
+		hxr_arena_chunk_ *chunk = allocator->allocate(t,
+			HXR_ARENA_CHUNK_HEADER_SIZE_ + capacity);
+		if ( chunk == NULL )
+			return NULL;
+
+		chunk->capacity = capacity;
+
+		// Splice it in after the current chunk so that any retained chunks
+		// further down the list are still available for later growth.
+		if ( arena->current == NULL ) {
+			chunk->next  = arena->first;
+			arena->first = chunk;
+		} else {
+			chunk->next = arena->current->next;
+			arena->current->next = chunk;
+		}
+		next = chunk;
+	}
+
+	hxr_arena_enter_chunk_(arena, next);
+	void *result = arena->cursor;
+	arena->cursor += num_bytes;
+	return result;
+}
+
+static inline void *hxr_arena_alloc_(hxr_thread *t, hxr_arena_ *arena, hxr_allocator *allocator, size_t num_bytes)
+{
+	num_bytes = HXR_ARENA_ALIGN_UP_(num_bytes);
+	if ( (size_t)(arena->limit - arena->cursor) >= num_bytes ) {
+		void *result = arena->cursor;
+		arena->cursor += num_bytes;
+		return result;
+	}
+	return hxr_arena_grow_(t, arena, allocator, num_bytes);
+}
+
+// Returns the number of bytes that can be allocated without growing.
+// This allows things like vsnprintf to write directly into the arena.
+static inline size_t hxr_arena_available_(const hxr_arena_ *arena)
+{
+	return (size_t)(arena->limit - arena->cursor);
+}
+
+// Gives back everything allocated at or after `ptr`, as long as `ptr` lies
+// in the current chunk. Returns 0 (and does nothing) otherwise.
+// The caller is responsible for knowing that nothing it still needs was
+// allocated after `ptr`.
+static int hxr_arena_rewind_(hxr_arena_ *arena, void *ptr)
+{
+	char *p = ptr;
+	if ( arena->current == NULL
+	||   p <  HXR_ARENA_CHUNK_DATA_(arena->current)
+	||   p >= arena->limit )
+		return 0;
+	arena->cursor = p;
+	return 1;
+}
+
+static void hxr_arena_reset_(hxr_arena_ *arena)
+{
+	if ( arena->first == NULL )
+		return;
+	hxr_arena_enter_chunk_(arena, arena->first);
+}
+
+static void hxr_arena_free_(hxr_thread *t, hxr_arena_ *arena, hxr_allocator *allocator)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_arena_chunk_ *chunk = arena->first;
+	while ( chunk != NULL ) {
+		hxr_arena_chunk_ *next = chunk->next;
+		allocator->free(t, chunk);
+		chunk = next;
+	}
+	hxr_arena_init_(arena);
+}
+
+// ===== Format Scratch Buffer : hxr_scratch_* =====
+// Per-thread buffer for text that is formatted only to be used right away
+// (ex: by a stream's `write_fmtstr`), as opposed to text that belongs to a
+// message (see `hxr_arena_`). It is kept between calls and grows by doubling,
+// so once it has grown to fit the longest text the thread formats, every
+// format is done exactly once and nothing is allocated.
+//
+// The text is only good until `hxr_scratch_release_`. If the buffer is
+// already in use (ex: a message handler that prints while a stream is
+// reporting a problem with its own formatted text), then a one-off buffer
+// is allocated instead.
+
+#define HXR_SCRATCH_INITIAL_SIZE_  (256)
+
+typedef struct S_HXR__SCRATCH
+{
+	char     *buf;
+	size_t   capacity;
+	uint8_t  in_use;
+} hxr_scratch_;
+
+static void hxr_scratch_init_(hxr_scratch_ *scratch)
+{
+	scratch->buf      = NULL;
+	scratch->capacity = 0;
+	scratch->in_use   = 0;
+}
+
+static void hxr_scratch_free_(hxr_thread *t, hxr_scratch_ *scratch, hxr_allocator *allocator)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	if ( scratch->buf != NULL )
+		allocator->free(t, scratch->buf);
+	hxr_scratch_init_(scratch);
+}
+
+// Formats `fmtstr` and stores the length of the result in `*len`.
+// Returns: The text, or NULL if formatting failed or memory ran out.
+// Anything that isn't NULL must be given to `hxr_scratch_release_`.
+static char *hxr_scratch_vformat_(
+	hxr_thread *t,  hxr_scratch_ *scratch,  hxr_allocator *allocator,
+	const char *fmtstr,  va_list vargs,  size_t *len)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+	char     *buf = NULL;
+	size_t   capacity = 0;
+	va_list  vargs_consumable;
+
+	if ( !scratch->in_use ) {
+		buf      = scratch->buf;
+		capacity = scratch->capacity;
+	}
+
+	va_copy(vargs_consumable, vargs);
+	int rc = hxr_libc_vtbl_instance_.vsnprintf(buf, capacity, fmtstr, vargs_consumable);
+	va_end(vargs_consumable);
+	if ( rc < 0 )
+		return NULL;
+
+	size_t needed = (size_t)rc + 1;
+	if ( needed > capacity )
+	{
+		// Too small (or busy). The contents don't need to be kept, so
+		// free-then-allocate rather than reallocate.
+		if ( scratch->in_use )
+			capacity = needed;
+		else {
+			capacity = scratch->capacity ? scratch->capacity : HXR_SCRATCH_INITIAL_SIZE_;
+			while ( capacity < needed )
+				capacity *= 2;
+			if ( scratch->buf != NULL )
+				allocator->free(t, scratch->buf);
+			scratch->buf      = NULL;
+			scratch->capacity = 0;
+		}
+
+		buf = allocator->allocate(t, capacity);
+		if ( buf == NULL )
+			return NULL;
+		if ( !scratch->in_use ) {
+			scratch->buf      = buf;
+			scratch->capacity = capacity;
+		}
+
+		va_copy(vargs_consumable, vargs);
+		hxr_libc_vtbl_instance_.vsnprintf(buf, capacity, fmtstr, vargs_consumable);
+		va_end(vargs_consumable);
+	}
+
+	if ( buf == scratch->buf )
+		scratch->in_use = 1;
+	*len = (size_t)rc;
+	return buf;
+}
+
+static void hxr_scratch_release_(hxr_thread *t, hxr_scratch_ *scratch, hxr_allocator *allocator, char *text)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+	if ( text == NULL )
+		return;
+	if ( text == scratch->buf )
+		scratch->in_use = 0;
+	else
+		allocator->free(t, text);
+}
+
+// Longest message prefix that will be printed, padding included. Anything
+// past this is cut off. See `hxr_format_*`.
+#define HXR_FORMAT_PREFIX_MAX_  (512)
+
+// The parts of message prefixes that each thread keeps around between
+// messages, so that printing a lot of messages in the same second doesn't
+// render the same timestamp (or look up the same directory) every time.
+typedef struct S_HXR__FORMAT_CACHE
+{
+	// ISO 8601 text for `second` (seconds since the Unix epoch). The date and
+	// time directives copy slices of it. All ones when there's nothing cached.
+	uint64_t  second;
+	char      datetime[32];
+	size_t    datetime_len;
+
+	// The working directory, as looked up during `cwd_second`.
+	uint64_t  cwd_second;
+	char      cwd[HXR_FORMAT_PREFIX_MAX_];
+	size_t    cwd_len;
+} hxr_format_cache_;
+
+// Error messages get a stack trace from unwinding the native stack where
+// that can be done, and from the frame stack (the calls that call history
+// says haven't returned) where it can't. See `hxr_stack_*`.
+#define HXR_STACK_TRACES_NATIVE_     (HXR_STACK_TRACE_DEPTH > 0 && HXR_NATIVE_STACK_TRACES_)
+#define HXR_STACK_TRACES_CALLSITES_  (HXR_STACK_TRACE_DEPTH > 0 && !HXR_NATIVE_STACK_TRACES_ && HXR_CALL_HISTORY_MAX > 0)
+#define HXR_STACK_TRACES_            (HXR_STACK_TRACES_NATIVE_ || HXR_STACK_TRACES_CALLSITES_)
+
+// One entry of a thread's call history. See `hxr_call_history_*`.
+typedef struct S_HXR__CALL_ENTRY
+{
+	uint32_t  callsite;  // See `hxr_callsite_*`.
+	uint32_t  depth;
+	uint64_t  count;     // Repeats of this call and everything under it.
+} hxr_call_entry_;
+
+#define HXR_CALLSITE_NONE_      (0)
+#define HXR_PROFILE_PATH_ROOT_  (0)
+#define HXR_PROFILE_PATH_LOST_  (0xFFFFFFFFu)
+
+// A call that hasn't returned (as far as can be told).
+typedef struct S_HXR__CALL_FRAME
+{
+	const void  *address;
+	size_t      entry;       // Position of its `hxr_call_entry_`.
+
+	// Its call path (see `hxr_profile_path_*`), and the last callsite that
+	// it called along with that call's path, which usually saves looking
+	// the path up again.
+	uint32_t    path;
+	uint32_t    last_callsite;
+	uint32_t    last_path;
+
+	// Its own callsite, for stack traces.
+	uint32_t    callsite_id;
+
+#if HXR_ENABLE_FRAME_TIMING
+	// See `hxr_frame_timing_*`. `weight` is 1, or the sampling period.
+	hxr_callsite  *callsite;
+	uint64_t      start_ticks;
+	uint64_t      child_ticks;
+	size_t        weight;
+#endif
+} hxr_call_frame_;
+
+// Deepest nesting of instrumented frames that call history tells apart.
+#define HXR_CALL_DEPTH_MAX_  (128)
+
+// How many `HXR_FNCLASS_*` bits there can be. This is also the size of
+// `hxr_thread::sample_countdown_`.
+#define HXR_FNCLASS_BITS_  (sizeof(size_t) * 8)
+
+// Frames are only timed when there's a frame stack. See `hxr_frame_timing_*`.
+#define HXR_FRAME_TIMING_  (HXR_ENABLE_FRAME_TIMING && HXR_CALL_HISTORY_MAX > 0)
+
 // -------------------------------------
 
 TODO: Thinking of just eliminating hxr_process. It seems pointless.
@@ -207,10 +685,88 @@ static void hxr_process_init_(hxr_process *proc)
 {
 	hxr_allocator_init_(&proc->default_allocator);
 	hxr_logger_init_(&...); TODO
-	TODO: how do we organize message formatters? Shouldn't these be per-output?
+	// Message formats are per-output; see `hxr_sink_graph`.
 }
 
 
+// One text section of a feedback message (ex: its summary).
+//
+// If the section was built with a `_fmt` or `_va` function, then `fmtstr`
+// and `args` hold the deferred formatting job (see `hxr_fmtargs_*`) and
+// `text` stays NULL until the first time somebody asks for it.
+typedef struct S_HXR__MESSAGE_TEXT
+{
+	const char           *text;
+	const char           *fmtstr;
+	const unsigned char  *args;
+} hxr_message_text_;
+
+typedef struct S_HXR__COALESCE_ENTRY
+{
+	// Interned `message_id` plus callsite.
+	hxr_msgid             id;
+	const char            *file;
+	size_t                line;
+	uint32_t              hash;
+
+	// The entry is only live if `generation` matches the thread's
+	// `coalesce_generation` AND `queue_seq` is still in the queue.
+	uint32_t              generation;
+	size_t                queue_seq;
+	hxr_feedback_message  *msg;
+} hxr_coalesce_entry_;
+
+struct S_HXR_FEEDBACK_MESSAGE
+{
+	// Links either the message queue (once the message is finished) or the
+	// stack of messages under construction (while its HXR_BEGIN-HXR_END
+	// block is still open).
+	hxr_feedback_message      *next;
+
+	// `HXR_MSG_TYPE_*` and `HXR_MSG_FLAG_*` values. See `hxr_block_`.
+	uint32_t                  type_and_flags;
+
+	hxr_source_location_      loc;
+
+	// While it's under construction: how many HXR_BEGINs directly inside
+	// this one couldn't allocate their messages and haven't had their
+	// HXR_ENDs yet. See `hxr_message_alloc_failures_`.
+	size_t                    alloc_failures;
+
+	// Snapshot of the thread's `arena_epoch` from when this message was
+	// started. If it hasn't changed by HXR_END, then everything in the arena
+	// from this message's address onwards belongs to this message, and a
+	// dropped message can be given back to the arena.
+	size_t                    arena_epoch;
+
+	// Coalescing: how many times this message was reported (1 unless repeats
+	// were folded into it), and when the first and last of those happened
+	// (nanoseconds since the Unix epoch, from `HXR_TIMESTAMP_DEFAULT`).
+	size_t                    repeat_count;
+	uint64_t                  first_time;
+	uint64_t                  last_time;
+
+	// `id` is the interned string for `id_handle` (see `hxr_msgid_*`), or an
+	// arena copy if the id couldn't be interned, or NULL.
+	hxr_msgid                 id_handle;
+	const char                *id;
+
+	// All of these point into the owning thread's message arena, or are NULL.
+	hxr_message_text_         summary;
+	hxr_message_text_         details;
+	hxr_message_text_         suggestion;
+
+#if HXR_STACK_TRACES_
+	// Errors only: where HXR_BEGIN_ERROR was, innermost call first, as
+	// return addresses (or `hxr_callsite`s, without native stack traces).
+	// `stack_text` is the trace rendered as text, the first time it is
+	// asked for. See `hxr_stack_*`.
+	const void                **stack;
+	size_t                    stack_depth;
+	const char                *stack_text;
+#endif
+};
+
 typedef struct S_HXR__THREAD_IMPL
 {
 	hxr_process_wrapper_      *process;
@@ -218,10 +774,86 @@ typedef struct S_HXR__THREAD_IMPL
 	hxr_logger                *logger;
 	hxr_message_format        *msg_format;
 
+	// Totals since the last `hxr_clear_messages`. These include messages
+	// that were dropped because the queue was full.
 	size_t                    error_count;
-	hxr_feedback_message      *message_queue;
+	size_t                    message_count;
+	size_t                    dropped_count;
+	size_t                    coalesced_count;
+
+	// Fixed-capacity ring buffer (HXR_MESSAGE_QUEUE_CAPACITY slots) of
+	// finished messages. `queue_head` and `queue_tail` only ever increase;
+	// they are masked when indexing.
+	hxr_feedback_message      **message_queue;
+	size_t                    queue_head;
+	size_t                    queue_tail;
+	uint32_t                  queue_overflow_policy;
+
+	// For HXR_QUEUE_OVERFLOW_COLLAPSE: how many messages have been dropped
+	// since the last collapse summary was handed out, and the most severe
+	// HXR_MSG_TYPE_* among them.
+	uint32_t                  collapsed_type;
+	size_t                    collapsed_count;
+
+	// The stack of messages under construction, and how many HXR_BEGINs
+	// outside of all of them couldn't allocate their messages (see
+	// `hxr_message_alloc_failures_`).
+	hxr_feedback_message      *messages_in_progress;
+	size_t                    message_alloc_failures;
+	hxr_arena_                message_arena;
+
+	// For HXR_QUEUE_OVERFLOW_DROP_OLDEST: the arena that the messages queued
+	// before `queue_generation` were built in. It's reused once they've all
+	// been evicted (see `hxr_message_arena_turnover_`), unless it's pinned:
+	// something in it was handed out (or rendered for a message that was),
+	// which has to last until `hxr_clear_messages`.
+	hxr_arena_                retired_arena;
+	size_t                    queue_generation;
+	uint8_t                   retired_arena_pinned;
+	uint8_t                   message_arena_pinned;
+
+	// For text that's formatted and then used right away. See `hxr_scratch_`.
+	hxr_scratch_              format_scratch;
+	hxr_format_cache_         format_cache;
+
+	// Open-addressing table for folding repeated messages together.
+	// See `hxr_coalesce_*`.
+	hxr_coalesce_entry_       *coalesce_table;
+	uint32_t                  coalesce_generation;
+	uint8_t                   coalesce_enabled;
+
+	// Incremented whenever something other than the innermost message in
+	// progress takes memory from the arena (ex: a message being enqueued,
+	// or deferred text being rendered). See `hxr_feedback_message::arena_epoch`.
+	size_t                    arena_epoch;
 	hxr_feedback_handler      message_handler_func_ptr;
 	void                      *message_handler_context;
+
+	// Function classes this thread records whatever the process's are, and
+	// ones it doesn't. See `hxr_thread_set_call_history_fnclasses`.
+	size_t                    fnclasses_on;
+	size_t                    fnclasses_off;
+
+#if HXR_CALL_HISTORY_MAX > 0
+	// Ring of the last HXR_CALL_HISTORY_MAX calls. `call_history_pos` is
+	// where the next entry goes; it is masked when indexing, and moves back
+	// when entries are folded. `call_history_count` is how many entries
+	// before it are still intact. `frame_stack` holds the calls that haven't
+	// returned, from `frame_stack[1]` to `frame_stack[t->frame_depth_]`
+	// (the depth is kept in the `hxr_thread`, so that hexer.h can read it).
+	// See `hxr_call_history_*`.
+	hxr_call_entry_           call_history[HXR_CALL_HISTORY_MAX];
+	size_t                    call_history_pos;
+	size_t                    call_history_count;
+	hxr_call_frame_           frame_stack[HXR_CALL_DEPTH_MAX_ + 1];
+#endif
+
+#if HXR_STACK_TRACES_NATIVE_ && HXR_STACK_TRACE_FRAME_POINTERS
+	// The bounds of the thread's stack, looked up the first time a stack
+	// trace is made. Frame pointers outside of them aren't followed.
+	uintptr_t                 stack_low;
+	uintptr_t                 stack_high;
+#endif
 }
 hxr_thread_impl_;
 
@@ -231,6 +863,7 @@ typedef hxr_thread  hxr_thread_embed_container_;
 typedef struct S_HXR__THREAD_EMBED_CONTAINER
 {
 	void **dynamic_embeds;
+	size_t frame_depth_;
 
 #ifdef HXR_THREAD_STATIC_EMBEDS
 #define HXR_X(embed_type, embed_name) embed_type embed_name;
@@ -263,6 +896,7 @@ static hxr_thread_impl_ *HXR(thread_get_impl_)(hxr_thread* t)
 	//                      [ ... ]
 	// hxr_thread* t ---> [ hxr_embed_container_ ]
 	//                      [ void **dynamic_embeds ]
+	//                      [ size_t frame_depth_ ]
 	//                      [ caller's library's struct ]
 	//                        [ library_context_part_01 ]
 	//                        [ library_context_part_02 ]
@@ -318,6 +952,14 @@ static hxr_thread_impl_ *HXR(thread_get_impl_)(hxr_thread* t)
 // it's placed towards the bottom of the file.
 static void hxr_process_level_early_init();
 
+#if HXR_ENABLE_ASYNC_WRITER
+static void hxr_async_stop_(void);
+#endif
+
+#if HXR_ENABLE_CRASH_HANDLER
+static void hxr_crash_forget_thread_(hxr_thread_impl_ *timpl);
+#endif
+
 static hxr_process  hxr_process_instance_;
 
 /// Initializes the HeXeR library and creates the `hxr_process*` object.
@@ -327,289 +969,7790 @@ hxr_process  *HXR(start)()
 	hxr_process_init_(&hxr_process_instance_);
 }
 
+/// Shuts down anything `hxr_start` (or later calls) started. In particular,
+/// this waits for the asynchronous writer (if any) to write out every message
+/// that was handed to it.
+void HXR(stop)(hxr_process *proc)
+{
+	// Everything this shuts down is process-wide, and there is only one
+	// process (`hxr_process_instance_`); `proc` just pairs this with
+	// `hxr_start`.
+	(void)proc;
+#if HXR_ENABLE_ASYNC_WRITER
+	hxr_async_stop_();
+#endif
+}
+
 /// Returns the process-wide instance of the `hxr_process` object.
 hxr_process  *HXR(get_current_process)();
 
-// -------------------------------------
+// ===== Deferred Formatting : hxr_fmtargs_* =====
+/// The `_fmt` and `_va` message builders don't format anything. Instead,
+/// they keep the format string and a compact binary copy of its arguments,
+/// and the text is only rendered when something actually asks for it
+/// (usually a stream that is printing or logging the message).
+///
+/// Messages that get filtered out, deduplicated, or thrown away by
+/// `hxr_clear_messages` therefore never pay for `vsnprintf`.
+///
+/// A `va_list` can't be stored or rebuilt portably, so the format string is
+/// parsed once during capture to learn each argument's type, and the values
+/// are packed back-to-back (unaligned) into an arena allocation. Rendering
+/// walks the format string again and formats one conversion at a time.
+/// Strings (`%s`) are deep-copied into the arena during capture, because
+/// the caller's buffer might not outlive the message.
+///
+/// Format strings that use features we can't replay (`%n`, positional
+/// `%1$d` arguments, wide characters/strings) are formatted immediately
+/// instead, just like they were before deferral existed.
 
-typedef struct S_HXR__TEXT_PLACEMENT_INFO
-{
-	char need_newline_before;
-	char need_newline_after;
+// Storage classes for captured arguments.
+#define HXR_FMTARG_NONE_      (0)   // "%%"; consumes nothing.
+#define HXR_FMTARG_INT_       (1)   // Also char/short (promoted) and '*' widths.
+#define HXR_FMTARG_UINT_      (2)
+#define HXR_FMTARG_LONG_      (3)
+#define HXR_FMTARG_ULONG_     (4)
+#define HXR_FMTARG_LLONG_     (5)
+#define HXR_FMTARG_ULLONG_    (6)
+#define HXR_FMTARG_INTMAX_    (7)
+#define HXR_FMTARG_UINTMAX_   (8)
+#define HXR_FMTARG_SIZE_      (9)
+#define HXR_FMTARG_PTRDIFF_   (10)
+#define HXR_FMTARG_DOUBLE_    (11)
+#define HXR_FMTARG_LDOUBLE_   (12)
+#define HXR_FMTARG_PTR_       (13)
+#define HXR_FMTARG_STRING_    (14)
+#define HXR_FMTARG_INVALID_   (0xFF)
 
-} hxr_text_placement_info_;
+// Longest conversion specification we'll replay, including the '%' and the
+// terminating null. Anything longer is formatted eagerly.
+#define HXR_FMTSPEC_MAX_  (32)
 
-static void hxr_get_text_placement_info_(
-		hxr_thread *t,  hxr_text_placement_info_ *result,  const char *text)
+typedef struct S_HXR__FMTSPEC
 {
-	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	const char  *begin;          // Points at the '%'.
+	const char  *end;            // One past the conversion character.
+	uint8_t     arg_class;       // HXR_FMTARG_*
+	uint8_t     n_stars;         // Number of '*' (width/precision) arguments.
+	uint8_t     precision_star;  // 1 if the precision is given by '*'.
+	int         precision;       // Literal precision, or -1 if there isn't one.
+} hxr_fmtspec_;
 
-	size_t newline_count = 0;
-	for ( size_t i = 0; text[i] != '\0'; i++ )
-		if ( text[i] == '\n' )
-			newline_count++;
-	size_t len = i;
+// Parses the conversion specification starting at `pct` (which must point at
+// a '%'). `spec->arg_class` will be HXR_FMTARG_INVALID_ if the specification
+// can't be captured and replayed.
+static void hxr_fmtspec_parse_(const char *pct, hxr_fmtspec_ *spec)
+{
+	const char *p = pct + 1;
+	spec->begin          = pct;
+	spec->arg_class      = HXR_FMTARG_INVALID_;
+	spec->n_stars        = 0;
+	spec->precision_star = 0;
+	spec->precision      = -1;
 
-	char newline_after = '\n';
-	if ( len > 0 && text[len-1] == '\n' ) {
-		newline_after = '\0'; // Don't put a redundant line ending.
-		newline_count--; // The last one doesn't count.
+	if ( *p == '%' ) {
+		spec->arg_class = HXR_FMTARG_NONE_;
+		spec->end = p + 1;
+		return;
 	}
 
-	char newline_before = '\0';
-	if ( newline_count > 0 )
-		newline_before = '\n';
+	// Flags.
+	while ( *p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0' || *p == '\'' )
+		p++;
 
-	result->need_newline_before = newline_before;
-	result->need_newline_after  = newline_after;
-}
+	// Width.
+	if ( *p == '*' ) {
+		spec->n_stars++;
+		p++;
+	} else {
+		while ( '0' <= *p && *p <= '9' )
+			p++;
+		if ( *p == '$' ) { // Positional arguments aren't supported.
+			spec->end = p;
+			return;
+		}
+	}
 
-// ===== Stream Structure : hxr_stream_ =====
-/// Very simple internal-use stream object that allows output-writing code
-/// to have less code duplication.
+	// Precision.
+	if ( *p == '.' ) {
+		p++;
+		if ( *p == '*' ) {
+			spec->n_stars++;
+			spec->precision_star = 1;
+			p++;
+		} else {
+			spec->precision = 0;
+			while ( '0' <= *p && *p <= '9' ) {
+				spec->precision = spec->precision * 10 + (*p - '0');
+				p++;
+			}
+		}
+	}
 
-#include <stdarg.h>
+	// Length modifiers.
+	char len1 = '\0';
+	char len2 = '\0';
+	if ( *p == 'h' || *p == 'l' || *p == 'j' || *p == 'z' || *p == 't' || *p == 'L' ) {
+		len1 = *p++;
+		if ( (len1 == 'h' || len1 == 'l') && *p == len1 )
+			len2 = *p++;
+	}
 
-typedef struct S_HXR__STREAM_VTBL
-{
-	ssize_t (write_line*)  (hxr_thread*, hxr_stream*, const char* text);
-	ssize_t (write_text*)  (hxr_thread*, hxr_stream*, const char* text);
-	ssize_t (write_fmtstr*)(hxr_thread*, hxr_stream*, const char* fmtstr, va_list);
-} hxr_stream_vtbl_;
+	char conv = *p;
+	spec->end = (conv == '\0') ? p : p + 1;
+	if ( (size_t)(spec->end - spec->begin) >= HXR_FMTSPEC_MAX_ )
+		return;
 
-typedef struct S_HXR__STREAM
-{
-	void                  *impl;
-	hxr_stream_vtbl_      *vtable;
-	hxr_source_location_  init_loc;
-	hxr_source_location_  final_loc;
-} hxr_stream_;
+	switch ( conv )
+	{
+		case 'd': case 'i': case 'c':
+		case 'o': case 'u': case 'x': case 'X':
+		{
+			uint8_t is_unsigned = (conv != 'd' && conv != 'i' && conv != 'c');
+			if ( conv == 'c' && len1 != '\0' )
+				return; // %lc (wint_t)
+			switch ( len1 )
+			{
+				case '\0':
+				case 'h': spec->arg_class = is_unsigned ? HXR_FMTARG_UINT_ : HXR_FMTARG_INT_; break;
+				case 'l':
+					if ( len2 == 'l' )
+						spec->arg_class = is_unsigned ? HXR_FMTARG_ULLONG_ : HXR_FMTARG_LLONG_;
+					else
+						spec->arg_class = is_unsigned ? HXR_FMTARG_ULONG_  : HXR_FMTARG_LONG_;
+					break;
+				case 'j': spec->arg_class = is_unsigned ? HXR_FMTARG_UINTMAX_ : HXR_FMTARG_INTMAX_; break;
+				case 'z': spec->arg_class = HXR_FMTARG_SIZE_;    break;
+				case 't': spec->arg_class = HXR_FMTARG_PTRDIFF_; break;
+				default: break;
+			}
+			return;
+		}
 
-// The canary stream (defined further down) is used to represent an abstract
-// stream's default state of "I'm not programmed to do ANYTHING". This allows
-// some programming mistakes to turn into error messages instead of segfaults.
-static ssize_t canary_stream_write_line(hxr_thread* t,  hxr_stream_* stream,  const char* text);
-static ssize_t canary_stream_write_text(hxr_thread* t,  hxr_stream_* stream,  const char* text);
-static ssize_t canary_stream_write_fmtstr(hxr_thread* t,  hxr_stream_* stream,  const char* fmtstr, va_list vargs);
+		case 'f': case 'F': case 'e': case 'E':
+		case 'g': case 'G': case 'a': case 'A':
+			if ( len1 == 'L' )
+				spec->arg_class = HXR_FMTARG_LDOUBLE_;
+			else
+			if ( len1 == '\0' || (len1 == 'l' && len2 == '\0') )
+				spec->arg_class = HXR_FMTARG_DOUBLE_;
+			return;
 
-static hxr_stream_vtbl_  hxr_canary_stream_vtbl_;
+		case 'p':
+			if ( len1 == '\0' )
+				spec->arg_class = HXR_FMTARG_PTR_;
+			return;
 
-static void hxr_stream_module_init_()
-{
-	hxr_canary_stream_vtbl_.write_line   = &canary_stream_write_line;
-	hxr_canary_stream_vtbl_.write_text   = &canary_stream_write_text;
-	hxr_canary_stream_vtbl_.write_fmtstr = &canary_stream_write_fmtstr;
+		case 's':
+			if ( len1 == '\0' )
+				spec->arg_class = HXR_FMTARG_STRING_;
+			return;
+
+		default:
+			// %n, %ls, and anything we don't recognize.
+			return;
+	}
 }
 
-static void hxr_stream_init_(hxr_thread *t, hxr_stream_ *stream, hxr_source_location_ loc)
+static size_t hxr_fmtarg_size_(uint8_t arg_class)
 {
-	stream->init_loc  = loc;
-	stream->final_loc = hxr_make_source_loc_("N/A", "N/A", 0);
-	stream->vtable    = &hxr_canary_stream_vtbl_;
-	stream->impl      = NULL;
+	switch ( arg_class )
+	{
+		case HXR_FMTARG_INT_:     return sizeof(int);
+		case HXR_FMTARG_UINT_:    return sizeof(unsigned int);
+		case HXR_FMTARG_LONG_:    return sizeof(long);
+		case HXR_FMTARG_ULONG_:   return sizeof(unsigned long);
+		case HXR_FMTARG_LLONG_:   return sizeof(long long);
+		case HXR_FMTARG_ULLONG_:  return sizeof(unsigned long long);
+		case HXR_FMTARG_INTMAX_:  return sizeof(intmax_t);
+		case HXR_FMTARG_UINTMAX_: return sizeof(uintmax_t);
+		case HXR_FMTARG_SIZE_:    return sizeof(size_t);
+		case HXR_FMTARG_PTRDIFF_: return sizeof(ptrdiff_t);
+		case HXR_FMTARG_DOUBLE_:  return sizeof(double);
+		case HXR_FMTARG_LDOUBLE_: return sizeof(long double);
+		case HXR_FMTARG_PTR_:     return sizeof(void*);
+		case HXR_FMTARG_STRING_:  return sizeof(const char*);
+		default:                  return 0;
+	}
 }
 
-void hxr_stream_finalize_(hxr_thread *t, hxr_stream_ *stream, hxr_source_location_ loc)
+static inline void hxr_copy_bytes_(void *dst, const void *src, size_t n)
 {
-	stream->final_loc = loc;
-	stream->vtable    = &hxr_canary_stream_vtbl_;
-	stream->impl      = NULL;
+	for ( size_t i = 0; i < n; i++ )
+		((unsigned char*)dst)[i] = ((const unsigned char*)src)[i];
 }
 
-// ===== Stream Interface : hxr_stream_* =====
+// Returns the number of bytes needed to capture the arguments for `fmtstr`,
+// or (size_t)-1 if `fmtstr` can't be deferred.
+static size_t hxr_fmtargs_measure_(const char *fmtstr)
+{
+	size_t total = 0;
+	const char *p = fmtstr;
+	while ( *p != '\0' )
+	{
+		if ( *p != '%' ) {
+			p++;
+			continue;
+		}
 
-static ssize_t stream_write_line(hxr_thread* t,  hxr_stream_* stream,  const char* text) {
-	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_WRAPPER);
-	return stream->write_line(t, stream, text);
+		hxr_fmtspec_ spec;
+		hxr_fmtspec_parse_(p, &spec);
+		if ( spec.arg_class == HXR_FMTARG_INVALID_ )
+			return (size_t)-1;
+
+		total += spec.n_stars * sizeof(int);
+		total += hxr_fmtarg_size_(spec.arg_class);
+		p = spec.end;
+	}
+	return total;
 }
 
-static ssize_t stream_write_text(hxr_thread* t,  hxr_stream_* stream,  const char* text) {
-	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_WRAPPER);
-	return stream->write_text(t, stream, text);
+// Copies at most `max_len` characters of `str` into the arena. Used for
+// `%s` arguments. `max_len` comes from the conversion's precision, which is
+// what lets callers pass buffers that aren't null-terminated.
+static const char *hxr_fmtargs_copy_str_(
+	hxr_thread *t,  hxr_arena_ *arena,  hxr_allocator *allocator,
+	const char *str,  size_t max_len)
+{
+	if ( str == NULL )
+		return NULL;
+
+	size_t len = 0;
+	while ( len < max_len && str[len] != '\0' )
+		len++;
+
+	char *result = hxr_arena_alloc_(t, arena, allocator, len+1);
+	if ( result == NULL )
+		return NULL;
+	hxr_copy_bytes_(result, str, len);
+	result[len] = '\0';
+	return result;
 }
 
-static ssize_t stream_write_text_fmt(hxr_thread* t,  hxr_stream_* stream,  const char* fmtstr, ...) {
+// Captures the arguments for `fmtstr` into `args`, which must be at least
+// `hxr_fmtargs_measure_(fmtstr)` bytes long.
+// Returns 0 if a `%s` argument could not be copied into the arena.
+static int hxr_fmtargs_capture_(
+	hxr_thread *t,  hxr_arena_ *arena,  hxr_allocator *allocator,
+	unsigned char *args,  const char *fmtstr,  va_list vargs)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+
+	unsigned char *out = args;
+	const char *p = fmtstr;
+
+#define HXR_FMTARGS_CAPTURE_(type) \
+	do { \
+		type value_ = va_arg(vargs, type); \
+		hxr_copy_bytes_(out, &value_, sizeof(type)); \
+		out += sizeof(type); \
+	} while(0)
+
+	while ( *p != '\0' )
+	{
+		if ( *p != '%' ) {
+			p++;
+			continue;
+		}
+
+		hxr_fmtspec_ spec;
+		hxr_fmtspec_parse_(p, &spec);
+		p = spec.end;
+
+		int precision = spec.precision;
+		for ( uint8_t i = 0; i < spec.n_stars; i++ ) {
+			int star = va_arg(vargs, int);
+			hxr_copy_bytes_(out, &star, sizeof(int));
+			out += sizeof(int);
+			if ( spec.precision_star && i == spec.n_stars-1 )
+				precision = star;
+		}
+
+		switch ( spec.arg_class )
+		{
+			case HXR_FMTARG_INT_:     HXR_FMTARGS_CAPTURE_(int);                break;
+			case HXR_FMTARG_UINT_:    HXR_FMTARGS_CAPTURE_(unsigned int);       break;
+			case HXR_FMTARG_LONG_:    HXR_FMTARGS_CAPTURE_(long);               break;
+			case HXR_FMTARG_ULONG_:   HXR_FMTARGS_CAPTURE_(unsigned long);      break;
+			case HXR_FMTARG_LLONG_:   HXR_FMTARGS_CAPTURE_(long long);          break;
+			case HXR_FMTARG_ULLONG_:  HXR_FMTARGS_CAPTURE_(unsigned long long); break;
+			case HXR_FMTARG_INTMAX_:  HXR_FMTARGS_CAPTURE_(intmax_t);           break;
+			case HXR_FMTARG_UINTMAX_: HXR_FMTARGS_CAPTURE_(uintmax_t);          break;
+			case HXR_FMTARG_SIZE_:    HXR_FMTARGS_CAPTURE_(size_t);             break;
+			case HXR_FMTARG_PTRDIFF_: HXR_FMTARGS_CAPTURE_(ptrdiff_t);          break;
+			case HXR_FMTARG_DOUBLE_:  HXR_FMTARGS_CAPTURE_(double);             break;
+			case HXR_FMTARG_LDOUBLE_: HXR_FMTARGS_CAPTURE_(long double);        break;
+			case HXR_FMTARG_PTR_:     HXR_FMTARGS_CAPTURE_(void*);              break;
+
+			case HXR_FMTARG_STRING_:
+			{
+				const char *str = va_arg(vargs, const char*);
+				size_t max_len = (precision < 0) ? (size_t)-1 : (size_t)precision;
+				const char *copy = hxr_fmtargs_copy_str_(t, arena, allocator, str, max_len);
+				if ( str != NULL && copy == NULL )
+					return 0;
+				hxr_copy_bytes_(out, &copy, sizeof(const char*));
+				out += sizeof(const char*);
+				break;
+			}
+
+			default: break; // HXR_FMTARG_NONE_
+		}
+	}
+
+#undef HXR_FMTARGS_CAPTURE_
+	return 1;
+}
+
+static int hxr_snprintf_(char *buf, size_t bufsz, const char *fmtstr, ...)
+{
+	va_list vargs;
+	va_start(vargs, fmtstr);
+	int rc = hxr_libc_vtbl_instance_.vsnprintf(buf, bufsz, fmtstr, vargs);
+	va_end(vargs);
+	return rc;
+}
+
+// Renders `fmtstr` with the arguments previously captured by
+// `hxr_fmtargs_capture_`. Has `snprintf` semantics: at most `bufsz` bytes
+// (including the null terminator) are written to `buf`, and the return value
+// is the length of the complete rendered text. Returns -1 on error.
+static ssize_t hxr_fmtargs_render_(
+	char *buf,  size_t bufsz,  const char *fmtstr,  const unsigned char *args)
+{
+	const unsigned char *in = args;
+	const char *p = fmtstr;
+	size_t pos = 0;
+
+#define HXR_FMTARGS_EMIT_CHAR_(ch) \
+	do { \
+		if ( pos + 1 < bufsz ) \
+			buf[pos] = (ch); \
+		pos++; \
+	} while(0)
+
+#define HXR_FMTARGS_RENDER_(type) \
+	do { \
+		type value_; \
+		hxr_copy_bytes_(&value_, in, sizeof(type)); \
+		in += sizeof(type); \
+		switch ( spec.n_stars ) { \
+			case 0:  rc = hxr_snprintf_(dst, dstsz, specstr, value_); break; \
+			case 1:  rc = hxr_snprintf_(dst, dstsz, specstr, stars[0], value_); break; \
+			default: rc = hxr_snprintf_(dst, dstsz, specstr, stars[0], stars[1], value_); break; \
+		} \
+	} while(0)
+
+	while ( *p != '\0' )
+	{
+		if ( *p != '%' ) {
+			HXR_FMTARGS_EMIT_CHAR_(*p);
+			p++;
+			continue;
+		}
+
+		hxr_fmtspec_ spec;
+		hxr_fmtspec_parse_(p, &spec);
+		p = spec.end;
+
+		if ( spec.arg_class == HXR_FMTARG_NONE_ ) {
+			HXR_FMTARGS_EMIT_CHAR_('%');
+			continue;
+		}
+
+		char specstr[HXR_FMTSPEC_MAX_];
+		size_t speclen = (size_t)(spec.end - spec.begin);
+		hxr_copy_bytes_(specstr, spec.begin, speclen);
+		specstr[speclen] = '\0';
+
+		int stars[2];
+		for ( uint8_t i = 0; i < spec.n_stars; i++ ) {
+			hxr_copy_bytes_(&stars[i], in, sizeof(int));
+			in += sizeof(int);
+		}
+
+		char   *dst   = (pos < bufsz) ? buf + pos : NULL;
+		size_t dstsz  = (pos < bufsz) ? bufsz - pos : 0;
+		int    rc     = 0;
+		switch ( spec.arg_class )
+		{
+			case HXR_FMTARG_INT_:     HXR_FMTARGS_RENDER_(int);                break;
+			case HXR_FMTARG_UINT_:    HXR_FMTARGS_RENDER_(unsigned int);       break;
+			case HXR_FMTARG_LONG_:    HXR_FMTARGS_RENDER_(long);               break;
+			case HXR_FMTARG_ULONG_:   HXR_FMTARGS_RENDER_(unsigned long);      break;
+			case HXR_FMTARG_LLONG_:   HXR_FMTARGS_RENDER_(long long);          break;
+			case HXR_FMTARG_ULLONG_:  HXR_FMTARGS_RENDER_(unsigned long long); break;
+			case HXR_FMTARG_INTMAX_:  HXR_FMTARGS_RENDER_(intmax_t);           break;
+			case HXR_FMTARG_UINTMAX_: HXR_FMTARGS_RENDER_(uintmax_t);          break;
+			case HXR_FMTARG_SIZE_:    HXR_FMTARGS_RENDER_(size_t);             break;
+			case HXR_FMTARG_PTRDIFF_: HXR_FMTARGS_RENDER_(ptrdiff_t);          break;
+			case HXR_FMTARG_DOUBLE_:  HXR_FMTARGS_RENDER_(double);             break;
+			case HXR_FMTARG_LDOUBLE_: HXR_FMTARGS_RENDER_(long double);        break;
+			case HXR_FMTARG_PTR_:     HXR_FMTARGS_RENDER_(void*);              break;
+			case HXR_FMTARG_STRING_:  HXR_FMTARGS_RENDER_(const char*);        break;
+			default: break;
+		}
+		if ( rc < 0 )
+			return -1;
+		pos += (size_t)rc;
+	}
+
+	if ( bufsz > 0 )
+		buf[(pos < bufsz) ? pos : bufsz-1] = '\0';
+
+#undef HXR_FMTARGS_RENDER_
+#undef HXR_FMTARGS_EMIT_CHAR_
+	return (ssize_t)pos;
+}
+
+// ===== Thread Lifecycle : hxr_thread_* =====
+// A thread is a `hxr_thread_wrapper_`: its `hxr_thread_impl_`, followed by
+// the caller's embeds, which is what the `hxr_thread*` points at (see
+// `hxr_thread_get_impl_`). It has to be allocated as a whole; an
+// `hxr_thread` on its own has nothing in front of it.
+
+// The state of a thread's messages is kept with the code that builds them.
+static void hxr_thread_messages_init_(hxr_thread_impl_ *timpl);
+static void hxr_thread_messages_free_(hxr_thread *t);
+
+// Everything that belongs to the thread rather than to its messages.
+static void hxr_thread_impl_init_(hxr_thread_impl_ *timpl)
+{
+	hxr_thread_messages_init_(timpl);
+	timpl->message_handler_func_ptr = NULL;
+	timpl->message_handler_context  = NULL;
+	timpl->fnclasses_on           = 0;
+	timpl->fnclasses_off          = 0;
+#if HXR_CALL_HISTORY_MAX > 0
+	timpl->call_history_pos       = 0;
+	timpl->call_history_count     = 0;
+	timpl->frame_stack[0].address       = (const void*)~(uintptr_t)0;
+	timpl->frame_stack[0].entry         = 0;
+	timpl->frame_stack[0].path          = HXR_PROFILE_PATH_ROOT_;
+	timpl->frame_stack[0].last_callsite = HXR_CALLSITE_NONE_;
+	timpl->frame_stack[0].last_path     = HXR_PROFILE_PATH_ROOT_;
+	timpl->frame_stack[0].callsite_id   = HXR_CALLSITE_NONE_;
+#if HXR_FRAME_TIMING_
+	timpl->frame_stack[0].child_ticks   = 0;
+#endif
+#endif
+#if HXR_STACK_TRACES_NATIVE_ && HXR_STACK_TRACE_FRAME_POINTERS
+	timpl->stack_low              = 0;
+	timpl->stack_high             = 0;
+#endif
+}
+
+// Creates a thread with the same process, allocator, logger, and message
+// format as `parent`, whose allocator it comes from. Returns NULL if it
+// couldn't be allocated.
+static hxr_thread *hxr_thread_create_(hxr_thread *parent)
+{
+	HXR_ENTER_FUNCTION(parent, HXR_FNCLASS_NORMAL);
+	hxr_thread_impl_ *parent_impl = HXR(thread_get_impl_)(parent);
+
+	hxr_thread_wrapper_ *wrapper = parent_impl->allocator->allocate(parent, sizeof(hxr_thread_wrapper_));
+	if ( wrapper == NULL )
+		return NULL;
+
+	hxr_thread_impl_ *timpl = &wrapper->impl;
+	timpl->process    = parent_impl->process;
+	timpl->allocator  = parent_impl->allocator;
+	timpl->logger     = parent_impl->logger;
+	hxr_thread_impl_init_(timpl);
+	timpl->msg_format = parent_impl->msg_format;
+	wrapper->embeds.dynamic_embeds = NULL;
+	wrapper->embeds.frame_depth_   = 0;
+	for ( size_t i = 0; i < HXR_FNCLASS_BITS_; i++ )
+		wrapper->embeds.sample_countdown_[i] = 1;
+	return &wrapper->embeds;
+}
+
+// Frees everything `t` has, and `t` itself. `t` is passed to its allocator's
+// `free` along with its own memory, so the allocator must not touch the
+// thread after freeing it.
+static void hxr_thread_destroy_(hxr_thread *t)
+{
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+	hxr_allocator    *allocator = timpl->allocator;
+#if HXR_ENABLE_CRASH_HANDLER
+	hxr_crash_forget_thread_(timpl);
+#endif
+	hxr_thread_messages_free_(t);
+	allocator->free(t, (hxr_thread_wrapper_*)timpl);
+}
+
+// ===== Message Building =====
+// Everything a message is made of (the struct itself and all of its text)
+// is allocated from the thread's message arena. See `hxr_arena_`.
+
+static void hxr_thread_messages_init_(hxr_thread_impl_ *timpl)
+{
+	timpl->error_count            = 0;
+	timpl->message_count          = 0;
+	timpl->dropped_count          = 0;
+	timpl->coalesced_count        = 0;
+	timpl->message_queue          = NULL;
+	timpl->queue_head             = 0;
+	timpl->queue_tail             = 0;
+	timpl->queue_overflow_policy  = HXR_QUEUE_OVERFLOW_COLLAPSE;
+	timpl->collapsed_type         = 0;
+	timpl->collapsed_count        = 0;
+	timpl->messages_in_progress   = NULL;
+	timpl->message_alloc_failures = 0;
+	timpl->arena_epoch            = 0;
+	timpl->coalesce_table         = NULL;
+	timpl->coalesce_generation    = 1;
+	timpl->coalesce_enabled       = (HXR_COALESCE_TABLE_SIZE > 0);
+	timpl->msg_format             = NULL;
+	timpl->format_cache.second    = ~(uint64_t)0;
+	timpl->format_cache.cwd_second = ~(uint64_t)0;
+	hxr_arena_init_(&timpl->message_arena);
+	hxr_arena_init_(&timpl->retired_arena);
+	timpl->queue_generation       = 0;
+	timpl->retired_arena_pinned   = 0;
+	timpl->message_arena_pinned   = 0;
+	hxr_scratch_init_(&timpl->format_scratch);
+}
+
+static void hxr_thread_messages_free_(hxr_thread *t)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_NORMAL);
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+	hxr_arena_free_(t, &timpl->message_arena, timpl->allocator);
+	hxr_arena_free_(t, &timpl->retired_arena, timpl->allocator);
+	hxr_scratch_free_(t, &timpl->format_scratch, timpl->allocator);
+	if ( timpl->message_queue != NULL )
+		timpl->allocator->free(t, timpl->message_queue);
+	if ( timpl->coalesce_table != NULL )
+		timpl->allocator->free(t, timpl->coalesce_table);
+	hxr_thread_messages_init_(timpl);
+}
+
+static inline void *hxr_message_alloc_(hxr_thread *t, hxr_thread_impl_ *timpl, size_t num_bytes)
+{
+	return hxr_arena_alloc_(t, &timpl->message_arena, timpl->allocator, num_bytes);
+}
+
+static const char *hxr_message_strdup_(hxr_thread *t, hxr_thread_impl_ *timpl, const char *text)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+	if ( text == NULL )
+		return NULL;
+
+	size_t len = 0;
+	while ( text[len] != '\0' )
+		len++;
+
+	char *result = hxr_message_alloc_(t, timpl, len+1);
+	if ( result == NULL )
+		return NULL;
+
+	for ( size_t i = 0; i <= len; i++ )
+		result[i] = text[i];
+	return result;
+}
+
+static const char *hxr_message_vformat_(
+	hxr_thread *t,  hxr_thread_impl_ *timpl,  const char *fmtstr,  va_list vargs)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+	hxr_arena_  *arena = &timpl->message_arena;
+	size_t      available = hxr_arena_available_(arena);
+	va_list     vargs_consumable;
+
+	// Optimistically format straight into the arena's free space. In the
+	// common case this is the only vsnprintf call we make, and claiming the
+	// memory afterwards is just a pointer bump.
+	va_copy(vargs_consumable, vargs);
+	int rc = hxr_libc_vtbl_instance_.vsnprintf(
+		arena->cursor, available, fmtstr, vargs_consumable);
+	va_end(vargs_consumable);
+	if ( rc < 0 )
+		return NULL;
+
+	size_t needed = (size_t)rc + 1;
+	if ( HXR_ARENA_ALIGN_UP_(needed) <= available )
+		return hxr_message_alloc_(t, timpl, needed);
+
+	// Didn't fit. Grow the arena and format again.
+	char *result = hxr_message_alloc_(t, timpl, needed);
+	if ( result == NULL )
+		return NULL;
+
+	va_copy(vargs_consumable, vargs);
+	hxr_libc_vtbl_instance_.vsnprintf(result, needed, fmtstr, vargs_consumable);
+	va_end(vargs_consumable);
+	return result;
+}
+
+static const char *hxr_message_format_(
+	hxr_thread *t,  hxr_thread_impl_ *timpl,  const char *fmtstr,  ...)
+{
+	va_list vargs;
+	va_start(vargs, fmtstr);
+	const char *result = hxr_message_vformat_(t, timpl, fmtstr, vargs);
+	va_end(vargs);
+	return result;
+}
+
+static inline void hxr_message_text_init_(hxr_message_text_ *mt)
+{
+	mt->text   = NULL;
+	mt->fmtstr = NULL;
+	mt->args   = NULL;
+}
+
+static void hxr_message_text_set_va_(
+	hxr_thread *t,  hxr_thread_impl_ *timpl,  hxr_message_text_ *mt,
+	const char *fmtstr,  va_list vargs)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+	hxr_message_text_init_(mt);
+
+#if HXR_DEFER_MESSAGE_FORMATTING
+	size_t args_size = hxr_fmtargs_measure_(fmtstr);
+	if ( args_size != (size_t)-1 )
+	{
+		// The format string is copied too, because nothing guarantees that
+		// it is a string literal.
+		unsigned char *args = hxr_message_alloc_(t, timpl, args_size);
+		const char *fmtstr_copy = hxr_message_strdup_(t, timpl, fmtstr);
+		if ( args != NULL && fmtstr_copy != NULL )
+		{
+			va_list vargs_consumable;
+			va_copy(vargs_consumable, vargs);
+			int ok = hxr_fmtargs_capture_(t, &timpl->message_arena, timpl->allocator,
+				args, fmtstr, vargs_consumable);
+			va_end(vargs_consumable);
+			if ( ok ) {
+				mt->fmtstr = fmtstr_copy;
+				mt->args   = args;
+				return;
+			}
+		}
+	}
+#endif
+
+	// Can't (or shouldn't) defer this one.
+	mt->text = hxr_message_vformat_(t, timpl, fmtstr, vargs);
+}
+
+// Returns the text for `mt`, rendering any deferred formatting first.
+// The rendered text is cached in the message, so this only ever formats
+// once per message section.
+static const char *hxr_message_text_get_(
+	hxr_thread *t,  hxr_thread_impl_ *timpl,  hxr_message_text_ *mt)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_NORMAL);
+	if ( mt->text != NULL || mt->fmtstr == NULL )
+		return mt->text;
+
+	hxr_arena_  *arena = &timpl->message_arena;
+	size_t      available = hxr_arena_available_(arena);
+
+	// Same trick as `hxr_message_vformat_`: render into the arena's free
+	// space first, and only render a second time if it didn't fit.
+	ssize_t rc = hxr_fmtargs_render_(arena->cursor, available, mt->fmtstr, mt->args);
+	if ( rc < 0 )
+		return NULL;
+
+	size_t needed = (size_t)rc + 1;
+	char *result;
+	if ( HXR_ARENA_ALIGN_UP_(needed) <= available )
+		result = hxr_message_alloc_(t, timpl, needed);
+	else {
+		result = hxr_message_alloc_(t, timpl, needed);
+		if ( result == NULL )
+			return NULL;
+		hxr_fmtargs_render_(result, needed, mt->fmtstr, mt->args);
+	}
+
+	mt->text = result;
+	timpl->arena_epoch++;
+	timpl->message_arena_pinned = 1;
+	return result;
+}
+
+// ===== Message Queue =====
+// Finished messages are kept in a fixed-capacity ring buffer of pointers so
+// that a runaway loop that emits errors can't grow memory without limit.
+// See `HXR_MESSAGE_QUEUE_CAPACITY` and `hxr_thread_set_queue_overflow_policy`.
+
+#define HXR_MESSAGE_QUEUE_MASK_  ((size_t)HXR_MESSAGE_QUEUE_CAPACITY - 1)
+
+static inline size_t hxr_message_queue_length_(const hxr_thread_impl_ *timpl)
+{
+	return timpl->queue_tail - timpl->queue_head;
+}
+
+// Gives `msg`'s memory back to the arena when nothing else has been
+// allocated since the message was started (which is the usual case for
+// a storm of messages that nobody is reading).
+static void hxr_message_discard_(hxr_thread_impl_ *timpl, hxr_feedback_message *msg)
+{
+	// Any message still in progress was started before `msg`, and couldn't
+	// have allocated anything since `msg` was started (its setters would have
+	// targeted `msg` instead), so it's safe from the rewind.
+	if ( msg->arena_epoch == timpl->arena_epoch )
+		hxr_arena_rewind_(&timpl->message_arena, msg);
+}
+
+// Called when `msg` can't be queued. Only HXR_QUEUE_OVERFLOW_COLLAPSE
+// remembers it for the "messages were dropped" summary.
+static void hxr_message_drop_(hxr_thread_impl_ *timpl, hxr_feedback_message *msg)
+{
+	timpl->dropped_count++;
+	if ( timpl->queue_overflow_policy == HXR_QUEUE_OVERFLOW_COLLAPSE )
+	{
+		uint32_t type = HXR_MSG_TYPE_EXTRACT(msg->type_and_flags);
+		timpl->collapsed_count++;
+		if ( timpl->collapsed_type < type )
+			timpl->collapsed_type = type;
+	}
+	hxr_message_discard_(timpl, msg);
+}
+
+// ===== Message ID Interning : hxr_msgid_* =====
+// Process-wide table that gives each distinct message id string a small
+// integer handle (its slot index plus one), so that anything downstream
+// (coalescing, filters, sinks) can compare ids with a single integer compare.
+//
+// Slots are claimed with a compare-and-swap and never released, so a handle,
+// and the string it refers to, stays valid for the life of the process.
+// The strings are copied with the default allocator the first time they
+// are interned.
+//
+// `HXR_MESSAGE_ID` caches the handle in a static at each callsite, so only
+// the first pass through a callsite pays for the hash and string compare.
+// A plain `hxr_message_id` pays for them every time.
+//
+// An id is only looked for in the HXR_MSGID_MAX_PROBES_ slots after its
+// hash, so a lookup costs a bounded number of string compares even when
+// the table is crowded. An id that finds no free slot there isn't
+// interned. Once every slot has been claimed, ids that are already in the
+// table are still found, but no new ones are copied or added: the message
+// keeps its own copy of the id instead (and isn't coalesced).
+
+#define HXR_MSGID_TABLE_MASK_  ((size_t)HXR_MESSAGE_ID_TABLE_SIZE - 1)
+#define HXR_MSGID_MAX_PROBES_  (16)
+
+static const char *hxr_msgid_table_[HXR_MESSAGE_ID_TABLE_SIZE];
+static size_t      hxr_msgid_claimed_;
+static size_t      hxr_msgid_table_full_reported_;
+
+static uint32_t hxr_msgid_hash_(const char *id, size_t *len)
+{
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	const char *p = id;
+	for ( ; *p != '\0'; p++ ) {
+		h ^= (uint8_t)*p;
+		h *= 16777619u;
+	}
+	*len = (size_t)(p - id);
+	return h;
+}
+
+static int hxr_msgid_equal_(const char *a, const char *b)
+{
+	if ( a == b )
+		return 1;
+	while ( *a != '\0' && *a == *b ) {
+		a++;
+		b++;
+	}
+	return *a == *b;
+}
+
+// Says (once) that ids have stopped being interned.
+static void hxr_msgid_report_full_(const char *id)
+{
+	if ( hxr_atomic_load_relaxed_size_(&hxr_msgid_table_full_reported_) != 0
+	||   hxr_atomic_cas_size_(&hxr_msgid_table_full_reported_, 0, 1) != 0 )
+		return;
+	HXR(debugf_)("HeXeR: The message id table is full, or too crowded to take \"%s\" "
+		"(%zd of HXR_MESSAGE_ID_TABLE_SIZE = %zd slots claimed). Ids that can't be "
+		"interned are copied into each message, and messages with those ids will "
+		"not be coalesced.\n",
+		id, hxr_atomic_load_relaxed_size_(&hxr_msgid_claimed_), (size_t)HXR_MESSAGE_ID_TABLE_SIZE);
+}
+
+hxr_msgid HXR(intern_message_id)(hxr_thread *t, const char *id)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_NORMAL);
+
+	if ( id == NULL )
+		return HXR_MSGID_NONE;
+
+	size_t   len;
+	uint32_t hash = hxr_msgid_hash_(id, &len);
+	char     *copy = NULL;
+
+	for ( size_t i = 0; i < HXR_MSGID_MAX_PROBES_ && i < HXR_MESSAGE_ID_TABLE_SIZE; i++ )
+	{
+		size_t slot = (hash + i) & HXR_MSGID_TABLE_MASK_;
+		const char *existing = hxr_atomic_load_ptr_((void *const *)&hxr_msgid_table_[slot]);
+
+		if ( existing == NULL )
+		{
+			if ( copy == NULL ) {
+				copy = hxr_default_malloc(t, len + 1);
+				if ( copy == NULL )
+					return HXR_MSGID_NONE;
+				hxr_copy_bytes_(copy, id, len + 1);
+			}
+
+			existing = hxr_atomic_cas_ptr_((void **)&hxr_msgid_table_[slot], NULL, copy);
+			if ( existing == NULL ) {
+				hxr_atomic_fetch_add_size_(&hxr_msgid_claimed_, 1);
+				return (hxr_msgid)(slot + 1);
+			}
+
+			// Another thread claimed this slot first. It might have been
+			// interning the same id, so fall through and compare.
+		}
+
+		if ( hxr_msgid_equal_(existing, id) ) {
+			if ( copy != NULL )
+				hxr_default_free(t, copy);
+			return (hxr_msgid)(slot + 1);
+		}
+	}
+
+	if ( copy != NULL )
+		hxr_default_free(t, copy);
+
+	hxr_msgid_report_full_(id);
+	return HXR_MSGID_NONE;
+}
+
+const char *HXR(msgid_string)(hxr_msgid id)
+{
+	if ( id == HXR_MSGID_NONE || id > HXR_MESSAGE_ID_TABLE_SIZE )
+		return NULL;
+	return hxr_atomic_load_ptr_((void *const *)&hxr_msgid_table_[id - 1]);
+}
+
+// ===== Call History : hxr_call_history_* =====
+// Every thread keeps its last HXR_CALL_HISTORY_MAX calls to functions that
+// start with HXR_ENTER_FUNCTION, as 16-byte `hxr_call_entry_`s in a ring
+// inside its `hxr_thread_impl_`. Recording a call is a load of the
+// callsite's id, a compare or two to work out its depth, and a store:
+// nothing is allocated and nothing is locked.
+//
+// Every HXR_ENTER_FUNCTION defines a static `hxr_callsite`. An entry refers
+// to it by a 32-bit id, which is handed out the first time the function is
+// entered: the id is one more than the callsite's slot in a process-wide
+// table of pointers (`hxr_callsite_*`). Slots are claimed with a
+// compare-and-swap, filled in, and then never change.
+//
+// The depth comes from the frame address of the function being entered
+// (`HXR_FRAME_ADDRESS_HERE_`). The thread keeps the frame addresses of the
+// calls it is inside of; when a new call comes in, every one at or below its
+// address belongs to a function that has returned, and is popped. The
+// bottom of that stack is the highest possible address, so the popping loop
+// doesn't need to check for running out. This
+// assumes that the stack grows downwards, as it does on all of the usual
+// platforms. A function that the compiler inlines shares its caller's frame,
+// and shows up at its caller's depth.
+//
+// Without a frame address, `frame_id` stands in for it. That is only a
+// place somewhere in the frame, so a call made right after a sibling with a
+// smaller frame can look like it's nested in that sibling.
+//
+// Functions that leave with HXR_RETURN pop their own frame as they go
+// (`hxr_thread_frame_exit_`), which keeps the depth right between calls and
+// avoids the problem above. HXR_ENTER_FUNCTION notes in a local whether it
+// pushed a frame, and HXR_RETURN only pops one if it did, so a call whose
+// entrance wasn't recorded (its class was off, or it was sampled out) can't
+// pop its caller's frame, even when it was inlined into it. Plain returns
+// are still allowed; their frames are popped by whatever comes next.
+//
+// Loops would flush everything else out of the ring in no time, so repeats
+// are folded as they happen. When a call is popped, its entry and the ones
+// after it (everything it called) are compared with the same number of
+// entries just before it. If those are the previous call from the same
+// place, with the same calls under it, the new copy is dropped and the
+// first one's count goes up. Calls under it are folded first, when they are
+// popped, so a loop that calls `foo` 50 times per iteration is one `foo`
+// entry with a count of 50 under each folded iteration. Only whole calls
+// are folded: a loop that calls `foo` and then `bar` is still an entry for
+// each of them, every time around.
+
+#define HXR_CALLSITE_TABLE_SIZE_  (4096)
+
+// The id of callsites entered after the table filled up. They are recorded
+// as unknown.
+#define HXR_CALLSITE_UNKNOWN_     (~(size_t)0)
+
+static hxr_callsite  *hxr_callsite_table_[HXR_CALLSITE_TABLE_SIZE_];
+static size_t        hxr_callsite_count_;
+
+// Returns: `site`'s id.
+static size_t hxr_callsite_register_(hxr_callsite *site)
+{
+	size_t id = hxr_atomic_load_size_(&site->id);
+	if ( id != HXR_CALLSITE_NONE_ )
+		return id;
+
+	size_t slot = hxr_atomic_load_size_(&hxr_callsite_count_);
+	while ( slot < HXR_CALLSITE_TABLE_SIZE_ )
+	{
+		size_t prev = hxr_atomic_cas_size_(&hxr_callsite_count_, slot, slot + 1);
+		if ( prev == slot )
+			break;
+		slot = prev;
+	}
+
+	id = HXR_CALLSITE_UNKNOWN_;
+	if ( slot < HXR_CALLSITE_TABLE_SIZE_ ) {
+		hxr_atomic_cas_ptr_((void**)&hxr_callsite_table_[slot], NULL, site);
+		id = slot + 1;
+	}
+
+	// If another thread got here first, its id wins. The slot that this one
+	// claimed is left pointing at a callsite with a different id, and is
+	// skipped by `hxr_callsite_next`.
+	size_t prev = hxr_atomic_cas_size_(&site->id, HXR_CALLSITE_NONE_, id);
+	return prev == HXR_CALLSITE_NONE_ ? id : prev;
+}
+
+// Returns: The callsite for `id`, or NULL.
+static const hxr_callsite *hxr_callsite_get_(uint32_t id)
+{
+	if ( id == HXR_CALLSITE_NONE_ || id > HXR_CALLSITE_TABLE_SIZE_ )
+		return NULL;
+	return hxr_atomic_load_ptr_((void *const *)&hxr_callsite_table_[id - 1]);
+}
+
+// The bounds of this module's callsite section. On ELF, the linker defines
+// `__start_` and `__stop_` symbols for sections named like C identifiers. On
+// Mach-O, they're `section$start$` and `section$end$`.
+#if HXR_HAVE_CALLSITE_SECTION_ && defined(__ELF__)
+extern hxr_callsite __start_hxr_callsites[] __attribute__((weak));
+extern hxr_callsite __stop_hxr_callsites[] __attribute__((weak));
+#	define HXR_CALLSITE_SECTION_BEGIN_  (__start_hxr_callsites)
+#	define HXR_CALLSITE_SECTION_END_    (__stop_hxr_callsites)
+#elif HXR_HAVE_CALLSITE_SECTION_ && defined(__APPLE__)
+extern hxr_callsite hxr_callsite_section_begin_[] __asm("section$start$__DATA$hxr_callsites");
+extern hxr_callsite hxr_callsite_section_end_[]   __asm("section$end$__DATA$hxr_callsites");
+#	define HXR_CALLSITE_SECTION_BEGIN_  (hxr_callsite_section_begin_)
+#	define HXR_CALLSITE_SECTION_END_    (hxr_callsite_section_end_)
+#else
+#	define HXR_CALLSITE_SECTION_BEGIN_  ((hxr_callsite*)NULL)
+#	define HXR_CALLSITE_SECTION_END_    ((hxr_callsite*)NULL)
+#endif
+
+static int hxr_callsite_in_section_(const hxr_callsite *site)
+{
+	const hxr_callsite *begin = HXR_CALLSITE_SECTION_BEGIN_;
+	const hxr_callsite *end   = HXR_CALLSITE_SECTION_END_;
+	return begin != NULL && begin <= site && site < end;
+}
+
+hxr_callsite *HXR(callsite_next)(const hxr_callsite *prev)
+{
+	hxr_callsite *begin = HXR_CALLSITE_SECTION_BEGIN_;
+	hxr_callsite *end   = HXR_CALLSITE_SECTION_END_;
+	size_t       slot   = 0;
+
+	if ( begin != NULL && (prev == NULL || hxr_callsite_in_section_(prev)) )
+	{
+		hxr_callsite *site = prev == NULL ? begin : (hxr_callsite*)prev + 1;
+		if ( site < end )
+			return site;
+	}
+	else if ( prev != NULL )
+		slot = prev->id;  // The slot after `prev`'s.
+
+	// Callsites that were entered but aren't in the section: the ones in
+	// other shared objects, or all of them if there's no section.
+	size_t count = hxr_atomic_load_size_(&hxr_callsite_count_);
+	for ( ; slot < count && slot < HXR_CALLSITE_TABLE_SIZE_; slot++ )
+	{
+		hxr_callsite *site = hxr_atomic_load_ptr_((void *const *)&hxr_callsite_table_[slot]);
+		if ( site != NULL && site->id == slot + 1 && !hxr_callsite_in_section_(site) )
+			return site;
+	}
+	return NULL;
+}
+
+// ----- Call Paths : hxr_profile_path_* -----
+// The call-count profile (`hxr_profile_*`) counts calls per path as well as
+// per callsite. A path is a callsite along with the path of the call it was
+// made from (so the paths form a tree, rooted at "called from code without
+// HXR_ENTER_FUNCTION"). They're kept in a process-wide table that works like
+// `hxr_msgid_*`, keyed on the parent path's id and the callsite's id, with
+// one difference: it can fill up. Calls along paths that don't fit are
+// counted in `hxr_profile_lost_`, and so are the calls under them.
+//
+// Each frame on a thread's stack keeps its path, and the last callsite it
+// called with the path that gave, so a loop making the same call only looks
+// the path up the first time around. That includes paths that didn't fit:
+// the frame remembers HXR_PROFILE_PATH_LOST_ just the same, so a frame that
+// keeps making a call that didn't fit doesn't keep probing for it.
+
+#if HXR_PROFILE_MAX_PATHS > 0 && HXR_CALL_HISTORY_MAX > 0
+#define HXR_PROFILE_PATH_MASK_    ((size_t)HXR_PROFILE_MAX_PATHS - 1)
+
+// How many slots a lookup tries before giving up on the path. Like the
+// symbol cache, this keeps a crowded (or full) table from costing a scan of
+// the whole thing on every miss.
+#define HXR_PROFILE_PATH_PROBES_  (16)
+
+#define HXR_PROFILE_PATH_EMPTY_    (0)
+#define HXR_PROFILE_PATH_FILLING_  (1)
+#define HXR_PROFILE_PATH_READY_    (2)
+
+typedef struct S_HXR__PROFILE_PATH
+{
+	size_t    state;       // HXR_PROFILE_PATH_*_, only changed atomically.
+	uint32_t  parent;      // Path id, or HXR_PROFILE_PATH_ROOT_.
+	uint32_t  callsite;
+	size_t    count;       // Relaxed, like `hxr_callsite.call_count`.
+} hxr_profile_path_;
+
+static hxr_profile_path_  hxr_profile_paths_[HXR_PROFILE_MAX_PATHS];
+#endif
+
+static size_t  hxr_profile_lost_;
+
+#if HXR_PROFILE_MAX_PATHS > 0 && HXR_CALL_HISTORY_MAX > 0
+// Returns: The id (slot index plus one) of the path made of `parent`
+// followed by `callsite`, or HXR_PROFILE_PATH_LOST_ if it isn't in any of
+// the slots it can go in, and they're all taken.
+static uint32_t hxr_profile_path_get_(uint32_t parent, uint32_t callsite)
+{
+	if ( parent == HXR_PROFILE_PATH_LOST_ )
+		return HXR_PROFILE_PATH_LOST_;
+
+	uint64_t key   = ((uint64_t)parent << 32) | callsite;
+	size_t   start = (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32);
+	for ( size_t i = 0; i < HXR_PROFILE_PATH_PROBES_ && i < HXR_PROFILE_MAX_PATHS; i++ )
+	{
+		size_t             slot  = (start + i) & HXR_PROFILE_PATH_MASK_;
+		hxr_profile_path_  *path = &hxr_profile_paths_[slot];
+		size_t             state = hxr_atomic_load_size_(&path->state);
+
+		if ( state == HXR_PROFILE_PATH_EMPTY_ )
+		{
+			state = hxr_atomic_cas_size_(&path->state, HXR_PROFILE_PATH_EMPTY_, HXR_PROFILE_PATH_FILLING_);
+			if ( state == HXR_PROFILE_PATH_EMPTY_ ) {
+				path->parent   = parent;
+				path->callsite = callsite;
+				hxr_atomic_store_size_(&path->state, HXR_PROFILE_PATH_READY_);
+				return (uint32_t)(slot + 1);
+			}
+		}
+
+		while ( state == HXR_PROFILE_PATH_FILLING_ )
+			state = hxr_atomic_load_size_(&path->state);
+
+		if ( path->parent == parent && path->callsite == callsite )
+			return (uint32_t)(slot + 1);
+	}
+	return HXR_PROFILE_PATH_LOST_;
+}
+
+// Adds `weight` calls (more than one for sampled calls) to the path's count.
+static inline void hxr_profile_path_count_(uint32_t id, size_t weight)
+{
+	size_t *count = id == HXR_PROFILE_PATH_LOST_ ? &hxr_profile_lost_ : &hxr_profile_paths_[id - 1].count;
+	hxr_atomic_store_relaxed_size_(count, hxr_atomic_load_relaxed_size_(count) + weight);
+}
+#endif
+
+#define HXR_CALL_HISTORY_MASK_  ((size_t)HXR_CALL_HISTORY_MAX - 1)
+
+#if HXR_CALL_HISTORY_MAX > 0
+// Folds the call at `start`, which has just returned, into the one before it
+// if they are the same (see above). `end` is `call_history_pos`.
+//
+// Returns: The new `call_history_pos`.
+static size_t hxr_call_history_fold_(hxr_thread_impl_ *timpl, size_t start, size_t end)
+{
+	size_t len = end - start;
+	if ( len + len > timpl->call_history_count )
+		return end;
+
+	hxr_call_entry_ *history = timpl->call_history;
+	hxr_call_entry_ *prev = &history[(start - len) & HXR_CALL_HISTORY_MASK_];
+	hxr_call_entry_ *next = &history[start & HXR_CALL_HISTORY_MASK_];
+	if ( prev->callsite != next->callsite || prev->depth != next->depth )
+		return end;
+
+	for ( size_t i = 1; i < len; i++ )
+	{
+		const hxr_call_entry_ *a = &history[(start - len + i) & HXR_CALL_HISTORY_MASK_];
+		const hxr_call_entry_ *b = &history[(start + i) & HXR_CALL_HISTORY_MASK_];
+		if ( a->callsite != b->callsite || a->depth != b->depth || a->count != b->count )
+			return end;
+	}
+
+	prev->count += next->count;
+	timpl->call_history_count -= len;
+	return start;
+}
+#endif
+
+// ----- Function Classes : hxr_*call_history_fnclasses -----
+// Which HXR_ENTER_FUNCTIONs are recorded is decided in three steps. Classes
+// left out of HXR_CALL_HISTORY_FNCLASSES are compiled out. The rest are
+// checked inline against `hxr_call_history_fnclasses_`, which is the
+// process's classes plus every class some thread has turned on for itself.
+// Calls that get past that are checked against the calling thread's own
+// classes in `hxr_thread_frame_entrance_`.
+//
+// Threads' classes are only ever added to `hxr_fnclasses_threads_on_`, so
+// a thread that turns a class off again doesn't have to know whether
+// another thread still has it on.
+
+size_t  HXR(call_history_fnclasses_) = HXR_CALL_HISTORY_FNCLASSES;
+
+static size_t  hxr_fnclasses_process_    = HXR_CALL_HISTORY_FNCLASSES;
+static size_t  hxr_fnclasses_threads_on_ = 0;
+
+// Recomputes `hxr_call_history_fnclasses_` after either of the others
+// changed. If two threads do this at once, the one that stores last might
+// have read one of them before the other thread changed it, so it checks
+// again after storing.
+static void hxr_fnclasses_publish_(void)
+{
+	size_t classes;
+	do {
+		classes = hxr_atomic_load_size_(&hxr_fnclasses_process_)
+		        | hxr_atomic_load_size_(&hxr_fnclasses_threads_on_);
+		hxr_atomic_store_size_(&HXR(call_history_fnclasses_), classes);
+	} while ( classes != (hxr_atomic_load_size_(&hxr_fnclasses_process_)
+	                    | hxr_atomic_load_size_(&hxr_fnclasses_threads_on_)) );
+}
+
+void HXR(set_call_history_fnclasses)(size_t fnclasses)
+{
+	hxr_atomic_store_size_(&hxr_fnclasses_process_, fnclasses & (HXR_CALL_HISTORY_FNCLASSES));
+	hxr_fnclasses_publish_();
+}
+
+size_t HXR(call_history_fnclasses)(void)
+{
+	return hxr_atomic_load_size_(&hxr_fnclasses_process_);
+}
+
+void HXR(thread_set_call_history_fnclasses)(hxr_thread *t, size_t on, size_t off)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_SETTER);
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+	timpl->fnclasses_on  = on & (HXR_CALL_HISTORY_FNCLASSES);
+	timpl->fnclasses_off = off & ~timpl->fnclasses_on;
+
+	size_t threads_on = hxr_atomic_load_size_(&hxr_fnclasses_threads_on_);
+	while ( (threads_on | timpl->fnclasses_on) != threads_on )
+	{
+		size_t prev = hxr_atomic_cas_size_(&hxr_fnclasses_threads_on_,
+			threads_on, threads_on | timpl->fnclasses_on);
+		if ( prev == threads_on ) {
+			hxr_fnclasses_publish_();
+			break;
+		}
+		threads_on = prev;
+	}
+}
+
+// ----- Sampling : hxr_*fnclass_sample_period -----
+// Each thread counts down from a class's period, and only records the call
+// that reaches 1, as if it had been made `period` times. The countdowns are
+// in `hxr_thread` (`sample_countdown_`), so that HXR_ENTER_FUNCTION can count
+// down inline, and only calls `hxr_thread_frame_entrance_` for the call that
+// is recorded, which starts the next countdown. Classes that aren't sampled
+// have a period of 1, so every call of theirs is recorded. The countdowns
+// start at 1, so the first call of each class is recorded. A period that
+// changes takes effect on each thread after its current countdown ends.
+
+// 1 for classes that aren't sampled (or 0, before their period is set).
+static size_t  hxr_fnclass_sample_periods_[HXR_FNCLASS_BITS_];
+
+void HXR(set_fnclass_sample_period)(size_t fnclasses, size_t period)
+{
+	// A period of 0 means the same as 1.
+	if ( period == 0 )
+		period = 1;
+
+	for ( size_t bits = fnclasses; bits != 0; bits &= bits - 1 )
+		hxr_atomic_store_size_(&hxr_fnclass_sample_periods_[hxr_lowest_bit_(bits)], period);
+}
+
+size_t HXR(fnclass_sample_period)(size_t fnclass)
+{
+	if ( fnclass == 0 )
+		return 1;
+	size_t period = hxr_atomic_load_size_(&hxr_fnclass_sample_periods_[hxr_lowest_bit_(fnclass)]);
+	return period > 1 ? period : 1;
+}
+
+// ----- Frame Timing : hxr_frame_timing_* -----
+// With HXR_ENABLE_FRAME_TIMING, each frame on a thread's frame stack keeps
+// the tick count from when it was pushed, and the ticks its children took.
+// When it's popped (by the next call made from its caller or higher; see
+// above), the difference is added to its callsite's inclusive time, and that
+// less the children's to its exclusive time. So there is one read of the
+// tick counter per call, shared by the frames it pops and the one it pushes.
+//
+// Ticks are the CPU's cycle counter where GCC or Clang can read it (x86's
+// TSC, ARM's virtual counter), and otherwise nanoseconds from the monotonic
+// clock. They're converted by comparing them with the monotonic clock at
+// startup and when converted.
+
+#if HXR_ENABLE_FRAME_TIMING && !HXR_ENABLE_LIBC
+#error "HXR_ENABLE_FRAME_TIMING needs HXR_ENABLE_LIBC (to measure the tick rate)."
+#endif
+
+#if HXR_ENABLE_FRAME_TIMING
+// Falls back on `time` (like `hxr_timestamp_default`) where there's no
+// `clock_gettime`, which only works out for frames that take seconds.
+static uint64_t hxr_monotonic_ns_(void)
+{
+#if defined(CLOCK_MONOTONIC_RAW) || defined(CLOCK_MONOTONIC) || defined(CLOCK_REALTIME)
+	struct timespec ts;
+#if defined(CLOCK_MONOTONIC_RAW)
+	if ( clock_gettime(CLOCK_MONOTONIC_RAW, &ts) == 0 )
+#elif defined(CLOCK_MONOTONIC)
+	if ( clock_gettime(CLOCK_MONOTONIC, &ts) == 0 )
+#else
+	if ( clock_gettime(CLOCK_REALTIME, &ts) == 0 )
+#endif
+		return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+	return (uint64_t)time(NULL) * 1000000000u;
+}
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#	define HXR_TICKS_ARE_NS_  0
+static inline uint64_t hxr_ticks_(void) {
+	return __builtin_ia32_rdtsc();
+}
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+#	define HXR_TICKS_ARE_NS_  0
+static inline uint64_t hxr_ticks_(void) {
+	uint64_t ticks;
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+	return ticks;
+}
+#else
+#	define HXR_TICKS_ARE_NS_  1
+static inline uint64_t hxr_ticks_(void) {
+	return hxr_monotonic_ns_();
+}
+#endif
+
+static uint64_t  hxr_frame_timing_start_ticks_;
+static uint64_t  hxr_frame_timing_start_ns_;
+
+static void hxr_frame_timing_module_init_(void)
+{
+	hxr_frame_timing_start_ns_    = hxr_monotonic_ns_();
+	hxr_frame_timing_start_ticks_ = hxr_ticks_();
+}
+
+uint64_t HXR(frame_ticks_to_ns)(uint64_t ticks)
+{
+#if HXR_TICKS_ARE_NS_
+	return ticks;
+#else
+	uint64_t ns          = hxr_monotonic_ns_() - hxr_frame_timing_start_ns_;
+	uint64_t ticks_since = hxr_ticks_() - hxr_frame_timing_start_ticks_;
+	if ( ns == 0 || ticks_since == 0 )
+		return 0;
+	return (uint64_t)((double)ticks * ((double)ns / (double)ticks_since));
+#endif
+}
+#endif
+
+#if HXR_FRAME_TIMING_
+// Pops `frame_stack[depth]`, which ended at `now`.
+static inline void hxr_frame_timing_pop_(hxr_thread_impl_ *timpl, size_t depth, uint64_t now)
+{
+	hxr_call_frame_ *frame     = &timpl->frame_stack[depth];
+	uint64_t        inclusive  = now - frame->start_ticks;
+	uint64_t        exclusive  = inclusive > frame->child_ticks ? inclusive - frame->child_ticks : 0;
+	hxr_callsite    *site      = frame->callsite;
+
+	// Not atomic adds; see `hxr_callsite`.
+	hxr_atomic_store_relaxed_u64_(&site->inclusive_ticks,
+		hxr_atomic_load_relaxed_u64_(&site->inclusive_ticks) + inclusive * frame->weight);
+	hxr_atomic_store_relaxed_u64_(&site->exclusive_ticks,
+		hxr_atomic_load_relaxed_u64_(&site->exclusive_ticks) + exclusive * frame->weight);
+	timpl->frame_stack[depth - 1].child_ticks += inclusive;
+}
+#endif
+
+#if HXR_CALL_HISTORY_MAX > 0
+// Pops the frames below `frame`, which belong to functions that have
+// returned, and the one at `frame` too if `inclusive`. Their calls are folded
+// in the history as they go. `now` is only used with frame timing.
+static inline void hxr_frame_stack_pop_(
+		hxr_thread       *t,
+		hxr_thread_impl_ *timpl,
+		const char       *frame,
+		int              inclusive,
+		uint64_t         now)
+{
+	size_t depth = t->frame_depth_;
+	size_t end   = timpl->call_history_pos;
+	while ( (const char*)timpl->frame_stack[depth].address < frame
+	||      (inclusive && timpl->frame_stack[depth].address == frame) ) {
+		end = hxr_call_history_fold_(timpl, timpl->frame_stack[depth].entry, end);
+#if HXR_FRAME_TIMING_
+		hxr_frame_timing_pop_(timpl, depth, now);
+#endif
+		depth--;
+	}
+	(void)now;
+	timpl->call_history_pos = end;
+	t->frame_depth_         = depth;
+}
+#endif
+
+// This is what HXR_ENTER_FUNCTION calls, so it must not use it itself.
+int HXR(thread_frame_entrance_)(
+		hxr_thread   **frame_id,
+		const void   *frame_address,
+		hxr_callsite *callsite)
+{
+	// The class got past `hxr_call_history_fnclasses_`, but that might only
+	// be because another thread turned it on.
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(*frame_id);
+	size_t classes = (hxr_atomic_load_relaxed_size_(&hxr_fnclasses_process_) & ~timpl->fnclasses_off)
+	               | timpl->fnclasses_on;
+	if ( (callsite->func_classification & classes) == 0 )
+		return 0;
+
+	// HXR_ENTER_FUNCTION has counted the class down to this call (or found
+	// a countdown of 0, which a thread that wasn't initialized would have),
+	// so it stands for every call in the class's period. The next period
+	// starts here.
+	unsigned bit    = hxr_lowest_bit_(callsite->func_classification);
+	size_t   weight = hxr_atomic_load_relaxed_size_(&hxr_fnclass_sample_periods_[bit]);
+	if ( weight < 1 )
+		weight = 1;
+	(*frame_id)->sample_countdown_[bit] = weight;
+
+	// Not an atomic add; see `hxr_callsite`.
+	hxr_atomic_store_relaxed_size_(&callsite->call_count,
+		hxr_atomic_load_relaxed_size_(&callsite->call_count) + weight);
+
+	size_t id = hxr_atomic_load_size_(&callsite->id);
+	if ( id == HXR_CALLSITE_NONE_ )
+		id = hxr_callsite_register_(callsite);
+
+#if HXR_CALL_HISTORY_MAX > 0
+	const char *frame = frame_address != NULL ? (const char*)frame_address : (const char*)frame_id;
+
+#if HXR_FRAME_TIMING_
+	uint64_t now = hxr_ticks_();
+#else
+	uint64_t now = 0;
+#endif
+	hxr_frame_stack_pop_(*frame_id, timpl, frame, 1, now);
+	size_t depth = (*frame_id)->frame_depth_;
+	size_t end   = timpl->call_history_pos;
+
+	// The call's path. The parent remembers the last one it made.
+	uint32_t path = HXR_PROFILE_PATH_LOST_;
+#if HXR_PROFILE_MAX_PATHS > 0
+	hxr_call_frame_ *parent = &timpl->frame_stack[depth];
+	if ( parent->last_callsite == (uint32_t)id )
+		path = parent->last_path;
+	else {
+		path = hxr_profile_path_get_(parent->path, (uint32_t)id);
+		parent->last_callsite = (uint32_t)id;
+		parent->last_path     = path;
+	}
+	hxr_profile_path_count_(path, weight);
+#endif
+
+	hxr_call_entry_ *entry = &timpl->call_history[end & HXR_CALL_HISTORY_MASK_];
+	entry->callsite = (uint32_t)id;
+	entry->depth    = (uint32_t)depth;
+	entry->count    = 1;
+	timpl->call_history_pos = end + 1;
+	if ( timpl->call_history_count < HXR_CALL_HISTORY_MAX )
+		timpl->call_history_count++;
+
+	// Past HXR_CALL_DEPTH_MAX_, calls are recorded at that depth (and aren't
+	// folded).
+	if ( depth < HXR_CALL_DEPTH_MAX_ ) {
+		depth++;
+		hxr_call_frame_ *pushed = &timpl->frame_stack[depth];
+		pushed->address       = frame;
+		pushed->entry         = end;
+		pushed->path          = path;
+		pushed->last_callsite = HXR_CALLSITE_NONE_;
+		pushed->callsite_id   = (uint32_t)id;
+#if HXR_FRAME_TIMING_
+		pushed->callsite      = callsite;
+		pushed->start_ticks   = now;
+		pushed->child_ticks   = 0;
+		pushed->weight        = weight;
+#endif
+		(*frame_id)->frame_depth_ = depth;
+		return 1;
+	}
+	(*frame_id)->frame_depth_ = depth;
+#endif
+	return 0;
+}
+
+// This is what HXR_RETURN calls, so it must not use HXR_ENTER_FUNCTION.
+void HXR(thread_frame_exit_)(hxr_thread **frame_id, const void *frame_address)
+{
+#if HXR_CALL_HISTORY_MAX > 0
+	// HXR_ENTER_FUNCTION would have replaced a NULL thread, so there's no
+	// frame to leave.
+	if ( *frame_id == NULL )
+		return;
+
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(*frame_id);
+	const char *frame = frame_address != NULL ? (const char*)frame_address : (const char*)frame_id;
+
+#if HXR_FRAME_TIMING_
+	uint64_t now = hxr_ticks_();
+#else
+	uint64_t now = 0;
+#endif
+	// This call pushed the frame here, and it's returning, so that frame
+	// goes along with anything below it (which returned without
+	// HXR_RETURN). If the frame is already gone, a callee that was inlined
+	// into this one popped it with its own entrance, and whatever the callee
+	// left in its place has returned too.
+	hxr_frame_stack_pop_(*frame_id, timpl, frame, 1, now);
+#else
+	(void)frame_id;
+	(void)frame_address;
+#endif
+}
+
+size_t HXR(thread_call_history)(hxr_thread *t, hxr_call_record *records, size_t max_records)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_GETTER);
+#if HXR_CALL_HISTORY_MAX > 0
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+	size_t end   = timpl->call_history_pos;
+	size_t count = timpl->call_history_count;
+	if ( count > max_records )
+		count = max_records;
+
+	for ( size_t i = 0; i < count; i++ )
+	{
+		const hxr_call_entry_ *entry = &timpl->call_history[(end - count + i) & HXR_CALL_HISTORY_MASK_];
+		const hxr_callsite    *site  = hxr_callsite_get_(entry->callsite);
+		records[i].file     = site != NULL ? site->file     : "?";
+		records[i].function = site != NULL ? site->function : "?";
+		records[i].line     = site != NULL ? site->line     : 0;
+		records[i].depth    = entry->depth;
+		records[i].count    = entry->count;
+	}
+	return count;
+#else
+	return 0;
+#endif
+}
+
+#if HXR_ENABLE_FILE_IO
+void HXR(print_call_history)(hxr_thread *t, FILE *fd)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+#if HXR_CALL_HISTORY_MAX > 0
+	hxr_call_record records[HXR_CALL_HISTORY_MAX];
+	size_t count = HXR(thread_call_history)(t, records, HXR_CALL_HISTORY_MAX);
+	for ( size_t i = 0; i < count; i++ )
+	{
+		const hxr_call_record *r = &records[i];
+		fprintf(fd, "%s, line %4zd: %*s%s", r->file, (ssize_t)r->line, (int)(2 * r->depth), "", r->function);
+		if ( r->count > 1 )
+			fprintf(fd, " (%llu times)", (unsigned long long)r->count);
+		fprintf(fd, "\n");
+	}
+#endif
+}
+#endif
+
+#if defined(HXR_EXTRACT_UNITTESTS) && (0 != HXR_EXTRACT_UNITTESTS)
+static void hxr_call_history_test_inner_(hxr_thread *t)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+}
+
+static void hxr_call_history_test_outer_(hxr_thread *t)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	// Through a pointer, so that the compiler can't inline it.
+	void (*volatile inner)(hxr_thread*) = &hxr_call_history_test_inner_;
+	inner(t);
+	inner(t);
+}
+
+static int hxr_call_history_test_return_(hxr_thread *t)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	HXR_RETURN(t, 1);
+}
+
+static void hxr_call_history_test_getter_(hxr_thread *t)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_GETTER);
+	HXR_RETURN(t);
+}
+
+// Has a callee inlined into it whose entrance isn't recorded, because
+// its class is turned off until just before it returns. Returns the depth
+// that the callee's HXR_RETURN left.
+static size_t hxr_call_history_test_inlined_(hxr_thread *t)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	size_t depth;
+	{
+		hxr_thread_set_call_history_fnclasses(t, 0, HXR_FNCLASS_NORMAL);
+		HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+		hxr_thread_set_call_history_fnclasses(t, 0, 0);
+		HXR_FRAME_EXIT_(t);
+		depth = HXR(thread_frame_depth_)(t);
+	}
+	HXR_RETURN(t, depth);
+}
+
+void HXR(call_history_unittest)(hxr_thread *t)
+{
+	hxr_call_record records[8];
+	size_t n_records, i;
+
+	// ................................ //
+	hxr_thread_init_(t);
+
+	void (*volatile outer)(hxr_thread*) = &hxr_call_history_test_outer_;
+	void (*volatile inner)(hxr_thread*) = &hxr_call_history_test_inner_;
+	outer(t);
+	outer(t);
+	inner(t); // So that the second outer call is known to have returned.
+
+	do {
+		n_records = hxr_thread_call_history(t, records, 8);
+		for ( i = n_records; i > 0; i-- )
+			if ( hxr_msgid_equal_(records[i-1].function, "hxr_call_history_test_outer_") )
+				break;
+		HXR_ASSERT_ELSE( i, >, 0 )                                                  break;
+		HXR_ASSERT_ELSE( i + 2, <, n_records + 1 )                                  break;
+
+		// Both outer calls fold into one entry, and so do the inner calls
+		// under each of them.
+		const hxr_call_record *r = &records[i-1];
+		HXR_ASSERT_STR_ELSE( r[1].function, ==, "hxr_call_history_test_inner_" )   break;
+		HXR_ASSERT_STR_ELSE( r[2].function, ==, "hxr_call_history_test_inner_" )   break;
+		HXR_ASSERT_ELSE( r[0].count, ==, 2 )                                        break;
+		HXR_ASSERT_ELSE( r[1].count, ==, 2 )                                        break;
+		HXR_ASSERT_ELSE( r[2].count, ==, 1 )                                        break;
+		HXR_ASSERT_ELSE( r[1].depth, ==, r[0].depth + 1 )                           break;
+		HXR_ASSERT_ELSE( r[2].depth, ==, r[0].depth )                               break;
+
+		// The outer function's callsite counted both calls.
+		hxr_callsite *site = NULL;
+		while ( NULL != (site = hxr_callsite_next(site)) )
+			if ( hxr_msgid_equal_(site->function, "hxr_call_history_test_outer_") )
+				break;
+		HXR_ASSERT_ELSE( site, !=, NULL )                                           break;
+		HXR_ASSERT_ELSE( site->call_count, >=, 2 )                                  break;
+	} while (0);
+
+	// With its class turned off on this thread, the call isn't counted.
+	do {
+		hxr_callsite *site = NULL;
+		while ( NULL != (site = hxr_callsite_next(site)) )
+			if ( hxr_msgid_equal_(site->function, "hxr_call_history_test_outer_") )
+				break;
+		HXR_ASSERT_ELSE( site, !=, NULL )                                           break;
+		size_t calls = site->call_count;
+		hxr_thread_set_call_history_fnclasses(t, 0, HXR_FNCLASS_NORMAL);
+		outer(t);
+		hxr_thread_set_call_history_fnclasses(t, 0, 0);
+		HXR_ASSERT_ELSE( site->call_count, ==, calls )                              break;
+		outer(t);
+		HXR_ASSERT_ELSE( site->call_count, ==, calls + 1 )                          break;
+	} while (0);
+
+	// HXR_RETURN pops its own frame, and only if its entrance pushed one,
+	// so the frame of the function that an unrecorded call was inlined into
+	// stays until that function returns.
+	do {
+		int (*volatile ret)(hxr_thread*)        = &hxr_call_history_test_return_;
+		size_t (*volatile inlined)(hxr_thread*) = &hxr_call_history_test_inlined_;
+		// The first call also pops the frames left by plain returns.
+		HXR_ASSERT_ELSE( ret(t), ==, 1 )                                            break;
+		size_t depth = HXR(thread_frame_depth_)(t);
+		HXR_ASSERT_ELSE( ret(t), ==, 1 )                                            break;
+		HXR_ASSERT_ELSE( HXR(thread_frame_depth_)(t), ==, depth )                   break;
+
+		HXR(begin_test_debugf)();
+		size_t inlined_depth = inlined(t);
+		HXR(end_test_debugf)();
+		HXR_ASSERT_ELSE( inlined_depth, ==, depth + 1 )                             break;
+		HXR_ASSERT_ELSE( hxr_debugf_count, ==, 0 )                                  break;
+		HXR_ASSERT_ELSE( HXR(thread_frame_depth_)(t), ==, depth )                   break;
+
+		// An HXR_RETURN in a function whose class isn't compiled in doesn't
+		// call into HeXeR. If it did, it would pop the frame that `inner`
+		// left (at the same address).
+		void (*volatile getter)(hxr_thread*) = &hxr_call_history_test_getter_;
+		if ( (HXR_FNCLASS_GETTER & (HXR_CALL_HISTORY_FNCLASSES)) == 0 )
+		{
+			inner(t);
+			getter(t);
+			HXR_ASSERT_ELSE( HXR(thread_frame_depth_)(t), ==, depth + 1 )           break;
+			ret(t); // Pops what `inner` left, so it doesn't fold into what's next.
+		}
+	} while (0);
+
+	// Sampled one in four: the first of every four calls is recorded and
+	// counted as four. A countdown of 0 reloads instead of wrapping, and a
+	// period of 0 is taken as 1.
+	do {
+		int (*volatile ret)(hxr_thread*) = &hxr_call_history_test_return_;
+		hxr_callsite *site = NULL;
+		while ( NULL != (site = hxr_callsite_next(site)) )
+			if ( hxr_msgid_equal_(site->function, "hxr_call_history_test_inner_") )
+				break;
+		HXR_ASSERT_ELSE( site, !=, NULL )                                           break;
+		size_t calls = site->call_count;
+
+		unsigned bit = hxr_lowest_bit_(HXR_FNCLASS_NORMAL);
+		hxr_set_fnclass_sample_period(HXR_FNCLASS_NORMAL, 4);
+		t->sample_countdown_[bit] = 0;
+		for ( i = 0; i < 8; i++ )
+			inner(t);
+		hxr_set_fnclass_sample_period(HXR_FNCLASS_NORMAL, 0);
+		ret(t); // So that the last inner call is known to have returned.
+
+		HXR_ASSERT_ELSE( hxr_fnclass_sample_period(HXR_FNCLASS_NORMAL), ==, 1 )     break;
+		HXR_ASSERT_ELSE( hxr_fnclass_sample_periods_[bit], ==, 1 )                  break;
+		HXR_ASSERT_ELSE( site->call_count, ==, calls + 8 )                          break;
+
+		// The two recorded calls fold into one entry.
+		n_records = hxr_thread_call_history(t, records, 8);
+		for ( i = n_records; i > 0; i-- )
+			if ( hxr_msgid_equal_(records[i-1].function, "hxr_call_history_test_inner_") )
+				break;
+		HXR_ASSERT_ELSE( i, >, 0 )                                                  break;
+		HXR_ASSERT_ELSE( records[i-1].count, ==, 2 )                                break;
+	} while (0);
+
+#if HXR_FRAME_TIMING_
+	// A popped frame's inclusive time is from its start to `now`, and its
+	// exclusive time is that less its children's, both scaled by its weight.
+	// Its inclusive time (unscaled) is added to its parent's children's.
+	do {
+		hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+		size_t depth = t->frame_depth_;
+		HXR_ASSERT_ELSE( depth + 2, <=, HXR_CALL_DEPTH_MAX_ )                       break;
+
+		hxr_callsite outer_site = HXR_CALLSITE_INIT_(HXR_FNCLASS_NORMAL);
+		hxr_callsite inner_site = HXR_CALLSITE_INIT_(HXR_FNCLASS_NORMAL);
+		hxr_call_frame_ *outer_frame = &timpl->frame_stack[depth + 1];
+		hxr_call_frame_ *inner_frame = &timpl->frame_stack[depth + 2];
+		uint64_t child_ticks = timpl->frame_stack[depth].child_ticks;
+
+		outer_frame->callsite    = &outer_site;
+		outer_frame->start_ticks = 1000;
+		outer_frame->child_ticks = 0;
+		outer_frame->weight      = 2;
+		inner_frame->callsite    = &inner_site;
+		inner_frame->start_ticks = 1030;
+		inner_frame->child_ticks = 0;
+		inner_frame->weight      = 1;
+
+		hxr_frame_timing_pop_(timpl, depth + 2, 1050);
+		hxr_frame_timing_pop_(timpl, depth + 1, 1100);
+		uint64_t parent_ticks = timpl->frame_stack[depth].child_ticks - child_ticks;
+		timpl->frame_stack[depth].child_ticks = child_ticks;
+
+		HXR_ASSERT_ELSE( inner_site.inclusive_ticks, ==, 20 )                       break;
+		HXR_ASSERT_ELSE( inner_site.exclusive_ticks, ==, 20 )                       break;
+		HXR_ASSERT_ELSE( outer_frame->child_ticks, ==, 20 )                         break;
+		HXR_ASSERT_ELSE( outer_site.inclusive_ticks, ==, 200 )                      break;
+		HXR_ASSERT_ELSE( outer_site.exclusive_ticks, ==, 160 )                      break;
+		HXR_ASSERT_ELSE( parent_ticks, ==, 100 )                                    break;
+	} while (0);
+#endif
+
+	hxr_thread_free_(t);
+}
+#endif
+
+// ===== Stack Traces : hxr_stack_* =====
+// Every HXR_BEGIN_ERROR captures where it was called from. Capturing has to
+// be cheap, since errors can come in bursts, so only the raw frames are
+// kept with the message (in its arena); turning them into text waits until
+// the message is printed, or `hxr_message_stack_trace` is called.
+//
+// With native stack traces, the frames are return addresses. They come from
+// following the chain of saved frame pointers (HXR_STACK_TRACE_FRAME_POINTERS),
+// which is a couple of loads per frame, or from glibc's `backtrace`, which
+// reads the unwind tables and is about fifty times slower. The walk
+// starts at `hxr_begin_`'s own frame, so the first frame is the function
+// that used HXR_BEGIN_ERROR. Frame pointers are only followed while they
+// point further up the thread's stack, so code built without them ends the
+// trace early instead of sending it off into the weeds.
+//
+// Return addresses are turned into "function+offset (module)" with `dladdr`,
+// which has to search the symbol tables. The results are kept in a
+// process-wide cache (an open-addressing table keyed by address, whose
+// slots are claimed with a compare-and-swap and never change after that),
+// and their text in a pool that is never freed, so each address is looked
+// up once for the life of the process.
+//
+// Without native stack traces, the frames are the callsites on the thread's
+// frame stack whose classes aren't in HXR_STACK_TRACE_EXCLUDES.
+
+#if HXR_STACK_TRACES_
+
+// How long one frame's line can be. Longer ones are cut off.
+#define HXR_STACK_LINE_MAX_  (256)
+
+static inline void hxr_stack_put_(char *buf, size_t *len, const char *text, size_t n)
+{
+	size_t room = HXR_STACK_LINE_MAX_ - *len;
+	if ( n > room )
+		n = room;
+	hxr_copy_bytes_(buf + *len, text, n);
+	*len += n;
+}
+
+static void hxr_stack_put_str_(char *buf, size_t *len, const char *text)
+{
+	size_t n = 0;
+	while ( text[n] != '\0' )
+		n++;
+	hxr_stack_put_(buf, len, text, n);
+}
+
+static void hxr_stack_put_uint_(char *buf, size_t *len, uintptr_t value, unsigned base)
+{
+	char digits[2 * sizeof(uintptr_t) + 2];
+	char *end = digits + sizeof(digits);
+	char *p   = end;
+	do {
+		*--p = "0123456789abcdef"[value % base];
+		value /= base;
+	} while ( value != 0 );
+	if ( base == 16 ) {
+		*--p = 'x';
+		*--p = '0';
+	}
+	hxr_stack_put_(buf, len, p, (size_t)(end - p));
+}
+
+#endif // HXR_STACK_TRACES_
+
+#if HXR_STACK_TRACES_NATIVE_
+
+#include <dlfcn.h>
+#if HXR_STACK_TRACE_FRAME_POINTERS
+#include <pthread.h>
+#else
+#include <execinfo.h>
+#endif
+
+#define HXR_SYMBOL_CACHE_SIZE_    (1024)
+#define HXR_SYMBOL_CACHE_MASK_    ((size_t)HXR_SYMBOL_CACHE_SIZE_ - 1)
+#define HXR_SYMBOL_CACHE_PROBES_  (16)
+#define HXR_SYMBOL_POOL_SIZE_     (65536)
+
+typedef struct S_HXR__SYMBOL_ENTRY
+{
+	size_t      pc;    // 0 while the slot is free.
+	const char  *text; // NULL until the slot's owner has looked it up.
+} hxr_symbol_entry_;
+
+static hxr_symbol_entry_  hxr_symbol_cache_[HXR_SYMBOL_CACHE_SIZE_];
+static char               hxr_symbol_pool_[HXR_SYMBOL_POOL_SIZE_];
+static size_t             hxr_symbol_pool_used_;
+
+static void hxr_stack_module_init_(void)
+{
+#if !HXR_STACK_TRACE_FRAME_POINTERS
+	// The first `backtrace` loads libgcc_s, which allocates. Get that out of
+	// the way now rather than in the middle of reporting an error.
+	void *pc;
+	backtrace(&pc, 1);
+#endif
+}
+
+#if HXR_STACK_TRACE_FRAME_POINTERS
+// Returns: 0 if the bounds of the calling thread's stack can't be found.
+// They're remembered by the `hxr_thread`, which belongs to one thread.
+static int hxr_stack_bounds_(hxr_thread_impl_ *timpl)
+{
+	if ( timpl->stack_high != 0 )
+		return 1;
+
+	pthread_attr_t attr;
+	void   *addr;
+	size_t size;
+	if ( pthread_getattr_np(pthread_self(), &attr) != 0 )
+		return 0;
+	int rc = pthread_attr_getstack(&attr, &addr, &size);
+	pthread_attr_destroy(&attr);
+	if ( rc != 0 )
+		return 0;
+
+	timpl->stack_low  = (uintptr_t)addr;
+	timpl->stack_high = (uintptr_t)addr + size;
+	return 1;
+}
+#endif
+
+// Fills `pcs` with up to `max` return addresses, starting with `caller_pc`
+// (the return address of the function whose frame is `frame`).
+// Returns: How many there are.
+static size_t hxr_stack_unwind_(hxr_thread_impl_ *timpl, const void *frame, const void *caller_pc,
+	const void **pcs, size_t max)
+{
+	size_t n = 0;
+#if HXR_STACK_TRACE_FRAME_POINTERS
+	(void)caller_pc;
+	if ( !hxr_stack_bounds_(timpl) )
+		return 0;
+
+	// Each frame starts with the caller's frame pointer, followed by the
+	// return address into the caller (on x86-64 and AArch64 alike).
+	const uintptr_t *fp = frame;
+	while ( n < max )
+	{
+		uintptr_t addr = (uintptr_t)fp;
+		if ( addr < timpl->stack_low || addr > timpl->stack_high - 2 * sizeof(uintptr_t)
+		||   (addr & (sizeof(uintptr_t) - 1)) != 0 )
+			break;
+		if ( fp[1] == 0 )
+			break;
+		pcs[n++] = (const void*)fp[1];
+
+		// Callers' frames are further up the stack. Anything else means
+		// that this wasn't a frame pointer after all.
+		const uintptr_t *next = (const uintptr_t*)fp[0];
+		if ( next <= fp )
+			break;
+		fp = next;
+	}
+#else
+	(void)timpl;
+	(void)frame;
+	// `backtrace` starts inside HeXeR; skip to the caller. A few extra
+	// frames leave room for the ones skipped.
+	void *found[HXR_STACK_TRACE_DEPTH + 8];
+	int  count = backtrace(found, (int)(sizeof(found) / sizeof(found[0])));
+	int  start = 0;
+	while ( start < count && found[start] != caller_pc )
+		start++;
+	if ( start == count )
+		start = 0;
+	for ( int i = start; i < count && n < max; i++ )
+		pcs[n++] = found[i];
+#endif
+	return n;
+}
+
+// Renders one return address as "function+0x1a (module)", or as
+// "module+0x1234" if no symbol covers it.
+// Returns: The length of the text put in `buf` (HXR_STACK_LINE_MAX_ bytes).
+static size_t hxr_symbol_format_(char *buf, const void *pc)
+{
+	size_t  len = 0;
+	Dl_info info;
+
+	// A return address can be just past the end of the function that made
+	// the call (if the call was the last thing in it), so look up the byte
+	// before it.
+	if ( dladdr((const char*)pc - 1, &info) == 0 || info.dli_fname == NULL ) {
+		hxr_stack_put_uint_(buf, &len, (uintptr_t)pc, 16);
+		return len;
+	}
+
+	const char *module = info.dli_fname;
+	for ( const char *p = info.dli_fname; *p != '\0'; p++ )
+		if ( *p == '/' )
+			module = p + 1;
+
+	if ( info.dli_sname != NULL && info.dli_saddr != NULL ) {
+		hxr_stack_put_str_(buf, &len, info.dli_sname);
+		hxr_stack_put_str_(buf, &len, "+");
+		hxr_stack_put_uint_(buf, &len, (uintptr_t)pc - (uintptr_t)info.dli_saddr, 16);
+		hxr_stack_put_str_(buf, &len, " (");
+		hxr_stack_put_str_(buf, &len, module);
+		hxr_stack_put_str_(buf, &len, ")");
+	} else {
+		hxr_stack_put_str_(buf, &len, module);
+		hxr_stack_put_str_(buf, &len, "+");
+		hxr_stack_put_uint_(buf, &len, (uintptr_t)pc - (uintptr_t)info.dli_fbase, 16);
+	}
+	return len;
+}
+
+// Returns: A copy of `text` that lasts as long as the process, or NULL if
+// the pool is full.
+static const char *hxr_symbol_pool_add_(const char *text, size_t len)
+{
+	size_t used = hxr_atomic_load_size_(&hxr_symbol_pool_used_);
+	while (1)
+	{
+		if ( HXR_SYMBOL_POOL_SIZE_ - used < len + 1 )
+			return NULL;
+		size_t prev = hxr_atomic_cas_size_(&hxr_symbol_pool_used_, used, used + len + 1);
+		if ( prev == used )
+			break;
+		used = prev;
+	}
+	char *copy = hxr_symbol_pool_ + used;
+	hxr_copy_bytes_(copy, text, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+// Returns: The text for `pc` from the cache, or rendered into `buf` (which
+// needs HXR_STACK_LINE_MAX_ + 1 bytes) when it can't be cached.
+static const char *hxr_symbolize_(const void *pc, char *buf)
+{
+	size_t key   = (size_t)(uintptr_t)pc;
+	size_t start = (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 32);
+	hxr_symbol_entry_ *owned = NULL;
+	for ( size_t i = 0; i < HXR_SYMBOL_CACHE_PROBES_; i++ )
+	{
+		hxr_symbol_entry_ *entry = &hxr_symbol_cache_[(start + i) & HXR_SYMBOL_CACHE_MASK_];
+		size_t entry_pc = hxr_atomic_load_size_(&entry->pc);
+		if ( entry_pc == 0 ) {
+			entry_pc = hxr_atomic_cas_size_(&entry->pc, 0, key);
+			if ( entry_pc == 0 ) {
+				owned = entry;
+				break;
+			}
+		}
+		if ( entry_pc == key ) {
+			// If another thread is still looking it up, don't wait for it.
+			const char *text = hxr_atomic_load_ptr_((void *const *)&entry->text);
+			if ( text != NULL )
+				return text;
+			break;
+		}
+	}
+
+	size_t len = hxr_symbol_format_(buf, pc);
+	buf[len] = '\0';
+	if ( owned != NULL ) {
+		const char *text = hxr_symbol_pool_add_(buf, len);
+		if ( text != NULL ) {
+			hxr_atomic_cas_ptr_((void**)&owned->text, NULL, (void*)text);
+			return text;
+		}
+	}
+	return buf;
+}
+
+#endif // HXR_STACK_TRACES_NATIVE_
+
+#if HXR_STACK_TRACES_
+
+// Records the stack trace of `msg`, which is being started by `hxr_begin_`.
+// `frame` and `caller_pc` are `hxr_begin_`'s frame address and return address.
+static void hxr_stack_capture_(hxr_thread *t, hxr_thread_impl_ *timpl, hxr_feedback_message *msg,
+	const void *frame, const void *caller_pc)
+{
+	const void *frames[HXR_STACK_TRACE_DEPTH];
+	size_t     n = 0;
+
+#if HXR_STACK_TRACES_NATIVE_
+	n = hxr_stack_unwind_(timpl, frame, caller_pc, frames, HXR_STACK_TRACE_DEPTH);
+#else
+	// `hxr_begin_`'s HXR_ENTER_FUNCTION has just popped everything that
+	// returned, so the frame stack is up to date (if its class is recorded).
+	(void)frame;
+	(void)caller_pc;
+	for ( size_t depth = t->frame_depth_; depth > 0 && n < HXR_STACK_TRACE_DEPTH; depth-- )
+	{
+		const hxr_callsite *site = hxr_callsite_get_(timpl->frame_stack[depth].callsite_id);
+		if ( site != NULL && (site->func_classification & (HXR_STACK_TRACE_EXCLUDES)) == 0 )
+			frames[n++] = site;
+	}
+#endif
+
+	if ( n == 0 )
+		return;
+	const void **stack = hxr_message_alloc_(t, timpl, n * sizeof(frames[0]));
+	if ( stack == NULL )
+		return;
+	hxr_copy_bytes_(stack, frames, n * sizeof(frames[0]));
+	msg->stack       = stack;
+	msg->stack_depth = n;
+}
+
+// Puts one frame of a stack trace in `line` (HXR_STACK_LINE_MAX_ bytes).
+// Returns: Its length.
+static size_t hxr_stack_format_frame_(char *line, size_t index, const void *frame)
+{
+	size_t len = 0;
+	hxr_stack_put_str_(line, &len, "  #");
+	hxr_stack_put_uint_(line, &len, index, 10);
+	hxr_stack_put_str_(line, &len, " ");
+#if HXR_STACK_TRACES_NATIVE_
+	char buf[HXR_STACK_LINE_MAX_ + 1];
+	hxr_stack_put_str_(line, &len, hxr_symbolize_(frame, buf));
+#else
+	const hxr_callsite *site = frame;
+	hxr_stack_put_str_(line, &len, site->function);
+	hxr_stack_put_str_(line, &len, " (");
+	hxr_stack_put_str_(line, &len, site->file);
+	hxr_stack_put_str_(line, &len, ":");
+	hxr_stack_put_uint_(line, &len, (uintptr_t)site->line, 10);
+	hxr_stack_put_str_(line, &len, ")");
+#endif
+	return len;
+}
+
+// Returns: `msg`'s stack trace as text, one frame per line, or NULL if it
+// doesn't have one. It's rendered into the thread's message arena the
+// first time, and cached in the message.
+static const char *hxr_stack_render_(hxr_thread *t, hxr_thread_impl_ *timpl, hxr_feedback_message *msg)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_NORMAL);
+	if ( msg->stack_text != NULL || msg->stack_depth == 0 )
+		return msg->stack_text;
+
+	// Measure, then render. The second look-up of each frame is a cache hit.
+	char   line[HXR_STACK_LINE_MAX_];
+	size_t total = 0;
+	for ( size_t i = 0; i < msg->stack_depth; i++ )
+		total += hxr_stack_format_frame_(line, i, msg->stack[i]) + 1;
+
+	char *text = hxr_message_alloc_(t, timpl, total + 1);
+	if ( text == NULL )
+		return NULL;
+	size_t pos = 0;
+	for ( size_t i = 0; i < msg->stack_depth && pos < total; i++ )
+	{
+		size_t len = hxr_stack_format_frame_(line, i, msg->stack[i]);
+		if ( len + 1 > total - pos )
+			len = total - pos - 1;
+		hxr_copy_bytes_(text + pos, line, len);
+		text[pos + len] = '\n';
+		pos += len + 1;
+	}
+	text[pos] = '\0';
+
+	msg->stack_text = text;
+	timpl->arena_epoch++;
+	timpl->message_arena_pinned = 1;
+	return text;
+}
+
+#if defined(HXR_EXTRACT_UNITTESTS) && (0 != HXR_EXTRACT_UNITTESTS)
+static void hxr_stack_test_report_(hxr_thread *t)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	HXR_BEGIN_ERROR(t);
+		hxr_message_id(t, "stack_test");
+	HXR_END(t);
+	HXR_BEGIN_WARNING(t);
+		hxr_message_id(t, "stack_test");
+	HXR_END(t);
+}
+
+void HXR(stack_trace_unittest)(hxr_thread *t)
+{
+	hxr_feedback_message  *msg;
+	const char            *trace;
+
+	// ................................ //
+	hxr_thread_init_(t);
+	hxr_thread_set_message_coalescing(t, 0);
+
+	// Through a pointer, so that the compiler can't inline it.
+	void (*volatile report)(hxr_thread*) = &hxr_stack_test_report_;
+	report(t);
+
+	do {
+		// Errors get a trace, and it's only rendered once.
+		HXR_ASSERT_ELSE( hxr_msg_next(t, &msg) )                                   break;
+		trace = hxr_message_stack_trace(t, msg);
+		HXR_ASSERT_ELSE( trace, !=, NULL )                                         break;
+		HXR_ASSERT_ELSE( trace[0] == ' ' && trace[1] == ' ' && trace[2] == '#' )   break;
+		HXR_ASSERT_ELSE( hxr_message_stack_trace(t, msg), ==, trace )              break;
+#if HXR_STACK_TRACES_CALLSITES_
+		// The innermost frame is the function that reported the error.
+		HXR_ASSERT_ELSE( hxr_msgid_equal_(((const hxr_callsite*)msg->stack[0])->function,
+			"hxr_stack_test_report_") )                                             break;
+#endif
+
+		// Warnings don't.
+		HXR_ASSERT_ELSE( hxr_msg_next(t, &msg) )                                   break;
+		HXR_ASSERT_ELSE( hxr_message_stack_trace(t, msg), ==, NULL )               break;
+	} while (0);
+
+	hxr_thread_free_(t);
+}
+#endif
+
+#endif // HXR_STACK_TRACES_
+
+// ===== Message Coalescing : hxr_coalesce_* =====
+// Folds repeats of a message into the copy that is already waiting in the
+// queue, so that a loop reporting the same thing 48,112 times produces one
+// message with a `repeat_count` of 48,112 instead of 48,112 messages.
+//
+// Two messages are repeats of each other if they have the same
+// `hxr_message_id` AND came from the same HXR_BEGIN_* callsite. Messages
+// without an (interned) id are never coalesced; giving a message an id is how
+// a caller opts in.
+//
+// The table is a small open-addressing hash table with linear probing and
+// a short probe limit. Entries go stale on their own (the message they point
+// at gets read out of the queue, or `hxr_clear_messages` bumps the
+// generation), and stale slots are simply reused. A miss just means
+// a message doesn't get folded, so the table never needs to be resized
+// or scrubbed.
+
+#define HXR_COALESCE_TABLE_MASK_   ((size_t)HXR_COALESCE_TABLE_SIZE - 1)
+#define HXR_COALESCE_MAX_PROBES_   (8)
+
+static uint32_t hxr_coalesce_hash_(hxr_msgid id, const char *file, size_t line)
+{
+	// FNV-1a style mixing of the id handle and the callsite.
+	uint32_t h = 2166136261u;
+	h ^= (uint32_t)id;
+	h *= 16777619u;
+	h ^= (uint32_t)((uintptr_t)file >> 3);
+	h *= 16777619u;
+	h ^= (uint32_t)line;
+	h *= 16777619u;
+	return h;
+}
+
+static inline int hxr_coalesce_entry_is_live_(
+	const hxr_thread_impl_ *timpl, const hxr_coalesce_entry_ *entry)
+{
+	return entry->generation == timpl->coalesce_generation
+	&&     entry->queue_seq  >= timpl->queue_head
+	&&     entry->queue_seq  <  timpl->queue_tail;
+}
+
+// Tries to fold `msg` into an earlier message that is still queued.
+// Returns 1 if it did (and `msg` should be discarded).
+//
+// Otherwise, returns 0 and sets `*vacancy` to a slot that `msg` can claim
+// with `hxr_coalesce_claim_` once it has actually been queued (or to NULL if
+// there is no room). The slot is not live until then, so a message that ends
+// up being dropped can't be found by later repeats.
+static int hxr_coalesce_(
+	hxr_thread *t,  hxr_thread_impl_ *timpl,  hxr_feedback_message *msg,
+	hxr_coalesce_entry_ **vacancy)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+
+	*vacancy = NULL;
+	if ( !timpl->coalesce_enabled || msg->id_handle == HXR_MSGID_NONE )
+		return 0;
+
+	if ( timpl->coalesce_table == NULL )
+	{
+		size_t n_bytes = HXR_COALESCE_TABLE_SIZE * sizeof(hxr_coalesce_entry_);
+		timpl->coalesce_table = timpl->allocator->allocate(t, n_bytes);
+		if ( timpl->coalesce_table == NULL ) {
+			timpl->coalesce_enabled = 0;
+			return 0;
+		}
+		for ( size_t i = 0; i < HXR_COALESCE_TABLE_SIZE; i++ )
+			timpl->coalesce_table[i].generation = 0;
+	}
+
+	uint32_t hash = hxr_coalesce_hash_(msg->id_handle, msg->loc.file, msg->loc.line);
+	hxr_coalesce_entry_ *free_slot = NULL;
+
+	for ( size_t i = 0; i < HXR_COALESCE_MAX_PROBES_; i++ )
+	{
+		hxr_coalesce_entry_ *entry =
+			&timpl->coalesce_table[(hash + i) & HXR_COALESCE_TABLE_MASK_];
+
+		if ( !hxr_coalesce_entry_is_live_(timpl, entry) ) {
+			if ( free_slot == NULL )
+				free_slot = entry;
+			continue;
+		}
+
+		if ( entry->id   == msg->id_handle
+		&&   entry->line == msg->loc.line
+		&&   entry->file == msg->loc.file )
+		{
+			hxr_feedback_message *original = entry->msg;
+			original->repeat_count += msg->repeat_count;
+			original->last_time     = msg->last_time;
+			return 1;
+		}
+	}
+
+	if ( free_slot != NULL ) {
+		free_slot->id   = msg->id_handle;
+		free_slot->file = msg->loc.file;
+		free_slot->line = msg->loc.line;
+		free_slot->hash = hash;
+		*vacancy = free_slot;
+	}
+	return 0;
+}
+
+// Makes `entry` (from `hxr_coalesce_`) point at `msg`, which was just
+// stored at queue position `queue_seq`.
+static inline void hxr_coalesce_claim_(
+	hxr_thread_impl_ *timpl,  hxr_coalesce_entry_ *entry,
+	hxr_feedback_message *msg,  size_t queue_seq)
+{
+	entry->msg        = msg;
+	entry->queue_seq  = queue_seq;
+	entry->generation = timpl->coalesce_generation;
+}
+
+void HXR(thread_set_message_coalescing)(hxr_thread *t, uint8_t enabled)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_SETTER);
+	HXR(thread_get_impl_)(t)->coalesce_enabled = (HXR_COALESCE_TABLE_SIZE > 0) && enabled;
+}
+
+size_t    HXR(message_repeat_count)(const hxr_feedback_message *msg) { return msg->repeat_count; }
+uint64_t  HXR(message_first_time)(const hxr_feedback_message *msg)   { return msg->first_time; }
+uint64_t  HXR(message_last_time)(const hxr_feedback_message *msg)    { return msg->last_time; }
+
+// For HXR_QUEUE_OVERFLOW_DROP_OLDEST, which evicts messages from the queue
+// without giving their memory back. The arena is split into two
+// generations: `message_arena`, which new messages are built in, and
+// `retired_arena`, which holds the messages queued before
+// `queue_generation`. Once the queue's head has passed `queue_generation`,
+// every message in the retired arena has been evicted (or read, which pins
+// it), so it's reset and becomes the new `message_arena`, and the current
+// one is retired in its place. That keeps an error storm to about two
+// queues' worth of messages.
+//
+// This only happens between messages: one that is still being built might
+// have been started in the arena that is about to be reset.
+static void hxr_message_arena_turnover_(hxr_thread_impl_ *timpl)
+{
+	if ( timpl->queue_head < timpl->queue_generation
+	||   timpl->retired_arena_pinned
+	||   timpl->messages_in_progress != NULL
+	||   timpl->message_alloc_failures != 0 )
+		return;
+
+	hxr_arena_ reused = timpl->retired_arena;
+	hxr_arena_reset_(&reused);
+	timpl->retired_arena        = timpl->message_arena;
+	timpl->message_arena        = reused;
+	timpl->retired_arena_pinned = timpl->message_arena_pinned;
+	timpl->message_arena_pinned = 0;
+	timpl->queue_generation     = timpl->queue_tail;
+
+	// Nothing in progress can rewind into the arena it was started in.
+	timpl->arena_epoch++;
+}
+
+static void hxr_message_enqueue_(hxr_thread *t, hxr_thread_impl_ *timpl, hxr_feedback_message *msg)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+
+	// Totals are exact no matter what happens to the message itself.
+	timpl->message_count++;
+	if ( HXR_MSG_TYPE_EXTRACT(msg->type_and_flags) == HXR_MSG_TYPE_ERROR )
+		timpl->error_count++;
+
+	// Repeats of a message that's still waiting in the queue are folded into
+	// it. This happens before the overflow check, so that an error storm
+	// made of repeats doesn't fill the queue in the first place.
+	hxr_coalesce_entry_ *vacancy;
+	if ( hxr_coalesce_(t, timpl, msg, &vacancy) ) {
+		timpl->coalesced_count++;
+		hxr_message_discard_(timpl, msg);
+		return;
+	}
+
+	if ( timpl->message_queue == NULL )
+	{
+		timpl->message_queue = timpl->allocator->allocate(t,
+			HXR_MESSAGE_QUEUE_CAPACITY * sizeof(hxr_feedback_message*));
+		if ( timpl->message_queue == NULL ) {
+			HXR(debugf_)("%s : %s, line %zd: Could not allocate the message queue. Message dropped.\n",
+				msg->loc.file, msg->loc.func, msg->loc.line);
+			hxr_message_drop_(timpl, msg);
+			return;
+		}
+	}
+
+	int evicted = 0;
+	if ( hxr_message_queue_length_(timpl) >= HXR_MESSAGE_QUEUE_CAPACITY )
+	{
+		if ( timpl->queue_overflow_policy != HXR_QUEUE_OVERFLOW_DROP_OLDEST ) {
+			hxr_message_drop_(timpl, msg);
+			return;
+		}
+
+		// Make room by evicting the oldest message. Its memory is reused by
+		// `hxr_message_arena_turnover_`, once everything else in its arena
+		// has gone too.
+		timpl->queue_head++;
+		timpl->dropped_count++;
+		evicted = 1;
+	}
+
+	if ( vacancy != NULL )
+		hxr_coalesce_claim_(timpl, vacancy, msg, timpl->queue_tail);
+
+	timpl->message_queue[timpl->queue_tail & HXR_MESSAGE_QUEUE_MASK_] = msg;
+	timpl->queue_tail++;
+	timpl->arena_epoch++;
+	if ( evicted )
+		hxr_message_arena_turnover_(timpl);
+}
+
+// Builds the "N messages were dropped" message for HXR_QUEUE_OVERFLOW_COLLAPSE.
+static hxr_feedback_message *hxr_message_make_collapse_summary_(hxr_thread *t, hxr_thread_impl_ *timpl)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_NORMAL);
+
+	hxr_feedback_message *msg = hxr_message_alloc_(t, timpl, sizeof(hxr_feedback_message));
+	if ( msg == NULL )
+		return NULL;
+
+	msg->next           = NULL;
+	msg->type_and_flags = timpl->collapsed_type | HXR_MSG_FLAG_HEXER;
+	msg->loc            = HXR_SOURCE_LOCATION_HERE_;
+	msg->arena_epoch    = timpl->arena_epoch;
+	msg->repeat_count   = 1;
+	msg->first_time     = hxr_libc_vtbl_instance_.timestamp();
+	msg->last_time      = msg->first_time;
+	msg->id_handle      = HXR(intern_message_id)(t, "message_queue_overflow");
+	msg->id             = HXR(msgid_string)(msg->id_handle);
+	if ( msg->id == NULL )
+		msg->id = "message_queue_overflow";
+	hxr_message_text_init_(&msg->summary);
+	hxr_message_text_init_(&msg->details);
+	hxr_message_text_init_(&msg->suggestion);
+#if HXR_STACK_TRACES_
+	msg->stack          = NULL;
+	msg->stack_depth    = 0;
+	msg->stack_text     = NULL;
+#endif
+
+	msg->summary.text = hxr_message_format_(t, timpl,
+		"%zu message(s) were dropped because the message queue was full.",
+		timpl->collapsed_count);
+	msg->details.text = hxr_message_format_(t, timpl,
+		"The message queue holds at most %zu messages. Messages that arrived "
+		"while it was full were discarded and are summarized here instead.",
+		(size_t)HXR_MESSAGE_QUEUE_CAPACITY);
+	msg->suggestion.text =
+		"Read messages more often (ex: with `hxr_print_messages`) or look for "
+		"a loop that emits the same message over and over.";
+
+	timpl->collapsed_count = 0;
+	timpl->collapsed_type  = 0;
+	timpl->arena_epoch++;
+	return msg;
+}
+
+void HXR(thread_set_queue_overflow_policy)(hxr_thread *t, uint32_t policy)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_SETTER);
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+	if ( policy > HXR_QUEUE_OVERFLOW_COLLAPSE )
+		policy = HXR_QUEUE_OVERFLOW_COLLAPSE;
+	timpl->queue_overflow_policy = policy;
+}
+
+uint32_t HXR(thread_get_queue_overflow_policy)(hxr_thread *t)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_GETTER);
+	return HXR(thread_get_impl_)(t)->queue_overflow_policy;
+}
+
+size_t  HXR(msg_count)(hxr_thread *t)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_GETTER);
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+	size_t n = hxr_message_queue_length_(timpl);
+	if ( timpl->queue_overflow_policy == HXR_QUEUE_OVERFLOW_COLLAPSE && timpl->collapsed_count > 0 )
+		n++;
+	return n;
+}
+
+int  HXR(msg_next)(hxr_thread *t, hxr_feedback_message **msg)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_NORMAL);
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+
+	// What's handed out has to stay valid until `hxr_clear_messages`, so
+	// its arena can't be reused before then.
+	if ( hxr_message_queue_length_(timpl) > 0 ) {
+		*msg = timpl->message_queue[timpl->queue_head & HXR_MESSAGE_QUEUE_MASK_];
+		if ( timpl->queue_head < timpl->queue_generation )
+			timpl->retired_arena_pinned = 1;
+		else
+			timpl->message_arena_pinned = 1;
+		timpl->queue_head++;
+		return 1;
+	}
+
+	// The collapse summary is handed out after everything that did fit.
+	if ( timpl->queue_overflow_policy == HXR_QUEUE_OVERFLOW_COLLAPSE && timpl->collapsed_count > 0 ) {
+		*msg = hxr_message_make_collapse_summary_(t, timpl);
+		timpl->message_arena_pinned = 1;
+		return (*msg != NULL);
+	}
+
+	*msg = NULL;
+	return 0;
+}
+
+size_t  HXR(dropped_message_count)(hxr_thread *t)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_GETTER);
+	return HXR(thread_get_impl_)(t)->dropped_count;
+}
+
+// HXR_BEGINs that fail to allocate are counted at the nesting level they
+// happened at: in the innermost message under construction, or in the
+// thread if there isn't one. An HXR_END takes one back off that count before
+// it pops anything, so every HXR_END pairs with its own HXR_BEGIN, even when
+// an allocation fails and a later one inside that block succeeds.
+static inline size_t *hxr_message_alloc_failures_(hxr_thread_impl_ *timpl)
+{
+	if ( timpl->messages_in_progress != NULL )
+		return &timpl->messages_in_progress->alloc_failures;
+	return &timpl->message_alloc_failures;
+}
+
+void HXR(begin_)(hxr_thread *t, uint32_t type_and_flags, hxr_source_location_ loc)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_NORMAL);
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+
+	hxr_feedback_message *msg = hxr_message_alloc_(t, timpl, sizeof(hxr_feedback_message));
+	if ( msg == NULL ) {
+		// We can't build a message to complain about this, since building
+		// messages is the thing that just failed.
+		HXR(debugf_)("%s : %s, line %zd: Could not allocate memory for a feedback message.\n",
+			loc.file, loc.func, loc.line);
+		(*hxr_message_alloc_failures_(timpl))++;
+		return;
+	}
+
+	msg->type_and_flags = type_and_flags;
+	msg->loc            = loc;
+	msg->alloc_failures = 0;
+	msg->arena_epoch    = timpl->arena_epoch;
+	msg->repeat_count   = 1;
+	msg->first_time     = hxr_libc_vtbl_instance_.timestamp();
+	msg->last_time      = msg->first_time;
+	msg->id_handle      = HXR_MSGID_NONE;
+	msg->id             = NULL;
+	hxr_message_text_init_(&msg->summary);
+	hxr_message_text_init_(&msg->details);
+	hxr_message_text_init_(&msg->suggestion);
+
+#if HXR_STACK_TRACES_
+	msg->stack          = NULL;
+	msg->stack_depth    = 0;
+	msg->stack_text     = NULL;
+	if ( HXR_MSG_TYPE_EXTRACT(type_and_flags) == HXR_MSG_TYPE_ERROR ) {
+#if HXR_STACK_TRACES_NATIVE_
+		hxr_stack_capture_(t, timpl, msg, __builtin_frame_address(0), __builtin_return_address(0));
+#else
+		hxr_stack_capture_(t, timpl, msg, NULL, NULL);
+#endif
+	}
+#endif
+
+	msg->next = timpl->messages_in_progress;
+	timpl->messages_in_progress = msg;
+}
+
+void HXR(end_)(hxr_thread *t, hxr_source_location_ loc)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_NORMAL);
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+
+	// The innermost HXR_BEGIN couldn't allocate its message, so there is
+	// nothing to enqueue for this HXR_END.
+	size_t *failures = hxr_message_alloc_failures_(timpl);
+	if ( *failures > 0 ) {
+		(*failures)--;
+		return;
+	}
+
+	hxr_feedback_message *msg = timpl->messages_in_progress;
+	if ( msg == NULL )
+		return;
+	timpl->messages_in_progress = msg->next;
+	msg->next = NULL;
+
+	hxr_message_enqueue_(t, timpl, msg);
+}
+
+// Returns the message currently being built, or NULL if we aren't within
+// a HXR_BEGIN-HXR_END block (or its message couldn't be allocated).
+static inline hxr_feedback_message *hxr_message_in_progress_(hxr_thread_impl_ *timpl)
+{
+	if ( *hxr_message_alloc_failures_(timpl) > 0 )
+		return NULL;
+	return timpl->messages_in_progress;
+}
+
+void HXR(message_id)(hxr_thread *t, const char *id)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_SETTER);
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+	hxr_feedback_message *msg = hxr_message_in_progress_(timpl);
+	if ( msg == NULL )
+		return;
+
+	msg->id_handle = HXR(intern_message_id)(t, id);
+	if ( msg->id_handle != HXR_MSGID_NONE )
+		msg->id = HXR(msgid_string)(msg->id_handle);
+	else if ( id != NULL )
+		msg->id = hxr_message_strdup_(t, timpl, id);
+	else
+		msg->id = NULL;
+}
+
+void HXR(message_id_handle)(hxr_thread *t, hxr_msgid id)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_SETTER);
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+	hxr_feedback_message *msg = hxr_message_in_progress_(timpl);
+	if ( msg == NULL )
+		return;
+
+	msg->id_handle = id;
+	msg->id = HXR(msgid_string)(id);
+	if ( msg->id == NULL )
+		msg->id_handle = HXR_MSGID_NONE;
+}
+
+// Defines the plain, `_fmt`, and `_va` setters for one text field of
+// hxr_feedback_message. They're all the same except for the field name.
+#define HXR_DEFINE_MESSAGE_TEXT_SETTERS_(field) \
+	void HXR(field)(hxr_thread *t, const char *text) \
+	{ \
+		HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_SETTER); \
+		hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t); \
+		hxr_feedback_message *msg = hxr_message_in_progress_(timpl); \
+		if ( msg != NULL ) { \
+			hxr_message_text_init_(&msg->field); \
+			msg->field.text = hxr_message_strdup_(t, timpl, text); \
+		} \
+	} \
+	\
+	void HXR(field ## _va)(hxr_thread *t, const char *fmtstr, va_list vargs) \
+	{ \
+		HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_SETTER); \
+		hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t); \
+		hxr_feedback_message *msg = hxr_message_in_progress_(timpl); \
+		if ( msg != NULL ) \
+			hxr_message_text_set_va_(t, timpl, &msg->field, fmtstr, vargs); \
+	} \
+	\
+	void HXR(field ## _fmt)(hxr_thread *t, const char *fmtstr, ...) \
+	{ \
+		HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_WRAPPER); \
+		va_list vargs; \
+		va_start(vargs, fmtstr); \
+		HXR(field ## _va)(t, fmtstr, vargs); \
+		va_end(vargs); \
+	}
+
+HXR_DEFINE_MESSAGE_TEXT_SETTERS_(summary)
+HXR_DEFINE_MESSAGE_TEXT_SETTERS_(details)
+HXR_DEFINE_MESSAGE_TEXT_SETTERS_(suggestion)
+
+#undef HXR_DEFINE_MESSAGE_TEXT_SETTERS_
+
+uint32_t     HXR(message_type)(const hxr_feedback_message *msg)       { return HXR_MSG_TYPE_EXTRACT(msg->type_and_flags); }
+const char  *HXR(message_get_id)(const hxr_feedback_message *msg)     { return msg->id; }
+hxr_msgid    HXR(message_get_id_handle)(const hxr_feedback_message *msg) { return msg->id_handle; }
+
+const char  *HXR(message_summary)(hxr_thread *t, hxr_feedback_message *msg)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_GETTER);
+	return hxr_message_text_get_(t, HXR(thread_get_impl_)(t), &msg->summary);
+}
+
+const char  *HXR(message_details)(hxr_thread *t, hxr_feedback_message *msg)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_GETTER);
+	return hxr_message_text_get_(t, HXR(thread_get_impl_)(t), &msg->details);
+}
+
+const char  *HXR(message_suggestion)(hxr_thread *t, hxr_feedback_message *msg)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_GETTER);
+	return hxr_message_text_get_(t, HXR(thread_get_impl_)(t), &msg->suggestion);
+}
+
+const char  *HXR(message_stack_trace)(hxr_thread *t, hxr_feedback_message *msg)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_GETTER);
+#if HXR_STACK_TRACES_
+	return hxr_stack_render_(t, HXR(thread_get_impl_)(t), msg);
+#else
+	return NULL;
+#endif
+}
+
+size_t  HXR(error_count)(hxr_thread *t)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_GETTER);
+	return HXR(thread_get_impl_)(t)->error_count;
+}
+
+size_t  HXR(message_count)(hxr_thread *t)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_GETTER);
+	return HXR(thread_get_impl_)(t)->message_count;
+}
+
+size_t  HXR(clear_messages)(hxr_thread *t)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_NORMAL);
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+	size_t n_cleared = HXR(msg_count)(t);
+
+	timpl->queue_head      = 0;
+	timpl->queue_tail      = 0;
+	timpl->collapsed_count = 0;
+	timpl->collapsed_type  = 0;
+	timpl->message_count   = 0;
+	timpl->error_count     = 0;
+	timpl->dropped_count   = 0;
+	timpl->coalesced_count = 0;
+
+	// Nothing that was handed out has to be kept any more.
+	timpl->queue_generation     = 0;
+	timpl->retired_arena_pinned = 0;
+	timpl->message_arena_pinned = 0;
+
+	// Invalidates every coalescing table entry at once.
+	timpl->coalesce_generation++;
+	if ( timpl->coalesce_generation == 0 )
+		timpl->coalesce_generation = 1;
+
+	// Messages that are still being built live in the same arena, so we can
+	// only rewind it if there aren't any. (This only happens when
+	// `hxr_clear_messages` is called from within a HXR_BEGIN-HXR_END block;
+	// the memory will be reclaimed on the next call made outside of one.)
+	if ( timpl->messages_in_progress == NULL && timpl->message_alloc_failures == 0 ) {
+		hxr_arena_reset_(&timpl->message_arena);
+		hxr_arena_reset_(&timpl->retired_arena);
+	}
+
+	return n_cleared;
+}
+
+#if defined(HXR_EXTRACT_UNITTESTS) && (0 != HXR_EXTRACT_UNITTESTS)
+static void *hxr_message_test_no_alloc_(hxr_thread *t, size_t num_bytes)
+{
+	(void)t;
+	(void)num_bytes;
+	return NULL;
+}
+
+// Counts the chunks held by both of the thread's message arenas.
+static size_t hxr_message_arena_chunks_for_test_(hxr_thread *t)
+{
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+	const hxr_arena_chunk_ *chunk;
+	size_t n = 0;
+	for ( chunk = timpl->message_arena.first; chunk != NULL; chunk = chunk->next )
+		n++;
+	for ( chunk = timpl->retired_arena.first; chunk != NULL; chunk = chunk->next )
+		n++;
+	return n;
+}
+
+void HXR(message_queue_unittest)(hxr_thread *t_but_real)
+{
+	hxr_thread            t0;
+	hxr_thread            *t = &t0;
+	hxr_feedback_message  *msg;
+	size_t                i;
+
+	// ................................ //
+	hxr_thread_init_(t);
+	hxr_thread_set_queue_overflow_policy(t, HXR_QUEUE_OVERFLOW_COLLAPSE);
+	hxr_thread_set_message_coalescing(t, 0);
+
+	for ( i = 0; i < HXR_MESSAGE_QUEUE_CAPACITY + 10; i++ ) {
+		HXR_BEGIN_ERROR(t);
+			hxr_message_id(t, "storm");
+		HXR_END(t);
+	}
+
+	HXR_ASSERT( hxr_message_count(t),         ==, HXR_MESSAGE_QUEUE_CAPACITY + 10 );
+	HXR_ASSERT( hxr_error_count(t),           ==, HXR_MESSAGE_QUEUE_CAPACITY + 10 );
+	HXR_ASSERT( hxr_dropped_message_count(t), ==, 10 );
+	HXR_ASSERT( hxr_msg_count(t),             ==, HXR_MESSAGE_QUEUE_CAPACITY + 1 );
+
+	for ( i = 0; i < HXR_MESSAGE_QUEUE_CAPACITY; i++ )
+		hxr_msg_next(t, &msg);
+
+	do {
+		HXR_ASSERT_ELSE( hxr_msg_next(t, &msg) )                               break;
+		HXR_ASSERT_STR_ELSE( msg->id, ==, "message_queue_overflow" )           break;
+		HXR_ASSERT_ELSE( hxr_message_type(msg), ==, HXR_MSG_TYPE_ERROR )       break;
+		HXR_ASSERT_ELSE( hxr_msg_count(t), ==, 0 )                             break;
+	} while (0);
+
+	hxr_thread_free_(t);
+
+	// ................................ //
+	hxr_thread_init_(t);
+	hxr_thread_set_queue_overflow_policy(t, HXR_QUEUE_OVERFLOW_DROP_OLDEST);
+	hxr_thread_set_message_coalescing(t, 0);
+
+	HXR_BEGIN_INFO(t);
+		hxr_message_id(t, "first");
+	HXR_END(t);
+	for ( i = 0; i < HXR_MESSAGE_QUEUE_CAPACITY; i++ ) {
+		HXR_BEGIN_INFO(t);
+			hxr_message_id(t, "later");
+		HXR_END(t);
+	}
+
+	HXR_ASSERT( hxr_message_count(t),         ==, HXR_MESSAGE_QUEUE_CAPACITY + 1 );
+	HXR_ASSERT( hxr_error_count(t),           ==, 0 );
+	HXR_ASSERT( hxr_dropped_message_count(t), ==, 1 );
+	do {
+		HXR_ASSERT_ELSE( hxr_msg_count(t), ==, HXR_MESSAGE_QUEUE_CAPACITY ) break;
+		HXR_ASSERT_ELSE( hxr_msg_next(t, &msg) )                             break;
+		HXR_ASSERT_STR_ELSE( msg->id, ==, "later" )                          break;
+	} while (0);
+
+	hxr_thread_free_(t);
+
+	// ................................ //
+	// An error storm under DROP_OLDEST reuses the evicted messages' memory
+	// instead of growing the arena.
+	hxr_thread_init_(t);
+	hxr_thread_set_queue_overflow_policy(t, HXR_QUEUE_OVERFLOW_DROP_OLDEST);
+	hxr_thread_set_message_coalescing(t, 0);
+
+	size_t n_chunks = 0;
+	for ( i = 0; i < HXR_MESSAGE_QUEUE_CAPACITY * 10; i++ ) {
+		if ( i == HXR_MESSAGE_QUEUE_CAPACITY * 3 )
+			n_chunks = hxr_message_arena_chunks_for_test_(t);
+		HXR_BEGIN_ERROR(t);
+			hxr_message_id(t, "storm");
+			hxr_summary_fmt(t, "storm message %d", (int)(i / HXR_MESSAGE_QUEUE_CAPACITY));
+		HXR_END(t);
+	}
+
+	HXR_ASSERT( n_chunks, >, 0 );
+	HXR_ASSERT( hxr_message_arena_chunks_for_test_(t), ==, n_chunks );
+	HXR_ASSERT( hxr_dropped_message_count(t), ==, HXR_MESSAGE_QUEUE_CAPACITY * 9 );
+	do {
+		HXR_ASSERT_ELSE( hxr_msg_count(t), ==, HXR_MESSAGE_QUEUE_CAPACITY ) break;
+		HXR_ASSERT_ELSE( hxr_msg_next(t, &msg) )                             break;
+		HXR_ASSERT_STR_ELSE( hxr_message_summary(t, msg), ==, "storm message 9" ) break;
+	} while (0);
+
+	hxr_thread_free_(t);
+
+	// ................................ //
+	// DROP_NEWEST leaves nothing behind for a later COLLAPSE to report.
+	hxr_thread_init_(t);
+	hxr_thread_set_queue_overflow_policy(t, HXR_QUEUE_OVERFLOW_DROP_NEWEST);
+	hxr_thread_set_message_coalescing(t, 0);
+
+	for ( i = 0; i < HXR_MESSAGE_QUEUE_CAPACITY + 10; i++ ) {
+		HXR_BEGIN_ERROR(t);
+			hxr_message_id(t, "storm");
+		HXR_END(t);
+	}
+	hxr_thread_set_queue_overflow_policy(t, HXR_QUEUE_OVERFLOW_COLLAPSE);
+
+	HXR_ASSERT( hxr_dropped_message_count(t), ==, 10 );
+	HXR_ASSERT( hxr_msg_count(t),             ==, HXR_MESSAGE_QUEUE_CAPACITY );
+
+	hxr_thread_free_(t);
+
+	// ................................ //
+	// Coalescing: repeats from one callsite fold into the queued message
+	// until it is taken out of the queue.
+	hxr_thread_init_(t);
+
+	for ( i = 0; i < 3; i++ ) {
+		for ( size_t j = 0; j < 5; j++ ) {
+			HXR_BEGIN_WARNING(t);
+				hxr_message_id(t, "repeated");
+			HXR_END(t);
+		}
+		HXR_BEGIN_WARNING(t);
+			hxr_message_id(t, "repeated"); // Different callsite.
+		HXR_END(t);
+	}
+
+	HXR_ASSERT( hxr_message_count(t),         ==, 18 );
+	HXR_ASSERT( hxr_dropped_message_count(t), ==, 0 );
+	do {
+		HXR_ASSERT_ELSE( hxr_msg_count(t), ==, 2 )                           break;
+		HXR_ASSERT_ELSE( hxr_msg_next(t, &msg) )                             break;
+		HXR_ASSERT_ELSE( hxr_message_repeat_count(msg), ==, 15 )             break;
+		HXR_ASSERT_ELSE( hxr_message_first_time(msg), <=, hxr_message_last_time(msg) ) break;
+		HXR_ASSERT_ELSE( hxr_msg_next(t, &msg) )                             break;
+		HXR_ASSERT_ELSE( hxr_message_repeat_count(msg), ==, 3 )              break;
+	} while (0);
+
+	HXR_BEGIN_WARNING(t);
+		hxr_message_id(t, "repeated");
+	HXR_END(t);
+	do {
+		HXR_ASSERT_ELSE( hxr_msg_next(t, &msg) )                             break;
+		HXR_ASSERT_ELSE( hxr_message_repeat_count(msg), ==, 1 )              break;
+	} while (0);
+
+	// Interned ids compare by handle, and `HXR_MESSAGE_ID` agrees with
+	// `hxr_message_id` about which handle an id gets.
+	hxr_msgid id = hxr_intern_message_id(t, "repeated");
+	HXR_ASSERT( id, !=, HXR_MSGID_NONE );
+	HXR_ASSERT( id, ==, hxr_message_get_id_handle(msg) );
+	HXR_ASSERT( id, !=, hxr_intern_message_id(t, "repeated_not") );
+	HXR_ASSERT_STR( hxr_msgid_string(id), ==, "repeated" );
+	HXR_BEGIN_WARNING(t);
+		HXR_MESSAGE_ID(t, "repeated");
+	HXR_END(t);
+	do {
+		HXR_ASSERT_ELSE( hxr_msg_next(t, &msg) )                             break;
+		HXR_ASSERT_ELSE( hxr_message_get_id_handle(msg), ==, id )            break;
+	} while (0);
+
+	hxr_thread_free_(t);
+
+	// ................................ //
+	// An HXR_BEGIN that can't allocate its message leaves nothing for its
+	// HXR_END to pop, even if the block inside it gets a message.
+	hxr_thread_init_(t);
+	do {
+		hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+		hxr_allocator *allocator = timpl->allocator;
+		hxr_allocator failing = *allocator;
+		failing.allocate = &hxr_message_test_no_alloc_;
+
+		HXR(begin_test_debugf)();
+		timpl->allocator = &failing;
+		HXR_BEGIN_ERROR(t);
+			timpl->allocator = allocator;
+			HXR_BEGIN_WARNING(t);
+				hxr_message_id(t, "inner");
+			HXR_END(t);
+		HXR_END(t);
+		HXR(end_test_debugf)();
+
+		HXR_ASSERT_ELSE( hxr_debugf_count, ==, 1 )                           break;
+		HXR_ASSERT_ELSE( timpl->messages_in_progress == NULL )               break;
+		HXR_ASSERT_ELSE( timpl->message_alloc_failures, ==, 0 )              break;
+		HXR_ASSERT_ELSE( hxr_msg_count(t), ==, 1 )                           break;
+		HXR_ASSERT_ELSE( hxr_msg_next(t, &msg) )                             break;
+		HXR_ASSERT_STR_ELSE( msg->id, ==, "inner" )                          break;
+		HXR_ASSERT_ELSE( hxr_message_type(msg), ==, HXR_MSG_TYPE_WARNING )   break;
+	} while (0);
+
+	hxr_thread_free_(t);
+}
+
+void HXR(message_arena_unittest)(hxr_thread *t)
+{
+	hxr_arena_     arena;
+	hxr_allocator  allocator;
+	hxr_allocator_init_(&allocator);
+	hxr_arena_init_(&arena);
+
+	// First allocation creates the first chunk.
+	char *a = hxr_arena_alloc_(t, &arena, &allocator, 1);
+	HXR_ASSERT( a != NULL );
+	HXR_ASSERT( ((uintptr_t)a % HXR_ARENA_ALIGNMENT_), ==, 0 );
+	hxr_arena_chunk_ *first = arena.first;
+
+	// Subsequent small allocations are bumped out of the same chunk.
+	char *b = hxr_arena_alloc_(t, &arena, &allocator, 1);
+	HXR_ASSERT( b, ==, a + HXR_ARENA_ALIGNMENT_ );
+	HXR_ASSERT( arena.current, ==, first );
+
+	// Oversized allocations get their own chunk.
+	char *big = hxr_arena_alloc_(t, &arena, &allocator, HXR_MESSAGE_ARENA_CHUNK_SIZE * 3);
+	HXR_ASSERT( big != NULL );
+	HXR_ASSERT( arena.current != first );
+	HXR_ASSERT( arena.current->capacity, >=, HXR_MESSAGE_ARENA_CHUNK_SIZE * 3 );
+
+	// Reset rewinds to the start of the first chunk without freeing anything,
+	// and the retained chunks are reused afterwards.
+	hxr_arena_chunk_ *second = arena.current;
+	hxr_arena_reset_(&arena);
+	HXR_ASSERT( arena.current, ==, first );
+	HXR_ASSERT( hxr_arena_alloc_(t, &arena, &allocator, 1), ==, a );
+	hxr_arena_alloc_(t, &arena, &allocator, HXR_MESSAGE_ARENA_CHUNK_SIZE);
+	HXR_ASSERT( arena.current, ==, second );
+
+	hxr_arena_free_(t, &arena, &allocator);
+	HXR_ASSERT( arena.first == NULL );
+}
+
+static char *hxr_scratch_format_for_test_(
+	hxr_thread *t,  hxr_scratch_ *scratch,  hxr_allocator *allocator,  size_t *len,  const char *fmtstr, ...)
+{
+	va_list vargs;
+	va_start(vargs, fmtstr);
+	char *result = hxr_scratch_vformat_(t, scratch, allocator, fmtstr, vargs, len);
+	va_end(vargs);
+	return result;
+}
+
+void HXR(format_scratch_unittest)(hxr_thread *t)
+{
+	hxr_scratch_   scratch;
+	hxr_allocator  allocator;
+	size_t         len;
+	hxr_allocator_init_(&allocator);
+	hxr_scratch_init_(&scratch);
+
+	char *a = hxr_scratch_format_for_test_(t, &scratch, &allocator, &len, "%s %d", "abc", 42);
+	HXR_ASSERT_STR( a, ==, "abc 42" );
+	HXR_ASSERT( len, ==, 6 );
+	HXR_ASSERT( a, ==, scratch.buf );
+
+	// While it's in use, nested formatting gets a buffer of its own.
+	char *b = hxr_scratch_format_for_test_(t, &scratch, &allocator, &len, "%d", 7);
+	HXR_ASSERT_STR( b, ==, "7" );
+	HXR_ASSERT( b != a );
+	hxr_scratch_release_(t, &scratch, &allocator, b);
+	hxr_scratch_release_(t, &scratch, &allocator, a);
+
+	// Long text grows the buffer by doubling, and it is reused afterwards.
+	char *c = hxr_scratch_format_for_test_(t, &scratch, &allocator, &len,
+		"%0*d", (int)(HXR_SCRATCH_INITIAL_SIZE_ * 3), 1);
+	HXR_ASSERT( len, ==, HXR_SCRATCH_INITIAL_SIZE_ * 3 );
+	HXR_ASSERT( scratch.capacity, ==, HXR_SCRATCH_INITIAL_SIZE_ * 4 );
+	hxr_scratch_release_(t, &scratch, &allocator, c);
+	char *d = hxr_scratch_format_for_test_(t, &scratch, &allocator, &len, "%s", "short");
+	HXR_ASSERT( d, ==, c );
+	hxr_scratch_release_(t, &scratch, &allocator, d);
+
+	hxr_scratch_free_(t, &scratch, &allocator);
+	HXR_ASSERT( scratch.buf == NULL );
+}
+#endif
+
+// -------------------------------------
+
+// ===== Text Scanning : hxr_scan_* =====
+// Finds the length of a string and where its line endings are, in one pass.
+// Laying out multi-line text (ex: `hxr_get_text_placement_info_`, line
+// prefixing, word wrapping) needs all three, and doing them separately
+// means reading every message several times.
+//
+// On x86 with SSE2 (all x86-64 CPUs), 16 bytes are compared against '\0' and
+// '\n' at once, or 32 with AVX2 when the CPU has it (checked once, at
+// startup). Loads are aligned, so a load never crosses into a page that the
+// string doesn't touch, even though it can read past the terminator. That is
+// the usual trick for vectorized strlen; AddressSanitizer doesn't know it's
+// safe, so those functions aren't instrumented.
+//
+// `hxr_scan_bytes_` does the same for text whose length is already known
+// (ex: one fragment of a message being prefixed line by line). It never
+// reads past the end, so it doesn't need any of that.
+
+typedef struct S_HXR__TEXT_SCAN
+{
+	size_t  length;
+	size_t  newline_count;       // All of them, even past `positions_capacity`.
+	size_t  *positions;          // Offsets of the first `positions_capacity`
+	size_t  positions_capacity;  //   newlines, in order. Can be NULL and 0.
+} hxr_text_scan_;
+
+static void hxr_scan_text_portable_(const char *text, hxr_text_scan_ *scan)
+{
+	size_t i = 0;
+	for ( ; text[i] != '\0'; i++ )
+	{
+		if ( text[i] != '\n' )
+			continue;
+		if ( scan->newline_count < scan->positions_capacity )
+			scan->positions[scan->newline_count] = i;
+		scan->newline_count++;
+	}
+	scan->length = i;
+}
+
+static void hxr_scan_bytes_portable_(const char *text, size_t len, hxr_text_scan_ *scan)
+{
+	for ( size_t i = 0; i < len; i++ )
+	{
+		if ( text[i] != '\n' )
+			continue;
+		if ( scan->newline_count < scan->positions_capacity )
+			scan->positions[scan->newline_count] = i;
+		scan->newline_count++;
+	}
+	scan->length = len;
+}
+
+#if HXR_ENABLE_SIMD && (defined(__GNUC__) || defined(__clang__)) && defined(__SSE2__)
+#define HXR_SCAN_HAVE_SSE2_ (1)
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#if defined(__has_feature)
+#	if __has_feature(address_sanitizer)
+#		define HXR_SCAN_NO_ASAN_  __attribute__((no_sanitize_address))
+#	endif
+#elif defined(__SANITIZE_ADDRESS__)
+#	define HXR_SCAN_NO_ASAN_  __attribute__((no_sanitize_address))
+#endif
+#ifndef HXR_SCAN_NO_ASAN_
+#	define HXR_SCAN_NO_ASAN_
+#endif
+
+// Records the newlines marked in `mask` (bit i = `base` + i).
+static inline void hxr_scan_record_(hxr_text_scan_ *scan, size_t base, uint32_t mask)
+{
+	while ( mask != 0 )
+	{
+		size_t n = scan->newline_count++;
+		if ( n < scan->positions_capacity )
+			scan->positions[n] = base + (size_t)__builtin_ctz(mask);
+		else {
+			// No room left; just count the rest.
+			scan->newline_count += (size_t)__builtin_popcount(mask & (mask - 1));
+			return;
+		}
+		mask &= mask - 1;
+	}
+}
+
+HXR_SCAN_NO_ASAN_
+static void hxr_scan_text_sse2_(const char *text, hxr_text_scan_ *scan)
+{
+	const __m128i  newline = _mm_set1_epi8('\n');
+	const __m128i  zero    = _mm_setzero_si128();
+	const char     *block  = (const char*)((uintptr_t)text & ~(uintptr_t)15);
+
+	// Ignore whatever comes before `text` in the first block.
+	uint32_t  keep = ~(uint32_t)0 << (text - block);
+	for (;;)
+	{
+		__m128i   v  = _mm_load_si128((const __m128i*)block);
+		uint32_t  zm = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero))    & keep;
+		uint32_t  nm = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)) & keep;
+		size_t    base = (size_t)(block - text);
+		if ( zm != 0 ) {
+			uint32_t end = (uint32_t)__builtin_ctz(zm);
+			hxr_scan_record_(scan, base, nm & ((1u << end) - 1));
+			scan->length = base + end;
+			return;
+		}
+		hxr_scan_record_(scan, base, nm);
+		block += 16;
+		keep = ~(uint32_t)0;
+	}
+}
+
+__attribute__((target("avx2"))) HXR_SCAN_NO_ASAN_
+static void hxr_scan_text_avx2_(const char *text, hxr_text_scan_ *scan)
+{
+	const __m256i  newline = _mm256_set1_epi8('\n');
+	const __m256i  zero    = _mm256_setzero_si256();
+	const char     *block  = (const char*)((uintptr_t)text & ~(uintptr_t)31);
+
+	uint32_t  keep = ~(uint32_t)0 << (text - block);
+	for (;;)
+	{
+		__m256i   v  = _mm256_load_si256((const __m256i*)block);
+		uint32_t  zm = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero))    & keep;
+		uint32_t  nm = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline)) & keep;
+		size_t    base = (size_t)(block - text);
+		if ( zm != 0 ) {
+			uint32_t end = (uint32_t)__builtin_ctz(zm);
+			hxr_scan_record_(scan, base, nm & ((1u << end) - 1));
+			scan->length = base + end;
+			return;
+		}
+		hxr_scan_record_(scan, base, nm);
+		block += 32;
+		keep = ~(uint32_t)0;
+	}
+}
+
+static void hxr_scan_bytes_sse2_(const char *text, size_t len, hxr_text_scan_ *scan)
+{
+	const __m128i  newline = _mm_set1_epi8('\n');
+	size_t i = 0;
+	for ( ; i + 16 <= len; i += 16 ) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(text + i));
+		hxr_scan_record_(scan, i, (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)));
+	}
+	for ( ; i < len; i++ )
+		if ( text[i] == '\n' )
+			hxr_scan_record_(scan, i, 1);
+	scan->length = len;
+}
+
+__attribute__((target("avx2")))
+static void hxr_scan_bytes_avx2_(const char *text, size_t len, hxr_text_scan_ *scan)
+{
+	const __m256i  newline = _mm256_set1_epi8('\n');
+	size_t i = 0;
+	for ( ; i + 32 <= len; i += 32 ) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(text + i));
+		hxr_scan_record_(scan, i, (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline)));
+	}
+	for ( ; i < len; i++ )
+		if ( text[i] == '\n' )
+			hxr_scan_record_(scan, i, 1);
+	scan->length = len;
+}
+#else
+#define HXR_SCAN_HAVE_SSE2_ (0)
+#endif
+
+static void (*hxr_scan_text_impl_)(const char *text, hxr_text_scan_ *scan) = &hxr_scan_text_portable_;
+static void (*hxr_scan_bytes_impl_)(const char *text, size_t len, hxr_text_scan_ *scan) = &hxr_scan_bytes_portable_;
+
+static void hxr_scan_module_init_()
+{
+#if HXR_SCAN_HAVE_SSE2_
+	hxr_scan_text_impl_  = &hxr_scan_text_sse2_;
+	hxr_scan_bytes_impl_ = &hxr_scan_bytes_sse2_;
+	__builtin_cpu_init();
+	if ( __builtin_cpu_supports("avx2") ) {
+		hxr_scan_text_impl_  = &hxr_scan_text_avx2_;
+		hxr_scan_bytes_impl_ = &hxr_scan_bytes_avx2_;
+	}
+#endif
+}
+
+// Scans `text`, filling in `scan->length` and `scan->newline_count`, and
+// the first `positions_capacity` entries of `positions`.
+static void hxr_scan_text_(hxr_thread *t, const char *text, hxr_text_scan_ *scan, size_t *positions, size_t positions_capacity)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+	scan->length             = 0;
+	scan->newline_count      = 0;
+	scan->positions          = positions;
+	scan->positions_capacity = positions != NULL ? positions_capacity : 0;
+	hxr_scan_text_impl_(text, scan);
+}
+
+// Same as `hxr_scan_text_`, for the `len` bytes at `text`.
+static void hxr_scan_bytes_(hxr_thread *t, const char *text, size_t len, hxr_text_scan_ *scan, size_t *positions, size_t positions_capacity)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+	scan->length             = 0;
+	scan->newline_count      = 0;
+	scan->positions          = positions;
+	scan->positions_capacity = positions != NULL ? positions_capacity : 0;
+	hxr_scan_bytes_impl_(text, len, scan);
+}
+
+#if defined(HXR_EXTRACT_UNITTESTS) && (0 != HXR_EXTRACT_UNITTESTS)
+void HXR(text_scan_unittest)(hxr_thread *t)
+{
+	// Every starting alignment and every terminator position within a couple
+	// of SIMD blocks, checked against the portable scanner.
+	char    buf[160];
+	size_t  positions[8];
+	size_t  expected_positions[8];
+
+	for ( size_t start = 0; start < 64; start++ )
+	for ( size_t len = 0; len < 96; len++ )
+	{
+		char *text = buf + start;
+		for ( size_t i = 0; i < len; i++ )
+			text[i] = (i % 7 == 3 || i % 11 == 0) ? '\n' : 'x';
+		text[len] = '\0';
+
+		hxr_text_scan_ expected;
+		expected.length             = 0;
+		expected.newline_count      = 0;
+		expected.positions          = expected_positions;
+		expected.positions_capacity = 8;
+		hxr_scan_text_portable_(text, &expected);
+
+		hxr_text_scan_ scan;
+		hxr_scan_text_(t, text, &scan, positions, 8);
+		HXR_ASSERT_ELSE( scan.length, ==, len )                                   break;
+		HXR_ASSERT_ELSE( scan.newline_count, ==, expected.newline_count )         break;
+		size_t n = scan.newline_count < 8 ? scan.newline_count : 8;
+		for ( size_t i = 0; i < n; i++ )
+			HXR_ASSERT_ELSE( positions[i], ==, expected_positions[i] )            break;
+
+		hxr_scan_bytes_(t, text, len, &scan, positions, 8);
+		HXR_ASSERT_ELSE( scan.length, ==, len )                                   break;
+		HXR_ASSERT_ELSE( scan.newline_count, ==, expected.newline_count )         break;
+		for ( size_t i = 0; i < n; i++ )
+			HXR_ASSERT_ELSE( positions[i], ==, expected_positions[i] )            break;
+	}
+}
+#endif
+
+typedef struct S_HXR__TEXT_PLACEMENT_INFO
+{
+	char need_newline_before;
+	char need_newline_after;
+
+	size_t length;
+	size_t newline_count;  // Not counting a line ending at the very end.
+
+} hxr_text_placement_info_;
+
+static void hxr_get_text_placement_info_(
+		hxr_thread *t,  hxr_text_placement_info_ *result,  const char *text)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+
+	hxr_text_scan_ scan;
+	hxr_scan_text_(t, text, &scan, NULL, 0);
+	size_t newline_count = scan.newline_count;
+	size_t len = scan.length;
+
+	char newline_after = '\n';
+	if ( len > 0 && text[len-1] == '\n' ) {
+		newline_after = '\0'; // Don't put a redundant line ending.
+		newline_count--; // The last one doesn't count.
+	}
+
+	char newline_before = '\0';
+	if ( newline_count > 0 )
+		newline_before = '\n';
+
+	result->need_newline_before = newline_before;
+	result->need_newline_after  = newline_after;
+	result->length              = len;
+	result->newline_count       = newline_count;
+}
+
+// ===== Stream Structure : hxr_stream_ =====
+/// Very simple internal-use stream object that allows output-writing code
+/// to have less code duplication.
+
+#include <stdarg.h>
+
+// One fragment of a `write_iov` call. This isn't `struct iovec` because that
+// is only available on POSIX systems.
+typedef struct S_HXR__IOVEC
+{
+	const char  *base;   // Doesn't need to be null-terminated.
+	size_t      len;
+} hxr_iovec_;
+
+typedef struct S_HXR__STREAM_VTBL
+{
+	ssize_t (write_line*)  (hxr_thread*, hxr_stream*, const char* text);
+	ssize_t (write_text*)  (hxr_thread*, hxr_stream*, const char* text);
+	ssize_t (write_fmtstr*)(hxr_thread*, hxr_stream*, const char* fmtstr, va_list);
+
+	// Writes `iov_count` fragments as if they were one string. This lets
+	// callers pass along prefixes, ids, and message text where they already
+	// are, instead of gluing them together first or making a call for each.
+	ssize_t (*write_iov)(hxr_thread*, hxr_stream_*, const hxr_iovec_ *iov, size_t iov_count);
+
+	// Optional. Streams that can store a message more cheaply than as text
+	// (ex: `hxr_binlog_*`) set this. When it is NULL, `hxr_send_message_`
+	// renders the message through the functions above instead.
+	ssize_t (*write_message)(hxr_thread*, hxr_stream_*, hxr_feedback_message*);
+} hxr_stream_vtbl_;
+
+typedef struct S_HXR__STREAM
+{
+	void                  *impl;
+	hxr_stream_vtbl_      *vtable;
+	hxr_source_location_  init_loc;
+	hxr_source_location_  final_loc;
+} hxr_stream_;
+
+// The canary stream (defined further down) is used to represent an abstract
+// stream's default state of "I'm not programmed to do ANYTHING". This allows
+// some programming mistakes to turn into error messages instead of segfaults.
+static ssize_t canary_stream_write_line(hxr_thread* t,  hxr_stream_* stream,  const char* text);
+static ssize_t canary_stream_write_text(hxr_thread* t,  hxr_stream_* stream,  const char* text);
+static ssize_t canary_stream_write_fmtstr(hxr_thread* t,  hxr_stream_* stream,  const char* fmtstr, va_list vargs);
+static ssize_t canary_stream_write_iov(hxr_thread* t,  hxr_stream_* stream,  const hxr_iovec_ *iov, size_t iov_count);
+
+static hxr_stream_vtbl_  hxr_canary_stream_vtbl_;
+
+static void hxr_stream_module_init_()
+{
+	hxr_canary_stream_vtbl_.write_line   = &canary_stream_write_line;
+	hxr_canary_stream_vtbl_.write_text   = &canary_stream_write_text;
+	hxr_canary_stream_vtbl_.write_fmtstr = &canary_stream_write_fmtstr;
+	hxr_canary_stream_vtbl_.write_iov    = &canary_stream_write_iov;
+	hxr_canary_stream_vtbl_.write_message = NULL;
+}
+
+static void hxr_stream_init_(hxr_thread *t, hxr_stream_ *stream, hxr_source_location_ loc)
+{
+	stream->init_loc  = loc;
+	stream->final_loc = hxr_make_source_loc_("N/A", "N/A", 0);
+	stream->vtable    = &hxr_canary_stream_vtbl_;
+	stream->impl      = NULL;
+}
+
+void hxr_stream_finalize_(hxr_thread *t, hxr_stream_ *stream, hxr_source_location_ loc)
+{
+	stream->final_loc = loc;
+	stream->vtable    = &hxr_canary_stream_vtbl_;
+	stream->impl      = NULL;
+}
+
+// ===== Stream Interface : hxr_stream_* =====
+
+static ssize_t stream_write_line(hxr_thread* t,  hxr_stream_* stream,  const char* text) {
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_WRAPPER);
+	return stream->vtable->write_line(t, stream, text);
+}
+
+static ssize_t stream_write_text(hxr_thread* t,  hxr_stream_* stream,  const char* text) {
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_WRAPPER);
+	return stream->vtable->write_text(t, stream, text);
+}
+
+static ssize_t stream_write_text_fmt(hxr_thread* t,  hxr_stream_* stream,  const char* fmtstr, ...) {
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_WRAPPER);
+	va_list vargs;
+	va_start(vargs, fmtstr);
+	ssize_t rc = stream->vtable->write_fmtstr(t, stream, fmtstr, vargs);
+	va_end(vargs);
+	return rc;
+}
+
+static ssize_t stream_write_text_fmt_va(hxr_thread* t,  hxr_stream_* stream,  const char* fmtstr, va_list vargs) {
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_WRAPPER);
+	return stream->vtable->write_fmtstr(t, stream, fmtstr, vargs);
+}
+
+static ssize_t stream_write_iov(hxr_thread* t,  hxr_stream_* stream,  const hxr_iovec_ *iov, size_t iov_count) {
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_WRAPPER);
+	return stream->vtable->write_iov(t, stream, iov, iov_count);
+}
+
+// ===== Canary Stream : canary_stream_* =====
+// This is used to raise errors whenever a finalized stream is used.
+
+static ssize_t canary_stream_write_line(hxr_thread* t,  hxr_stream_* stream,  const char* text)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+
+	hxr_source_location_  init_loc  = stream->init_loc;
+	hxr_source_location_  final_loc = stream->final_loc;
+
+	HXR_BEGIN_ERROR(t);
+		hxr_message_id(t, "canary_stream_write_line");
+		hxr_summary(t, "write_line() called on an expired stream.");
+		hxr_details_fmt(t,
+			"This stream was initialized in file \"%s\", function \"%s\", and line %zd. "
+			"The stream was finalized in file \"%s\", function \"%s\", and line %zd. "
+			"The text that was to be printed is as follows: \"%s\"",
+			init_loc.file,  init_loc.func,  init_loc.line,
+			final_loc.file, final_loc.func, final_loc.line,
+			text);
+	HXR_END(t);
+
+	return -1;
+}
+
+static ssize_t canary_stream_write_text(hxr_thread* t,  hxr_stream_* stream,  const char* text)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_source_location_  init_loc  = stream->init_loc;
+	hxr_source_location_  final_loc = stream->final_loc;
+
+	hxr_text_placement_info_  tp;
+	hxr_get_text_placement_info_(t, &tp, text);
+
+	HXR_BEGIN_ERROR(t);
+		hxr_message_id(t, "canary_stream_write_text");
+		hxr_summary(t, "write_line() called on an expired stream.");
+		hxr_details_fmt(t,
+			"This stream was initialized in file \"%s\", function \"%s\", and line %zd. "
+			"The stream was finalized in file \"%s\", function \"%s\", and line %zd. "
+			"The text that was to be printed is as follows: %c%s%c",
+			init_loc.file,  init_loc.func,  init_loc.line,
+			final_loc.file, final_loc.func, final_loc.line,
+			tp.need_newline_before, text, tp.need_newline_after);
+	HXR_END(t);
+
+	return -1;
+}
+
+static ssize_t canary_stream_write_fmtstr(hxr_thread* t,  hxr_stream_* stream,  const char* fmtstr, va_list vargs)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+	hxr_source_location_  init_loc  = stream->init_loc;
+	hxr_source_location_  final_loc = stream->final_loc;
+
+	size_t len;
+	char *formatted = hxr_scratch_vformat_(t, &timpl->format_scratch, timpl->allocator, fmtstr, vargs, &len);
+	const char *finalstr = formatted != NULL ? formatted : "(formatting failed)";
+
+	hxr_text_placement_info_  tp_raw;
+	hxr_text_placement_info_  tp_fmt;
+	hxr_get_text_placement_info_(t, &tp_raw, fmtstr);
+	hxr_get_text_placement_info_(t, &tp_fmt, finalstr);
+
+	HXR_BEGIN_ERROR(t);
+		hxr_message_id(t, "canary_stream_write_fmtstr");
+		hxr_summary(t, "write_line() called on an expired stream.");
+		hxr_details_fmt(t,
+			"This stream was initialized in file \"%s\", function \"%s\", and line %zd. "
+			"The stream was finalized in file \"%s\", function \"%s\", and line %zd. "
+			"The format string that was to be printed is as follows: %c%s%c\n"
+			"The resulting text after formatting is: %c%s%c",
+			init_loc.file,  init_loc.func,  init_loc.line,
+			final_loc.file, final_loc.func, final_loc.line,
+			tp_raw.need_newline_before, fmtstr,   tp_raw.need_newline_after,
+			tp_fmt.need_newline_before, finalstr, tp_fmt.need_newline_after);
+	HXR_END(t);
+
+	hxr_scratch_release_(t, &timpl->format_scratch, timpl->allocator, formatted);
+	return -1;
+}
+
+static ssize_t canary_stream_write_iov(hxr_thread* t,  hxr_stream_* stream,  const hxr_iovec_ *iov, size_t iov_count)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_source_location_  init_loc  = stream->init_loc;
+	hxr_source_location_  final_loc = stream->final_loc;
+
+	size_t total = 0;
+	for ( size_t i = 0; i < iov_count; i++ )
+		total += iov[i].len;
+
+	HXR_BEGIN_ERROR(t);
+		hxr_message_id(t, "canary_stream_write_iov");
+		hxr_summary(t, "write_iov() called on an expired stream.");
+		hxr_details_fmt(t,
+			"This stream was initialized in file \"%s\", function \"%s\", and line %zd. "
+			"The stream was finalized in file \"%s\", function \"%s\", and line %zd. "
+			"%zd bytes of text in %zd fragments were to be printed. The first fragment is: \"%.*s\"",
+			init_loc.file,  init_loc.func,  init_loc.line,
+			final_loc.file, final_loc.func, final_loc.line,
+			total, iov_count,
+			iov_count > 0 ? (int)iov[0].len : 0, iov_count > 0 ? iov[0].base : "");
+	HXR_END(t);
+
+	return -1;
+}
+
+// ===== File Stream : fstream_* =====
+
+#ifdef HXR_ENABLE_FILE_IO
+#include <stdio.h>
+
+static ssize_t fstream_write_line(hxr_thread* t,  hxr_stream_* stream,  const char* text) {
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	FILE *fd = stream->impl;
+	int rc = fprintf(fd, "%s\n", text);
+	if ( rc < 0 )
+		return -1;
+	else
+		return rc;
+}
+
+static ssize_t fstream_write_text(hxr_thread* t,  hxr_stream_* stream,  const char* text) {
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	FILE *fd = stream->impl;
+	int rc = fprintf(fd, "%s", text);
+	if ( rc < 0 )
+		return -1;
+	else
+		return rc;
+}
+
+static ssize_t fstream_write_fmtstr(hxr_thread* t,  hxr_stream_* stream,  const char* text, va_list vargs) {
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	FILE *fd = stream->impl;
+	int rc = fprintf(fd, fmtstr, vargs);
+	if ( rc < 0 )
+		return -1;
+	else
+		return rc;
+}
+
+static ssize_t fstream_write_iov(hxr_thread* t,  hxr_stream_* stream,  const hxr_iovec_ *iov, size_t iov_count) {
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	FILE *fd = stream->impl;
+	ssize_t total = 0;
+
+	// Taking the lock once for all of the fragments is cheaper than letting
+	// every `fwrite` take it, and keeps other threads' output from landing
+	// in the middle.
+#if defined(__unix__) || defined(__APPLE__)
+	flockfile(fd);
+#endif
+	for ( size_t i = 0; i < iov_count; i++ ) {
+		if ( iov[i].len > 0 && fwrite(iov[i].base, 1, iov[i].len, fd) != iov[i].len ) {
+			total = -1;
+			break;
+		}
+		total += iov[i].len;
+	}
+#if defined(__unix__) || defined(__APPLE__)
+	funlockfile(fd);
+#endif
+	return total;
+}
+
+static hxr_stream_vtbl_  hxr_fstream_vtbl_;
+
+static void fstream_module_init()
+{
+	hxr_fstream_vtbl_.write_line   = &fstream_write_line;
+	hxr_fstream_vtbl_.write_text   = &fstream_write_text;
+	hxr_fstream_vtbl_.write_fmtstr = &fstream_write_fmtstr;
+	hxr_fstream_vtbl_.write_iov    = &fstream_write_iov;
+	hxr_fstream_vtbl_.write_message = NULL;
+}
+
+void fstream_init(hxr_thread *t, hxr_stream_ *stream, hxr_source_location_ loc)
+{
+	hxr_stream_init_(t, stream, loc);
+	stream->vtable = &hxr_fstream_vtbl_;
+	stream->impl   = stdout;
+}
+
+#define FSTREAM_INIT(t, stream) \
+	(fstream_init(t, stream, HXR_SOURCE_LOCATION_HERE_))
+
+void fstream_set_fd(hxr_thread *t, hxr_stream_ *stream, FILE *fd)
+{
+	stream->impl = fd;
+}
+
+void fstream_finalize(hxr_thread *t, hxr_stream_ *stream, hxr_source_location_ loc)
+{
+	hxr_stream_finalize_(t, stream, loc);
+}
+
+#define FSTREAM_FINALIZE(t, stream) \
+	(fstream_finalize(t, stream, HXR_SOURCE_LOCATION_HERE_))
+
+#endif // HXR_ENABLE_FILE_IO
+
+// ===== Message Rendering : hxr_send_message_ =====
+
+static const char *hxr_message_type_name_(uint32_t type_and_flags)
+{
+	switch ( HXR_MSG_TYPE_EXTRACT(type_and_flags) )
+	{
+		case HXR_MSG_TYPE_INFO:    return "info";
+		case HXR_MSG_TYPE_WARNING: return "warning";
+		case HXR_MSG_TYPE_ERROR:   return "error";
+		default:                   return "message";
+	}
+}
+
+// Enough fragments for every piece of the longest possible message.
+#define HXR_SEND_MAX_IOV_  (23)
+
+typedef struct S_HXR__SEND_IOV
+{
+	hxr_iovec_  iov[HXR_SEND_MAX_IOV_];
+	size_t      count;
+} hxr_send_iov_;
+
+static void hxr_send_add_(hxr_send_iov_ *out, const char *base, size_t len)
+{
+	if ( len == 0 )
+		return;
+	out->iov[out->count].base = base;
+	out->iov[out->count].len  = len;
+	out->count++;
+}
+
+#define HXR_SEND_ADD_LITERAL_(out, literal) \
+	(hxr_send_add_((out), (literal), sizeof(literal) - 1))
+
+static size_t hxr_send_add_str_(hxr_send_iov_ *out, const char *text)
+{
+	size_t len = 0;
+	while ( text[len] != '\0' )
+		len++;
+	hxr_send_add_(out, text, len);
+	return len;
+}
+
+// Writes `value` in decimal so that it ends just before `end`.
+// Returns: where the digits start. `end` needs 20 bytes before it (21 if
+// `value` can be negative).
+static char *hxr_send_decimal_(char *end, int64_t value)
+{
+	uint64_t magnitude = value < 0 ? (uint64_t)0 - (uint64_t)value : (uint64_t)value;
+	char *p = end;
+	do {
+		*--p = (char)('0' + magnitude % 10);
+		magnitude /= 10;
+	} while ( magnitude != 0 );
+	if ( value < 0 )
+		*--p = '-';
+	return p;
+}
+
+// Adds `text` as a section on its own line(s), with a line ending if
+// `text` doesn't already have one.
+static void hxr_send_section_(hxr_send_iov_ *out, const char *label, const char *text)
+{
+	if ( text == NULL || text[0] == '\0' )
+		return;
+	hxr_send_add_str_(out, label);
+	size_t len = hxr_send_add_str_(out, text);
+	if ( text[len-1] != '\n' )
+		HXR_SEND_ADD_LITERAL_(out, "\n");
+}
+
+static ssize_t hxr_format_write_(hxr_thread *t, hxr_stream_ *stream, const hxr_message_format *fmt,
+	hxr_feedback_message *msg, const hxr_iovec_ *iov, size_t iov_count);
+
+// Renders `msg` as text and writes it with one `write_iov` call:
+//
+//     file:line: type: summary [id] (repeated N times)
+//     details
+//     Suggestion: suggestion
+//
+// followed by the stack trace of an error (see `hxr_stack_*`), where the
+// id, repeat count, details, suggestion, and stack trace only appear if the
+// message has them. Nothing is copied except the two numbers. If `fmt` isn't
+// NULL, its prefixes are put in front of the lines (see `hxr_format_write_`),
+// which can take more than one `write_iov` call.
+// Keep hxr-binlog-decode.c in sync with this.
+static ssize_t hxr_send_message_formatted_(hxr_thread *t, hxr_stream_ *stream,
+	hxr_feedback_message *msg, const hxr_message_format *fmt)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+	const char *summary    = hxr_message_text_get_(t, timpl, &msg->summary);
+	const char *details    = hxr_message_text_get_(t, timpl, &msg->details);
+	const char *suggestion = hxr_message_text_get_(t, timpl, &msg->suggestion);
+#if HXR_STACK_TRACES_
+	const char *stack      = hxr_stack_render_(t, timpl, msg);
+#endif
+
+	char line_buf[24];
+	char repeat_buf[24];
+	char *line_end   = line_buf + sizeof(line_buf);
+	char *repeat_end = repeat_buf + sizeof(repeat_buf);
+
+	hxr_send_iov_ out;
+	out.count = 0;
+	hxr_send_add_str_(&out, msg->loc.file);
+	HXR_SEND_ADD_LITERAL_(&out, ":");
+	char *line = hxr_send_decimal_(line_end, (int64_t)msg->loc.line);
+	hxr_send_add_(&out, line, (size_t)(line_end - line));
+	HXR_SEND_ADD_LITERAL_(&out, ": ");
+	hxr_send_add_str_(&out, hxr_message_type_name_(msg->type_and_flags));
+	HXR_SEND_ADD_LITERAL_(&out, ": ");
+	hxr_send_add_str_(&out, summary != NULL ? summary : "(no summary)");
+	if ( msg->id != NULL ) {
+		HXR_SEND_ADD_LITERAL_(&out, " [");
+		hxr_send_add_str_(&out, msg->id);
+		HXR_SEND_ADD_LITERAL_(&out, "]");
+	}
+	if ( msg->repeat_count > 1 ) {
+		char *repeat = hxr_send_decimal_(repeat_end, (int64_t)msg->repeat_count);
+		HXR_SEND_ADD_LITERAL_(&out, " (repeated ");
+		hxr_send_add_(&out, repeat, (size_t)(repeat_end - repeat));
+		HXR_SEND_ADD_LITERAL_(&out, " times)");
+	}
+	HXR_SEND_ADD_LITERAL_(&out, "\n");
+	hxr_send_section_(&out, "", details);
+	hxr_send_section_(&out, "Suggestion: ", suggestion);
+#if HXR_STACK_TRACES_
+	hxr_send_section_(&out, "Stack trace:\n", stack);
+#endif
+
+	if ( fmt != NULL )
+		return hxr_format_write_(t, stream, fmt, msg, out.iov, out.count);
+	return stream_write_iov(t, stream, out.iov, out.count);
+}
+
+// Renders `msg` with the thread's message format.
+static ssize_t hxr_send_message_text_(hxr_thread *t, hxr_stream_ *stream, hxr_feedback_message *msg)
+{
 	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_WRAPPER);
+	return hxr_send_message_formatted_(t, stream, msg, HXR(thread_get_impl_)(t)->msg_format);
+}
+
+// Sends `msg` to `stream`. Streams that handle messages themselves
+// (`write_message`) get the message as-is. Everything else gets it rendered
+// by `hxr_send_message_text_`.
+static ssize_t hxr_send_message_(hxr_thread *t, hxr_stream_ *stream, hxr_feedback_message *msg)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	if ( stream->vtable->write_message != NULL )
+		return stream->vtable->write_message(t, stream, msg);
+	return hxr_send_message_text_(t, stream, msg);
+}
+
+// ===== Message Format : hxr_format_* =====
+// A message format says what goes in front of each line of a message that
+// is printed as text (see `hxr_message_format` in hexer.h). The spec strings
+// are compiled once, by `hxr_message_format_compile`, into a short program
+// for each kind of line:
+//
+//     "%T %e[%p] "  ->  TIME, LITERAL(" "), EXE, LITERAL("["), PID, LITERAL("] "), END
+//
+// Runs of literal text are kept in one pool and copied as they are. When a
+// message is printed, each program is run once to build that message's three
+// prefixes, and `hxr_format_write_` then only stitches prefixes and lines
+// together: the spec is never looked at again, and nothing is rendered per line.
+
+#define HXR_FORMAT_OP_END       (0)
+#define HXR_FORMAT_OP_LITERAL   (1)
+#define HXR_FORMAT_OP_DATE      (2)
+#define HXR_FORMAT_OP_TIME      (3)
+#define HXR_FORMAT_OP_DATETIME  (4)
+#define HXR_FORMAT_OP_HOSTNAME  (5)
+#define HXR_FORMAT_OP_PID       (6)
+#define HXR_FORMAT_OP_UID       (7)
+#define HXR_FORMAT_OP_GID       (8)
+#define HXR_FORMAT_OP_EXE       (9)
+#define HXR_FORMAT_OP_CWD       (10)
+#define HXR_FORMAT_OP_FILE      (11)
+#define HXR_FORMAT_OP_LINE      (12)
+#define HXR_FORMAT_OP_FUNC      (13)
+#define HXR_FORMAT_OP_TYPE      (14)
+#define HXR_FORMAT_OP_ID        (15)
+
+#define HXR_FORMAT_FIRST_   (0)
+#define HXR_FORMAT_MIDDLE_  (1)
+#define HXR_FORMAT_LAST_    (2)
+
+typedef struct S_HXR__FORMAT_OP
+{
+	uint8_t   code;      // HXR_FORMAT_OP_*
+	uint8_t   reserved;
+	uint16_t  len;       // LITERAL: how many bytes,
+	uint32_t  offset;    //   starting here in `literals`.
+} hxr_format_op_;
+
+struct S_HXR_MESSAGE_FORMAT
+{
+	hxr_allocator   *allocator;
+
+	// The three programs (indexed by HXR_FORMAT_FIRST_ etc.), back to back
+	// in `ops`, each ending with HXR_FORMAT_OP_END. The ops and the literal
+	// pool live in the same allocation as the format itself.
+	hxr_format_op_  *ops;
+	size_t          program[3];
+	char            *literals;
+
+	// Bit (1 << HXR_FORMAT_OP_*) is set for every op that the programs use.
+	uint32_t        fields;
+
+	size_t          min_prefix_width;
+	size_t          max_line_length;
+	uint8_t         align_prefixes;
+};
+
+static uint8_t hxr_format_directive_(char c)
+{
+	switch ( c )
+	{
+		case 'D': return HXR_FORMAT_OP_DATE;
+		case 'T': return HXR_FORMAT_OP_TIME;
+		case 'I': return HXR_FORMAT_OP_DATETIME;
+		case 'h': return HXR_FORMAT_OP_HOSTNAME;
+		case 'p': return HXR_FORMAT_OP_PID;
+		case 'u': return HXR_FORMAT_OP_UID;
+		case 'g': return HXR_FORMAT_OP_GID;
+		case 'e': return HXR_FORMAT_OP_EXE;
+		case 'c': return HXR_FORMAT_OP_CWD;
+		case 'f': return HXR_FORMAT_OP_FILE;
+		case 'l': return HXR_FORMAT_OP_LINE;
+		case 'F': return HXR_FORMAT_OP_FUNC;
+		case 't': return HXR_FORMAT_OP_TYPE;
+		case 'i': return HXR_FORMAT_OP_ID;
+		case '%': return HXR_FORMAT_OP_LITERAL;
+		default:  return HXR_FORMAT_OP_END;
+	}
+}
+
+// Compiles one spec string, appending its ops at `ops + *n_ops` and its
+// literal text at `literals + *n_literal`. When `ops` is NULL, this only
+// counts how much room that takes.
+// Returns: 0, or -1 with `*bad` pointing at the '%' of a bad directive.
+static int hxr_format_parse_(const char *spec,
+	hxr_format_op_ *ops, char *literals, size_t *n_ops, size_t *n_literal, const char **bad)
+{
+	size_t  literal_op  = 0;
+	size_t  literal_len = 0;   // 0 when the last op isn't a literal.
+	const char *p = spec;
+	while ( *p != '\0' )
+	{
+		uint8_t code = HXR_FORMAT_OP_LITERAL;
+		if ( *p == '%' ) {
+			code = hxr_format_directive_(p[1]);
+			if ( code == HXR_FORMAT_OP_END ) {
+				*bad = p;
+				return -1;
+			}
+			p++;  // For "%%", the second '%' is the literal.
+		}
+
+		if ( code != HXR_FORMAT_OP_LITERAL ) {
+			if ( ops != NULL ) {
+				ops[*n_ops].code     = code;
+				ops[*n_ops].reserved = 0;
+				ops[*n_ops].len      = 0;
+				ops[*n_ops].offset   = 0;
+			}
+			(*n_ops)++;
+			literal_len = 0;
+			p++;
+			continue;
+		}
+
+		if ( literal_len == 0 || literal_len == 0xFFFF ) {
+			literal_op  = (*n_ops)++;
+			literal_len = 0;
+			if ( ops != NULL ) {
+				ops[literal_op].code     = HXR_FORMAT_OP_LITERAL;
+				ops[literal_op].reserved = 0;
+				ops[literal_op].offset   = (uint32_t)*n_literal;
+			}
+		}
+		if ( ops != NULL ) {
+			literals[*n_literal] = *p;
+			ops[literal_op].len = (uint16_t)(literal_len + 1);
+		}
+		literal_len++;
+		(*n_literal)++;
+		p++;
+	}
+
+	if ( ops != NULL ) {
+		ops[*n_ops].code     = HXR_FORMAT_OP_END;
+		ops[*n_ops].reserved = 0;
+		ops[*n_ops].len      = 0;
+		ops[*n_ops].offset   = 0;
+	}
+	(*n_ops)++;
+	return 0;
+}
+
+hxr_message_format *HXR(message_format_compile)(hxr_thread *t, const hxr_message_format_spec *spec)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+
+	const char *specs[3];
+	specs[HXR_FORMAT_FIRST_]  = spec->first_line   != NULL ? spec->first_line   : "";
+	specs[HXR_FORMAT_MIDDLE_] = spec->middle_lines != NULL ? spec->middle_lines : specs[HXR_FORMAT_FIRST_];
+	specs[HXR_FORMAT_LAST_]   = spec->last_line    != NULL ? spec->last_line    : specs[HXR_FORMAT_MIDDLE_];
+
+	size_t n_ops = 0;
+	size_t n_literal = 0;
+	for ( size_t i = 0; i < 3; i++ )
+	{
+		const char *bad = NULL;
+		if ( hxr_format_parse_(specs[i], NULL, NULL, &n_ops, &n_literal, &bad) == 0 )
+			continue;
+
+		HXR_BEGIN_ERROR(t);
+			hxr_message_id(t, "message_format_bad_directive");
+			hxr_summary(t, "Unknown directive in a message format spec.");
+			if ( bad[1] == '\0' )
+				hxr_details_fmt(t, "The spec \"%s\" ends with a lone '%%'.", specs[i]);
+			else
+				hxr_details_fmt(t, "The spec \"%s\" has \"%%%c\" at offset %zd, "
+					"which isn't a directive that hxr_message_format_compile knows.",
+					specs[i], bad[1], (ssize_t)(bad - specs[i]));
+			hxr_suggestion(t, "Use \"%%\" for a literal percent sign. "
+				"The directives are listed with hxr_message_format in hexer.h.");
+		HXR_END(t);
+		return NULL;
+	}
+
+	size_t ops_offset = sizeof(hxr_message_format);
+	size_t literals_offset = ops_offset + n_ops * sizeof(hxr_format_op_);
+	char *block = timpl->allocator->allocate(t, literals_offset + n_literal);
+	if ( block == NULL )
+		return NULL;
+
+	hxr_message_format *fmt = (hxr_message_format*)block;
+	fmt->allocator        = timpl->allocator;
+	fmt->ops              = (hxr_format_op_*)(block + ops_offset);
+	fmt->literals         = block + literals_offset;
+	fmt->fields           = 0;
+	fmt->min_prefix_width = spec->min_prefix_width;
+	fmt->max_line_length  = spec->max_line_length;
+	fmt->align_prefixes   = spec->align_prefixes;
+
+	const char *unused = NULL;
+	n_ops = 0;
+	n_literal = 0;
+	for ( size_t i = 0; i < 3; i++ ) {
+		fmt->program[i] = n_ops;
+		hxr_format_parse_(specs[i], fmt->ops, fmt->literals, &n_ops, &n_literal, &unused);
+	}
+	for ( size_t i = 0; i < n_ops; i++ )
+		fmt->fields |= (uint32_t)1 << fmt->ops[i].code;
+	return fmt;
+}
+
+void HXR(message_format_free)(hxr_thread *t, hxr_message_format *fmt)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	if ( fmt != NULL )
+		fmt->allocator->free(t, fmt);
+}
+
+void HXR(thread_set_message_format)(hxr_thread *t, hxr_message_format *fmt)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_SETTER);
+	HXR(thread_get_impl_)(t)->msg_format = fmt;
+}
+
+hxr_message_format *HXR(thread_get_message_format)(hxr_thread *t)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_GETTER);
+	return HXR(thread_get_impl_)(t)->msg_format;
+}
+
+// ----- Running the programs -----
+
+// Appends `n` bytes to a prefix, or as many of them as fit.
+static inline void hxr_format_put_(char *buf, size_t *len, const char *text, size_t n)
+{
+	size_t room = HXR_FORMAT_PREFIX_MAX_ - *len;
+	if ( n > room )
+		n = room;
+	hxr_copy_bytes_(buf + *len, text, n);
+	*len += n;
+}
+
+static void hxr_format_put_str_(char *buf, size_t *len, const char *text)
+{
+	size_t n = 0;
+	while ( text[n] != '\0' )
+		n++;
+	hxr_format_put_(buf, len, text, n);
+}
+
+static void hxr_format_put_decimal_(char *buf, size_t *len, int64_t value)
+{
+	char digits[24];
+	char *end = digits + sizeof(digits);
+	char *start = hxr_send_decimal_(end, value);
+	hxr_format_put_(buf, len, start, (size_t)(end - start));
+}
+
+static inline void hxr_format_two_digits_(char *out, uint32_t value)
+{
+	out[0] = (char)('0' + value / 10);
+	out[1] = (char)('0' + value % 10);
+}
+
+// Renders the ISO 8601 text for the second that `ns` (nanoseconds since the
+// Unix epoch) is in, unless that's the second that is already cached. The
+// date arithmetic is Howard Hinnant's `civil_from_days`, so that this doesn't
+// depend on `gmtime_r` being available (or on its locking).
+static void hxr_format_cache_time_(hxr_format_cache_ *cache, uint64_t ns)
+{
+	uint64_t  secs = ns / 1000000000u;
+	if ( secs == cache->second )
+		return;
+
+	uint64_t  z    = secs / 86400u + 719468u;
+	uint32_t  sod  = (uint32_t)(secs % 86400u);
+	uint64_t  era  = z / 146097u;
+	uint32_t  doe  = (uint32_t)(z - era * 146097u);
+	uint32_t  yoe  = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+	uint32_t  doy  = doe - (365*yoe + yoe/4 - yoe/100);
+	uint32_t  mp   = (5*doy + 2) / 153;
+	uint32_t  day  = doy - (153*mp + 2)/5 + 1;
+	uint32_t  mon  = mp < 10 ? mp + 3 : mp - 9;
+	uint64_t  year = era * 400 + yoe + (mon <= 2);
+
+	char   *text = cache->datetime;
+	size_t n = 0;
+	char   year_buf[24];
+	char   *year_end = year_buf + sizeof(year_buf);
+	char   *year_start = hxr_send_decimal_(year_end, (int64_t)year);
+	while ( year_start < year_end )
+		text[n++] = *year_start++;
+	text[n++] = '-';
+	hxr_format_two_digits_(text + n, mon);             n += 2;
+	text[n++] = '-';
+	hxr_format_two_digits_(text + n, day);             n += 2;
+	text[n++] = 'T';
+	hxr_format_two_digits_(text + n, sod / 3600);      n += 2;
+	text[n++] = ':';
+	hxr_format_two_digits_(text + n, sod / 60 % 60);   n += 2;
+	text[n++] = ':';
+	hxr_format_two_digits_(text + n, sod % 60);        n += 2;
+	text[n++] = 'Z';
+	cache->datetime_len = n;
+	cache->second = secs;
+}
+
+// Appends the date, time, or both from the cached timestamp.
+// "THH:MM:SSZ" is the last 10 characters of it.
+static void hxr_format_put_time_(char *buf, size_t *len, uint8_t code, const hxr_format_cache_ *cache)
+{
+	size_t date_len = cache->datetime_len - 10;
+	switch ( code )
+	{
+		case HXR_FORMAT_OP_DATE: hxr_format_put_(buf, len, cache->datetime, date_len);            break;
+		case HXR_FORMAT_OP_TIME: hxr_format_put_(buf, len, cache->datetime + date_len + 1, 8);    break;
+		default:                 hxr_format_put_(buf, len, cache->datetime, cache->datetime_len); break;
+	}
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+// Looks up something about the process (ex: its pid) and appends it.
+// Anything that can't be found out on this platform comes out as "?".
+// This makes a system call or two; see `hxr_format_static_fields_` and
+// `hxr_format_cache_` for how it is avoided.
+static void hxr_format_lookup_field_(char *buf, size_t *len, uint8_t code)
+{
+#if defined(__unix__) || defined(__APPLE__)
+	char path[HXR_FORMAT_PREFIX_MAX_];
+	switch ( code )
+	{
+		case HXR_FORMAT_OP_PID: hxr_format_put_decimal_(buf, len, (int64_t)getpid()); return;
+		case HXR_FORMAT_OP_UID: hxr_format_put_decimal_(buf, len, (int64_t)getuid()); return;
+		case HXR_FORMAT_OP_GID: hxr_format_put_decimal_(buf, len, (int64_t)getgid()); return;
+
+		case HXR_FORMAT_OP_HOSTNAME:
+			if ( gethostname(path, sizeof(path)) != 0 )
+				break;
+			path[sizeof(path)-1] = '\0';
+			hxr_format_put_str_(buf, len, path);
+			return;
+
+		case HXR_FORMAT_OP_CWD:
+			if ( getcwd(path, sizeof(path)) == NULL )
+				break;
+			hxr_format_put_str_(buf, len, path);
+			return;
+
+		case HXR_FORMAT_OP_EXE:
+		{
+#if defined(__linux__)
+			ssize_t rc = readlink("/proc/self/exe", path, sizeof(path));
+			if ( rc <= 0 )
+				break;
+			size_t name = (size_t)rc;
+			while ( name > 0 && path[name-1] != '/' )
+				name--;
+			hxr_format_put_(buf, len, path + name, (size_t)rc - name);
+			return;
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+			hxr_format_put_str_(buf, len, getprogname());
+			return;
+#else
+			break;
+#endif
+		}
+	}
+#endif
+	hxr_format_put_(buf, len, "?", 1);
+}
+
+// The process fields that don't change while the process runs (hostname
+// through exe name, in HXR_FORMAT_OP_* order). They are looked up the first
+// time a format needs one of them and are then shared by every thread.
+// A forked child has a different pid, so it starts over (see
+// `hxr_format_module_init_`).
+#define HXR_FORMAT_STATIC_FIRST_  (HXR_FORMAT_OP_HOSTNAME)
+#define HXR_FORMAT_STATIC_COUNT_  (HXR_FORMAT_OP_EXE - HXR_FORMAT_OP_HOSTNAME + 1)
+#define HXR_FORMAT_STATIC_MASK_   ((((uint32_t)1 << HXR_FORMAT_STATIC_COUNT_) - 1) << HXR_FORMAT_STATIC_FIRST_)
+
+#define HXR_FORMAT_FIELDS_EMPTY_    (0)
+#define HXR_FORMAT_FIELDS_FILLING_  (1)
+#define HXR_FORMAT_FIELDS_READY_    (2)
+
+typedef struct S_HXR__FORMAT_STATIC_FIELDS
+{
+	size_t  state;   // HXR_FORMAT_FIELDS_*
+	size_t  len[HXR_FORMAT_STATIC_COUNT_];
+	char    text[HXR_FORMAT_STATIC_COUNT_][HXR_FORMAT_PREFIX_MAX_];
+} hxr_format_static_fields_;
+
+static hxr_format_static_fields_  hxr_format_static_fields_instance_;
+
+// Returns: The static fields, or NULL if another thread is still looking
+// them up (in which case the caller looks up what it needs itself, rather
+// than wait).
+static const hxr_format_static_fields_ *hxr_format_get_static_fields_(void)
+{
+	hxr_format_static_fields_ *fields = &hxr_format_static_fields_instance_;
+	size_t state = hxr_atomic_load_size_(&fields->state);
+	if ( state == HXR_FORMAT_FIELDS_READY_ )
+		return fields;
+	if ( state != HXR_FORMAT_FIELDS_EMPTY_
+	||   hxr_atomic_cas_size_(&fields->state, HXR_FORMAT_FIELDS_EMPTY_, HXR_FORMAT_FIELDS_FILLING_) != HXR_FORMAT_FIELDS_EMPTY_ )
+		return NULL;
+
+	for ( size_t i = 0; i < HXR_FORMAT_STATIC_COUNT_; i++ ) {
+		fields->len[i] = 0;
+		hxr_format_lookup_field_(fields->text[i], &fields->len[i], (uint8_t)(HXR_FORMAT_STATIC_FIRST_ + i));
+	}
+	hxr_atomic_store_size_(&fields->state, HXR_FORMAT_FIELDS_READY_);
+	return fields;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+
+static void hxr_format_after_fork_(void)
+{
+	// Only the forking thread exists in the child, so nobody is reading.
+	hxr_format_static_fields_instance_.state = HXR_FORMAT_FIELDS_EMPTY_;
+}
+#endif
+
+static void hxr_format_module_init_()
+{
+#if defined(__unix__) || defined(__APPLE__)
+	pthread_atfork(NULL, NULL, &hxr_format_after_fork_);
+#endif
+}
+
+// Runs the program starting at `op` for `msg`.
+// Returns: The length of the prefix it built in `buf`.
+// `cache` must be up to date for `msg` (see `hxr_format_prefixes_`).
+static size_t hxr_format_run_(const hxr_message_format *fmt, const hxr_format_op_ *op,
+	hxr_feedback_message *msg, const hxr_format_cache_ *cache,
+	const hxr_format_static_fields_ *fields, char *buf)
+{
+	size_t len = 0;
+	for ( ; op->code != HXR_FORMAT_OP_END; op++ )
+	{
+		switch ( op->code )
+		{
+			case HXR_FORMAT_OP_LITERAL:
+				hxr_format_put_(buf, &len, fmt->literals + op->offset, op->len);
+				break;
+
+			case HXR_FORMAT_OP_DATE:
+			case HXR_FORMAT_OP_TIME:
+			case HXR_FORMAT_OP_DATETIME:
+				hxr_format_put_time_(buf, &len, op->code, cache);
+				break;
+
+			case HXR_FORMAT_OP_CWD:
+				hxr_format_put_(buf, &len, cache->cwd, cache->cwd_len);
+				break;
+
+			case HXR_FORMAT_OP_FILE:
+				hxr_format_put_str_(buf, &len, msg->loc.file != NULL ? msg->loc.file : "?");
+				break;
+			case HXR_FORMAT_OP_LINE:
+				hxr_format_put_decimal_(buf, &len, (int64_t)msg->loc.line);
+				break;
+			case HXR_FORMAT_OP_FUNC:
+				hxr_format_put_str_(buf, &len, msg->loc.func != NULL ? msg->loc.func : "?");
+				break;
+			case HXR_FORMAT_OP_TYPE:
+				hxr_format_put_str_(buf, &len, hxr_message_type_name_(msg->type_and_flags));
+				break;
+			case HXR_FORMAT_OP_ID:
+				if ( msg->id != NULL )
+					hxr_format_put_str_(buf, &len, msg->id);
+				break;
+
+			default:
+				if ( fields != NULL ) {
+					size_t i = op->code - HXR_FORMAT_STATIC_FIRST_;
+					hxr_format_put_(buf, &len, fields->text[i], fields->len[i]);
+				}
+				else
+					hxr_format_lookup_field_(buf, &len, op->code);
+				break;
+		}
+	}
+	return len;
+}
+
+// Builds the first, middle, and last line prefixes for `msg`, padded as
+// the format asks.
+static void hxr_format_prefixes_(hxr_thread *t, const hxr_message_format *fmt,
+	hxr_feedback_message *msg, char buf[3][HXR_FORMAT_PREFIX_MAX_], size_t len[3])
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_NORMAL);
+	hxr_format_cache_ *cache = &HXR(thread_get_impl_)(t)->format_cache;
+	const uint32_t time_fields =
+		((uint32_t)1 << HXR_FORMAT_OP_DATE) | ((uint32_t)1 << HXR_FORMAT_OP_TIME) |
+		((uint32_t)1 << HXR_FORMAT_OP_DATETIME);
+
+	if ( fmt->fields & time_fields )
+		hxr_format_cache_time_(cache, msg->first_time);
+
+	// The working directory can change, so it's looked up again, but only
+	// once per second of messages.
+	if ( fmt->fields & ((uint32_t)1 << HXR_FORMAT_OP_CWD) ) {
+		uint64_t second = msg->first_time / 1000000000u;
+		if ( second != cache->cwd_second ) {
+			cache->cwd_len = 0;
+			hxr_format_lookup_field_(cache->cwd, &cache->cwd_len, HXR_FORMAT_OP_CWD);
+			cache->cwd_second = second;
+		}
+	}
+	const hxr_format_static_fields_ *fields = NULL;
+	if ( fmt->fields & HXR_FORMAT_STATIC_MASK_ )
+		fields = hxr_format_get_static_fields_();
+
+	size_t width = fmt->min_prefix_width;
+	for ( size_t i = 0; i < 3; i++ ) {
+		len[i] = hxr_format_run_(fmt, fmt->ops + fmt->program[i], msg, cache, fields, buf[i]);
+		if ( fmt->align_prefixes && len[i] > width )
+			width = len[i];
+	}
+	if ( width > HXR_FORMAT_PREFIX_MAX_ )
+		width = HXR_FORMAT_PREFIX_MAX_;
+	for ( size_t i = 0; i < 3; i++ )
+		for ( ; len[i] < width; len[i]++ )
+			buf[i][len[i]] = ' ';
+}
+
+// ----- Laying out lines -----
+
+// Every line needs a prefix, at most a piece of every fragment that
+// `hxr_send_message_text_` produces, and a line ending if it was wrapped.
+#define HXR_FORMAT_MAX_IOV_   (64)
+#define HXR_FORMAT_LINE_IOV_  (HXR_SEND_MAX_IOV_ + 2)
+#define HXR_FORMAT_NO_LINE_   ((size_t)-1)
+
+// A place in the line being laid out: `ptr` is in `iov[idx]`, or, if `idx`
+// is the count of pieces, in the part of the text that `hxr_format_text_`
+// hasn't added yet.
+typedef struct S_HXR__FORMAT_MARK
+{
+	size_t      idx;
+	const char  *ptr;
+} hxr_format_mark_;
+
+static inline hxr_format_mark_ hxr_make_format_mark_(size_t idx, const char *ptr)
+{
+	hxr_format_mark_ result;
+	result.idx = idx;
+	result.ptr = ptr;
+	return result;
+}
+
+typedef struct S_HXR__FORMAT_LAYOUT
+{
+	hxr_thread   *t;
+	hxr_stream_  *stream;
+	const char   *prefix[3];
+	size_t       prefix_len[3];
+
+	hxr_iovec_   iov[HXR_FORMAT_MAX_IOV_];
+	size_t       count;
+
+	// The slot saved for the current line's prefix, which is only filled in
+	// once it's known whether this is the last line. HXR_FORMAT_NO_LINE_
+	// between lines.
+	size_t       line_slot;
+	size_t       line_index;
+
+	// The slot of the line that was ended last, whose prefix can still
+	// change if a wrap turns out to have ended the text (see
+	// `hxr_format_newline_`).
+	size_t       ended_slot;
+
+	// Word wrapping (see `hxr_format_text_`). `width` is how many columns of
+	// text fit after the first line's prefix, and after the others'; 0 if
+	// lines aren't wrapped. `col` is how many the current line has.
+	size_t            width[2];
+	size_t            col;
+	uint8_t           seen_word;    // The line has something other than spaces.
+	uint8_t           in_spaces;
+	uint8_t           skip_spaces;  // Dropping the spaces after a wrap.
+	uint8_t           has_break;
+
+	// Where the current line's last run of spaces starts (the line can end
+	// there) and where the word after it starts (the next line would start
+	// there), and `col` at that word.
+	hxr_format_mark_  brk_end;
+	hxr_format_mark_  brk_word;
+	size_t            brk_word_col;
+
+	ssize_t      written;   // -1 once a write has failed.
+} hxr_format_layout_;
+
+static void hxr_format_flush_(hxr_format_layout_ *out)
+{
+	if ( out->count == 0 )
+		return;
+	ssize_t rc = stream_write_iov(out->t, out->stream, out->iov, out->count);
+	if ( rc < 0 || out->written < 0 )
+		out->written = -1;
+	else
+		out->written += rc;
+	out->count = 0;
+}
+
+static void hxr_format_begin_line_(hxr_format_layout_ *out)
+{
+	// Only whole lines are flushed, so make sure this one will fit.
+	if ( out->count + HXR_FORMAT_LINE_IOV_ > HXR_FORMAT_MAX_IOV_ )
+		hxr_format_flush_(out);
+	out->line_slot = out->count++;
+}
+
+static void hxr_format_piece_(hxr_format_layout_ *out, const char *base, size_t len)
+{
+	if ( out->line_slot == HXR_FORMAT_NO_LINE_ )
+		hxr_format_begin_line_(out);
+	out->iov[out->count].base = base;
+	out->iov[out->count].len  = len;
+	out->count++;
+}
+
+// Fills in the prefix saved at `slot` for line `line_index`.
+static void hxr_format_set_prefix_(hxr_format_layout_ *out, size_t slot, size_t line_index, int is_last)
+{
+	size_t kind = HXR_FORMAT_MIDDLE_;
+	if ( line_index == 0 )
+		kind = HXR_FORMAT_FIRST_;
+	else if ( is_last )
+		kind = HXR_FORMAT_LAST_;
+	out->iov[slot].base = out->prefix[kind];
+	out->iov[slot].len  = out->prefix_len[kind];
+}
+
+static void hxr_format_end_line_(hxr_format_layout_ *out, int is_last)
+{
+	hxr_format_set_prefix_(out, out->line_slot, out->line_index, is_last);
+	out->ended_slot = out->line_slot;
+	out->line_slot  = HXR_FORMAT_NO_LINE_;
+	out->line_index++;
+	out->col       = 0;
+	out->seen_word = 0;
+	out->in_spaces = 0;
+	out->has_break = 0;
+}
+
+// Ends the current line where a line ending was found in the text.
+static void hxr_format_newline_(hxr_format_layout_ *out, const char *newline, int is_last)
+{
+	if ( out->skip_spaces ) {
+		out->skip_spaces = 0;
+		if ( out->line_slot == HXR_FORMAT_NO_LINE_ ) {
+			// The line was wrapped right before this, so it has ended
+			// already, but as a middle line. It might be the last one.
+			hxr_format_set_prefix_(out, out->ended_slot, out->line_index - 1, is_last);
+			return;
+		}
+	}
+
+	// Keep the text and its line ending in one piece, if they are.
+	if ( out->line_slot != HXR_FORMAT_NO_LINE_ && out->count - 1 > out->line_slot
+	&&   out->iov[out->count - 1].base + out->iov[out->count - 1].len == newline )
+		out->iov[out->count - 1].len++;
+	else
+		hxr_format_piece_(out, newline, 1);
+	hxr_format_end_line_(out, is_last);
+}
+
+// Ends the current line early (at `mark`), because the rest doesn't fit.
+// `pending` is where the part of the text that hasn't been added yet starts.
+static void hxr_format_wrap_at_(hxr_format_layout_ *out, hxr_format_mark_ mark, const char *pending)
+{
+	if ( mark.idx == out->count ) {
+		if ( mark.ptr > pending )
+			hxr_format_piece_(out, pending, (size_t)(mark.ptr - pending));
+	}
+	else if ( mark.ptr > out->iov[mark.idx].base ) {
+		out->iov[mark.idx].len = (size_t)(mark.ptr - out->iov[mark.idx].base);
+		out->count = mark.idx + 1;
+	}
+	else
+		out->count = mark.idx;
+	hxr_format_piece_(out, "\n", 1);
+	hxr_format_end_line_(out, 0);
+}
+
+// Lays out `len` bytes of text that has no line endings in it. Without
+// wrapping, that's just adding it to the line.
+//
+// With wrapping, lines are broken at runs of spaces (which are dropped), or
+// in the middle of a word that doesn't fit on a line by itself. Columns are
+// counted in UTF-8 characters (any byte that isn't 10xxxxxx starts one), and
+// a word is never split inside a character. Only the text's place is kept
+// track of, never the text, and a wrap only moves the pieces of the last
+// word (at most one per fragment), so this stays linear in the length of
+// the text.
+static void hxr_format_text_(hxr_format_layout_ *out, const char *text, size_t len)
+{
+	if ( out->width[0] == 0 ) {
+		if ( len > 0 )
+			hxr_format_piece_(out, text, len);
+		return;
+	}
+
+	const char *pending = text;
+	for ( size_t i = 0; i < len; i++ )
+	{
+		char c = text[i];
+		if ( out->skip_spaces ) {
+			if ( c == ' ' ) {
+				pending = text + i + 1;
+				continue;
+			}
+			out->skip_spaces = 0;
+		}
+		if ( out->line_slot == HXR_FORMAT_NO_LINE_ )
+			hxr_format_begin_line_(out);
+
+		// Spaces that indent a line aren't a place to break it.
+		if ( c == ' ' ) {
+			if ( out->seen_word && !out->in_spaces ) {
+				out->brk_end.idx = out->count;
+				out->brk_end.ptr = text + i;
+				out->in_spaces   = 1;
+			}
+		}
+		else {
+			if ( out->in_spaces ) {
+				out->brk_word.idx = out->count;
+				out->brk_word.ptr = text + i;
+				out->brk_word_col = out->col;
+				out->in_spaces    = 0;
+				out->has_break    = 1;
+			}
+			out->seen_word = 1;
+		}
+
+		if ( ((uint8_t)c & 0xC0) == 0x80 )
+			continue;  // The rest of a character.
+		if ( out->col < out->width[out->line_index == 0 ? 0 : 1] ) {
+			out->col++;
+			continue;
+		}
+
+		// `c` doesn't fit on this line.
+		if ( out->in_spaces ) {
+			hxr_format_wrap_at_(out, out->brk_end, pending);
+			out->skip_spaces = 1;
+			pending = text + i + 1;
+			continue;
+		}
+
+		// The last word goes to the next line, unless it wouldn't fit there
+		// either (the first line can be wider than the others).
+		if ( out->has_break && out->col - out->brk_word_col < out->width[1] )
+		{
+			hxr_format_mark_  word     = out->brk_word;
+			size_t            word_col = out->col - out->brk_word_col;
+			if ( word.idx == out->count ) {
+				// The word is all in `text`.
+				hxr_format_wrap_at_(out, out->brk_end, pending);
+				pending = word.ptr;
+			}
+			else {
+				// The word started in an earlier fragment; move its pieces.
+				hxr_iovec_  carry[HXR_FORMAT_LINE_IOV_];
+				size_t      n_carry = 0;
+				for ( size_t j = word.idx; j < out->count; j++ ) {
+					const char *start = (j == word.idx) ? word.ptr : out->iov[j].base;
+					const char *end   = out->iov[j].base + out->iov[j].len;
+					carry[n_carry].base = start;
+					carry[n_carry].len  = (size_t)(end - start);
+					n_carry++;
+				}
+				hxr_format_wrap_at_(out, out->brk_end, pending);
+				hxr_format_begin_line_(out);
+				for ( size_t j = 0; j < n_carry; j++ )
+					if ( carry[j].len > 0 )
+						hxr_format_piece_(out, carry[j].base, carry[j].len);
+			}
+			out->col = word_col;
+		}
+		else {
+			// Split the word.
+			hxr_format_wrap_at_(out, hxr_make_format_mark_(out->count, text + i), pending);
+			pending = text + i;
+		}
+		if ( out->line_slot == HXR_FORMAT_NO_LINE_ )
+			hxr_format_begin_line_(out);
+		out->seen_word = (c != ' ');
+		out->col++;
+	}
+	if ( text + len > pending )
+		hxr_format_piece_(out, pending, (size_t)(text + len - pending));
+}
+
+// Returns: The number of UTF-8 characters in the `len` bytes at `text`.
+static size_t hxr_format_columns_(const char *text, size_t len)
+{
+	size_t cols = 0;
+	for ( size_t i = 0; i < len; i++ )
+		cols += (((uint8_t)text[i] & 0xC0) != 0x80);
+	return cols;
+}
+
+// Writes the text in `iov` (as produced by `hxr_send_message_text_`) with
+// `fmt`'s prefixes in front of its lines, wrapping lines that are longer
+// than `fmt->max_line_length`. Line endings are found with `hxr_scan_bytes_`,
+// and the text itself is never copied.
+static ssize_t hxr_format_write_(hxr_thread *t, hxr_stream_ *stream, const hxr_message_format *fmt,
+	hxr_feedback_message *msg, const hxr_iovec_ *iov, size_t iov_count)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	char prefix_buf[3][HXR_FORMAT_PREFIX_MAX_];
+	hxr_format_layout_ out;
+	out.t          = t;
+	out.stream     = stream;
+	out.count      = 0;
+	out.line_slot  = HXR_FORMAT_NO_LINE_;
+	out.line_index = 0;
+	out.ended_slot = HXR_FORMAT_NO_LINE_;
+	out.written    = 0;
+	out.col        = 0;
+	out.seen_word  = 0;
+	out.in_spaces  = 0;
+	out.skip_spaces = 0;
+	out.has_break  = 0;
+	hxr_format_prefixes_(t, fmt, msg, prefix_buf, out.prefix_len);
+	for ( size_t i = 0; i < 3; i++ )
+		out.prefix[i] = prefix_buf[i];
+
+	out.width[0] = 0;
+	out.width[1] = 0;
+	if ( fmt->max_line_length > 0 )
+	{
+		size_t first  = hxr_format_columns_(out.prefix[HXR_FORMAT_FIRST_],  out.prefix_len[HXR_FORMAT_FIRST_]);
+		size_t middle = hxr_format_columns_(out.prefix[HXR_FORMAT_MIDDLE_], out.prefix_len[HXR_FORMAT_MIDDLE_]);
+		size_t last   = hxr_format_columns_(out.prefix[HXR_FORMAT_LAST_],   out.prefix_len[HXR_FORMAT_LAST_]);
+		size_t others = middle > last ? middle : last;
+
+		// Always leave room for at least one character, however long the
+		// prefixes are.
+		out.width[0] = fmt->max_line_length > first  ? fmt->max_line_length - first  : 1;
+		out.width[1] = fmt->max_line_length > others ? fmt->max_line_length - others : 1;
+	}
+
+	size_t positions[32];
+	for ( size_t f = 0; f < iov_count; f++ )
+	{
+		const char  *base = iov[f].base;
+		size_t      len   = iov[f].len;
+		size_t      start = 0;   // Of the part of the line in this fragment.
+		int         last_fragment = (f + 1 == iov_count);
+		while ( start < len )
+		{
+			hxr_text_scan_ scan;
+			size_t scan_start = start;
+			hxr_scan_bytes_(t, base + scan_start, len - scan_start, &scan, positions, 32);
+			size_t n = scan.newline_count < 32 ? scan.newline_count : 32;
+			for ( size_t i = 0; i < n; i++ ) {
+				size_t newline = scan_start + positions[i];
+				hxr_format_text_(&out, base + start, newline - start);
+				hxr_format_newline_(&out, base + newline, last_fragment && newline + 1 == len);
+				start = newline + 1;
+			}
+			if ( scan.newline_count > n )
+				continue;  // Too many to record at once; scan the rest.
+			hxr_format_text_(&out, base + start, len - start);
+			break;
+		}
+	}
+	if ( out.line_slot != HXR_FORMAT_NO_LINE_ )
+		hxr_format_end_line_(&out, 1);
+	else if ( out.skip_spaces )  // Wrapped at spaces that end the text.
+		hxr_format_set_prefix_(&out, out.ended_slot, out.line_index - 1, 1);
+	hxr_format_flush_(&out);
+	return out.written;
+}
+
+#if defined(HXR_EXTRACT_UNITTESTS) && (0 != HXR_EXTRACT_UNITTESTS)
+typedef struct S_HXR__FORMAT_TEST_SINK
+{
+	char    text[256];
+	size_t  len;
+	size_t  calls;
+} hxr_format_test_sink_;
+
+static ssize_t hxr_format_test_write_iov_(hxr_thread *t, hxr_stream_ *stream, const hxr_iovec_ *iov, size_t iov_count)
+{
+	hxr_format_test_sink_ *sink = stream->impl;
+	size_t total = 0;
+	for ( size_t i = 0; i < iov_count; i++ ) {
+		hxr_copy_bytes_(sink->text + sink->len, iov[i].base, iov[i].len);
+		sink->len += iov[i].len;
+		total += iov[i].len;
+	}
+	sink->text[sink->len] = '\0';
+	sink->calls++;
+	return (ssize_t)total;
+}
+
+void HXR(message_format_unittest)(hxr_thread *t)
+{
+	hxr_feedback_message  *msg;
+	hxr_message_format    *fmt;
+
+	// ................................ //
+	hxr_thread_init_(t);
+	hxr_thread_set_message_coalescing(t, 0);
+
+	hxr_message_format_spec spec = {0};
+	spec.first_line = "%t 50%q ";
+	HXR_ASSERT( hxr_message_format_compile(t, &spec), ==, NULL );
+	HXR_ASSERT( hxr_msg_next(t, &msg) );
+	HXR_ASSERT_STR( msg->id, ==, "message_format_bad_directive" );
+	hxr_clear_messages(t);
+
+	spec.first_line     = "%t 100%% ";
+	spec.middle_lines   = "| ";
+	spec.last_line      = "` ";
+	spec.align_prefixes = 1;
+	fmt = hxr_message_format_compile(t, &spec);
+
+	HXR_BEGIN_ERROR(t);
+		hxr_message_id(t, "format_test");
+	HXR_END(t);
+
+	hxr_stream_vtbl_       vtable = {0};
+	hxr_stream_            stream;
+	hxr_format_test_sink_  sink;
+	vtable.write_iov = &hxr_format_test_write_iov_;
+	stream.vtable    = &vtable;
+	stream.impl      = &sink;
+	sink.len         = 0;
+	sink.calls       = 0;
+
+	// Lines split across fragments, and a fragment with several lines.
+	hxr_iovec_ iov[3];
+	iov[0].base = "one\ntw";    iov[0].len = 6;
+	iov[1].base = "o";          iov[1].len = 1;
+	iov[2].base = "\nthree\n";  iov[2].len = 7;
+	do {
+		HXR_ASSERT_ELSE( hxr_msg_next(t, &msg) )                               break;
+		HXR_ASSERT_ELSE( hxr_format_write_(t, &stream, fmt, msg, iov, 3), ==, 47 ) break;
+		HXR_ASSERT_STR_ELSE( sink.text, ==,
+			"error 100% one\n"
+			"|          two\n"
+			"`          three\n" )                                                break;
+		HXR_ASSERT_ELSE( sink.calls, ==, 1 )                                   break;
+	} while (0);
+	hxr_message_format_free(t, fmt);
+
+	// Wrapping: a word split across fragments moves to the next line whole,
+	// runs of spaces go away, and "ë" is one column.
+	spec.first_line      = "> ";
+	spec.middle_lines    = "  ";
+	spec.last_line       = "  ";
+	spec.align_prefixes  = 0;
+	spec.max_line_length = 12;
+	fmt = hxr_message_format_compile(t, &spec);
+	sink.len = 0;
+	iov[0].base = "Zo\xC3\xAB fed the elep";      iov[0].len = 17;
+	iov[1].base = "hant an\nenormous  cake";  iov[1].len = 22;
+	do {
+		HXR_ASSERT_ELSE( hxr_format_write_(t, &stream, fmt, msg, iov, 2), ==, 50 ) break;
+		HXR_ASSERT_STR_ELSE( sink.text, ==,
+			"> Zo\xC3\xAB fed\n"
+			"  the\n"
+			"  elephant\n"
+			"  an\n"
+			"  enormous\n"
+			"  cake" )                                                           break;
+	} while (0);
+	hxr_message_format_free(t, fmt);
+
+	// Wrapping at the spaces that end the text (with its last line ending,
+	// and without) still gives that line the last line's prefix.
+	spec.middle_lines = "| ";
+	spec.last_line    = "` ";
+	fmt = hxr_message_format_compile(t, &spec);
+	for ( size_t i = 0; i < 2; i++ )
+	{
+		sink.len = 0;
+		iov[0].base = i == 0 ? "aaaa bbbb cccc        \n" : "aaaa bbbb cccc        ";
+		iov[0].len  = i == 0 ? 23 : 22;
+		HXR_ASSERT_ELSE( hxr_format_write_(t, &stream, fmt, msg, iov, 1), ==, 19 ) break;
+		HXR_ASSERT_STR_ELSE( sink.text, ==,
+			"> aaaa bbbb\n"
+			"` cccc\n" )                                                         break;
+	}
+
+	hxr_message_format_free(t, fmt);
+	hxr_thread_free_(t);
+}
+#endif
+
+// ===== Binary Message Log : hxr_binlog_* =====
+// A compact, append-only log of messages for places where rendering every
+// message to text costs too much. Nothing is formatted on the way in:
+// message ids and callsites are written once and referred to by number, and
+// deferred `_fmt` text is stored as its format string plus the raw argument
+// values. source/hxr/hxr-binlog-decode.c turns a log back into the same
+// text that `hxr_print_message` would have produced.
+//
+// The file is a sequence of records. Every record starts with an 8-byte
+// header and is padded with zeros to a multiple of 8 bytes, so a reader can
+// skip records without decoding them, and the fixed-size fields stay aligned
+// when the file is mmap'd:
+//
+//     uint32_t  size;      // Whole record, including header and padding.
+//     uint16_t  kind;      // HXR_BINLOG_*_
+//     uint16_t  reserved;  // 0
+//
+// Integers are written in the writer's native byte order.
+//
+// SESSION   Written by `hxr_binlog_open`.
+//     char      magic[8];    // "HXRBLOG" and a null.
+//     uint32_t  version;     // HXR_BINLOG_VERSION_
+//     uint32_t  byte_order;  // 0x01020304, as written by this machine.
+//     uint64_t  start_time;  // See `HXR_TIMESTAMP_DEFAULT`.
+//   Id and callsite numbers only mean something within the session that
+//   defined them, so logs can be appended to and concatenated freely.
+//
+// MSGID     Defines a message id, just before its first use in the session.
+//     uint32_t  handle;      // `hxr_msgid`
+//     char      id[];        // Null-terminated.
+//
+// CALLSITE  Defines a callsite, just before its first use in the session.
+//     uint32_t  index;
+//     uint32_t  line;
+//     char      file[];      // Null-terminated.
+//     char      func[];      // Null-terminated.
+//
+// MESSAGE
+//     uint32_t  type_and_flags;
+//     uint32_t  msgid;       // HXR_MSGID_NONE, HXR_BINLOG_INLINE_MSGID_,
+//                            // or defined by a MSGID record.
+//     uint32_t  callsite;
+//     uint32_t  repeat_count;
+//     uint64_t  first_time;
+//     uint64_t  last_time;
+//     char      id[];        // Only for HXR_BINLOG_INLINE_MSGID_: an id
+//                            // that wasn't interned. Null-terminated.
+//   Then the summary, details, and suggestion (in that order), each as a
+//   `uint8_t` HXR_BINLOG_SECTION_*_ followed by:
+//     NONE:     nothing.
+//     TEXT:     char text[] (null-terminated).
+//     FORMAT:   char fmtstr[] (null-terminated), then one value for each
+//               conversion in `fmtstr`, unaligned: each '*' as an int32_t,
+//               integers and pointers as 64 bits, floating point as a double,
+//               and strings as a uint32_t length (0xFFFFFFFF for NULL)
+//               followed by that many bytes.
+//
+// TEXT      Anything written with the stream's write_line/write_text/write_fmtstr/write_iov.
+//     char      text[];      // Null-terminated.
+
+#if HXR_ENABLE_FILE_IO
+
+#define HXR_BINLOG_SESSION_     (1)
+#define HXR_BINLOG_MSGID_       (2)
+#define HXR_BINLOG_CALLSITE_    (3)
+#define HXR_BINLOG_MESSAGE_     (4)
+#define HXR_BINLOG_TEXT_        (5)
+
+#define HXR_BINLOG_SECTION_NONE_    (0)
+#define HXR_BINLOG_SECTION_TEXT_    (1)
+#define HXR_BINLOG_SECTION_FORMAT_  (2)
+
+#define HXR_BINLOG_VERSION_        (2)
+#define HXR_BINLOG_HEADER_SIZE_    (8)
+#define HXR_BINLOG_NULL_STRING_    ((uint32_t)0xFFFFFFFF)
+#define HXR_BINLOG_INLINE_MSGID_   ((uint32_t)0xFFFFFFFF)
+
+typedef struct S_HXR__BINLOG_CALLSITE
+{
+	const char  *file;   // NULL if the slot is empty.
+	size_t      line;
+	uint32_t    index;
+} hxr_binlog_callsite_;
+
+struct S_HXR_BINLOG
+{
+	hxr_stream_            stream;
+	FILE                   *fd;
+	hxr_allocator          *allocator;
+
+	// The record being built. Reused for every record.
+	unsigned char          *buf;
+	size_t                 buf_len;
+	size_t                 buf_capacity;
+	uint8_t                alloc_failed;
+
+	// One bit per `hxr_msgid`: has a MSGID record been written this session?
+	uint8_t                *msgids_defined;
+
+	// Open-addressing table of callsites that have CALLSITE records.
+	hxr_binlog_callsite_   *callsites;
+	size_t                 callsites_capacity;   // Power of two.
+	uint32_t               n_callsites;
+};
+
+static hxr_stream_vtbl_  hxr_binlog_vtbl_;
+
+// Makes room for `n` more bytes at the end of the record and returns where
+// they go, without writing them. Returns NULL (and sets `alloc_failed`) if
+// the buffer couldn't grow.
+static unsigned char *hxr_binlog_reserve_(hxr_thread *t, hxr_binlog *log, size_t n)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+	if ( log->alloc_failed )
+		return NULL;
+
+	if ( log->buf_len + n > log->buf_capacity )
+	{
+		size_t new_capacity = log->buf_capacity ? log->buf_capacity : 256;
+		while ( new_capacity < log->buf_len + n )
+			new_capacity *= 2;
+		unsigned char *new_buf = log->allocator->reallocate(t, log->buf, new_capacity);
+		if ( new_buf == NULL ) {
+			log->alloc_failed = 1;
+			return NULL;
+		}
+		log->buf = new_buf;
+		log->buf_capacity = new_capacity;
+	}
+
+	unsigned char *dst = log->buf + log->buf_len;
+	log->buf_len += n;
+	return dst;
+}
+
+static void hxr_binlog_put_(hxr_thread *t, hxr_binlog *log, const void *src, size_t n)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+	unsigned char *dst = hxr_binlog_reserve_(t, log, n);
+	if ( dst != NULL )
+		hxr_copy_bytes_(dst, src, n);
+}
+
+static void hxr_binlog_put_u8_(hxr_thread *t, hxr_binlog *log, uint8_t v)   { hxr_binlog_put_(t, log, &v, sizeof(v)); }
+static void hxr_binlog_put_u32_(hxr_thread *t, hxr_binlog *log, uint32_t v) { hxr_binlog_put_(t, log, &v, sizeof(v)); }
+static void hxr_binlog_put_u64_(hxr_thread *t, hxr_binlog *log, uint64_t v) { hxr_binlog_put_(t, log, &v, sizeof(v)); }
+
+static void hxr_binlog_put_str_(hxr_thread *t, hxr_binlog *log, const char *str)
+{
+	if ( str == NULL )
+		str = "";
+	size_t len = 0;
+	while ( str[len] != '\0' )
+		len++;
+	hxr_binlog_put_(t, log, str, len + 1);
+}
+
+static void hxr_binlog_begin_record_(hxr_thread *t, hxr_binlog *log, uint16_t kind)
+{
+	uint16_t reserved = 0;
+	log->buf_len = 0;
+	log->alloc_failed = 0;
+	hxr_binlog_put_u32_(t, log, 0); // Size, filled in by `hxr_binlog_end_record_`.
+	hxr_binlog_put_(t, log, &kind, sizeof(kind));
+	hxr_binlog_put_(t, log, &reserved, sizeof(reserved));
+}
+
+// Throws away the record being built; nothing of it is written.
+static void hxr_binlog_abandon_record_(hxr_binlog *log)
+{
+	log->buf_len = 0;
+	log->alloc_failed = 0;
+}
+
+// Pads, sizes, and writes out the record. Returns the number of bytes
+// written, or -1 on failure (in which case the record is abandoned).
+static ssize_t hxr_binlog_end_record_(hxr_thread *t, hxr_binlog *log)
+{
+	static const unsigned char zeros[HXR_BINLOG_HEADER_SIZE_] = {0};
+	size_t padding = (HXR_BINLOG_HEADER_SIZE_ - (log->buf_len % HXR_BINLOG_HEADER_SIZE_)) % HXR_BINLOG_HEADER_SIZE_;
+	hxr_binlog_put_(t, log, zeros, padding);
+	if ( log->alloc_failed || log->buf_len > UINT32_MAX ) {
+		hxr_binlog_abandon_record_(log);
+		return -1;
+	}
+
+	uint32_t size = (uint32_t)log->buf_len;
+	hxr_copy_bytes_(log->buf, &size, sizeof(size));
+	if ( fwrite(log->buf, 1, log->buf_len, log->fd) != log->buf_len )
+		return -1;
+	return (ssize_t)log->buf_len;
+}
+
+// Writes the values captured by `hxr_fmtargs_capture_` for `fmtstr` in the
+// portable layout described above.
+static void hxr_binlog_put_args_(
+	hxr_thread *t,  hxr_binlog *log,  const char *fmtstr,  const unsigned char *args)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+	const unsigned char *in = args;
+	const char *p = fmtstr;
+
+#define HXR_BINLOG_PUT_ARG_(type, wide_type, put) \
+	do { \
+		type value_; \
+		hxr_copy_bytes_(&value_, in, sizeof(type)); \
+		in += sizeof(type); \
+		put(t, log, (wide_type)value_); \
+	} while(0)
+
+	while ( *p != '\0' )
+	{
+		if ( *p != '%' ) {
+			p++;
+			continue;
+		}
+
+		hxr_fmtspec_ spec;
+		hxr_fmtspec_parse_(p, &spec);
+		p = spec.end;
+
+		for ( uint8_t i = 0; i < spec.n_stars; i++ ) {
+			int star;
+			hxr_copy_bytes_(&star, in, sizeof(int));
+			in += sizeof(int);
+			hxr_binlog_put_u32_(t, log, (uint32_t)(int32_t)star);
+		}
+
+		switch ( spec.arg_class )
+		{
+			case HXR_FMTARG_INT_:     HXR_BINLOG_PUT_ARG_(int,                int64_t,   hxr_binlog_put_u64_); break;
+			case HXR_FMTARG_UINT_:    HXR_BINLOG_PUT_ARG_(unsigned int,       uint64_t,  hxr_binlog_put_u64_); break;
+			case HXR_FMTARG_LONG_:    HXR_BINLOG_PUT_ARG_(long,               int64_t,   hxr_binlog_put_u64_); break;
+			case HXR_FMTARG_ULONG_:   HXR_BINLOG_PUT_ARG_(unsigned long,      uint64_t,  hxr_binlog_put_u64_); break;
+			case HXR_FMTARG_LLONG_:   HXR_BINLOG_PUT_ARG_(long long,          int64_t,   hxr_binlog_put_u64_); break;
+			case HXR_FMTARG_ULLONG_:  HXR_BINLOG_PUT_ARG_(unsigned long long, uint64_t,  hxr_binlog_put_u64_); break;
+			case HXR_FMTARG_INTMAX_:  HXR_BINLOG_PUT_ARG_(intmax_t,           int64_t,   hxr_binlog_put_u64_); break;
+			case HXR_FMTARG_UINTMAX_: HXR_BINLOG_PUT_ARG_(uintmax_t,          uint64_t,  hxr_binlog_put_u64_); break;
+			case HXR_FMTARG_SIZE_:    HXR_BINLOG_PUT_ARG_(size_t,             uint64_t,  hxr_binlog_put_u64_); break;
+			case HXR_FMTARG_PTRDIFF_: HXR_BINLOG_PUT_ARG_(ptrdiff_t,          int64_t,   hxr_binlog_put_u64_); break;
+			case HXR_FMTARG_PTR_:     HXR_BINLOG_PUT_ARG_(void*,              uintptr_t, hxr_binlog_put_u64_); break;
+
+			case HXR_FMTARG_DOUBLE_:
+			case HXR_FMTARG_LDOUBLE_:
+			{
+				double value;
+				if ( spec.arg_class == HXR_FMTARG_DOUBLE_ ) {
+					hxr_copy_bytes_(&value, in, sizeof(double));
+					in += sizeof(double);
+				} else {
+					long double lvalue;
+					hxr_copy_bytes_(&lvalue, in, sizeof(long double));
+					in += sizeof(long double);
+					value = (double)lvalue;
+				}
+				hxr_binlog_put_(t, log, &value, sizeof(value));
+				break;
+			}
+
+			case HXR_FMTARG_STRING_:
+			{
+				const char *str;
+				hxr_copy_bytes_(&str, in, sizeof(const char*));
+				in += sizeof(const char*);
+				if ( str == NULL ) {
+					hxr_binlog_put_u32_(t, log, HXR_BINLOG_NULL_STRING_);
+					break;
+				}
+				size_t len = 0;
+				while ( str[len] != '\0' )
+					len++;
+				hxr_binlog_put_u32_(t, log, (uint32_t)len);
+				hxr_binlog_put_(t, log, str, len);
+				break;
+			}
+
+			default: break; // HXR_FMTARG_NONE_
+		}
+	}
+
+#undef HXR_BINLOG_PUT_ARG_
+}
+
+static void hxr_binlog_put_section_(hxr_thread *t, hxr_binlog *log, const hxr_message_text_ *mt)
+{
+	if ( mt->text != NULL ) {
+		// Already rendered (or never deferred).
+		hxr_binlog_put_u8_(t, log, HXR_BINLOG_SECTION_TEXT_);
+		hxr_binlog_put_str_(t, log, mt->text);
+	} else
+	if ( mt->fmtstr != NULL ) {
+		hxr_binlog_put_u8_(t, log, HXR_BINLOG_SECTION_FORMAT_);
+		hxr_binlog_put_str_(t, log, mt->fmtstr);
+		hxr_binlog_put_args_(t, log, mt->fmtstr, mt->args);
+	} else {
+		hxr_binlog_put_u8_(t, log, HXR_BINLOG_SECTION_NONE_);
+	}
+}
+
+// Returns the callsite's index, writing its CALLSITE record first if this is
+// the first time the session has seen it. Returns 0 on failure.
+static uint32_t hxr_binlog_get_callsite_(hxr_thread *t, hxr_binlog *log, const hxr_source_location_ *loc)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+
+	// Keep the table at most half full.
+	if ( (log->n_callsites + 1) * 2 > log->callsites_capacity )
+	{
+		size_t new_capacity = log->callsites_capacity ? log->callsites_capacity * 2 : 64;
+		hxr_binlog_callsite_ *new_table = log->allocator->allocate(t, new_capacity * sizeof(hxr_binlog_callsite_));
+		if ( new_table == NULL )
+			return 0;
+		for ( size_t i = 0; i < new_capacity; i++ )
+			new_table[i].file = NULL;
+
+		for ( size_t i = 0; i < log->callsites_capacity; i++ )
+		{
+			hxr_binlog_callsite_ *old = &log->callsites[i];
+			if ( old->file == NULL )
+				continue;
+			size_t slot = ((uintptr_t)old->file ^ old->line * 2654435761u) & (new_capacity - 1);
+			while ( new_table[slot].file != NULL )
+				slot = (slot + 1) & (new_capacity - 1);
+			new_table[slot] = *old;
+		}
+
+		if ( log->callsites != NULL )
+			log->allocator->free(t, log->callsites);
+		log->callsites = new_table;
+		log->callsites_capacity = new_capacity;
+	}
+
+	size_t mask = log->callsites_capacity - 1;
+	size_t slot = ((uintptr_t)loc->file ^ loc->line * 2654435761u) & mask;
+	while ( log->callsites[slot].file != NULL )
+	{
+		if ( log->callsites[slot].file == loc->file && log->callsites[slot].line == loc->line )
+			return log->callsites[slot].index;
+		slot = (slot + 1) & mask;
+	}
+
+	uint32_t index = log->n_callsites + 1;
+	hxr_binlog_begin_record_(t, log, HXR_BINLOG_CALLSITE_);
+	hxr_binlog_put_u32_(t, log, index);
+	hxr_binlog_put_u32_(t, log, (uint32_t)loc->line);
+	hxr_binlog_put_str_(t, log, loc->file);
+	hxr_binlog_put_str_(t, log, loc->func);
+	if ( hxr_binlog_end_record_(t, log) < 0 )
+		return 0;
+
+	log->callsites[slot].file  = loc->file;
+	log->callsites[slot].line  = loc->line;
+	log->callsites[slot].index = index;
+	log->n_callsites++;
+	return index;
+}
+
+// Writes the MSGID record for `id` if this session hasn't seen it yet.
+static int hxr_binlog_define_msgid_(hxr_thread *t, hxr_binlog *log, hxr_msgid id)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+	if ( id == HXR_MSGID_NONE )
+		return 1;
+
+	uint8_t bit = (uint8_t)(1u << (id % 8));
+	if ( log->msgids_defined[id / 8] & bit )
+		return 1;
+
+	hxr_binlog_begin_record_(t, log, HXR_BINLOG_MSGID_);
+	hxr_binlog_put_u32_(t, log, id);
+	hxr_binlog_put_str_(t, log, HXR(msgid_string)(id));
+	if ( hxr_binlog_end_record_(t, log) < 0 )
+		return 0;
+
+	log->msgids_defined[id / 8] |= bit;
+	return 1;
+}
+
+static ssize_t hxr_binlog_write_message_(hxr_thread *t, hxr_stream_ *stream, hxr_feedback_message *msg)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+	hxr_binlog *log = stream->impl;
+
+	hxr_msgid msgid = msg->id_handle;
+	if ( !hxr_binlog_define_msgid_(t, log, msgid) )
+		return -1;
+
+	uint32_t callsite = hxr_binlog_get_callsite_(t, log, &msg->loc);
+	if ( callsite == 0 )
+		return -1;
+
+	// An id that couldn't be interned (see `hxr_msgid_*`) has no handle to
+	// refer to, so it goes into the record itself.
+	const char *inline_id = NULL;
+	if ( msgid == HXR_MSGID_NONE && msg->id != NULL ) {
+		inline_id = msg->id;
+		msgid = HXR_BINLOG_INLINE_MSGID_;
+	}
+
+	hxr_binlog_begin_record_(t, log, HXR_BINLOG_MESSAGE_);
+	hxr_binlog_put_u32_(t, log, msg->type_and_flags);
+	hxr_binlog_put_u32_(t, log, msgid);
+	hxr_binlog_put_u32_(t, log, callsite);
+	hxr_binlog_put_u32_(t, log, (uint32_t)msg->repeat_count);
+	hxr_binlog_put_u64_(t, log, msg->first_time);
+	hxr_binlog_put_u64_(t, log, msg->last_time);
+	if ( inline_id != NULL )
+		hxr_binlog_put_str_(t, log, inline_id);
+	hxr_binlog_put_section_(t, log, &msg->summary);
+	hxr_binlog_put_section_(t, log, &msg->details);
+	hxr_binlog_put_section_(t, log, &msg->suggestion);
+	return hxr_binlog_end_record_(t, log);
+}
+
+static ssize_t hxr_binlog_write_text_(hxr_thread *t, hxr_stream_ *stream, const char *text)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_binlog *log = stream->impl;
+	hxr_binlog_begin_record_(t, log, HXR_BINLOG_TEXT_);
+	hxr_binlog_put_str_(t, log, text);
+	return hxr_binlog_end_record_(t, log);
+}
+
+static ssize_t hxr_binlog_write_line_(hxr_thread *t, hxr_stream_ *stream, const char *text)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_binlog *log = stream->impl;
+	hxr_binlog_begin_record_(t, log, HXR_BINLOG_TEXT_);
+	size_t len = 0;
+	while ( text[len] != '\0' )
+		len++;
+	hxr_binlog_put_(t, log, text, len);
+	hxr_binlog_put_(t, log, "\n", 2);
+	return hxr_binlog_end_record_(t, log);
+}
+
+static ssize_t hxr_binlog_write_fmtstr_(hxr_thread *t, hxr_stream_ *stream, const char *fmtstr, va_list vargs)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_binlog *log = stream->impl;
+
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+
+	// Plain text isn't worth deferring here; it isn't part of a message.
+	size_t len;
+	char *text = hxr_scratch_vformat_(t, &timpl->format_scratch, timpl->allocator, fmtstr, vargs, &len);
+	if ( text == NULL )
+		return -1;
+
+	hxr_binlog_begin_record_(t, log, HXR_BINLOG_TEXT_);
+	unsigned char *dst = hxr_binlog_reserve_(t, log, len + 1);
+	if ( dst != NULL )
+		hxr_copy_bytes_(dst, text, len + 1);
+	hxr_scratch_release_(t, &timpl->format_scratch, timpl->allocator, text);
+	if ( dst == NULL ) {
+		hxr_binlog_abandon_record_(log);
+		return -1;
+	}
+	return hxr_binlog_end_record_(t, log);
+}
+
+static ssize_t hxr_binlog_write_iov_(hxr_thread *t, hxr_stream_ *stream, const hxr_iovec_ *iov, size_t iov_count)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_binlog *log = stream->impl;
+	hxr_binlog_begin_record_(t, log, HXR_BINLOG_TEXT_);
+	for ( size_t i = 0; i < iov_count; i++ )
+		hxr_binlog_put_(t, log, iov[i].base, iov[i].len);
+	hxr_binlog_put_u8_(t, log, 0);
+	return hxr_binlog_end_record_(t, log);
+}
+
+static void hxr_binlog_module_init_()
+{
+	hxr_binlog_vtbl_.write_line    = &hxr_binlog_write_line_;
+	hxr_binlog_vtbl_.write_text    = &hxr_binlog_write_text_;
+	hxr_binlog_vtbl_.write_fmtstr  = &hxr_binlog_write_fmtstr_;
+	hxr_binlog_vtbl_.write_iov     = &hxr_binlog_write_iov_;
+	hxr_binlog_vtbl_.write_message = &hxr_binlog_write_message_;
+}
+
+hxr_binlog *HXR(binlog_open_)(hxr_thread *t, FILE *fd, hxr_source_location_ loc)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+	hxr_allocator *allocator = timpl->allocator;
+
+	hxr_binlog *log = allocator->allocate(t, sizeof(hxr_binlog));
+	if ( log == NULL )
+		return NULL;
+
+	size_t bitmap_size = (HXR_MESSAGE_ID_TABLE_SIZE + 1 + 7) / 8;
+	log->msgids_defined = allocator->allocate(t, bitmap_size);
+	if ( log->msgids_defined == NULL ) {
+		allocator->free(t, log);
+		return NULL;
+	}
+	for ( size_t i = 0; i < bitmap_size; i++ )
+		log->msgids_defined[i] = 0;
+
+	hxr_stream_init_(t, &log->stream, loc);
+	log->stream.vtable       = &hxr_binlog_vtbl_;
+	log->stream.impl         = log;
+	log->fd                  = fd;
+	log->allocator           = allocator;
+	log->buf                 = NULL;
+	log->buf_len             = 0;
+	log->buf_capacity        = 0;
+	log->alloc_failed        = 0;
+	log->callsites           = NULL;
+	log->callsites_capacity  = 0;
+	log->n_callsites         = 0;
+
+	static const char magic[8] = "HXRBLOG";
+	hxr_binlog_begin_record_(t, log, HXR_BINLOG_SESSION_);
+	hxr_binlog_put_(t, log, magic, sizeof(magic));
+	hxr_binlog_put_u32_(t, log, HXR_BINLOG_VERSION_);
+	hxr_binlog_put_u32_(t, log, 0x01020304);
+	hxr_binlog_put_u64_(t, log, hxr_libc_vtbl_instance_.timestamp());
+	hxr_binlog_end_record_(t, log);
+	return log;
+}
+
+void HXR(binlog_close_)(hxr_thread *t, hxr_binlog *log, hxr_source_location_ loc)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	if ( log == NULL )
+		return;
+
+	fflush(log->fd);
+	hxr_stream_finalize_(t, &log->stream, loc);
+	hxr_allocator *allocator = log->allocator;
+	if ( log->buf != NULL )
+		allocator->free(t, log->buf);
+	if ( log->callsites != NULL )
+		allocator->free(t, log->callsites);
+	allocator->free(t, log->msgids_defined);
+	allocator->free(t, log);
+}
+
+int HXR(binlog_message)(hxr_thread *t, hxr_binlog *log, hxr_feedback_message *msg)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	return hxr_send_message_(t, &log->stream, msg) < 0 ? -1 : 0;
+}
+
+size_t HXR(binlog_messages)(hxr_thread *t, hxr_binlog *log)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	size_t n_written = 0;
+	hxr_feedback_message *msg;
+	while ( HXR(msg_next)(t, &msg) )
+		if ( hxr_send_message_(t, &log->stream, msg) >= 0 )
+			n_written++;
+	return n_written;
+}
+
+#endif // HXR_ENABLE_FILE_IO
+
+// ===== Buffered Descriptor Stream : hxr_fdstream_* =====
+// Text output to a raw file descriptor that gathers a message (or a batch of
+// them) and hands it to the kernel with a single `writev`.
+//
+// Pieces of text are queued as iovecs. Short pieces are copied into `buf`,
+// and consecutive copies share one iovec. While a message is being written
+// (`in_message`), pieces of at least HXR_FDSTREAM_DIRECT_MIN_ bytes are
+// queued where they are instead of being copied: they belong to the message,
+// which stays put until `hxr_fdstream_write_message_` returns, so that
+// function always flushes before returning if it queued any.
+
+#if HXR_ENABLE_FD_STREAM
+
+#include <errno.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define HXR_FDSTREAM_MAX_IOV_     (64)
+#define HXR_FDSTREAM_DIRECT_MIN_  (1024)
+
+struct S_HXR_FDSTREAM
+{
+	hxr_stream_      stream;
+	int              fd;
+	hxr_allocator    *allocator;
+	int              flush_policy;     // HXR_FDSTREAM_FLUSH_*
+	size_t           flush_threshold;
+
+	char             *buf;             // HXR_FD_STREAM_BUFFER_SIZE bytes.
+	size_t           buf_len;
+
+	struct iovec     iov[HXR_FDSTREAM_MAX_IOV_];
+	int              iov_count;
+	size_t           pending;          // Total bytes queued in `iov`.
+
+	uint8_t          in_message;
+	uint8_t          has_direct;       // `iov` points outside of `buf`.
+	uint8_t          error;            // A write failed; drop everything.
+};
+
+static hxr_stream_vtbl_  hxr_fdstream_vtbl_;
+
+static int hxr_fdstream_flush_(hxr_thread *t, hxr_fdstream *out)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_NORMAL);
+	struct iovec  *iov = out->iov;
+	int           iov_count = out->iov_count;
+
+	while ( iov_count > 0 && !out->error )
+	{
+		ssize_t rc = writev(out->fd, iov, iov_count);
+		if ( rc < 0 ) {
+			if ( errno == EINTR )
+				continue;
+			out->error = 1;
+			break;
+		}
+
+		// Partial write: skip what was written and go again.
+		size_t written = (size_t)rc;
+		while ( iov_count > 0 && written >= iov->iov_len ) {
+			written -= iov->iov_len;
+			iov++;
+			iov_count--;
+		}
+		if ( iov_count > 0 ) {
+			iov->iov_base = (char*)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+
+	out->iov_count  = 0;
+	out->pending    = 0;
+	out->buf_len    = 0;
+	out->has_direct = 0;
+	return out->error ? -1 : 0;
+}
+
+static void hxr_fdstream_push_iov_(hxr_thread *t, hxr_fdstream *out, const char *ptr, size_t len)
+{
+	if ( out->iov_count == HXR_FDSTREAM_MAX_IOV_ )
+		hxr_fdstream_flush_(t, out);
+	out->iov[out->iov_count].iov_base = (void*)ptr;
+	out->iov[out->iov_count].iov_len  = len;
+	out->iov_count++;
+	out->pending += len;
+}
+
+// Copies `len` bytes into the buffer, flushing first if they don't fit.
+// `len` must be at most HXR_FD_STREAM_BUFFER_SIZE.
+static void hxr_fdstream_copy_(hxr_thread *t, hxr_fdstream *out, const char *text, size_t len)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+	// Flushing resets the buffer, so it can't happen once `text` is in it.
+	if ( len > HXR_FD_STREAM_BUFFER_SIZE - out->buf_len || out->iov_count == HXR_FDSTREAM_MAX_IOV_ )
+		hxr_fdstream_flush_(t, out);
+
+	char *dest = out->buf + out->buf_len;
+	hxr_copy_bytes_(dest, text, len);
+	out->buf_len += len;
+
+	struct iovec *last = out->iov_count > 0 ? &out->iov[out->iov_count-1] : NULL;
+	if ( last != NULL && (char*)last->iov_base + last->iov_len == dest ) {
+		last->iov_len += len;
+		out->pending  += len;
+	}
+	else
+		hxr_fdstream_push_iov_(t, out, dest, len);
+}
+
+static ssize_t hxr_fdstream_put_(hxr_thread *t, hxr_fdstream *out, const char *text, size_t len)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+	if ( out->error )
+		return -1;
+	if ( len == 0 )
+		return 0;
+
+	if ( len < HXR_FDSTREAM_DIRECT_MIN_ && len <= HXR_FD_STREAM_BUFFER_SIZE )
+		hxr_fdstream_copy_(t, out, text, len);
+	else if ( out->in_message ) {
+		hxr_fdstream_push_iov_(t, out, text, len);
+		out->has_direct = 1;
+	}
+	else {
+		// Nothing keeps `text` alive once we return, so write it now.
+		hxr_fdstream_push_iov_(t, out, text, len);
+		hxr_fdstream_flush_(t, out);
+	}
+
+	if ( out->error )
+		return -1;
+	return (ssize_t)len;
+}
+
+static int hxr_fdstream_should_flush_(hxr_fdstream *out)
+{
+	if ( out->has_direct )
+		return 1;
+	switch ( out->flush_policy )
+	{
+		case HXR_FDSTREAM_FLUSH_EACH_MESSAGE: return 1;
+		case HXR_FDSTREAM_FLUSH_THRESHOLD:    return out->pending >= out->flush_threshold;
+		default:                              return 0;
+	}
+}
+
+static ssize_t hxr_fdstream_write_text_(hxr_thread *t, hxr_stream_ *stream, const char *text)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_fdstream *out = stream->impl;
+	size_t len = 0;
+	while ( text[len] != '\0' )
+		len++;
+	ssize_t rc = hxr_fdstream_put_(t, out, text, len);
+	if ( rc >= 0 && !out->in_message && hxr_fdstream_should_flush_(out) )
+		hxr_fdstream_flush_(t, out);
+	return out->error ? -1 : rc;
+}
+
+static ssize_t hxr_fdstream_write_line_(hxr_thread *t, hxr_stream_ *stream, const char *text)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_fdstream *out = stream->impl;
+	size_t len = 0;
+	while ( text[len] != '\0' )
+		len++;
+	ssize_t rc = hxr_fdstream_put_(t, out, text, len);
+	if ( rc >= 0 )
+		rc = hxr_fdstream_put_(t, out, "\n", 1) < 0 ? -1 : rc + 1;
+	if ( rc >= 0 && !out->in_message && hxr_fdstream_should_flush_(out) )
+		hxr_fdstream_flush_(t, out);
+	return out->error ? -1 : rc;
+}
+
+static ssize_t hxr_fdstream_write_fmtstr_(hxr_thread *t, hxr_stream_ *stream, const char *fmtstr, va_list vargs)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_fdstream *out = stream->impl;
+	if ( out->error )
+		return -1;
+
+	if ( out->iov_count == HXR_FDSTREAM_MAX_IOV_ )
+		hxr_fdstream_flush_(t, out);
+
+	// Format straight into the buffer's free space.
+	size_t available = HXR_FD_STREAM_BUFFER_SIZE - out->buf_len;
+	va_list vargs_consumable;
+	va_copy(vargs_consumable, vargs);
+	int len = hxr_libc_vtbl_instance_.vsnprintf(out->buf + out->buf_len, available, fmtstr, vargs_consumable);
+	va_end(vargs_consumable);
+	if ( len < 0 )
+		return -1;
+
+	if ( (size_t)len < available )
+	{
+		// Already in place; this just claims it.
+		char *dest = out->buf + out->buf_len;
+		struct iovec *last = out->iov_count > 0 ? &out->iov[out->iov_count-1] : NULL;
+		out->buf_len += (size_t)len;
+		if ( last != NULL && (char*)last->iov_base + last->iov_len == dest ) {
+			last->iov_len += (size_t)len;
+			out->pending  += (size_t)len;
+		}
+		else if ( len > 0 )
+			hxr_fdstream_push_iov_(t, out, dest, (size_t)len);
+
+		if ( !out->in_message && hxr_fdstream_should_flush_(out) )
+			hxr_fdstream_flush_(t, out);
+		return out->error ? -1 : len;
+	}
+
+	// Didn't fit. Format it on the side and write it from there. The scratch
+	// buffer gets reused, so the text can't be left queued.
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+	size_t text_len;
+	char *text = hxr_scratch_vformat_(t, &timpl->format_scratch, timpl->allocator, fmtstr, vargs, &text_len);
+	if ( text == NULL )
+		return -1;
+	if ( text_len <= HXR_FD_STREAM_BUFFER_SIZE ) {
+		hxr_fdstream_flush_(t, out);
+		hxr_fdstream_copy_(t, out, text, text_len);
+		if ( !out->in_message && hxr_fdstream_should_flush_(out) )
+			hxr_fdstream_flush_(t, out);
+	}
+	else {
+		hxr_fdstream_push_iov_(t, out, text, text_len);
+		hxr_fdstream_flush_(t, out);
+	}
+	hxr_scratch_release_(t, &timpl->format_scratch, timpl->allocator, text);
+	return out->error ? -1 : len;
+}
+
+static ssize_t hxr_fdstream_write_iov_(hxr_thread *t, hxr_stream_ *stream, const hxr_iovec_ *iov, size_t iov_count)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_fdstream *out = stream->impl;
+	size_t total = 0;
+	for ( size_t i = 0; i < iov_count; i++ ) {
+		if ( hxr_fdstream_put_(t, out, iov[i].base, iov[i].len) < 0 )
+			return -1;
+		total += iov[i].len;
+	}
+	if ( !out->in_message && hxr_fdstream_should_flush_(out) )
+		hxr_fdstream_flush_(t, out);
+	return out->error ? -1 : (ssize_t)total;
+}
+
+static ssize_t hxr_fdstream_write_message_(hxr_thread *t, hxr_stream_ *stream, hxr_feedback_message *msg)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_fdstream *out = stream->impl;
+	if ( out->error )
+		return -1;
+
+	out->in_message = 1;
+	ssize_t rc = hxr_send_message_text_(t, stream, msg);
+	out->in_message = 0;
+
+	if ( hxr_fdstream_should_flush_(out) )
+		hxr_fdstream_flush_(t, out);
+	return out->error ? -1 : rc;
+}
+
+static void hxr_fdstream_module_init_()
+{
+	hxr_fdstream_vtbl_.write_line    = &hxr_fdstream_write_line_;
+	hxr_fdstream_vtbl_.write_text    = &hxr_fdstream_write_text_;
+	hxr_fdstream_vtbl_.write_fmtstr  = &hxr_fdstream_write_fmtstr_;
+	hxr_fdstream_vtbl_.write_iov     = &hxr_fdstream_write_iov_;
+	hxr_fdstream_vtbl_.write_message = &hxr_fdstream_write_message_;
+}
+
+hxr_fdstream *HXR(fdstream_open_)(hxr_thread *t, int fd, hxr_source_location_ loc)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+	hxr_allocator *allocator = timpl->allocator;
+
+	hxr_fdstream *out = allocator->allocate(t, sizeof(hxr_fdstream));
+	if ( out == NULL )
+		return NULL;
+	out->buf = allocator->allocate(t, HXR_FD_STREAM_BUFFER_SIZE);
+	if ( out->buf == NULL ) {
+		allocator->free(t, out);
+		return NULL;
+	}
+
+	hxr_stream_init_(t, &out->stream, loc);
+	out->stream.vtable    = &hxr_fdstream_vtbl_;
+	out->stream.impl      = out;
+	out->fd               = fd;
+	out->allocator        = allocator;
+	out->flush_policy     = HXR_FDSTREAM_FLUSH_EACH_MESSAGE;
+	out->flush_threshold  = HXR_FD_STREAM_BUFFER_SIZE;
+	out->buf_len          = 0;
+	out->iov_count        = 0;
+	out->pending          = 0;
+	out->in_message       = 0;
+	out->has_direct       = 0;
+	out->error            = 0;
+	return out;
+}
+
+void HXR(fdstream_close_)(hxr_thread *t, hxr_fdstream *out, hxr_source_location_ loc)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	if ( out == NULL )
+		return;
+
+	hxr_fdstream_flush_(t, out);
+	hxr_stream_finalize_(t, &out->stream, loc);
+	hxr_allocator *allocator = out->allocator;
+	allocator->free(t, out->buf);
+	allocator->free(t, out);
+}
+
+void HXR(fdstream_set_flush_policy)(hxr_thread *t, hxr_fdstream *out, int policy, size_t threshold)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	// An unknown policy would otherwise never flush (see
+	// `hxr_fdstream_should_flush_`), so it gets the default instead.
+	if ( policy < HXR_FDSTREAM_FLUSH_EACH_MESSAGE || policy > HXR_FDSTREAM_FLUSH_EXPLICIT )
+		policy = HXR_FDSTREAM_FLUSH_EACH_MESSAGE;
+	out->flush_policy    = policy;
+	out->flush_threshold = threshold != 0 ? threshold : HXR_FD_STREAM_BUFFER_SIZE;
+}
+
+int HXR(fdstream_flush)(hxr_thread *t, hxr_fdstream *out)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	return hxr_fdstream_flush_(t, out);
+}
+
+int HXR(fdstream_message)(hxr_thread *t, hxr_fdstream *out, hxr_feedback_message *msg)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	return hxr_send_message_(t, &out->stream, msg) < 0 ? -1 : 0;
+}
+
+size_t HXR(fdstream_messages)(hxr_thread *t, hxr_fdstream *out)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	size_t n_written = 0;
+	hxr_feedback_message *msg;
+	while ( HXR(msg_next)(t, &msg) )
+		if ( hxr_send_message_(t, &out->stream, msg) >= 0 )
+			n_written++;
+	return n_written;
+}
+
+#endif // HXR_ENABLE_FD_STREAM
+
+// ===== Asynchronous Writer : hxr_async_* =====
+// Optional background thread that does the formatting and `fwrite`-ing for
+// `hxr_print_messages`, so threads that report messages stay off the I/O path.
+// See `hxr_async_start`.
+//
+// Messages can't be handed over as-is, because they live in their thread's
+// message arena, and that gets rewound by `hxr_clear_messages`. Instead, each
+// one is "detached": copied into a single allocation along with its text.
+// Deferred (`_fmt`) text stays deferred; only the format string and argument
+// values are copied. The writer thread renders it.
+//
+// The handoff is a bounded multi-producer/single-consumer ring of
+// `HXR_ASYNC_QUEUE_CAPACITY` cells, where each cell has a sequence number
+// that says whose turn it is to use the cell (Dmitry Vyukov's bounded queue).
+// Producers claim a position with a CAS on `enqueue_pos`, fill the cell, and
+// publish it by bumping its sequence number. No locks are taken on that path.
+// The mutex and condition variables are only used for sleeping: by the
+// writer when the ring is empty, and by `hxr_flush` callers and producers
+// that found the ring full.
+//
+// When the ring is full, producers wait for the writer to make room. That
+// (plus one detached message per cell) is what bounds the memory.
+
+#if HXR_ENABLE_ASYNC_WRITER
+
+#include <pthread.h>
+#include <time.h>
+
+#define HXR_ASYNC_QUEUE_MASK_       ((size_t)HXR_ASYNC_QUEUE_CAPACITY - 1)
+
+// The writer calls `fflush` and wakes up `hxr_flush` callers at least this
+// often while it's busy, as well as every time the ring runs dry.
+#define HXR_ASYNC_FLUSH_INTERVAL_   (256)
+
+typedef struct S_HXR__ASYNC_CELL
+{
+	size_t                seq;
+	hxr_feedback_message  *msg;
+} hxr_async_cell_;
+
+typedef struct S_HXR__ASYNC_WRITER
+{
+	hxr_async_cell_   *cells;
+	FILE              *fd;
+	hxr_thread        *writer;       // The writer's own thread state; see `hxr_async_start`.
+	pthread_t         thread;
+	uint8_t           running;
+
+	// Producer side. Kept apart from the consumer side so that the writer
+	// and the producers don't keep stealing each other's cache line.
+	char              pad0_[64];
+	size_t            enqueue_pos;
+
+	// Consumer side.
+	char              pad1_[64];
+	size_t            dequeue_pos;  // Only touched by the writer thread.
+	size_t            completed;    // Positions below this are written and flushed.
+	size_t            sleeping;     // Writer is (about to be) waiting on `wake`.
+	size_t            stopping;
+
+	pthread_mutex_t   mutex;
+	pthread_cond_t    wake;         // Signaled when there's work for the writer.
+	pthread_cond_t    done;         // Broadcast whenever `completed` advances.
+} hxr_async_writer_;
+
+static hxr_async_writer_  hxr_async_writer_instance_;
+
+// Returns the number of bytes needed by the `%s` arguments in `args`, if
+// `cursor` is NULL. Otherwise, copies each of them to `*cursor` (advancing it)
+// and points the argument at the copy.
+static size_t hxr_fmtargs_relocate_strings_(const char *fmtstr, unsigned char *args, char **cursor)
+{
+	size_t total = 0;
+	unsigned char *in = args;
+	const char *p = fmtstr;
+	while ( *p != '\0' )
+	{
+		if ( *p != '%' ) {
+			p++;
+			continue;
+		}
+
+		hxr_fmtspec_ spec;
+		hxr_fmtspec_parse_(p, &spec);
+		p = spec.end;
+		in += spec.n_stars * sizeof(int);
+
+		if ( spec.arg_class != HXR_FMTARG_STRING_ ) {
+			in += hxr_fmtarg_size_(spec.arg_class);
+			continue;
+		}
+
+		const char *str;
+		hxr_copy_bytes_(&str, in, sizeof(const char*));
+		if ( str != NULL )
+		{
+			size_t len = 0;
+			while ( str[len] != '\0' )
+				len++;
+			total += len + 1;
+
+			if ( cursor != NULL ) {
+				char *copy = *cursor;
+				hxr_copy_bytes_(copy, str, len + 1);
+				*cursor += len + 1;
+				hxr_copy_bytes_(in, &copy, sizeof(const char*));
+			}
+		}
+		in += sizeof(const char*);
+	}
+	return total;
+}
+
+static size_t hxr_message_text_detached_size_(const hxr_message_text_ *mt)
+{
+	size_t total = 0;
+	if ( mt->text != NULL ) {
+		while ( mt->text[total] != '\0' )
+			total++;
+		return total + 1;
+	}
+	if ( mt->fmtstr != NULL ) {
+		while ( mt->fmtstr[total] != '\0' )
+			total++;
+		total += 1 + hxr_fmtargs_measure_(mt->fmtstr);
+		total += hxr_fmtargs_relocate_strings_(mt->fmtstr, (unsigned char*)mt->args, NULL);
+	}
+	return total;
+}
+
+static void hxr_message_text_detach_(hxr_message_text_ *dst, const hxr_message_text_ *src, char **cursor)
+{
+	hxr_message_text_init_(dst);
+	if ( src->text != NULL ) {
+		size_t len = 0;
+		while ( src->text[len] != '\0' )
+			len++;
+		hxr_copy_bytes_(*cursor, src->text, len + 1);
+		dst->text = *cursor;
+		*cursor += len + 1;
+	} else
+	if ( src->fmtstr != NULL ) {
+		size_t fmtlen = 0;
+		while ( src->fmtstr[fmtlen] != '\0' )
+			fmtlen++;
+		hxr_copy_bytes_(*cursor, src->fmtstr, fmtlen + 1);
+		dst->fmtstr = *cursor;
+		*cursor += fmtlen + 1;
+
+		size_t args_size = hxr_fmtargs_measure_(src->fmtstr);
+		unsigned char *args = (unsigned char*)*cursor;
+		hxr_copy_bytes_(args, src->args, args_size);
+		dst->args = args;
+		*cursor += args_size;
+		hxr_fmtargs_relocate_strings_(dst->fmtstr, args, cursor);
+	}
+}
+
+// Copies `msg` and everything it points to into one allocation that can be
+// freed with `hxr_default_free`, and that no longer depends on `t`'s arena.
+static hxr_feedback_message *hxr_message_detach_(hxr_thread *t, const hxr_feedback_message *msg)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+
+	// Interned ids live as long as the process; only arena copies need copying.
+	const char *id = msg->id;
+	size_t id_size = 0;
+	if ( id != NULL && msg->id_handle == HXR_MSGID_NONE ) {
+		while ( id[id_size] != '\0' )
+			id_size++;
+		id_size++;
+	}
+
+	// The stack trace's frames go right after the message, where they're
+	// aligned. Its text is rendered again if it's needed.
+	size_t stack_size = 0;
+#if HXR_STACK_TRACES_
+	stack_size = msg->stack_depth * sizeof(msg->stack[0]);
+#endif
+
+	size_t total = sizeof(hxr_feedback_message) + stack_size + id_size
+		+ hxr_message_text_detached_size_(&msg->summary)
+		+ hxr_message_text_detached_size_(&msg->details)
+		+ hxr_message_text_detached_size_(&msg->suggestion);
+
+	hxr_feedback_message *copy = hxr_default_malloc(t, total);
+	if ( copy == NULL )
+		return NULL;
+
+	*copy = *msg;
+	copy->next = NULL;
+	char *cursor = (char*)(copy + 1);
+#if HXR_STACK_TRACES_
+	if ( stack_size > 0 ) {
+		hxr_copy_bytes_(cursor, msg->stack, stack_size);
+		copy->stack = (const void**)cursor;
+		cursor += stack_size;
+	}
+	copy->stack_text = NULL;
+#endif
+	if ( id_size > 0 ) {
+		hxr_copy_bytes_(cursor, id, id_size);
+		copy->id = cursor;
+		cursor += id_size;
+	}
+	hxr_message_text_detach_(&copy->summary,    &msg->summary,    &cursor);
+	hxr_message_text_detach_(&copy->details,    &msg->details,    &cursor);
+	hxr_message_text_detach_(&copy->suggestion, &msg->suggestion, &cursor);
+	return copy;
+}
+
+static void hxr_async_wake_writer_(hxr_async_writer_ *w)
+{
+	if ( hxr_atomic_load_size_(&w->sleeping) ) {
+		pthread_mutex_lock(&w->mutex);
+		pthread_cond_signal(&w->wake);
+		pthread_mutex_unlock(&w->mutex);
+	}
+}
+
+static void hxr_async_enqueue_(hxr_async_writer_ *w, hxr_feedback_message *msg)
+{
+	size_t pos = hxr_atomic_load_size_(&w->enqueue_pos);
+	hxr_async_cell_ *cell;
+	for (;;)
+	{
+		cell = &w->cells[pos & HXR_ASYNC_QUEUE_MASK_];
+		size_t seq = hxr_atomic_load_size_(&cell->seq);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+		if ( diff == 0 ) {
+			size_t prev = hxr_atomic_cas_size_(&w->enqueue_pos, pos, pos + 1);
+			if ( prev == pos )
+				break;
+			pos = prev;
+		} else
+		if ( diff < 0 ) {
+			// Full. Block until the writer has made room. Nothing is dropped:
+			// a producer that outruns the writer waits for it, like `hxr_flush`.
+			// The writer frees cells before it broadcasts `done` (under the
+			// mutex), so checking again under the mutex can't miss the wakeup.
+			pthread_mutex_lock(&w->mutex);
+			if ( hxr_atomic_load_size_(&cell->seq) == seq ) {
+				pthread_cond_signal(&w->wake);
+				pthread_cond_wait(&w->done, &w->mutex);
+			}
+			pthread_mutex_unlock(&w->mutex);
+			pos = hxr_atomic_load_size_(&w->enqueue_pos);
+		} else {
+			pos = hxr_atomic_load_size_(&w->enqueue_pos);
+		}
+	}
+
+	cell->msg = msg;
+	hxr_atomic_store_size_(&cell->seq, pos + 1);
+	hxr_async_wake_writer_(w);
+}
+
+// Returns the next message, or NULL if the ring is empty (or the next
+// producer in line hasn't finished publishing its message yet).
+static hxr_feedback_message *hxr_async_dequeue_(hxr_async_writer_ *w)
+{
+	hxr_async_cell_ *cell = &w->cells[w->dequeue_pos & HXR_ASYNC_QUEUE_MASK_];
+	if ( hxr_atomic_load_size_(&cell->seq) != w->dequeue_pos + 1 )
+		return NULL;
+
+	hxr_feedback_message *msg = cell->msg;
+	hxr_atomic_store_size_(&cell->seq, w->dequeue_pos + HXR_ASYNC_QUEUE_CAPACITY);
+	w->dequeue_pos++;
+	return msg;
+}
+
+static void hxr_async_publish_completed_(hxr_async_writer_ *w)
+{
+	fflush(w->fd);
+	pthread_mutex_lock(&w->mutex);
+	hxr_atomic_store_size_(&w->completed, w->dequeue_pos);
+	pthread_cond_broadcast(&w->done);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+static void *hxr_async_writer_main_(void *arg)
+{
+	hxr_async_writer_ *w = arg;
+	hxr_thread  *t = w->writer;
+
+	hxr_stream_  stream;
+	FSTREAM_INIT(t, &stream);
+	fstream_set_fd(t, &stream, w->fd);
+
+	size_t since_flush = 0;
+	for (;;)
+	{
+		hxr_feedback_message *msg = hxr_async_dequeue_(w);
+		if ( msg != NULL )
+		{
+			hxr_send_message_(t, &stream, msg);
+			hxr_default_free(t, msg);
+
+			// Rendering deferred text used the writer's own arena.
+			HXR(clear_messages)(t);
+
+			if ( ++since_flush < HXR_ASYNC_FLUSH_INTERVAL_ )
+				continue;
+		}
+
+		since_flush = 0;
+		hxr_async_publish_completed_(w);
+		if ( msg != NULL )
+			continue;
+
+		// The ring looks empty. Sleep until a producer (or `hxr_flush`, or
+		// `hxr_stop`) wakes us. `sleeping` is set before the last look at the
+		// ring, so a producer that publishes after that look will see it and
+		// signal; the mutex makes sure the signal can't arrive before the wait.
+		pthread_mutex_lock(&w->mutex);
+		hxr_atomic_store_size_(&w->sleeping, 1);
+		hxr_async_cell_ *next = &w->cells[w->dequeue_pos & HXR_ASYNC_QUEUE_MASK_];
+		int empty = (hxr_atomic_load_size_(&next->seq) != w->dequeue_pos + 1);
+		if ( empty && hxr_atomic_load_size_(&w->stopping) ) {
+			pthread_mutex_unlock(&w->mutex);
+			break;
+		}
+		if ( empty ) {
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_nsec += 100 * 1000 * 1000;
+			if ( deadline.tv_nsec >= 1000000000 ) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&w->wake, &w->mutex, &deadline);
+		}
+		hxr_atomic_store_size_(&w->sleeping, 0);
+		pthread_mutex_unlock(&w->mutex);
+	}
+
+	FSTREAM_FINALIZE(t, &stream);
+	w->writer = NULL;
+	hxr_thread_destroy_(t);
+	return NULL;
+}
+
+int HXR(async_start)(hxr_thread *t, FILE *fd)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_async_writer_ *w = &hxr_async_writer_instance_;
+	if ( w->running )
+		return -1;
+
+	w->cells = hxr_default_malloc(t, HXR_ASYNC_QUEUE_CAPACITY * sizeof(hxr_async_cell_));
+	if ( w->cells == NULL )
+		return -1;
+
+	// The writer gets a thread of its own, made from (and with the message
+	// format of) `t`. The writer destroys it when it exits.
+	w->writer = hxr_thread_create_(t);
+	if ( w->writer == NULL ) {
+		hxr_default_free(t, w->cells);
+		w->cells = NULL;
+		return -1;
+	}
+	for ( size_t i = 0; i < HXR_ASYNC_QUEUE_CAPACITY; i++ )
+		w->cells[i].seq = i;
+
+	w->fd          = fd;
+	w->enqueue_pos = 0;
+	w->dequeue_pos = 0;
+	w->completed   = 0;
+	w->sleeping    = 0;
+	w->stopping    = 0;
+	pthread_mutex_init(&w->mutex, NULL);
+	pthread_cond_init(&w->wake, NULL);
+	pthread_cond_init(&w->done, NULL);
+
+	if ( pthread_create(&w->thread, NULL, &hxr_async_writer_main_, w) != 0 ) {
+		pthread_cond_destroy(&w->done);
+		pthread_cond_destroy(&w->wake);
+		pthread_mutex_destroy(&w->mutex);
+		hxr_thread_destroy_(w->writer);
+		w->writer = NULL;
+		hxr_default_free(t, w->cells);
+		w->cells = NULL;
+		return -1;
+	}
+	w->running = 1;
+	return 0;
+}
+
+// Hands `msg` to the writer thread if it's running and writing to `fd`.
+// Returns 1 if it did, or 0 if the caller should print it itself.
+static int hxr_async_handoff_(hxr_thread *t, FILE *fd, hxr_feedback_message *msg)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_HOTPATH);
+	hxr_async_writer_ *w = &hxr_async_writer_instance_;
+	if ( !w->running || w->fd != fd || hxr_atomic_load_size_(&w->stopping) )
+		return 0;
+
+	hxr_feedback_message *copy = hxr_message_detach_(t, msg);
+	if ( copy == NULL )
+		return 0;
+
+	hxr_async_enqueue_(w, copy);
+	return 1;
+}
+
+void HXR(flush)(hxr_thread *t)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_async_writer_ *w = &hxr_async_writer_instance_;
+	if ( !w->running )
+		return;
+
+	size_t target = hxr_atomic_load_size_(&w->enqueue_pos);
+	pthread_mutex_lock(&w->mutex);
+	while ( hxr_atomic_load_size_(&w->completed) < target ) {
+		pthread_cond_signal(&w->wake);
+		pthread_cond_wait(&w->done, &w->mutex);
+	}
+	pthread_mutex_unlock(&w->mutex);
+}
+
+static void hxr_async_stop_(void)
+{
+	hxr_async_writer_ *w = &hxr_async_writer_instance_;
+	if ( !w->running )
+		return;
+
+	pthread_mutex_lock(&w->mutex);
+	hxr_atomic_store_size_(&w->stopping, 1);
+	pthread_cond_signal(&w->wake);
+	pthread_mutex_unlock(&w->mutex);
+	pthread_join(w->thread, NULL);
+
+	pthread_cond_destroy(&w->done);
+	pthread_cond_destroy(&w->wake);
+	pthread_mutex_destroy(&w->mutex);
+	HXR_FREE_DEFAULT(w->cells);
+	w->cells   = NULL;
+	w->running = 0;
+}
+
+#endif // HXR_ENABLE_ASYNC_WRITER
+
+// ===== Sink Graph : hxr_sink_* =====
+// Fans messages out to a list of sinks (see `hxr_sink_graph` in hexer.h).
+//
+// Text sinks are grouped by format as they are added, and each group has a
+// slot for the current message's text. The slot is filled the first time a
+// sink in the group accepts the message; every other sink in the group gets
+// the same `hxr_rendered_text`. The graph holds one reference to each text
+// it rendered until every sink has had the message, and a sink that keeps
+// the text (a callback that retains it) holds another.
+//
+// Text is rendered straight into the `hxr_rendered_text` allocation, by a
+// stream that grows it by doubling. The graph starts each text at the size
+// of the longest one so far, so after the first few messages it's a single
+// allocation and a single pass over the message per format.
+
+#if HXR_ENABLE_SYSLOG
+#include <syslog.h>
+#endif
+
+#define HXR_SINK_STREAM_    (0)   // Text, through the stream's `write_iov`.
+#define HXR_SINK_MESSAGE_   (1)   // The message itself, through `write_message`.
+#define HXR_SINK_SYSLOG_    (2)   // Text, through `vsyslog`.
+#define HXR_SINK_CALLBACK_  (3)   // Text, through the sink's handler.
+
+#define HXR_SINK_TEXT_MIN_  (256)
+
+// The text follows the header in the same allocation, null-terminated.
+struct S_HXR_RENDERED_TEXT
+{
+	size_t           refs;       // Only changed with `hxr_atomic_cas_size_`.
+	hxr_allocator    *allocator;
+	size_t           len;
+	size_t           capacity;   // Bytes after the header, terminator included.
+};
+
+typedef struct S_HXR__SINK
+{
+	uint8_t                kind;         // HXR_SINK_*_
+	uint8_t                group;        // Index into the graph's `formats`.
+	hxr_sink_spec          spec;
+	hxr_stream_            *stream;      // STREAM and MESSAGE sinks.
+	hxr_stream_            file_stream;  // What `stream` points to for files.
+	hxr_sink_text_handler  handler;
+	void                   *context;
+} hxr_sink_;
+
+struct S_HXR_SINK_GRAPH
+{
+	hxr_allocator             *allocator;
+	hxr_sink_                 sinks[HXR_SINK_GRAPH_MAX_SINKS];
+	size_t                    n_sinks;
+
+	// The distinct formats of the text sinks, and for each, the text of the
+	// message being sent (NULL until some sink with that format takes it).
+	const hxr_message_format  *formats[HXR_SINK_GRAPH_MAX_SINKS];
+	hxr_rendered_text         *texts[HXR_SINK_GRAPH_MAX_SINKS];
+	size_t                    n_formats;
+
+	// Capacity that every text starts with.
+	size_t                    text_capacity;
+};
+
+static inline char *hxr_rendered_text_buf_(const hxr_rendered_text *text)
+{
+	return (char*)(text + 1);
+}
+
+// ----- Rendering -----
+
+typedef struct S_HXR__SINK_RENDER
+{
+	hxr_rendered_text  *text;
+	uint8_t            failed;
+} hxr_sink_render_;
+
+static hxr_stream_vtbl_  hxr_sink_render_vtbl_;
+
+static ssize_t hxr_sink_render_write_iov_(hxr_thread *t, hxr_stream_ *stream, const hxr_iovec_ *iov, size_t iov_count)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_sink_render_ *r = stream->impl;
+	if ( r->failed )
+		return -1;
+
+	size_t total = 0;
+	for ( size_t i = 0; i < iov_count; i++ )
+		total += iov[i].len;
+
+	hxr_rendered_text *text = r->text;
+	if ( total >= text->capacity - text->len )
+	{
+		size_t capacity = text->capacity;
+		while ( total >= capacity - text->len )
+			capacity *= 2;
+		hxr_rendered_text *bigger = text->allocator->allocate(t, sizeof(hxr_rendered_text) + capacity);
+		if ( bigger == NULL ) {
+			r->failed = 1;
+			return -1;
+		}
+		*bigger = *text;
+		bigger->capacity = capacity;
+		hxr_copy_bytes_(hxr_rendered_text_buf_(bigger), hxr_rendered_text_buf_(text), text->len);
+		text->allocator->free(t, text);
+		r->text = text = bigger;
+	}
+
+	char *dest = hxr_rendered_text_buf_(text) + text->len;
+	for ( size_t i = 0; i < iov_count; i++ ) {
+		hxr_copy_bytes_(dest, iov[i].base, iov[i].len);
+		dest += iov[i].len;
+	}
+	text->len += total;
+	return (ssize_t)total;
+}
+
+static void hxr_sink_module_init_()
+{
+	hxr_sink_render_vtbl_.write_line    = &canary_stream_write_line;
+	hxr_sink_render_vtbl_.write_text    = &canary_stream_write_text;
+	hxr_sink_render_vtbl_.write_fmtstr  = &canary_stream_write_fmtstr;
+	hxr_sink_render_vtbl_.write_iov     = &hxr_sink_render_write_iov_;
+	hxr_sink_render_vtbl_.write_message = NULL;
+}
+
+// Returns: `msg` rendered with `fmt`, holding one reference, or NULL if
+// memory ran out.
+static hxr_rendered_text *hxr_sink_render_text_(hxr_thread *t, hxr_sink_graph *graph,
+	hxr_feedback_message *msg, const hxr_message_format *fmt)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	size_t capacity = graph->text_capacity;
+	hxr_rendered_text *text = graph->allocator->allocate(t, sizeof(hxr_rendered_text) + capacity);
+	if ( text == NULL )
+		return NULL;
+	text->refs      = 1;
+	text->allocator = graph->allocator;
+	text->len       = 0;
+	text->capacity  = capacity;
+
+	hxr_sink_render_ r;
+	r.text   = text;
+	r.failed = 0;
+
+	hxr_stream_ stream;
+	hxr_stream_init_(t, &stream, HXR_SOURCE_LOCATION_HERE_);
+	stream.vtable = &hxr_sink_render_vtbl_;
+	stream.impl   = &r;
+	hxr_send_message_formatted_(t, &stream, msg, fmt);
+	hxr_stream_finalize_(t, &stream, HXR_SOURCE_LOCATION_HERE_);
+
+	text = r.text;
+	if ( r.failed ) {
+		text->allocator->free(t, text);
+		return NULL;
+	}
+	hxr_rendered_text_buf_(text)[text->len] = '\0';
+	if ( text->capacity > graph->text_capacity )
+		graph->text_capacity = text->capacity;
+	return text;
+}
+
+const char *HXR(rendered_text_str)(const hxr_rendered_text *text)
+{
+	return hxr_rendered_text_buf_(text);
+}
+
+size_t HXR(rendered_text_len)(const hxr_rendered_text *text)
+{
+	return text->len;
+}
+
+void HXR(rendered_text_retain)(hxr_rendered_text *text)
+{
+	size_t refs = hxr_atomic_load_size_(&text->refs);
+	size_t seen;
+	while ( (seen = hxr_atomic_cas_size_(&text->refs, refs, refs + 1)) != refs )
+		refs = seen;
+}
+
+void HXR(rendered_text_release)(hxr_thread *t, hxr_rendered_text *text)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	size_t refs = hxr_atomic_load_size_(&text->refs);
+	size_t seen;
+	while ( (seen = hxr_atomic_cas_size_(&text->refs, refs, refs - 1)) != refs )
+		refs = seen;
+	if ( refs == 1 )
+		text->allocator->free(t, text);
+}
+
+// ----- Graph -----
+
+hxr_sink_graph *HXR(sink_graph_create)(hxr_thread *t)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_allocator *allocator = HXR(thread_get_impl_)(t)->allocator;
+	hxr_sink_graph *graph = allocator->allocate(t, sizeof(hxr_sink_graph));
+	if ( graph == NULL )
+		return NULL;
+	graph->allocator     = allocator;
+	graph->n_sinks       = 0;
+	graph->n_formats     = 0;
+	graph->text_capacity = HXR_SINK_TEXT_MIN_;
+	return graph;
+}
+
+void HXR(sink_graph_free)(hxr_thread *t, hxr_sink_graph *graph)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	if ( graph == NULL )
+		return;
+	for ( size_t i = 0; i < graph->n_sinks; i++ ) {
+		hxr_sink_ *sink = &graph->sinks[i];
+		if ( sink->stream == &sink->file_stream )
+			hxr_stream_finalize_(t, sink->stream, HXR_SOURCE_LOCATION_HERE_);
+	}
+	graph->allocator->free(t, graph);
+}
+
+// Returns: The new sink, or NULL if the graph is full.
+static hxr_sink_ *hxr_sink_add_(hxr_thread *t, hxr_sink_graph *graph, const hxr_sink_spec *spec, uint8_t kind)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	if ( graph->n_sinks == HXR_SINK_GRAPH_MAX_SINKS )
+	{
+		HXR_BEGIN_ERROR(t);
+			hxr_message_id(t, "sink_graph_full");
+			hxr_summary(t, "Too many sinks in one sink graph.");
+			hxr_details_fmt(t, "A sink graph can have at most %zd sinks (HXR_SINK_GRAPH_MAX_SINKS).",
+				(ssize_t)HXR_SINK_GRAPH_MAX_SINKS);
+			hxr_suggestion(t, "Use another sink graph for the rest of the outputs.");
+		HXR_END(t);
+		return NULL;
+	}
+
+	hxr_sink_ *sink = &graph->sinks[graph->n_sinks++];
+	sink->kind    = kind;
+	sink->group   = 0;
+	sink->spec    = *spec;
+	sink->stream  = NULL;
+	sink->handler = NULL;
+	sink->context = NULL;
+	if ( kind != HXR_SINK_MESSAGE_ )
+	{
+		size_t group = 0;
+		while ( group < graph->n_formats && graph->formats[group] != spec->format )
+			group++;
+		if ( group == graph->n_formats )
+			graph->formats[graph->n_formats++] = spec->format;
+		sink->group = (uint8_t)group;
+	}
+	return sink;
+}
+
+#if HXR_ENABLE_FILE_IO
+int HXR(sink_add_file)(hxr_thread *t, hxr_sink_graph *graph, const hxr_sink_spec *spec, FILE *fd)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_sink_ *sink = hxr_sink_add_(t, graph, spec, HXR_SINK_STREAM_);
+	if ( sink == NULL )
+		return -1;
+	FSTREAM_INIT(t, &sink->file_stream);
+	fstream_set_fd(t, &sink->file_stream, fd);
+	sink->stream = &sink->file_stream;
+	return 0;
+}
+
+int HXR(sink_add_binlog)(hxr_thread *t, hxr_sink_graph *graph, const hxr_sink_spec *spec, hxr_binlog *log)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_sink_ *sink = hxr_sink_add_(t, graph, spec, HXR_SINK_MESSAGE_);
+	if ( sink == NULL )
+		return -1;
+	sink->stream = &log->stream;
+	return 0;
+}
+#endif
+
+#if HXR_ENABLE_FD_STREAM
+int HXR(sink_add_fdstream)(hxr_thread *t, hxr_sink_graph *graph, const hxr_sink_spec *spec, hxr_fdstream *out)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_sink_ *sink = hxr_sink_add_(t, graph, spec, HXR_SINK_STREAM_);
+	if ( sink == NULL )
+		return -1;
+	sink->stream = &out->stream;
+	return 0;
+}
+#endif
+
+#if HXR_ENABLE_SYSLOG
+int HXR(sink_add_syslog)(hxr_thread *t, hxr_sink_graph *graph, const hxr_sink_spec *spec)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	return hxr_sink_add_(t, graph, spec, HXR_SINK_SYSLOG_) != NULL ? 0 : -1;
+}
+
+static void hxr_sink_syslog_(int priority, const char *fmtstr, ...)
+{
 	va_list vargs;
 	va_start(vargs, fmtstr);
-	ssize_t rc = stream->write_fmtstr(t, stream, fmtstr);
+	hxr_libc_vtbl_instance_.vsyslog(priority, fmtstr, vargs);
 	va_end(vargs);
+}
+#endif
+
+int HXR(sink_add_callback)(hxr_thread *t, hxr_sink_graph *graph, const hxr_sink_spec *spec,
+	hxr_sink_text_handler handler, void *context)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_sink_ *sink = hxr_sink_add_(t, graph, spec, HXR_SINK_CALLBACK_);
+	if ( sink == NULL )
+		return -1;
+	sink->handler = handler;
+	sink->context = context;
+	return 0;
+}
+
+// ----- Sending -----
+
+static int hxr_sink_accepts_(hxr_thread *t, const hxr_sink_ *sink, hxr_feedback_message *msg)
+{
+	if ( HXR_MSG_TYPE_EXTRACT(msg->type_and_flags) < sink->spec.min_type )
+		return 0;
+	if ( sink->spec.filter != NULL && !sink->spec.filter(t, sink->spec.filter_context, msg) )
+		return 0;
+	return 1;
+}
+
+static void hxr_sink_write_text_(hxr_thread *t, hxr_sink_ *sink, hxr_feedback_message *msg, hxr_rendered_text *text)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	const char *buf = hxr_rendered_text_buf_(text);
+	switch ( sink->kind )
+	{
+		case HXR_SINK_STREAM_:
+		{
+			hxr_iovec_ iov;
+			iov.base = buf;
+			iov.len  = text->len;
+			stream_write_iov(t, sink->stream, &iov, 1);
+			break;
+		}
+#if HXR_ENABLE_SYSLOG
+		case HXR_SINK_SYSLOG_:
+		{
+			// syslog ends the entry itself.
+			size_t len = text->len;
+			if ( len > 0 && buf[len-1] == '\n' )
+				len--;
+			int priority = LOG_INFO;
+			switch ( HXR_MSG_TYPE_EXTRACT(msg->type_and_flags) ) {
+				case HXR_MSG_TYPE_ERROR:   priority = LOG_ERR;     break;
+				case HXR_MSG_TYPE_WARNING: priority = LOG_WARNING; break;
+			}
+			hxr_sink_syslog_(priority, "%.*s", (int)len, buf);
+			break;
+		}
+#endif
+		case HXR_SINK_CALLBACK_:
+			sink->handler(t, sink->context, msg, text);
+			break;
+	}
+}
+
+int HXR(sink_graph_message)(hxr_thread *t, hxr_sink_graph *graph, hxr_feedback_message *msg)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	int n_taken = 0;
+	int render_failed = 0;
+	for ( size_t i = 0; i < graph->n_formats; i++ )
+		graph->texts[i] = NULL;
+
+	for ( size_t i = 0; i < graph->n_sinks; i++ )
+	{
+		hxr_sink_ *sink = &graph->sinks[i];
+		if ( !hxr_sink_accepts_(t, sink, msg) )
+			continue;
+
+		if ( sink->kind == HXR_SINK_MESSAGE_ ) {
+			hxr_send_message_(t, sink->stream, msg);
+			n_taken++;
+			continue;
+		}
+
+		hxr_rendered_text *text = graph->texts[sink->group];
+		if ( text == NULL ) {
+			text = hxr_sink_render_text_(t, graph, msg, graph->formats[sink->group]);
+			if ( text == NULL ) {
+				render_failed = 1;
+				continue;
+			}
+			graph->texts[sink->group] = text;
+		}
+		hxr_sink_write_text_(t, sink, msg, text);
+		n_taken++;
+	}
+
+	for ( size_t i = 0; i < graph->n_formats; i++ ) {
+		if ( graph->texts[i] != NULL )
+			HXR(rendered_text_release)(t, graph->texts[i]);
+		graph->texts[i] = NULL;
+	}
+	return render_failed ? -1 : n_taken;
+}
+
+size_t HXR(sink_graph_messages)(hxr_thread *t, hxr_sink_graph *graph)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	size_t n_sent = 0;
+	hxr_feedback_message *msg;
+	while ( HXR(msg_next)(t, &msg) ) {
+		HXR(sink_graph_message)(t, graph, msg);
+		n_sent++;
+	}
+	return n_sent;
+}
+
+#if defined(HXR_EXTRACT_UNITTESTS) && (0 != HXR_EXTRACT_UNITTESTS)
+typedef struct S_HXR__SINK_TEST_LOG
+{
+	hxr_rendered_text  *texts[4];
+	size_t             count;
+} hxr_sink_test_log_;
+
+static void hxr_sink_test_handler_(hxr_thread *t, void *context, hxr_feedback_message *msg, hxr_rendered_text *text)
+{
+	hxr_sink_test_log_ *log = context;
+	hxr_rendered_text_retain(text);
+	log->texts[log->count++] = text;
+}
+
+void HXR(sink_graph_unittest)(hxr_thread *t)
+{
+	hxr_feedback_message  *msg;
+
+	// ................................ //
+	hxr_thread_init_(t);
+	hxr_thread_set_message_coalescing(t, 0);
+
+	hxr_message_format_spec fmt_spec = {0};
+	fmt_spec.first_line = "%t: ";
+	hxr_message_format *fmt = hxr_message_format_compile(t, &fmt_spec);
+
+	hxr_sink_spec plain = {0};
+	hxr_sink_spec prefixed = {0};
+	prefixed.format = fmt;
+	hxr_sink_spec errors = prefixed;
+	errors.min_type = HXR_MSG_TYPE_ERROR;
+
+	hxr_sink_test_log_ a = {0};
+	hxr_sink_test_log_ b = {0};
+	hxr_sink_test_log_ c = {0};
+	hxr_sink_graph *graph = hxr_sink_graph_create(t);
+	hxr_sink_add_callback(t, graph, &prefixed, &hxr_sink_test_handler_, &a);
+	hxr_sink_add_callback(t, graph, &errors,   &hxr_sink_test_handler_, &b);
+	hxr_sink_add_callback(t, graph, &plain,    &hxr_sink_test_handler_, &c);
+
+	HXR_BEGIN_WARNING(t);
+		hxr_summary(t, "First.");
+	HXR_END(t);
+	HXR_BEGIN_ERROR(t);
+		hxr_summary(t, "Second.");
+	HXR_END(t);
+
+	do {
+		HXR_ASSERT_ELSE( hxr_sink_graph_messages(t, graph), ==, 2 )  break;
+		HXR_ASSERT_ELSE( a.count, ==, 2 )                            break;
+		HXR_ASSERT_ELSE( b.count, ==, 1 )                            break;
+		HXR_ASSERT_ELSE( c.count, ==, 2 )                            break;
+
+		// Same format, same text. The texts outlive the call because the
+		// handler retained them.
+		HXR_ASSERT_ELSE( b.texts[0], ==, a.texts[1] )                break;
+		HXR_ASSERT_ELSE( a.texts[1], !=, c.texts[1] )                break;
+		HXR_ASSERT_ELSE( hxr_rendered_text_len(a.texts[1]), ==,
+			hxr_rendered_text_len(c.texts[1]) + 7 )                  break;
+	} while (0);
+	hxr_clear_messages(t);
+
+	for ( size_t i = 0; i < a.count; i++ ) hxr_rendered_text_release(t, a.texts[i]);
+	for ( size_t i = 0; i < b.count; i++ ) hxr_rendered_text_release(t, b.texts[i]);
+	for ( size_t i = 0; i < c.count; i++ ) hxr_rendered_text_release(t, c.texts[i]);
+	hxr_sink_graph_free(t, graph);
+	hxr_message_format_free(t, fmt);
+	hxr_thread_free_(t);
+}
+#endif
+
+// ===== Call Profile : hxr_profile_* =====
+// Writes the call counts that HXR_ENTER_FUNCTION keeps (see `hxr_profile_dump`
+// in hexer.h). Callsite totals come from the `hxr_callsite`s themselves, and
+// everything else from the path table (`hxr_profile_path_*`): the number of
+// times one function called another is the sum of the counts of the paths
+// that end with the two of them.
+//
+// The rows are gathered into one array, sorted, and written one at a time
+// with `write_iov`.
+
+#define HXR_PROFILE_ROW_CALLSITE_  (0)
+#define HXR_PROFILE_ROW_CALL_      (1)
+#define HXR_PROFILE_ROW_PATH_      (2)
+
+typedef struct S_HXR__PROFILE_ROW
+{
+	uint8_t             kind;     // HXR_PROFILE_ROW_*_
+	const hxr_callsite  *site;    // NULL if it's unknown.
+	const hxr_callsite  *caller;  // CALL rows. NULL for uninstrumented code.
+	uint32_t            path;     // PATH rows.
+	size_t              count;
+#if HXR_ENABLE_FRAME_TIMING
+	uint64_t            inclusive_ns;  // CALLSITE rows.
+	uint64_t            exclusive_ns;
+#endif
+} hxr_profile_row_;
+
+typedef int (*hxr_profile_cmp_)(const hxr_profile_row_ *a, const hxr_profile_row_ *b);
+
+static const char *hxr_profile_function_(const hxr_callsite *site)
+{
+	return site != NULL ? site->function : "?";
+}
+
+static const char *hxr_profile_file_(const hxr_callsite *site)
+{
+	return site != NULL ? site->file : "?";
+}
+
+static int hxr_profile_strcmp_(const char *a, const char *b)
+{
+	while ( *a != '\0' && *a == *b ) {
+		a++;
+		b++;
+	}
+	return (int)(unsigned char)*a - (int)(unsigned char)*b;
+}
+
+// Groups CALL rows by caller and callee, so that they can be merged.
+static int hxr_profile_cmp_edge_(const hxr_profile_row_ *a, const hxr_profile_row_ *b)
+{
+	if ( a->kind != b->kind )
+		return a->kind < b->kind ? -1 : 1;
+	if ( a->caller != b->caller )
+		return (uintptr_t)a->caller < (uintptr_t)b->caller ? -1 : 1;
+	if ( a->site != b->site )
+		return (uintptr_t)a->site < (uintptr_t)b->site ? -1 : 1;
+	return 0;
+}
+
+// Busiest first, then by name, so that the output doesn't depend on where
+// things happen to be in memory.
+static int hxr_profile_cmp_count_(const hxr_profile_row_ *a, const hxr_profile_row_ *b)
+{
+	if ( a->kind != b->kind )
+		return a->kind < b->kind ? -1 : 1;
+	if ( a->count != b->count )
+		return a->count > b->count ? -1 : 1;
+	int cmp = hxr_profile_strcmp_(hxr_profile_function_(a->site), hxr_profile_function_(b->site));
+	if ( cmp == 0 && a->kind == HXR_PROFILE_ROW_CALL_ )
+		cmp = hxr_profile_strcmp_(hxr_profile_function_(a->caller), hxr_profile_function_(b->caller));
+	if ( cmp == 0 && a->site != NULL && b->site != NULL && a->site->line != b->site->line )
+		cmp = a->site->line < b->site->line ? -1 : 1;
+	return cmp;
+}
+
+// Merge sort, using `scratch` (as big as `rows`).
+static void hxr_profile_sort_(hxr_profile_row_ *rows, hxr_profile_row_ *scratch, size_t n, hxr_profile_cmp_ cmp)
+{
+	hxr_profile_row_ *from = rows;
+	hxr_profile_row_ *to   = scratch;
+	for ( size_t width = 1; width < n; width *= 2 )
+	{
+		for ( size_t lo = 0; lo < n; lo += 2 * width )
+		{
+			size_t mid = lo + width < n ? lo + width : n;
+			size_t hi  = lo + 2 * width < n ? lo + 2 * width : n;
+			size_t i = lo, j = mid, k = lo;
+			while ( i < mid && j < hi )
+				to[k++] = cmp(&from[j], &from[i]) < 0 ? from[j++] : from[i++];
+			while ( i < mid )
+				to[k++] = from[i++];
+			while ( j < hi )
+				to[k++] = from[j++];
+		}
+		hxr_profile_row_ *swap = from;
+		from = to;
+		to = swap;
+	}
+	if ( from != rows )
+		hxr_copy_bytes_(rows, from, n * sizeof(hxr_profile_row_));
+}
+
+// Returns: The number of rows put in `rows`, which has room for one per
+// callsite and two per path.
+static size_t hxr_profile_gather_(hxr_profile_row_ *rows, size_t max_rows, int format)
+{
+	size_t n = 0;
+	if ( format != HXR_PROFILE_COLLAPSED )
+	{
+		hxr_callsite *site = NULL;
+		while ( n < max_rows && NULL != (site = HXR(callsite_next)(site)) )
+		{
+			size_t count = hxr_atomic_load_relaxed_size_(&site->call_count);
+			if ( count == 0 )
+				continue;
+			hxr_profile_row_ *row = &rows[n++];
+			row->kind   = HXR_PROFILE_ROW_CALLSITE_;
+			row->site   = site;
+			row->caller = NULL;
+			row->path   = HXR_PROFILE_PATH_ROOT_;
+			row->count  = count;
+#if HXR_ENABLE_FRAME_TIMING
+			row->inclusive_ns = HXR(frame_ticks_to_ns)(hxr_atomic_load_relaxed_u64_(&site->inclusive_ticks));
+			row->exclusive_ns = HXR(frame_ticks_to_ns)(hxr_atomic_load_relaxed_u64_(&site->exclusive_ticks));
+#endif
+		}
+	}
+
+#if HXR_PROFILE_MAX_PATHS > 0 && HXR_CALL_HISTORY_MAX > 0
+	for ( size_t slot = 0; slot < HXR_PROFILE_MAX_PATHS && n < max_rows; slot++ )
+	{
+		hxr_profile_path_ *path = &hxr_profile_paths_[slot];
+		if ( hxr_atomic_load_size_(&path->state) != HXR_PROFILE_PATH_READY_ )
+			continue;
+		size_t count = hxr_atomic_load_relaxed_size_(&path->count);
+		if ( count == 0 )
+			continue;
+
+		hxr_profile_row_ *row = &rows[n++];
+		row->kind   = format == HXR_PROFILE_COLLAPSED ? HXR_PROFILE_ROW_PATH_ : HXR_PROFILE_ROW_CALL_;
+		row->site   = hxr_callsite_get_(path->callsite);
+		row->caller = NULL;
+		row->path   = (uint32_t)(slot + 1);
+		row->count  = count;
+		if ( path->parent != HXR_PROFILE_PATH_ROOT_ )
+			row->caller = hxr_callsite_get_(hxr_profile_paths_[path->parent - 1].callsite);
+	}
+#endif
+	return n;
+}
+
+// Adds CALL rows with the same caller and callee together. `rows` must be
+// sorted by `hxr_profile_cmp_edge_`.
+// Returns: The new number of rows.
+static size_t hxr_profile_merge_calls_(hxr_profile_row_ *rows, size_t n)
+{
+	size_t out = 0;
+	for ( size_t i = 0; i < n; i++ )
+	{
+		if ( out > 0 && rows[i].kind == HXR_PROFILE_ROW_CALL_
+		&&   hxr_profile_cmp_edge_(&rows[out-1], &rows[i]) == 0 )
+			rows[out-1].count += rows[i].count;
+		else
+			rows[out++] = rows[i];
+	}
+	return out;
+}
+
+// ----- Writing -----
+
+// Each row is flushed before the next one is added, so its numbers only
+// need room for the row with the most of them: a CSV row has its line,
+// count, caller line, and (with frame timing) its two times.
+#define HXR_PROFILE_ROW_NUMBERS_  (5)
+
+typedef struct S_HXR__PROFILE_OUT
+{
+	hxr_iovec_  iov[2 * HXR_CALL_DEPTH_MAX_ + 16];
+	size_t      count;
+	char        numbers[HXR_PROFILE_ROW_NUMBERS_][24];
+	size_t      n_numbers;
+} hxr_profile_out_;
+
+static const char hxr_profile_spaces_[] = "                                ";
+
+static void hxr_profile_add_(hxr_profile_out_ *out, const char *text, size_t len)
+{
+	if ( out->count < sizeof(out->iov) / sizeof(out->iov[0]) ) {
+		out->iov[out->count].base = text;
+		out->iov[out->count].len  = len;
+		out->count++;
+	}
+}
+
+static size_t hxr_profile_strlen_(const char *text)
+{
+	size_t len = 0;
+	while ( text[len] != '\0' )
+		len++;
+	return len;
+}
+
+// Returns: The length of `text`.
+static size_t hxr_profile_add_str_(hxr_profile_out_ *out, const char *text)
+{
+	size_t len = hxr_profile_strlen_(text);
+	hxr_profile_add_(out, text, len);
+	return len;
+}
+
+#define HXR_PROFILE_ADD_LITERAL_(out, lit)  (hxr_profile_add_((out), (lit), sizeof(lit) - 1))
+
+static void hxr_profile_add_spaces_(hxr_profile_out_ *out, size_t n)
+{
+	while ( n > 0 ) {
+		size_t chunk = n < sizeof(hxr_profile_spaces_) - 1 ? n : sizeof(hxr_profile_spaces_) - 1;
+		hxr_profile_add_(out, hxr_profile_spaces_, chunk);
+		n -= chunk;
+	}
+}
+
+// Returns: The number of digits added, which is 0 if the row already has
+// HXR_PROFILE_ROW_NUMBERS_ numbers.
+static size_t hxr_profile_add_number_(hxr_profile_out_ *out, uint64_t value)
+{
+	if ( out->n_numbers >= HXR_PROFILE_ROW_NUMBERS_ )
+		return 0;
+	char *end = out->numbers[out->n_numbers++] + sizeof(out->numbers[0]);
+	char *digits = hxr_send_decimal_(end, (int64_t)value);
+	hxr_profile_add_(out, digits, (size_t)(end - digits));
+	return (size_t)(end - digits);
+}
+
+static ssize_t hxr_profile_flush_(hxr_thread *t, hxr_stream_ *stream, hxr_profile_out_ *out)
+{
+	ssize_t rc = stream_write_iov(t, stream, out->iov, out->count);
+	out->count = 0;
+	out->n_numbers = 0;
+	return rc;
+}
+
+static size_t hxr_profile_digits_(uint64_t value)
+{
+	size_t n = 1;
+	while ( value >= 10 ) {
+		value /= 10;
+		n++;
+	}
+	return n;
+}
+
+// Adds `text` as a CSV field, quoted if it needs to be.
+static void hxr_profile_add_csv_(hxr_profile_out_ *out, const char *text)
+{
+	size_t len = 0, quotes = 0;
+	for ( ; text[len] != '\0'; len++ )
+		if ( text[len] == ',' || text[len] == '"' || text[len] == '\n' || text[len] == '\r' )
+			quotes++;
+	if ( quotes == 0 ) {
+		hxr_profile_add_(out, text, len);
+		return;
+	}
+
+	// Each quote in the text is doubled: the text up to and including the
+	// quote is added, and the quote is added again at the start of the rest.
+	HXR_PROFILE_ADD_LITERAL_(out, "\"");
+	size_t start = 0;
+	for ( size_t i = 0; i < len; i++ )
+		if ( text[i] == '"' ) {
+			hxr_profile_add_(out, text + start, i + 1 - start);
+			start = i;
+		}
+	hxr_profile_add_(out, text + start, len - start);
+	HXR_PROFILE_ADD_LITERAL_(out, "\"");
+}
+
+static ssize_t hxr_profile_write_summary_(hxr_thread *t, hxr_stream_ *stream, const hxr_profile_row_ *rows, size_t n)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_profile_out_ out;
+	out.count = 0;
+	out.n_numbers = 0;
+
+	// Column widths. Names are followed by a comma and at least one space.
+	size_t name_w = sizeof("Function,"), count_w = sizeof("Count") - 1, file_w = sizeof("File,");
+	size_t caller_w = sizeof("Caller,"), callee_w = sizeof("Callee,"), call_count_w = count_w;
+#if HXR_ENABLE_FRAME_TIMING
+	size_t inclusive_w = sizeof("Inclusive us") - 1, exclusive_w = sizeof("Exclusive us") - 1;
+#endif
+	for ( size_t i = 0; i < n; i++ )
+	{
+		const hxr_profile_row_ *row = &rows[i];
+		size_t name_len = hxr_profile_strlen_(hxr_profile_function_(row->site)) + 2;
+		size_t digits   = hxr_profile_digits_(row->count);
+		if ( row->kind == HXR_PROFILE_ROW_CALLSITE_ ) {
+			size_t file_len = hxr_profile_strlen_(hxr_profile_file_(row->site)) + 2;
+			name_w  = name_len > name_w ? name_len : name_w;
+			file_w  = file_len > file_w ? file_len : file_w;
+			count_w = digits > count_w ? digits : count_w;
+#if HXR_ENABLE_FRAME_TIMING
+			digits      = hxr_profile_digits_(row->inclusive_ns / 1000);
+			inclusive_w = digits > inclusive_w ? digits : inclusive_w;
+			digits      = hxr_profile_digits_(row->exclusive_ns / 1000);
+			exclusive_w = digits > exclusive_w ? digits : exclusive_w;
+#endif
+		}
+		else {
+			size_t caller_len = hxr_profile_strlen_(row->caller != NULL ? row->caller->function : "(none)") + 2;
+			caller_w     = caller_len > caller_w ? caller_len : caller_w;
+			callee_w     = name_len > callee_w ? name_len : callee_w;
+			call_count_w = digits > call_count_w ? digits : call_count_w;
+		}
+	}
+
+	ssize_t total = 0, rc;
+	uint8_t kind = HXR_PROFILE_ROW_PATH_;
+	for ( size_t i = 0; i < n; i++ )
+	{
+		const hxr_profile_row_ *row = &rows[i];
+		if ( row->kind != kind )
+		{
+			kind = row->kind;
+			if ( kind == HXR_PROFILE_ROW_CALLSITE_ ) {
+				HXR_PROFILE_ADD_LITERAL_(&out, "Function,");
+				hxr_profile_add_spaces_(&out, name_w - (sizeof("Function,") - 1) + count_w - (sizeof("Count") - 1));
+				HXR_PROFILE_ADD_LITERAL_(&out, "Count,  ");
+#if HXR_ENABLE_FRAME_TIMING
+				hxr_profile_add_spaces_(&out, inclusive_w - (sizeof("Inclusive us") - 1));
+				HXR_PROFILE_ADD_LITERAL_(&out, "Inclusive us,  ");
+				hxr_profile_add_spaces_(&out, exclusive_w - (sizeof("Exclusive us") - 1));
+				HXR_PROFILE_ADD_LITERAL_(&out, "Exclusive us,  ");
+#endif
+				HXR_PROFILE_ADD_LITERAL_(&out, "File,");
+				hxr_profile_add_spaces_(&out, file_w - (sizeof("File,") - 1));
+				HXR_PROFILE_ADD_LITERAL_(&out, "Line Number\n");
+			}
+			else {
+				if ( i > 0 )
+					HXR_PROFILE_ADD_LITERAL_(&out, "\n");
+				HXR_PROFILE_ADD_LITERAL_(&out, "Caller,");
+				hxr_profile_add_spaces_(&out, caller_w - (sizeof("Caller,") - 1));
+				HXR_PROFILE_ADD_LITERAL_(&out, "Callee,");
+				hxr_profile_add_spaces_(&out, callee_w - (sizeof("Callee,") - 1) + call_count_w - (sizeof("Count") - 1));
+				HXR_PROFILE_ADD_LITERAL_(&out, "Count\n");
+			}
+		}
+
+		if ( kind == HXR_PROFILE_ROW_CALLSITE_ ) {
+			size_t len = hxr_profile_add_str_(&out, hxr_profile_function_(row->site));
+			HXR_PROFILE_ADD_LITERAL_(&out, ",");
+			hxr_profile_add_spaces_(&out, name_w - len - 1 + count_w - hxr_profile_digits_(row->count));
+			hxr_profile_add_number_(&out, row->count);
+			HXR_PROFILE_ADD_LITERAL_(&out, ",  ");
+#if HXR_ENABLE_FRAME_TIMING
+			hxr_profile_add_spaces_(&out, inclusive_w - hxr_profile_digits_(row->inclusive_ns / 1000));
+			hxr_profile_add_number_(&out, row->inclusive_ns / 1000);
+			HXR_PROFILE_ADD_LITERAL_(&out, ",  ");
+			hxr_profile_add_spaces_(&out, exclusive_w - hxr_profile_digits_(row->exclusive_ns / 1000));
+			hxr_profile_add_number_(&out, row->exclusive_ns / 1000);
+			HXR_PROFILE_ADD_LITERAL_(&out, ",  ");
+#endif
+			len = hxr_profile_add_str_(&out, hxr_profile_file_(row->site));
+			HXR_PROFILE_ADD_LITERAL_(&out, ",");
+			hxr_profile_add_spaces_(&out, file_w - len - 1);
+			hxr_profile_add_number_(&out, row->site != NULL ? (size_t)row->site->line : 0);
+		}
+		else {
+			size_t len = hxr_profile_add_str_(&out, row->caller != NULL ? row->caller->function : "(none)");
+			HXR_PROFILE_ADD_LITERAL_(&out, ",");
+			hxr_profile_add_spaces_(&out, caller_w - len - 1);
+			len = hxr_profile_add_str_(&out, hxr_profile_function_(row->site));
+			HXR_PROFILE_ADD_LITERAL_(&out, ",");
+			hxr_profile_add_spaces_(&out, callee_w - len - 1 + call_count_w - hxr_profile_digits_(row->count));
+			hxr_profile_add_number_(&out, row->count);
+		}
+		HXR_PROFILE_ADD_LITERAL_(&out, "\n");
+
+		if ( (rc = hxr_profile_flush_(t, stream, &out)) < 0 )
+			return rc;
+		total += rc;
+	}
+
+	size_t lost = hxr_atomic_load_relaxed_size_(&hxr_profile_lost_);
+	if ( lost > 0 ) {
+		HXR_PROFILE_ADD_LITERAL_(&out, "\n");
+		hxr_profile_add_number_(&out, lost);
+		HXR_PROFILE_ADD_LITERAL_(&out, " calls were along call paths that didn't fit (see HXR_PROFILE_MAX_PATHS).\n");
+		if ( (rc = hxr_profile_flush_(t, stream, &out)) < 0 )
+			return rc;
+		total += rc;
+	}
+	return total;
+}
+
+static ssize_t hxr_profile_write_csv_(hxr_thread *t, hxr_stream_ *stream, const hxr_profile_row_ *rows, size_t n)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_profile_out_ out;
+	out.count = 0;
+	out.n_numbers = 0;
+#if HXR_ENABLE_FRAME_TIMING
+	HXR_PROFILE_ADD_LITERAL_(&out, "kind,function,file,line,count,caller_function,caller_file,caller_line,inclusive_ns,exclusive_ns\n");
+#else
+	HXR_PROFILE_ADD_LITERAL_(&out, "kind,function,file,line,count,caller_function,caller_file,caller_line\n");
+#endif
+
+	ssize_t total = 0, rc;
+	for ( size_t i = 0; i < n; i++ )
+	{
+		const hxr_profile_row_ *row = &rows[i];
+		if ( row->kind == HXR_PROFILE_ROW_CALLSITE_ )
+			HXR_PROFILE_ADD_LITERAL_(&out, "callsite,");
+		else
+			HXR_PROFILE_ADD_LITERAL_(&out, "call,");
+		hxr_profile_add_csv_(&out, hxr_profile_function_(row->site));
+		HXR_PROFILE_ADD_LITERAL_(&out, ",");
+		hxr_profile_add_csv_(&out, hxr_profile_file_(row->site));
+		HXR_PROFILE_ADD_LITERAL_(&out, ",");
+		hxr_profile_add_number_(&out, row->site != NULL ? (size_t)row->site->line : 0);
+		HXR_PROFILE_ADD_LITERAL_(&out, ",");
+		hxr_profile_add_number_(&out, row->count);
+		if ( row->caller != NULL ) {
+			HXR_PROFILE_ADD_LITERAL_(&out, ",");
+			hxr_profile_add_csv_(&out, row->caller->function);
+			HXR_PROFILE_ADD_LITERAL_(&out, ",");
+			hxr_profile_add_csv_(&out, row->caller->file);
+			HXR_PROFILE_ADD_LITERAL_(&out, ",");
+			hxr_profile_add_number_(&out, (size_t)row->caller->line);
+		}
+		else
+			HXR_PROFILE_ADD_LITERAL_(&out, ",,,");
+#if HXR_ENABLE_FRAME_TIMING
+		if ( row->kind == HXR_PROFILE_ROW_CALLSITE_ ) {
+			HXR_PROFILE_ADD_LITERAL_(&out, ",");
+			hxr_profile_add_number_(&out, row->inclusive_ns);
+			HXR_PROFILE_ADD_LITERAL_(&out, ",");
+			hxr_profile_add_number_(&out, row->exclusive_ns);
+		}
+		else
+			HXR_PROFILE_ADD_LITERAL_(&out, ",,");
+#endif
+		HXR_PROFILE_ADD_LITERAL_(&out, "\n");
+
+		if ( (rc = hxr_profile_flush_(t, stream, &out)) < 0 )
+			return rc;
+		total += rc;
+	}
+	if ( n == 0 ) {
+		if ( (rc = hxr_profile_flush_(t, stream, &out)) < 0 )
+			return rc;
+		total += rc;
+	}
+	return total;
+}
+
+static ssize_t hxr_profile_write_collapsed_(hxr_thread *t, hxr_stream_ *stream, const hxr_profile_row_ *rows, size_t n)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_profile_out_ out;
+	out.count = 0;
+	out.n_numbers = 0;
+
+	ssize_t total = 0, rc;
+#if HXR_PROFILE_MAX_PATHS > 0 && HXR_CALL_HISTORY_MAX > 0
+	// Paths are at most one longer than the deepest frame stack (calls past
+	// the end of the stack are counted as made by its last frame).
+	const hxr_callsite *chain[HXR_CALL_DEPTH_MAX_ + 2];
+	for ( size_t i = 0; i < n; i++ )
+	{
+		size_t depth = 0;
+		uint32_t id = rows[i].path;
+		while ( id != HXR_PROFILE_PATH_ROOT_ && depth < HXR_CALL_DEPTH_MAX_ + 2 ) {
+			const hxr_profile_path_ *path = &hxr_profile_paths_[id - 1];
+			chain[depth++] = hxr_callsite_get_(path->callsite);
+			id = path->parent;
+		}
+
+		while ( depth > 0 ) {
+			depth--;
+			hxr_profile_add_str_(&out, hxr_profile_function_(chain[depth]));
+			if ( depth > 0 )
+				HXR_PROFILE_ADD_LITERAL_(&out, ";");
+		}
+		HXR_PROFILE_ADD_LITERAL_(&out, " ");
+		hxr_profile_add_number_(&out, rows[i].count);
+		HXR_PROFILE_ADD_LITERAL_(&out, "\n");
+
+		if ( (rc = hxr_profile_flush_(t, stream, &out)) < 0 )
+			return rc;
+		total += rc;
+	}
+#endif
+
+	size_t lost = hxr_atomic_load_relaxed_size_(&hxr_profile_lost_);
+	if ( lost > 0 ) {
+		HXR_PROFILE_ADD_LITERAL_(&out, "[lost] ");
+		hxr_profile_add_number_(&out, lost);
+		HXR_PROFILE_ADD_LITERAL_(&out, "\n");
+		if ( (rc = hxr_profile_flush_(t, stream, &out)) < 0 )
+			return rc;
+		total += rc;
+	}
+	return total;
+}
+
+static int hxr_profile_write_(hxr_thread *t, hxr_stream_ *stream, int format)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	if ( format != HXR_PROFILE_SUMMARY && format != HXR_PROFILE_CSV && format != HXR_PROFILE_COLLAPSED )
+		return -1;
+#if HXR_PROFILE_MAX_PATHS == 0 || HXR_CALL_HISTORY_MAX == 0
+	// There are no paths to collapse.
+	if ( format == HXR_PROFILE_COLLAPSED )
+		return -1;
+#endif
+
+	size_t max_rows = 0;
+	hxr_callsite *site = NULL;
+	while ( NULL != (site = HXR(callsite_next)(site)) )
+		max_rows++;
+#if HXR_PROFILE_MAX_PATHS > 0 && HXR_CALL_HISTORY_MAX > 0
+	max_rows += HXR_PROFILE_MAX_PATHS;
+#endif
+
+	hxr_allocator *allocator = HXR(thread_get_impl_)(t)->allocator;
+	hxr_profile_row_ *rows = NULL;
+	if ( max_rows > 0 ) {
+		rows = allocator->allocate(t, 2 * max_rows * sizeof(hxr_profile_row_));
+		if ( rows == NULL )
+			return -1;
+	}
+	hxr_profile_row_ *scratch = rows + max_rows;
+
+	size_t n = hxr_profile_gather_(rows, max_rows, format);
+	if ( format != HXR_PROFILE_COLLAPSED ) {
+		hxr_profile_sort_(rows, scratch, n, &hxr_profile_cmp_edge_);
+		n = hxr_profile_merge_calls_(rows, n);
+	}
+	hxr_profile_sort_(rows, scratch, n, &hxr_profile_cmp_count_);
+
+	ssize_t rc;
+	switch ( format )
+	{
+		case HXR_PROFILE_CSV:       rc = hxr_profile_write_csv_(t, stream, rows, n);       break;
+		case HXR_PROFILE_COLLAPSED: rc = hxr_profile_write_collapsed_(t, stream, rows, n); break;
+		default:                    rc = hxr_profile_write_summary_(t, stream, rows, n);   break;
+	}
+
+	if ( rows != NULL )
+		allocator->free(t, rows);
+	return rc < 0 ? -1 : 0;
+}
+
+#if HXR_ENABLE_FILE_IO
+int HXR(profile_dump)(hxr_thread *t, FILE *fd, int format)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_stream_  stream;
+	FSTREAM_INIT(t, &stream);
+	fstream_set_fd(t, &stream, fd);
+	int rc = hxr_profile_write_(t, &stream, format);
+	FSTREAM_FINALIZE(t, &stream);
 	return rc;
 }
+#endif
 
-static ssize_t stream_write_text_fmt_va(hxr_thread* t,  hxr_stream_* stream,  const char* fmtstr, va_list vargs) {
-	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_WRAPPER);
-	return stream->write_fmtstr(t, stream, fmtstr, vargs);
+#if HXR_ENABLE_FD_STREAM
+int HXR(fdstream_profile)(hxr_thread *t, hxr_fdstream *out, int format)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	return hxr_profile_write_(t, &out->stream, format);
 }
+#endif
 
-// ===== Canary Stream : canary_stream_* =====
-// This is used to raise errors whenever a finalized stream is used.
+#if defined(HXR_EXTRACT_UNITTESTS) && (0 != HXR_EXTRACT_UNITTESTS)
+// Keeps the lines of a profile that mention the test's functions. The rest
+// of the profile (and the width of its columns) depends on what else the
+// process has called.
+typedef struct S_HXR__PROFILE_TEST_SINK
+{
+	char    text[1024];
+	size_t  len;
+	char    line[256];
+	size_t  line_len;
+} hxr_profile_test_sink_;
 
-static ssize_t canary_stream_write_line(hxr_thread* t,  hxr_stream_* stream,  const char* text)
+// Returns: Where `needle` is in `text`, starting from `from`, or -1.
+static ssize_t hxr_profile_test_find_(const char *text, size_t from, const char *needle)
 {
-	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	for ( size_t i = from; text[i] != '\0'; i++ )
+	{
+		size_t j = 0;
+		while ( needle[j] != '\0' && text[i + j] == needle[j] )
+			j++;
+		if ( needle[j] == '\0' )
+			return (ssize_t)i;
+	}
+	return -1;
+}
 
-	hxr_source_location_  init_loc  = stream->init_loc;
-	hxr_source_location_  final_loc = stream->final_loc;
+static ssize_t hxr_profile_test_write_iov_(hxr_thread *t, hxr_stream_ *stream, const hxr_iovec_ *iov, size_t iov_count)
+{
+	hxr_profile_test_sink_ *sink = stream->impl;
+	size_t total = 0;
+	for ( size_t i = 0; i < iov_count; i++ )
+	{
+		for ( size_t j = 0; j < iov[i].len; j++ )
+		{
+			if ( sink->line_len < sizeof(sink->line) - 1 )
+				sink->line[sink->line_len++] = iov[i].base[j];
+			if ( iov[i].base[j] != '\n' )
+				continue;
 
-	HXR_BEGIN_ERROR(t);
-		hxr_message_id(t, "canary_stream_write_line");
-		hxr_summary(t, "write_line() called on an expired stream.");
-		hxr_details_fmt(t,
-			"This stream was initialized in file \"%s\", function \"%s\", and line %zd. "
-			"The stream was finalized in file \"%s\", function \"%s\", and line %zd. "
-			"The text that was to be printed is as follows: \"%s\"",
-			init_loc.file,  init_loc.func,  init_loc.line,
-			final_loc.file, final_loc.func, final_loc.line,
-			text);
-	HXR_END(t);
+			sink->line[sink->line_len] = '\0';
+			if ( hxr_profile_test_find_(sink->line, 0, "hxr_profile_test_") >= 0
+			&&   sink->len + sink->line_len < sizeof(sink->text) ) {
+				hxr_copy_bytes_(sink->text + sink->len, sink->line, sink->line_len);
+				sink->len += sink->line_len;
+			}
+			sink->line_len = 0;
+		}
+		total += iov[i].len;
+	}
+	sink->text[sink->len] = '\0';
+	return (ssize_t)total;
+}
 
-	return -1;
+// Callsites of functions that don't exist, so that the test decides exactly
+// how they're called. The name of the second caller needs quoting in CSV.
+// They're static because their ids last as long as the process.
+#define HXR_PROFILE_TEST_OUTER_  (0)
+#define HXR_PROFILE_TEST_OTHER_  (1)
+#define HXR_PROFILE_TEST_MID_    (2)
+#define HXR_PROFILE_TEST_LEAF_   (3)
+static hxr_callsite hxr_profile_test_sites_[4];
+static const char *hxr_profile_test_names_[4] = {
+	"hxr_profile_test_outer",
+	"hxr_profile_test_other, \"quoted\"",
+	"hxr_profile_test_mid",
+	"hxr_profile_test_leaf",
+};
+
+// Calls `caller`, which calls mid `n_mids` times, which calls leaf `n_leaves`
+// times. The frames are at addresses in `frames`, deepest first, as they
+// would be on a stack that grows down.
+static void hxr_profile_test_calls_(hxr_thread *t, const char *frames, size_t caller, size_t n_mids, size_t n_leaves)
+{
+	hxr_callsite *sites = hxr_profile_test_sites_;
+	HXR(thread_frame_entrance_)(&t, frames + 2, &sites[caller]);
+	for ( size_t i = 0; i < n_mids; i++ )
+	{
+		HXR(thread_frame_entrance_)(&t, frames + 1, &sites[HXR_PROFILE_TEST_MID_]);
+		for ( size_t j = 0; j < n_leaves; j++ )
+			HXR(thread_frame_entrance_)(&t, frames, &sites[HXR_PROFILE_TEST_LEAF_]);
+	}
+	HXR(thread_frame_exit_)(&t, frames + 2);
 }
 
-static ssize_t canary_stream_write_text(hxr_thread* t,  hxr_stream_* stream,  const char* text)
+void HXR(profile_unittest)(hxr_thread *t)
 {
-	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
-	hxr_source_location_  init_loc  = stream->init_loc;
-	hxr_source_location_  final_loc = stream->final_loc;
+	hxr_callsite           *sites = hxr_profile_test_sites_;
+	hxr_stream_vtbl_       vtable = {0};
+	hxr_stream_            stream;
+	hxr_profile_test_sink_ sink;
+	char                   frames[3] = {0};  // Only their addresses are used.
+	size_t                 i;
+	ssize_t                leaf, mid, other, outer;
 
-	hxr_text_placement_info_  tp;
-	hxr_get_text_placement_info_(t, &tp, text);
+	vtable.write_iov = &hxr_profile_test_write_iov_;
+	stream.vtable    = &vtable;
+	stream.impl      = &sink;
 
-	HXR_BEGIN_ERROR(t);
-		hxr_message_id(t, "canary_stream_write_text");
-		hxr_summary(t, "write_line() called on an expired stream.");
-		hxr_details_fmt(t,
-			"This stream was initialized in file \"%s\", function \"%s\", and line %zd. "
-			"The stream was finalized in file \"%s\", function \"%s\", and line %zd. "
-			"The text that was to be printed is as follows: %c%s%c",
-			init_loc.file,  init_loc.func,  init_loc.line,
-			final_loc.file, final_loc.func, final_loc.line,
-			tp.need_newline_before, text, tp.need_newline_after);
-	HXR_END(t);
+	// ................................ //
+	hxr_thread_init_(t);
 
-	return -1;
+	// Counts are never reset, so these start over in case the test has run
+	// before. The lines are 10, 20, 30, 40.
+	for ( i = 0; i < 4; i++ ) {
+		sites[i].file                = "profile_test.c";
+		sites[i].function            = hxr_profile_test_names_[i];
+		sites[i].line                = (int)(10 * (i + 1));
+		sites[i].func_classification = HXR_FNCLASS_NORMAL;
+		sites[i].call_count          = 0;
+	}
+#if HXR_PROFILE_MAX_PATHS > 0 && HXR_CALL_HISTORY_MAX > 0
+	for ( size_t slot = 0; slot < HXR_PROFILE_MAX_PATHS; slot++ )
+		for ( i = 0; i < 4; i++ )
+			if ( sites[i].id != HXR_CALLSITE_NONE_ && hxr_profile_paths_[slot].callsite == sites[i].id )
+				hxr_profile_paths_[slot].count = 0;
+#endif
+
+	// The mid -> leaf calls are made along two paths, which the summary and
+	// the CSV add together.
+	hxr_profile_test_calls_(t, frames, HXR_PROFILE_TEST_OUTER_, 2, 3);
+	hxr_profile_test_calls_(t, frames, HXR_PROFILE_TEST_OTHER_, 1, 2);
+
+	// Busiest first, with ties by name.
+	sink.len = sink.line_len = 0;
+	do {
+		HXR_ASSERT_ELSE( hxr_profile_write_(t, &stream, HXR_PROFILE_SUMMARY), ==, 0 ) break;
+		leaf  = hxr_profile_test_find_(sink.text, 0, "hxr_profile_test_leaf,");
+		mid   = hxr_profile_test_find_(sink.text, 0, "hxr_profile_test_mid,");
+		other = hxr_profile_test_find_(sink.text, 0, "hxr_profile_test_other, \"quoted\",");
+		outer = hxr_profile_test_find_(sink.text, 0, "hxr_profile_test_outer,");
+		HXR_ASSERT_ELSE( leaf, ==, 0 )                                              break;
+		HXR_ASSERT_ELSE( mid, >, leaf )                                             break;
+		HXR_ASSERT_ELSE( other, >, mid )                                            break;
+		HXR_ASSERT_ELSE( outer, >, other )                                          break;
+	} while (0);
+
+	// Names with commas and quotes are quoted, and each caller -> callee
+	// pair has one row.
+	sink.len = sink.line_len = 0;
+	do {
+		HXR_ASSERT_ELSE( hxr_profile_write_(t, &stream, HXR_PROFILE_CSV), ==, 0 )     break;
+		HXR_ASSERT_ELSE( hxr_profile_test_find_(sink.text, 0,
+			"callsite,hxr_profile_test_leaf,profile_test.c,40,8,,,"), ==, 0 )        break;
+		HXR_ASSERT_ELSE( hxr_profile_test_find_(sink.text, 0,
+			"\ncallsite,\"hxr_profile_test_other, \"\"quoted\"\"\","
+			"profile_test.c,20,1,,,"), >, 0 )                                        break;
+#if HXR_PROFILE_MAX_PATHS > 0 && HXR_CALL_HISTORY_MAX > 0
+		leaf = hxr_profile_test_find_(sink.text, 0,
+			"\ncall,hxr_profile_test_leaf,profile_test.c,40,8,hxr_profile_test_mid,profile_test.c,30");
+		HXR_ASSERT_ELSE( leaf, >, 0 )                                               break;
+		HXR_ASSERT_ELSE( hxr_profile_test_find_(sink.text, (size_t)leaf + 1,
+			"\ncall,hxr_profile_test_leaf,"), ==, -1 )                               break;
+		HXR_ASSERT_ELSE( hxr_profile_test_find_(sink.text, 0,
+			"\ncall,hxr_profile_test_mid,profile_test.c,30,1,"
+			"\"hxr_profile_test_other, \"\"quoted\"\"\",profile_test.c,20"), >, 0 )   break;
+#else
+		HXR_ASSERT_ELSE( hxr_profile_test_find_(sink.text, 0, "\ncall,"), ==, -1 )   break;
+#endif
+	} while (0);
+
+	// One line per path, which isn't merged with the other path that ends
+	// the same way.
+	sink.len = sink.line_len = 0;
+	do {
+#if HXR_PROFILE_MAX_PATHS > 0 && HXR_CALL_HISTORY_MAX > 0
+		HXR_ASSERT_ELSE( hxr_profile_write_(t, &stream, HXR_PROFILE_COLLAPSED), ==, 0 ) break;
+		leaf  = hxr_profile_test_find_(sink.text, 0,
+			"hxr_profile_test_outer;hxr_profile_test_mid;hxr_profile_test_leaf 6\n");
+		other = hxr_profile_test_find_(sink.text, 0,
+			"hxr_profile_test_other, \"quoted\";hxr_profile_test_mid;hxr_profile_test_leaf 2\n");
+		mid   = hxr_profile_test_find_(sink.text, 0,
+			"hxr_profile_test_outer;hxr_profile_test_mid 2\n");
+		HXR_ASSERT_ELSE( leaf, >=, 0 )                                              break;
+		HXR_ASSERT_ELSE( other, >, leaf )                                           break;
+		HXR_ASSERT_ELSE( mid, >, leaf )                                             break;
+#else
+		HXR_ASSERT_ELSE( hxr_profile_write_(t, &stream, HXR_PROFILE_COLLAPSED), ==, -1 ) break;
+#endif
+	} while (0);
+
+	hxr_thread_free_(t);
 }
+#endif
 
-static ssize_t canary_stream_write_fmtstr(hxr_thread* t,  hxr_stream_* stream,  const char* fmtstr, va_list vargs)
+// ===== Crash Dump : hxr_crash_* =====
+// When the process crashes, the call history and the messages that never
+// got delivered are the best clues to what happened, and they're about to
+// be lost. `hxr_crash_handler_install` catches the signals that a crash
+// raises and writes them out first.
+//
+// Inside a signal handler, almost nothing is safe: no malloc, no stdio, no
+// locks (the crash may have happened while holding one). So the dump is
+// built one fixed-size line at a time in a buffer on the stack, with
+// numbers formatted by hand, and each line is handed to `write` and/or
+// copied into a region of memory that was set up beforehand. Text that
+// hasn't been formatted yet is shown as its format string, since
+// formatting it could allocate.
+//
+// Threads are found through a fixed table of pointers that they are put
+// into with `hxr_crash_register_thread` (slots are claimed and given back
+// with a compare-and-swap). Other threads keep running while the dump is
+// being written, so what's read from them can be torn; callsite ids are
+// checked against the callsite table, and queue positions are clamped, so
+// that the worst case is a wrong line rather than a second crash.
+
+#if HXR_ENABLE_CRASH_HANDLER
+
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HXR_CRASH_MAX_THREADS_     (256)
+#define HXR_CRASH_STACK_SIZE_      (65536)
+
+// How long (in milliseconds) a thread that crashes while another one is
+// writing the dump waits for it before dying anyway.
+#define HXR_CRASH_WAIT_MS_         (5000)
+
+// How many messages under construction are shown per thread. This also
+// stops the walk if the list has been corrupted into a loop.
+#define HXR_CRASH_MAX_IN_PROGRESS_ (64)
+
+static const int hxr_crash_signals_[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+static const char *const hxr_crash_signal_names_[] = { "SIGSEGV", "SIGBUS", "SIGILL", "SIGFPE", "SIGABRT" };
+#define HXR_CRASH_SIGNAL_COUNT_  (sizeof(hxr_crash_signals_) / sizeof(hxr_crash_signals_[0]))
+
+static hxr_thread_impl_  *hxr_crash_threads_[HXR_CRASH_MAX_THREADS_];
+
+// Where the dump goes. See `hxr_crash_handler_install`.
+static int               hxr_crash_fd_ = -1;
+static char              *hxr_crash_region_;
+static size_t            hxr_crash_region_size_;
+
+static uint8_t           hxr_crash_installed_;
+static struct sigaction  hxr_crash_previous_[HXR_CRASH_SIGNAL_COUNT_];
+
+// 0 until a crash is being dumped, 1 while it is, and 2 once it has been.
+static size_t            hxr_crash_dumped_;
+static char              hxr_crash_stack_[HXR_CRASH_STACK_SIZE_];
+
+typedef struct S_HXR__CRASH_LINE
 {
-	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
-	hxr_source_location_  init_loc  = stream->init_loc;
-	hxr_source_location_  final_loc = stream->final_loc;
+	char    text[HXR_CRASH_LINE_SIZE];
+	size_t  len;
+} hxr_crash_line_;
 
-#define BUFSIZE  (1024)
-	char printbuf[BUFSIZE];
-	size_t buflen = BUFSIZE;
-	char *finalstr = printbuf;
+typedef struct S_HXR__CRASH_OUT
+{
+	int     fd;
+	char    *region;
+	size_t  region_size;
+	size_t  region_used;
+} hxr_crash_out_;
 
-	va_list vargs_consumable;
-	va_copy(vargs_consumable, vargs);
-	int rc = vsnprintf(finalstr, buflen, fmtstr, vargs_consumable);
-	if ( rc > buflen ) {
-		buflen = rc+1;
-		finalstr = hxr_malloc(t, buflen);
-		va_copy(vargs_consumable, vargs);
-		rc = snprintf(finalstr, buflen, fmtstr, vargs_consumable);
+// Adds `str`, or as much of it as fits. Control characters (ex: line breaks
+// in a message's text) become spaces, so that every line stays one line.
+static void hxr_crash_put_str_(hxr_crash_line_ *line, const char *str)
+{
+	if ( str == NULL )
+		str = "?";
+	while ( *str != '\0' && line->len < HXR_CRASH_LINE_SIZE - 1 ) {
+		unsigned char c = (unsigned char)*str++;
+		line->text[line->len++] = c < 0x20 ? ' ' : (char)c;
 	}
+}
 
-	hxr_text_placement_info_  tp_raw;
-	hxr_text_placement_info_  tp_fmt;
-	hxr_get_text_placement_info_(t, &tp_raw, fmtstr);
-	hxr_get_text_placement_info_(t, &tp_fmt, fmtstr);
+static void hxr_crash_put_dec_(hxr_crash_line_ *line, uint64_t value)
+{
+	char digits[24];
+	digits[sizeof(digits) - 1] = '\0';
+	hxr_crash_put_str_(line, hxr_send_decimal_(digits + sizeof(digits) - 1, (int64_t)value));
+}
 
-	HXR_BEGIN_ERROR(t);
-		hxr_message_id(t, "canary_stream_write_fmtstr");
-		hxr_summary(t, "write_line() called on an expired stream.");
-		hxr_details_fmt(t,
-			"This stream was initialized in file \"%s\", function \"%s\", and line %zd. "
-			"The stream was finalized in file \"%s\", function \"%s\", and line %zd. "
-			"The format string that was to be printed is as follows: %c%s%c\n"
-			"The resulting text after formatting is: %c%s%c",
-			init_loc.file,  init_loc.func,  init_loc.line,
-			final_loc.file, final_loc.func, final_loc.line,
-			tp_raw.need_newline_before, fmtstr,   tp_raw.need_newline_after,
-			tp_fmt.need_newline_before, finalstr, tp_fmt.need_newline_after);
-	HXR_END(t);
+static void hxr_crash_put_hex_(hxr_crash_line_ *line, uintptr_t value)
+{
+	char digits[2 * sizeof(uintptr_t) + 3];
+	size_t n = 2 * sizeof(uintptr_t);
+	digits[0] = '0';
+	digits[1] = 'x';
+	for ( size_t i = 0; i < n; i++ )
+		digits[2 + i] = "0123456789abcdef"[(value >> (4 * (n - 1 - i))) & 0xF];
+	digits[2 + n] = '\0';
+	hxr_crash_put_str_(line, digits);
+}
 
-	if ( finalstr != printbuf )
-		hxr_free(t, finalstr);
+static void hxr_crash_put_spaces_(hxr_crash_line_ *line, size_t n)
+{
+	while ( n-- > 0 && line->len < HXR_CRASH_LINE_SIZE - 1 )
+		line->text[line->len++] = ' ';
+}
 
-	return -1;
+// Pads `line` out to HXR_CRASH_LINE_SIZE bytes, writes it, and empties it.
+// If writing to the fd fails, the rest of the dump only goes to the region.
+static void hxr_crash_emit_(hxr_crash_out_ *out, hxr_crash_line_ *line)
+{
+	hxr_crash_put_spaces_(line, HXR_CRASH_LINE_SIZE);
+	line->text[HXR_CRASH_LINE_SIZE - 1] = '\n';
+	line->len = 0;
+
+	size_t done = 0;
+	while ( out->fd >= 0 && done < HXR_CRASH_LINE_SIZE )
+	{
+		ssize_t rc = write(out->fd, line->text + done, HXR_CRASH_LINE_SIZE - done);
+		if ( rc < 0 && errno == EINTR )
+			continue;
+		if ( rc <= 0 ) {
+			out->fd = -1;
+			break;
+		}
+		done += (size_t)rc;
+	}
+
+	if ( out->region != NULL && out->region_size - out->region_used >= HXR_CRASH_LINE_SIZE ) {
+		hxr_copy_bytes_(out->region + out->region_used, line->text, HXR_CRASH_LINE_SIZE);
+		out->region_used += HXR_CRASH_LINE_SIZE;
+	}
 }
 
-// ===== File Stream : fstream_* =====
+// Starts a line of the dump's body: `label`, indented and padded so that
+// what follows it lines up.
+static void hxr_crash_put_label_(hxr_crash_line_ *line, const char *label)
+{
+	size_t start = line->len;
+	hxr_crash_put_str_(line, "  ");
+	hxr_crash_put_str_(line, label);
+	if ( line->len < start + 10 )
+		hxr_crash_put_spaces_(line, start + 10 - line->len);
+}
 
-#ifdef HXR_ENABLE_FILE_IO
-#include <stdio.h>
+static void hxr_crash_put_message_(hxr_crash_line_ *line, const hxr_feedback_message *msg, int finished)
+{
+	hxr_crash_put_label_(line, hxr_message_type_name_(msg->type_and_flags));
+	if ( !finished )
+		hxr_crash_put_str_(line, "(unfinished) ");
+	hxr_crash_put_str_(line, msg->loc.file);
+	hxr_crash_put_str_(line, ":");
+	hxr_crash_put_dec_(line, msg->loc.line);
+	if ( msg->repeat_count > 1 ) {
+		hxr_crash_put_str_(line, " x");
+		hxr_crash_put_dec_(line, msg->repeat_count);
+	}
+	if ( msg->id != NULL ) {
+		hxr_crash_put_str_(line, " [");
+		hxr_crash_put_str_(line, msg->id);
+		hxr_crash_put_str_(line, "]");
+	}
+	const char *summary = msg->summary.text != NULL ? msg->summary.text : msg->summary.fmtstr;
+	if ( summary != NULL ) {
+		hxr_crash_put_str_(line, ": ");
+		hxr_crash_put_str_(line, summary);
+	}
+}
 
-static ssize_t fstream_write_line(hxr_thread* t,  hxr_stream_* stream,  const char* text) {
-	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
-	FILE *fd = stream->impl;
-	int rc = fprintf(fd, "%s\n", text);
-	if ( rc < 0 )
-		return -1;
-	else
-		return rc;
+static void hxr_crash_dump_thread_(hxr_crash_out_ *out, hxr_crash_line_ *line, size_t index, hxr_thread_impl_ *timpl)
+{
+	size_t head = timpl->queue_head;
+	size_t tail = timpl->queue_tail;
+	if ( timpl->message_queue == NULL || tail - head > HXR_MESSAGE_QUEUE_CAPACITY )
+		head = tail;
+
+	size_t in_progress = 0;
+	const hxr_feedback_message *msg = timpl->messages_in_progress;
+	for ( ; msg != NULL && in_progress < HXR_CRASH_MAX_IN_PROGRESS_; msg = msg->next )
+		in_progress++;
+
+	size_t calls = 0;
+#if HXR_CALL_HISTORY_MAX > 0
+	size_t end = timpl->call_history_pos;
+	calls = timpl->call_history_count;
+	if ( calls > HXR_CALL_HISTORY_MAX )
+		calls = HXR_CALL_HISTORY_MAX;
+#endif
+
+	size_t pending = tail - head + in_progress;
+	hxr_crash_put_str_(line, "thread ");
+	hxr_crash_put_dec_(line, index);
+	hxr_crash_put_str_(line, ": ");
+	hxr_crash_put_dec_(line, calls);
+	hxr_crash_put_str_(line, calls == 1 ? " call, " : " calls, ");
+	hxr_crash_put_dec_(line, pending);
+	hxr_crash_put_str_(line, pending == 1 ? " pending message" : " pending messages");
+	hxr_crash_emit_(out, line);
+
+#if HXR_CALL_HISTORY_MAX > 0
+	// Oldest first, indented by depth, like `hxr_print_call_history`.
+	for ( size_t i = 0; i < calls; i++ )
+	{
+		const hxr_call_entry_ *entry = &timpl->call_history[(end - calls + i) & HXR_CALL_HISTORY_MASK_];
+		const hxr_callsite    *site  = hxr_callsite_get_(entry->callsite);
+		hxr_crash_put_label_(line, "call");
+		hxr_crash_put_spaces_(line, 2 * (entry->depth < 16 ? entry->depth : 16));
+		hxr_crash_put_str_(line, site != NULL ? site->function : "?");
+		hxr_crash_put_str_(line, " (");
+		hxr_crash_put_str_(line, site != NULL ? site->file : "?");
+		hxr_crash_put_str_(line, ":");
+		hxr_crash_put_dec_(line, site != NULL ? (uint64_t)site->line : 0);
+		hxr_crash_put_str_(line, ")");
+		if ( entry->count > 1 ) {
+			hxr_crash_put_str_(line, " x");
+			hxr_crash_put_dec_(line, entry->count);
+		}
+		hxr_crash_emit_(out, line);
+	}
+#endif
+
+	for ( size_t pos = head; pos != tail; pos++ )
+	{
+		msg = timpl->message_queue[pos & HXR_MESSAGE_QUEUE_MASK_];
+		if ( msg == NULL )
+			continue;
+		hxr_crash_put_message_(line, msg, 1);
+		hxr_crash_emit_(out, line);
+	}
+
+	msg = timpl->messages_in_progress;
+	for ( size_t i = 0; msg != NULL && i < in_progress; msg = msg->next, i++ ) {
+		hxr_crash_put_message_(line, msg, 0);
+		hxr_crash_emit_(out, line);
+	}
 }
 
-static ssize_t fstream_write_text(hxr_thread* t,  hxr_stream_* stream,  const char* text) {
-	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
-	FILE *fd = stream->impl;
-	int rc = fprintf(fd, "%s", text);
-	if ( rc < 0 )
-		return -1;
+// Writes the whole dump. `address` is the faulting address, or NULL.
+static void hxr_crash_dump_(hxr_crash_out_ *out, int signo, const void *address)
+{
+	hxr_crash_line_ line;
+	line.len = 0;
+
+	const char *name = "?";
+	for ( size_t i = 0; i < HXR_CRASH_SIGNAL_COUNT_; i++ )
+		if ( hxr_crash_signals_[i] == signo )
+			name = hxr_crash_signal_names_[i];
+
+	hxr_crash_put_str_(&line, "hexer crash: signal ");
+	hxr_crash_put_dec_(&line, (uint64_t)signo);
+	hxr_crash_put_str_(&line, " (");
+	hxr_crash_put_str_(&line, name);
+	hxr_crash_put_str_(&line, ")");
+	if ( address != NULL ) {
+		hxr_crash_put_str_(&line, ", address ");
+		hxr_crash_put_hex_(&line, (uintptr_t)address);
+	}
+	hxr_crash_emit_(out, &line);
+
+	for ( size_t i = 0; i < HXR_CRASH_MAX_THREADS_; i++ )
+	{
+		hxr_thread_impl_ *timpl = hxr_atomic_load_ptr_((void *const *)&hxr_crash_threads_[i]);
+		if ( timpl != NULL )
+			hxr_crash_dump_thread_(out, &line, i, timpl);
+	}
+
+	hxr_crash_put_str_(&line, "end of crash dump");
+	hxr_crash_emit_(out, &line);
+}
+
+static void hxr_crash_handler_(int signo, siginfo_t *info, void *context)
+{
+	(void)context;
+	int saved_errno = errno;
+
+	// Only the first crash is dumped. A second thread crashing at the same
+	// time waits for that dump to be finished, since dying now would take
+	// the whole process (and the dump) with it. The wait is bounded, so that
+	// a dump that hangs, or that crashes itself into here, still dies.
+	if ( hxr_atomic_cas_size_(&hxr_crash_dumped_, 0, 1) == 0 )
+	{
+		hxr_crash_out_ out;
+		out.fd          = hxr_crash_fd_;
+		out.region      = hxr_crash_region_;
+		out.region_size = hxr_crash_region_size_;
+		out.region_used = 0;
+		hxr_crash_dump_(&out, signo, signo != SIGABRT && info != NULL ? info->si_addr : NULL);
+		hxr_atomic_store_size_(&hxr_crash_dumped_, 2);
+	}
 	else
-		return rc;
+	{
+		struct timespec pause;
+		pause.tv_sec  = 0;
+		pause.tv_nsec = 1000000;
+		for ( size_t ms = 0; ms < HXR_CRASH_WAIT_MS_; ms++ )
+		{
+			if ( hxr_atomic_load_size_(&hxr_crash_dumped_) == 2 )
+				break;
+			nanosleep(&pause, NULL);
+		}
+	}
+
+	// Put back the previous handler and raise the signal again. It stays
+	// blocked until this returns, and is then handled the way it would have
+	// been without us. (A fault would also happen again when the faulting
+	// instruction is retried, but a signal from `abort` or `kill` wouldn't.)
+	for ( size_t i = 0; i < HXR_CRASH_SIGNAL_COUNT_; i++ )
+		if ( hxr_crash_signals_[i] == signo )
+			sigaction(signo, &hxr_crash_previous_[i], NULL);
+	errno = saved_errno;
+	raise(signo);
 }
 
-static ssize_t fstream_write_fmtstr(hxr_thread* t,  hxr_stream_* stream,  const char* text, va_list vargs) {
+int HXR(crash_handler_install)(hxr_thread *t, int fd, void *region, size_t region_size)
+{
 	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
-	FILE *fd = stream->impl;
-	int rc = fprintf(fd, fmtstr, vargs);
-	if ( rc < 0 )
+	hxr_crash_fd_          = fd;
+	hxr_crash_region_      = region;
+	hxr_crash_region_size_ = region != NULL ? region_size : 0;
+	if ( hxr_crash_installed_ )
+		return 0;
+
+	// Without a stack of its own, the handler can't run after a stack
+	// overflow. Leave any stack that was already set up alone.
+	stack_t current;
+	if ( sigaltstack(NULL, &current) == 0 && (current.ss_flags & SS_DISABLE) ) {
+		stack_t alt;
+		alt.ss_sp    = hxr_crash_stack_;
+		alt.ss_size  = sizeof(hxr_crash_stack_);
+		alt.ss_flags = 0;
+		sigaltstack(&alt, NULL);
+	}
+
+	// Static, so that the fields not set here start out zeroed.
+	static struct sigaction action;
+	action.sa_sigaction = &hxr_crash_handler_;
+	action.sa_flags     = SA_SIGINFO | SA_ONSTACK;
+	sigemptyset(&action.sa_mask);
+
+	for ( size_t i = 0; i < HXR_CRASH_SIGNAL_COUNT_; i++ )
+	{
+		if ( sigaction(hxr_crash_signals_[i], &action, &hxr_crash_previous_[i]) == 0 )
+			continue;
+		while ( i-- > 0 )
+			sigaction(hxr_crash_signals_[i], &hxr_crash_previous_[i], NULL);
 		return -1;
-	else
-		return rc;
+	}
+	hxr_crash_installed_ = 1;
+	return 0;
 }
 
-static hxr_stream_vtbl_  hxr_fstream_vtbl_;
-
-static void fstream_module_init()
+void HXR(crash_handler_uninstall)(hxr_thread *t)
 {
-	hxr_fstream_vtbl_.write_line   = &fstream_write_line;
-	hxr_fstream_vtbl_.write_text   = &fstream_write_text;
-	hxr_fstream_vtbl_.write_fmtstr = &fstream_write_fmtstr;
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	if ( !hxr_crash_installed_ )
+		return;
+	for ( size_t i = 0; i < HXR_CRASH_SIGNAL_COUNT_; i++ )
+		sigaction(hxr_crash_signals_[i], &hxr_crash_previous_[i], NULL);
+	hxr_crash_installed_ = 0;
 }
 
-void fstream_init(hxr_thread *t, hxr_stream_ *stream, hxr_source_location_ loc)
+int HXR(crash_register_thread)(hxr_thread *t)
 {
-	hxr_stream_init_(t, stream, loc);
-	stream->vtable = &hxr_fstream_vtbl_;
-	stream->impl   = stdout;
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_thread_impl_ *timpl = HXR(thread_get_impl_)(t);
+	for ( size_t i = 0; i < HXR_CRASH_MAX_THREADS_; i++ )
+		if ( hxr_atomic_load_ptr_((void *const *)&hxr_crash_threads_[i]) == timpl )
+			return 0;
+	for ( size_t i = 0; i < HXR_CRASH_MAX_THREADS_; i++ )
+		if ( hxr_atomic_cas_ptr_((void**)&hxr_crash_threads_[i], NULL, timpl) == NULL )
+			return 0;
+	return -1;
 }
 
-#define FSTREAM_INIT(t, stream) \
-	(fstream_init(t, stream, HXR_SOURCE_LOCATION_HERE_))
+static void hxr_crash_forget_thread_(hxr_thread_impl_ *timpl)
+{
+	for ( size_t i = 0; i < HXR_CRASH_MAX_THREADS_; i++ )
+		hxr_atomic_cas_ptr_((void**)&hxr_crash_threads_[i], timpl, NULL);
+}
 
-void fstream_set_fd(hxr_thread *t, hxr_stream_ *stream, FILE *fd)
+void HXR(crash_unregister_thread)(hxr_thread *t)
 {
-	stream->impl = fd;
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	hxr_crash_forget_thread_(HXR(thread_get_impl_)(t));
 }
 
-void fstream_finalize(hxr_thread *t, hxr_stream_ *stream, hxr_source_location_ loc)
+#if defined(HXR_EXTRACT_UNITTESTS) && (0 != HXR_EXTRACT_UNITTESTS)
+static int hxr_crash_test_starts_with_(const char *line, const char *prefix)
 {
-	hxr_stream_finalize_(t, stream, loc);
+	while ( *prefix != '\0' )
+		if ( *line++ != *prefix++ )
+			return 0;
+	return 1;
 }
 
-#define FSTREAM_FINALIZE(t, stream) \
-	(fstream_finalize(t, stream, HXR_SOURCE_LOCATION_HERE_))
+void HXR(crash_dump_unittest)(hxr_thread *t)
+{
+	static char     region[HXR_CRASH_LINE_SIZE * 64];
+	hxr_crash_out_  out;
+	size_t          i, n_lines;
 
-#endif // HXR_ENABLE_FILE_IO
+	// ................................ //
+	hxr_thread_init_(t);
+	hxr_thread_set_message_coalescing(t, 0);
+	hxr_crash_register_thread(t);
+
+	void (*volatile outer)(hxr_thread*) = &hxr_call_history_test_outer_;
+	outer(t);
+	HXR_BEGIN_ERROR(t);
+		hxr_message_id(t, "crash_test");
+		hxr_summary(t, "Still in the queue.");
+	HXR_END(t);
+
+	out.fd          = -1;
+	out.region      = region;
+	out.region_size = sizeof(region);
+	out.region_used = 0;
+	hxr_crash_dump_(&out, SIGSEGV, NULL);
+	n_lines = out.region_used / HXR_CRASH_LINE_SIZE;
+
+	do {
+		HXR_ASSERT_ELSE( n_lines, >=, 4 )                                          break;
+		for ( i = 0; i < n_lines; i++ )
+			if ( region[i * HXR_CRASH_LINE_SIZE + HXR_CRASH_LINE_SIZE - 1] != '\n' )
+				break;
+		HXR_ASSERT_ELSE( i, ==, n_lines )                                          break;
+
+		const char *first = region;
+		const char *last  = region + (n_lines - 1) * HXR_CRASH_LINE_SIZE;
+		HXR_ASSERT_ELSE( hxr_crash_test_starts_with_(first, "hexer crash: signal 11 (SIGSEGV)") )  break;
+		HXR_ASSERT_ELSE( hxr_crash_test_starts_with_(last,  "end of crash dump") ) break;
+
+		// The message is the last line before the end, and the calls
+		// are before it.
+		const char *msg_line = last - HXR_CRASH_LINE_SIZE;
+		HXR_ASSERT_ELSE( hxr_crash_test_starts_with_(msg_line, "  error   ") )   break;
+	} while (0);
+
+	// Once unregistered, the thread isn't in the dump.
+	hxr_crash_unregister_thread(t);
+	out.region_used = 0;
+	hxr_crash_dump_(&out, SIGSEGV, NULL);
+	HXR_ASSERT( out.region_used, ==, 2 * HXR_CRASH_LINE_SIZE );
+
+	hxr_thread_free_(t);
+}
+#endif
+
+#endif // HXR_ENABLE_CRASH_HANDLER
 
 // ===== Message Printing =====
 
 #ifdef HXR_ENABLE_FILE_IO
-void hxr_print_message(hxr_thread *t, FILE *fd, hxr_feedback_message *msg)
+void HXR(print_message)(hxr_thread *t, hxr_feedback_message *msg, FILE *fd)
 {
 	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
 	HXR_NEVER_NULL(t, t);
@@ -625,6 +8768,25 @@ void hxr_print_message(hxr_thread *t, FILE *fd, hxr_feedback_message *msg)
 	FSTREAM_FINALIZE(t, &stream);
 	HXR_RETURN(t);
 }
+
+size_t HXR(print_messages)(hxr_thread *t, FILE *fd)
+{
+	HXR_ENTER_FUNCTION(t, HXR_FNCLASS_NORMAL);
+	size_t n_printed = 0;
+	hxr_feedback_message *msg;
+	while ( HXR(msg_next)(t, &msg) )
+	{
+#if HXR_ENABLE_ASYNC_WRITER
+		if ( hxr_async_handoff_(t, fd, msg) ) {
+			n_printed++;
+			continue;
+		}
+#endif
+		HXR(print_message)(t, msg, fd);
+		n_printed++;
+	}
+	return n_printed;
+}
 #endif // HXR_ENABLE_FILE_IO
 
 
@@ -643,7 +8805,22 @@ static void hxr_process_level_early_init()
 		return;
 
 	hxr_init_libc_vtbl_();
+	hxr_scan_module_init_();
+	hxr_format_module_init_();
 	hxr_stream_module_init_();
+	hxr_sink_module_init_();
 	hxr_fstream_module_init_();
+#if HXR_ENABLE_FRAME_TIMING
+	hxr_frame_timing_module_init_();
+#endif
+#if HXR_STACK_TRACES_NATIVE_
+	hxr_stack_module_init_();
+#endif
+#if HXR_ENABLE_FILE_IO
+	hxr_binlog_module_init_();
+#endif
+#if HXR_ENABLE_FD_STREAM
+	hxr_fdstream_module_init_();
+#endif
 	hxr_early_init_done = 1;
 }
@@ -64,10 +64,95 @@
 /// unreachable code, thus making this a no-cost operation when the function
 /// is not included in function call history.
 ///
+/// Classes included here can still be turned off (and back on) while the
+/// program runs, for the whole process or one thread at a time; see
+/// `hxr_set_call_history_fnclasses`.
+///
 #define HXR_CALL_HISTORY_FNCLASSES  (1)
 
 #endif
 
+// ===== HXR_CALL_HISTORY_MAX =====
+#if defined(HXR_CALL_HISTORY_MAX) && HXR_DOCUMENTATION_BUILD
+#undef HXR_CALL_HISTORY_MAX
+#endif
+
+#ifndef HXR_CALL_HISTORY_MAX
+
+/// `HXR_CALL_HISTORY_MAX` is the number of function calls (see
+/// `HXR_ENTER_FUNCTION`) that each `hxr_thread` remembers. Once a thread has
+/// recorded that many, every new call overwrites the oldest one.
+///
+/// This MUST be a power of two, or 0 to not keep any call history.
+///
+/// Each call takes 16 bytes. They are stored in the `hxr_thread` itself, so
+/// recording one never allocates anything.
+///
+/// By default, this is defined as (256).
+///
+#define HXR_CALL_HISTORY_MAX  (256)
+
+#endif
+
+#if (HXR_CALL_HISTORY_MAX & (HXR_CALL_HISTORY_MAX - 1)) != 0
+#error "HXR_CALL_HISTORY_MAX must be a power of two (or 0)."
+#endif
+
+// ===== HXR_PROFILE_MAX_PATHS =====
+#if defined(HXR_PROFILE_MAX_PATHS) && HXR_DOCUMENTATION_BUILD
+#undef HXR_PROFILE_MAX_PATHS
+#endif
+
+#ifndef HXR_PROFILE_MAX_PATHS
+
+/// `HXR_PROFILE_MAX_PATHS` is the number of distinct call paths (chains of
+/// `HXR_ENTER_FUNCTION` callsites, like `main;foo;bar`) that the call-count
+/// profile keeps a count for (see `hxr_profile_dump`). Calls along paths
+/// that don't fit are only counted in their callsite's total.
+///
+/// This MUST be a power of two, or 0 to only count calls per callsite.
+/// Paths are only counted when there is call history to tell what called
+/// what (`HXR_CALL_HISTORY_MAX` isn't 0).
+///
+/// Each path takes 24 bytes, in a table shared by all threads. Counting
+/// paths makes every recorded call cost a little more (about 1.3 ns per call
+/// in `design/bench-call-history.c`); setting this to 0 saves that, but
+/// leaves the profile without its caller rows, and `HXR_PROFILE_COLLAPSED`
+/// can't be written at all.
+///
+/// By default, this is defined as (8192).
+///
+#define HXR_PROFILE_MAX_PATHS  (8192)
+
+#endif
+
+#if (HXR_PROFILE_MAX_PATHS & (HXR_PROFILE_MAX_PATHS - 1)) != 0
+#error "HXR_PROFILE_MAX_PATHS must be a power of two (or 0)."
+#endif
+
+// ===== HXR_ENABLE_FRAME_TIMING =====
+#if defined(HXR_ENABLE_FRAME_TIMING) && HXR_DOCUMENTATION_BUILD
+#undef HXR_ENABLE_FRAME_TIMING
+#endif
+
+#ifndef HXR_ENABLE_FRAME_TIMING
+/// The value of the `HXR_ENABLE_FRAME_TIMING` macro determines whether
+/// `HXR_ENTER_FUNCTION` reads the CPU's cycle counter (or a monotonic clock
+/// where there isn't one it can use) so that the call-count profile can say
+/// how much time was spent in each function, with and without the functions
+/// it called (see `hxr_profile_dump`).
+///
+/// Only calls that call history records are timed, so it follows
+/// `HXR_CALL_HISTORY_FNCLASSES` and the classes set while running, and it
+/// has no effect when `HXR_CALL_HISTORY_MAX` is 0. Each timed call costs
+/// one read of the counter.
+///
+/// By default, this is defined as (0), which compiles all of it out.
+///
+#define HXR_ENABLE_FRAME_TIMING  (0)
+
+#endif
+
 // ===== HXR_ENABLE_LIBC =====
 #if defined(HXR_ENABLE_LIBC) && HXR_ENABLE_LIBC
 #undef HXR_ENABLE_LIBC
@@ -175,6 +260,175 @@
 
 #endif
 
+// ===== HXR_ENABLE_ASYNC_WRITER =====
+#if defined(HXR_ENABLE_ASYNC_WRITER) && HXR_DOCUMENTATION_BUILD
+#undef HXR_ENABLE_ASYNC_WRITER
+#endif
+
+#ifndef HXR_ENABLE_ASYNC_WRITER
+/// The value of the `HXR_ENABLE_ASYNC_WRITER` macro determines whether
+/// `hxr_async_start` (and the background writer thread it starts) is
+/// available. This requires `HXR_ENABLE_FILE_IO` and POSIX threads.
+///
+/// By default, this is defined as (1) on POSIX systems when
+/// `HXR_ENABLE_FILE_IO` is enabled, and (0) otherwise.
+///
+#if (HXR_ENABLE_FILE_IO) && (defined(__unix__) || defined(__APPLE__))
+#define HXR_ENABLE_ASYNC_WRITER (1)
+#else
+#define HXR_ENABLE_ASYNC_WRITER (0)
+#endif
+
+#endif
+
+// ===== HXR_ENABLE_FD_STREAM =====
+#if defined(HXR_ENABLE_FD_STREAM) && HXR_DOCUMENTATION_BUILD
+#undef HXR_ENABLE_FD_STREAM
+#endif
+
+#ifndef HXR_ENABLE_FD_STREAM
+/// The value of the `HXR_ENABLE_FD_STREAM` macro determines whether
+/// `hxr_fdstream` (buffered output to a raw file descriptor with `writev`)
+/// is available. This requires `HXR_ENABLE_FILE_IO` and POSIX.
+///
+/// By default, this is defined as (1) on POSIX systems when
+/// `HXR_ENABLE_FILE_IO` is enabled, and (0) otherwise.
+///
+#if (HXR_ENABLE_FILE_IO) && (defined(__unix__) || defined(__APPLE__))
+#define HXR_ENABLE_FD_STREAM (1)
+#else
+#define HXR_ENABLE_FD_STREAM (0)
+#endif
+
+#endif
+
+// ===== HXR_ENABLE_CRASH_HANDLER =====
+#if defined(HXR_ENABLE_CRASH_HANDLER) && HXR_DOCUMENTATION_BUILD
+#undef HXR_ENABLE_CRASH_HANDLER
+#endif
+
+#ifndef HXR_ENABLE_CRASH_HANDLER
+/// The value of the `HXR_ENABLE_CRASH_HANDLER` macro determines whether
+/// `hxr_crash_handler_install` (which dumps call history and pending
+/// messages when the process crashes) is available. This requires POSIX
+/// signals, and does not need `HXR_ENABLE_FILE_IO`.
+///
+/// By default, this is defined as (1) on POSIX systems when
+/// `HXR_ENABLE_LIBC` is enabled, and (0) otherwise.
+///
+#if (HXR_ENABLE_LIBC) && (defined(__unix__) || defined(__APPLE__))
+#define HXR_ENABLE_CRASH_HANDLER (1)
+#else
+#define HXR_ENABLE_CRASH_HANDLER (0)
+#endif
+
+#endif
+
+// Whether HeXeR can unwind the native stack (and look up symbols) on this
+// platform. See `HXR_STACK_TRACE_DEPTH`.
+#if (HXR_ENABLE_LIBC) && defined(__linux__) && (defined(__GNUC__) || defined(__clang__))
+#define HXR_NATIVE_STACK_TRACES_ (1)
+#else
+#define HXR_NATIVE_STACK_TRACES_ (0)
+#endif
+
+// ===== HXR_STACK_TRACE_DEPTH =====
+#if defined(HXR_STACK_TRACE_DEPTH) && HXR_DOCUMENTATION_BUILD
+#undef HXR_STACK_TRACE_DEPTH
+#endif
+
+#ifndef HXR_STACK_TRACE_DEPTH
+/// `HXR_STACK_TRACE_DEPTH` is the most frames that are captured for the
+/// stack trace of an error message (one is captured at every
+/// HXR_BEGIN_ERROR; see `hxr_message_stack_trace`). Setting it to 0 turns
+/// stack traces off.
+///
+/// On Linux, the trace is made by unwinding the native stack (see
+/// `HXR_STACK_TRACE_FRAME_POINTERS`), and only the return addresses are
+/// kept with the message. They are turned into function names when the
+/// message is printed, with `dladdr`, so functions that aren't exported
+/// (static ones, or any function in an executable that wasn't linked with
+/// `-rdynamic`) are shown as an offset into the executable or library,
+/// which `addr2line` can turn into a line number. This needs `-ldl` on
+/// older versions of glibc.
+///
+/// Elsewhere, the trace is the calls that call history says haven't
+/// returned yet (see `HXR_STACK_TRACE_EXCLUDES`).
+///
+/// By default, this is defined as (32).
+///
+#define HXR_STACK_TRACE_DEPTH  (32)
+
+#endif
+
+// ===== HXR_STACK_TRACE_FRAME_POINTERS =====
+#if defined(HXR_STACK_TRACE_FRAME_POINTERS) && HXR_DOCUMENTATION_BUILD
+#undef HXR_STACK_TRACE_FRAME_POINTERS
+#endif
+
+#ifndef HXR_STACK_TRACE_FRAME_POINTERS
+/// The value of the `HXR_STACK_TRACE_FRAME_POINTERS` macro determines how
+/// native stack traces are made. If it is (1), HeXeR follows the chain of
+/// saved frame pointers, which costs a few nanoseconds per frame. Every
+/// function that should show up in the trace (including HeXeR's own) has
+/// to be compiled with frame pointers (`-fno-omit-frame-pointer`); the
+/// chain is checked against the bounds of the thread's stack, so code
+/// without them makes the trace stop early or skip callers, but never
+/// crashes. If it is (0), glibc's `backtrace` is used instead, which reads
+/// the unwind tables and works for any code, but costs a couple of
+/// microseconds per trace.
+///
+/// By default, this is defined as (1) on x86-64 and AArch64, and (0)
+/// elsewhere.
+///
+#if defined(__x86_64__) || defined(__aarch64__)
+#define HXR_STACK_TRACE_FRAME_POINTERS  (1)
+#else
+#define HXR_STACK_TRACE_FRAME_POINTERS  (0)
+#endif
+
+#endif
+
+// ===== HXR_STACK_TRACE_EXCLUDES =====
+#if defined(HXR_STACK_TRACE_EXCLUDES) && HXR_DOCUMENTATION_BUILD
+#undef HXR_STACK_TRACE_EXCLUDES
+#endif
+
+#ifndef HXR_STACK_TRACE_EXCLUDES
+/// `HXR_STACK_TRACE_EXCLUDES` is the `HXR_FNCLASS_*` values whose functions
+/// are left out of stack traces that are made from call history. That is
+/// only done where the native stack can't be unwound; only calls that call
+/// history records (see `HXR_CALL_HISTORY_FNCLASSES`) can show up in them.
+///
+/// By default, this is defined as every class where native stack traces
+/// are available (so they are always used), and as
+/// `HXR_FNCLASS_CANT_MESSAGE` (HeXeR's own message handling) elsewhere.
+///
+#if HXR_NATIVE_STACK_TRACES_
+#define HXR_STACK_TRACE_EXCLUDES  (~(size_t)0)
+#else
+#define HXR_STACK_TRACE_EXCLUDES  (HXR_FNCLASS_CANT_MESSAGE)
+#endif
+
+#endif
+
+// ===== HXR_ENABLE_SIMD =====
+#if defined(HXR_ENABLE_SIMD) && HXR_DOCUMENTATION_BUILD
+#undef HXR_ENABLE_SIMD
+#endif
+
+#ifndef HXR_ENABLE_SIMD
+/// The value of the `HXR_ENABLE_SIMD` macro determines whether HeXeR may use
+/// SIMD instructions (currently SSE2, and AVX2 when the CPU has it) to scan
+/// text for line endings. When it is (0), or when the compiler or target
+/// doesn't support them, a portable implementation is used instead.
+///
+/// By default, this is defined as (1).
+///
+#define HXR_ENABLE_SIMD (1)
+
+#endif
+
 // ===== HXR_VFPRINTF_DEFAULT =====
 #if defined(HXR_VFPRINTF_DEFAULT) && HXR_DOCUMENTATION_BUILD
 #undef HXR_VFPRINTF_DEFAULT
@@ -298,6 +552,28 @@
 
 #endif
 
+// ===== HXR_TIMESTAMP_DEFAULT =====
+#if defined(HXR_TIMESTAMP_DEFAULT) && HXR_DOCUMENTATION_BUILD
+#undef HXR_TIMESTAMP_DEFAULT
+#endif
+
+#ifndef HXR_TIMESTAMP_DEFAULT
+
+/// `HXR_TIMESTAMP_DEFAULT` defines the function that HeXeR calls to find out
+/// when a message was reported. It must have the signature `uint64_t f(void)`
+/// and return nanoseconds since the Unix epoch.
+///
+/// By default, this is `HXR(timestamp_default)`, which uses `clock_gettime`
+/// (or `time`, where that isn't available). When `HXR_ENABLE_LIBC` is 0,
+/// this defaults to `HXR(timestamp_noop)`, which always returns 0.
+#if HXR_ENABLE_LIBC
+#define HXR_TIMESTAMP_DEFAULT  HXR(timestamp_default)
+#else
+#define HXR_TIMESTAMP_DEFAULT  HXR(timestamp_noop)
+#endif
+
+#endif
+
 // ===== HXR_MALLOC_DEFAULT =====
 #if defined(HXR_MALLOC_DEFAULT) && HXR_DOCUMENTATION_BUILD
 #undef HXR_MALLOC_DEFAULT
@@ -363,6 +639,180 @@
 
 #endif
 
+// ===== HXR_MESSAGE_ARENA_CHUNK_SIZE =====
+#if defined(HXR_MESSAGE_ARENA_CHUNK_SIZE) && HXR_DOCUMENTATION_BUILD
+#undef HXR_MESSAGE_ARENA_CHUNK_SIZE
+#endif
+
+#ifndef HXR_MESSAGE_ARENA_CHUNK_SIZE
+
+/// `HXR_MESSAGE_ARENA_CHUNK_SIZE` determines the size, in bytes, of each
+/// chunk of memory that a `hxr_thread` requests from its allocator when
+/// its message arena runs out of room.
+///
+/// All feedback message structure and text (summaries, details, suggestions,
+/// etc) is placed into a per-thread bump-allocated arena. Chunks are only
+/// requested from the allocator when the arena grows; once a thread has
+/// warmed up, building messages does not call `malloc` at all. Calling
+/// `hxr_clear_messages` rewinds the arena in constant time while keeping
+/// its chunks for reuse.
+///
+/// Any single allocation that is larger than this will receive a dedicated
+/// chunk of its own, so this is a tuning knob and not a limit.
+///
+/// By default, this is defined as (4096).
+///
+#define HXR_MESSAGE_ARENA_CHUNK_SIZE  (4096)
+
+#endif
+
+// ===== HXR_MESSAGE_QUEUE_CAPACITY =====
+#if defined(HXR_MESSAGE_QUEUE_CAPACITY) && HXR_DOCUMENTATION_BUILD
+#undef HXR_MESSAGE_QUEUE_CAPACITY
+#endif
+
+#ifndef HXR_MESSAGE_QUEUE_CAPACITY
+
+/// `HXR_MESSAGE_QUEUE_CAPACITY` is the maximum number of finished messages
+/// that a `hxr_thread` will hold on to before its overflow policy kicks in.
+/// See `hxr_thread_set_queue_overflow_policy`.
+///
+/// This MUST be a power of two.
+///
+/// The queue is a ring buffer of pointers, so each slot costs one pointer's
+/// worth of memory. It is allocated the first time a message is queued.
+///
+/// By default, this is defined as (1024).
+///
+#define HXR_MESSAGE_QUEUE_CAPACITY  (1024)
+
+#endif
+
+#if (HXR_MESSAGE_QUEUE_CAPACITY & (HXR_MESSAGE_QUEUE_CAPACITY - 1)) != 0
+#error "HXR_MESSAGE_QUEUE_CAPACITY must be a power of two."
+#endif
+
+// ===== HXR_COALESCE_TABLE_SIZE =====
+#if defined(HXR_COALESCE_TABLE_SIZE) && HXR_DOCUMENTATION_BUILD
+#undef HXR_COALESCE_TABLE_SIZE
+#endif
+
+#ifndef HXR_COALESCE_TABLE_SIZE
+
+/// `HXR_COALESCE_TABLE_SIZE` is the number of slots in each thread's table of
+/// recently queued messages, which is used to fold repeated messages into
+/// one. See `hxr_message_repeat_count`.
+///
+/// This must be a power of two, or 0 to disable coalescing entirely.
+/// The table is allocated the first time a message with an id is queued.
+///
+/// By default, this is defined as (256).
+#define HXR_COALESCE_TABLE_SIZE  (256)
+
+#endif
+
+#if (HXR_COALESCE_TABLE_SIZE & (HXR_COALESCE_TABLE_SIZE - 1)) != 0
+#error "HXR_COALESCE_TABLE_SIZE must be a power of two, or 0."
+#endif
+
+// ===== HXR_ASYNC_QUEUE_CAPACITY =====
+#if defined(HXR_ASYNC_QUEUE_CAPACITY) && HXR_DOCUMENTATION_BUILD
+#undef HXR_ASYNC_QUEUE_CAPACITY
+#endif
+
+#ifndef HXR_ASYNC_QUEUE_CAPACITY
+
+/// `HXR_ASYNC_QUEUE_CAPACITY` is the number of messages that can be waiting
+/// for the asynchronous writer at once. When it's full, `hxr_print_messages`
+/// waits for the writer to catch up. See `hxr_async_start`.
+///
+/// This must be a power of two.
+///
+/// By default, this is defined as (4096).
+#define HXR_ASYNC_QUEUE_CAPACITY  (4096)
+
+#endif
+
+#if (HXR_ASYNC_QUEUE_CAPACITY & (HXR_ASYNC_QUEUE_CAPACITY - 1)) != 0 || (HXR_ASYNC_QUEUE_CAPACITY == 0)
+#error "HXR_ASYNC_QUEUE_CAPACITY must be a power of two."
+#endif
+
+// ===== HXR_FD_STREAM_BUFFER_SIZE =====
+#if defined(HXR_FD_STREAM_BUFFER_SIZE) && HXR_DOCUMENTATION_BUILD
+#undef HXR_FD_STREAM_BUFFER_SIZE
+#endif
+
+#ifndef HXR_FD_STREAM_BUFFER_SIZE
+
+/// `HXR_FD_STREAM_BUFFER_SIZE` is the size, in bytes, of the output buffer
+/// that each `hxr_fdstream` copies short pieces of text into before writing
+/// them. It is also the default flush threshold for
+/// `HXR_FDSTREAM_FLUSH_THRESHOLD`.
+///
+/// By default, this is defined as (16384).
+#define HXR_FD_STREAM_BUFFER_SIZE  (16384)
+
+#endif
+
+#if (HXR_FD_STREAM_BUFFER_SIZE) < 256
+#error "HXR_FD_STREAM_BUFFER_SIZE must be at least 256."
+#endif
+
+// ===== HXR_MESSAGE_ID_TABLE_SIZE =====
+#if defined(HXR_MESSAGE_ID_TABLE_SIZE) && HXR_DOCUMENTATION_BUILD
+#undef HXR_MESSAGE_ID_TABLE_SIZE
+#endif
+
+#ifndef HXR_MESSAGE_ID_TABLE_SIZE
+
+/// `HXR_MESSAGE_ID_TABLE_SIZE` is the maximum number of distinct message ids
+/// that can be interned in one process. See `hxr_intern_message_id`.
+///
+/// The table is a static array of this many pointers. It never grows, and
+/// it should be kept comfortably larger than the number of ids in the
+/// program: an id is only looked for in a few slots near its hash, so a
+/// crowded table turns some ids away before it is full.
+///
+/// This must be a power of two.
+///
+/// By default, this is defined as (4096).
+#define HXR_MESSAGE_ID_TABLE_SIZE  (4096)
+
+#endif
+
+#if (HXR_MESSAGE_ID_TABLE_SIZE & (HXR_MESSAGE_ID_TABLE_SIZE - 1)) != 0 || (HXR_MESSAGE_ID_TABLE_SIZE == 0)
+#error "HXR_MESSAGE_ID_TABLE_SIZE must be a power of two."
+#endif
+
+// ===== HXR_DEFER_MESSAGE_FORMATTING =====
+#if defined(HXR_DEFER_MESSAGE_FORMATTING) && HXR_DOCUMENTATION_BUILD
+#undef HXR_DEFER_MESSAGE_FORMATTING
+#endif
+
+#ifndef HXR_DEFER_MESSAGE_FORMATTING
+
+/// `HXR_DEFER_MESSAGE_FORMATTING` determines whether the `_fmt` and `_va`
+/// message building functions (ex: `hxr_details_fmt`) format their text
+/// immediately, or only when the message is actually rendered.
+///
+/// When this is (1), those functions store the format string along with
+/// a compact copy of their arguments, and `vsnprintf` is not called until
+/// something (usually a stream that prints or logs the message) asks for
+/// the text. Messages that are filtered, deduplicated, or cleared with
+/// `hxr_clear_messages` never pay the cost of formatting.
+///
+/// Format strings that can't be replayed later (ex: ones using `%n` or
+/// positional `%1$d` arguments) are always formatted immediately.
+///
+/// Setting this to (0) makes all formatting happen immediately. This might
+/// be useful when troubleshooting a `HXR_VSNPRINTF_DEFAULT` replacement.
+///
+/// By default, this is defined as (1).
+///
+#define HXR_DEFER_MESSAGE_FORMATTING  (1)
+
+#endif
+
 // ===== HXR_ALLOW_VLAS =====
 #if defined(HXR_ALLOW_VLAS) && HXR_DOCUMENTATION_BUILD
 #undef HXR_ALLOW_VLAS
@@ -661,6 +1111,12 @@ void HXR(vsyslog_noop)(int priority, const char *format, va_list ap);
 ///
 int HXR(debugf_noop)(const char *str, ...);
 
+/// The default `HXR_TIMESTAMP_DEFAULT`: nanoseconds since the Unix epoch.
+uint64_t HXR(timestamp_default)(void);
+
+/// Set `HXR_TIMESTAMP_DEFAULT` to this to leave message timestamps at 0.
+uint64_t HXR(timestamp_noop)(void);
+
 /// Stores HeXeR configuration and metadata related to the current running process.
 ///
 /// This includes default values for various C-library functions:
@@ -705,6 +1161,16 @@ typedef struct S_HXR_THREAD
 	// TODO: implement this.
 	void **dynamic_embeds;
 
+	// Internal-use: see `hxr_thread_frame_depth_`. It's here rather than with
+	// the rest of the call history so that HXR_BEGIN can read it inline.
+	size_t frame_depth_;
+
+	// Internal-use: calls left until the next one of each function class is
+	// recorded, indexed by the class's lowest bit. HXR_ENTER_FUNCTION counts
+	// these down inline, so that a call that is sampled out doesn't call into
+	// HeXeR. See `hxr_set_fnclass_sample_period`.
+	size_t sample_countdown_[sizeof(size_t) * 8];
+
 #ifdef HXR_THREAD_STATIC_EMBEDS
 #define HXR_X(embed_type, embed_name) embed_type embed_name;
 	HXR_THREAD_STATIC_EMBEDS(HXR_X)
@@ -716,6 +1182,11 @@ HXR__PREFIX_ALIAS(thread);
 /// Initializes the HeXeR library and creates the `hxr_process*` object.
 hxr_process  *HXR(start)();
 
+/// Shuts HeXeR down. If the asynchronous writer is running (see
+/// `hxr_async_start`), this waits for it to write everything it was given,
+/// and then stops it.
+void  HXR(stop)(hxr_process *proc);
+
 /// Returns the process-wide instance of the `hxr_process` object.
 hxr_process  *HXR(get_current_process)();
 
@@ -756,6 +1227,27 @@ hxr_thread *HXR(process_get_current_thread)(hxr_process *proc);
 /// only one per POSIX thread.
 hxr_thread *HXR(get_current_thread)();
 
+/// A structured feedback message (ex: an error message) as built by a
+/// `HXR_BEGIN_*`-`HXR_END` block.
+///
+/// The contents of this struct are private. Use the `hxr_message_*` accessor
+/// functions to read from it.
+///
+/// Messages live in their thread's message arena. Any `hxr_feedback_message*`
+/// obtained from a thread becomes invalid after `hxr_clear_messages` (or any
+/// other function that removes all messages from the thread) is called.
+typedef struct S_HXR_FEEDBACK_MESSAGE  hxr_feedback_message;
+HXR__PREFIX_ALIAS(feedback_message);
+
+/// A small integer that stands for an interned message id string.
+/// Two messages have the same id exactly when their handles are equal.
+/// See `hxr_intern_message_id`.
+typedef uint32_t  hxr_msgid;
+HXR__PREFIX_ALIAS(msgid);
+
+/// The handle of "no message id".
+#define HXR_MSGID_NONE  ((hxr_msgid)0)
+
 /// Implementing this callback allows calling code to print/handle messages,
 /// errors, etc, as they happen within a called function, instead fo waiting
 /// for the function to finish. Most of the time this won't matter, but it is
@@ -784,20 +1276,215 @@ hxr_feedback_handler HXR(thread_get_feedback_handler)(hxr_thread *t);
 /// feedback handler itself and an explanation of why anyone would want to use one.
 void HXR(thread_set_message_handler(hxr_thread *t, hxr_feedback_handler callback, void *callback_context);
 
+/// Returns: The number of error messages reported on this thread since the
+/// last `hxr_clear_messages`, including any that were dropped because the
+/// message queue was full.
 size_t  HXR(error_count)(hxr_thread *t);
+
+/// Returns: The number of messages (of any type) reported on this thread
+/// since the last `hxr_clear_messages`, including any that were dropped
+/// because the message queue was full.
 size_t  HXR(message_count)(hxr_thread *t);
 void    HXR(print_message)(hxr_thread *t, hxr_feedback_message *msg, FILE *fd);
 void    HXR(log_message)(hxr_thread *t, hxr_feedback_message *msg);
 
-/// Returns: The number of messages printed.
+/// Takes every message out of the thread's queue (like `hxr_msg_next`) and
+/// prints it to `fd`. If the asynchronous writer is running and writing to
+/// `fd`, then the messages are handed to it instead. See `hxr_async_start`.
+///
+/// Returns: The number of messages printed (or handed off).
 size_t  HXR(print_messages)(hxr_thread *t, FILE *fd);
 
+#if (HXR_ENABLE_ASYNC_WRITER) || (HXR_DOCUMENTATION_BUILD)
+/// Starts a background thread that prints messages to `fd`.
+///
+/// After this, `hxr_print_messages(t, fd)` (with the same `fd`) only copies
+/// each message and hands it to the writer thread, which formats and writes
+/// it. The copy doesn't format anything either: text from the `_fmt`/`_va`
+/// functions travels as its format string and arguments. Messages printed
+/// from any one thread keep their order.
+///
+/// The handoff is lock-free and has room for `HXR_ASYNC_QUEUE_CAPACITY`
+/// messages. If it fills up, `hxr_print_messages` waits for the writer.
+///
+/// Call this (and `hxr_stop`) while no other thread is printing messages.
+///
+/// Returns: 0 on success, or -1 if the writer is already running or could
+/// not be started.
+int   HXR(async_start)(hxr_thread *t, FILE *fd);
+
+/// Waits until every message handed to the asynchronous writer before this
+/// call has been written and `fflush`ed. Does nothing if the writer isn't
+/// running.
+void  HXR(flush)(hxr_thread *t);
+#endif
+
 /// Returns: The number of messages logged.
 size_t  HXR(log_messages)(hxr_thread *t);
 
+/// Overflow policies for a thread's message queue.
+/// See `hxr_thread_set_queue_overflow_policy`.
+#define HXR_QUEUE_OVERFLOW_DROP_NEWEST  ((uint32_t)0)
+#define HXR_QUEUE_OVERFLOW_DROP_OLDEST  ((uint32_t)1)
+#define HXR_QUEUE_OVERFLOW_COLLAPSE     ((uint32_t)2)
+
+/// Chooses what happens when a message is finished while the thread's
+/// message queue already holds `HXR_MESSAGE_QUEUE_CAPACITY` messages.
+///
+/// - `HXR_QUEUE_OVERFLOW_DROP_NEWEST` discards the new message.
+/// - `HXR_QUEUE_OVERFLOW_DROP_OLDEST` discards the oldest queued message
+///     to make room for the new one.
+/// - `HXR_QUEUE_OVERFLOW_COLLAPSE` (the default) discards the new message,
+///     but counts it. After the queued messages have been read, one more
+///     message (flagged with `HXR_MSG_FLAG_HEXER`) is handed out that says
+///     how many messages were discarded. Its type is that of the most severe
+///     discarded message.
+///
+/// DROP_NEWEST and COLLAPSE give the memory of discarded messages back to
+/// the thread, so memory use stays flat during an error storm. DROP_OLDEST
+/// reuses the evicted messages' memory once every message that was queued
+/// along with them has been evicted too, so it holds about two queues' worth
+/// of messages. Messages that were read with `hxr_msg_next` have to stay
+/// valid until `hxr_clear_messages`, though: reading during a storm keeps
+/// memory from being reused until the messages are cleared.
+///
+/// In every case, `hxr_message_count` and `hxr_error_count` still count the
+/// discarded messages, and `hxr_dropped_message_count` says how many there were.
+void      HXR(thread_set_queue_overflow_policy)(hxr_thread *t, uint32_t policy);
+uint32_t  HXR(thread_get_queue_overflow_policy)(hxr_thread *t);
+
+/// Returns: The number of messages that could not be queued (or were evicted
+/// from the queue) since the last `hxr_clear_messages`.
+size_t  HXR(dropped_message_count)(hxr_thread *t);
+
+/// Turns message coalescing on or off for the thread. It is on by default
+/// (unless `HXR_COALESCE_TABLE_SIZE` is 0).
+///
+/// While it's on, a message that has the same `hxr_message_id` and the same
+/// HXR_BEGIN_* callsite as a message that is still waiting in the queue is not
+/// queued. Instead, the waiting message's `hxr_message_repeat_count` goes up
+/// by one and its `hxr_message_last_time` is updated. Messages without an id
+/// are never coalesced.
+///
+/// Coalesced messages still count towards `hxr_message_count` and
+/// `hxr_error_count`, but not towards `hxr_dropped_message_count`.
+void    HXR(thread_set_message_coalescing)(hxr_thread *t, uint8_t enabled);
+
+/// Returns: The number of messages waiting in the thread's queue.
+///
+/// Unlike `hxr_message_count`, this goes down as messages are taken out of
+/// the queue with `hxr_msg_next`.
+size_t  HXR(msg_count)(hxr_thread *t);
+
+/// Takes the oldest message out of the thread's queue and stores it in `*msg`.
+///
+/// Returns: 1 if a message was retrieved, 0 if the queue is empty.
+///
+/// The message stays valid until `hxr_clear_messages` is called.
+int     HXR(msg_next)(hxr_thread *t, hxr_feedback_message **msg);
+
 /// Returns: The number of messages deleted.
+///
+/// This also rewinds the thread's message arena, so it is a constant-time
+/// operation no matter how many messages were queued. Any pointers to those
+/// messages (or their text) are invalid afterwards.
 size_t  HXR(clear_messages)(hxr_thread *t);
 
+// Message building:
+//
+// These are only valid within a HXR_BEGIN_[message type]-HXR_END block.
+// The text passed to them is copied into the thread's message arena, so
+// the caller's buffers do not need to outlive the call.
+void  HXR(message_id)(hxr_thread *t, const char *id);
+void  HXR(message_id_handle)(hxr_thread *t, hxr_msgid id);
+void  HXR(summary)(hxr_thread *t, const char *text);
+void  HXR(summary_fmt)(hxr_thread *t, const char *fmtstr, ...);
+void  HXR(summary_va)(hxr_thread *t, const char *fmtstr, va_list vargs);
+void  HXR(details)(hxr_thread *t, const char *text);
+void  HXR(details_fmt)(hxr_thread *t, const char *fmtstr, ...);
+void  HXR(details_va)(hxr_thread *t, const char *fmtstr, va_list vargs);
+void  HXR(suggestion)(hxr_thread *t, const char *text);
+void  HXR(suggestion_fmt)(hxr_thread *t, const char *fmtstr, ...);
+void  HXR(suggestion_va)(hxr_thread *t, const char *fmtstr, va_list vargs);
+
+/// Returns: The process-wide handle for the message id `id`, adding `id` to
+/// the table (as a copy) if this is the first time it has been seen. The
+/// handle stays valid for the life of the process.
+///
+/// Returns `HXR_MSGID_NONE` if `id` is NULL, if the table is full, or if
+/// the slots near `id`'s hash are all taken by other ids and `id` isn't
+/// already in them (see `HXR_MESSAGE_ID_TABLE_SIZE`).
+///
+/// This is safe to call from multiple threads at once.
+hxr_msgid    HXR(intern_message_id)(hxr_thread *t, const char *id);
+
+/// Returns: The string that `id` was interned from, or NULL for
+/// `HXR_MSGID_NONE` (or anything that isn't a valid handle).
+const char  *HXR(msgid_string)(hxr_msgid id);
+
+#if defined(__GNUC__) || defined(__clang__)
+#define HXR_MSGID_CACHE_LOAD_(p)      __atomic_load_n((p), __ATOMIC_RELAXED)
+#define HXR_MSGID_CACHE_STORE_(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#else
+#define HXR_MSGID_CACHE_LOAD_(p)      (*(volatile hxr_msgid*)(p))
+#define HXR_MSGID_CACHE_STORE_(p, v)  (*(volatile hxr_msgid*)(p) = (v))
+#endif
+
+/// Same as `hxr_message_id(t, id)`, but `id` is interned only once per
+/// callsite. The handle is cached in a static variable, so later passes
+/// through the callsite just load it. `id` should be a string literal (or
+/// at least, the same string every time this callsite runs).
+///
+/// Example:
+/// ===
+/// HXR_BEGIN_ERROR(t);
+///     HXR_MESSAGE_ID(t, "elephant_in_way");
+///     hxr_summary(t, "Object did not continue to move.");
+/// HXR_END(t);
+/// ===
+#define HXR_MESSAGE_ID(t, id) \
+	do { \
+		static hxr_msgid  hxr_msgid_cache_ = HXR_MSGID_NONE; \
+		hxr_msgid  hxr_msgid_ = HXR_MSGID_CACHE_LOAD_(&hxr_msgid_cache_); \
+		if ( hxr_msgid_ == HXR_MSGID_NONE ) { \
+			hxr_msgid_ = HXR(intern_message_id)((t), (id)); \
+			HXR_MSGID_CACHE_STORE_(&hxr_msgid_cache_, hxr_msgid_); \
+		} \
+		if ( hxr_msgid_ != HXR_MSGID_NONE ) \
+			HXR(message_id_handle)((t), hxr_msgid_); \
+		else \
+			HXR(message_id)((t), (id)); \
+	} while (0)
+
+// Message accessors:
+uint32_t     HXR(message_type)(const hxr_feedback_message *msg);
+const char  *HXR(message_get_id)(const hxr_feedback_message *msg);
+hxr_msgid    HXR(message_get_id_handle)(const hxr_feedback_message *msg);
+
+/// Returns: How many times this message was reported. This is 1 unless
+/// repeats were folded into it. See `hxr_thread_set_message_coalescing`.
+size_t       HXR(message_repeat_count)(const hxr_feedback_message *msg);
+
+/// Returns: When the first and the most recent report of this message
+/// happened, in nanoseconds since the Unix epoch. See `HXR_TIMESTAMP_DEFAULT`.
+uint64_t     HXR(message_first_time)(const hxr_feedback_message *msg);
+uint64_t     HXR(message_last_time)(const hxr_feedback_message *msg);
+
+// The text accessors take the thread that owns the message because text
+// built with the `_fmt`/`_va` functions is rendered (into that thread's
+// message arena) the first time it is requested.
+// See `HXR_DEFER_MESSAGE_FORMATTING`.
+const char  *HXR(message_summary)(hxr_thread *t, hxr_feedback_message *msg);
+const char  *HXR(message_details)(hxr_thread *t, hxr_feedback_message *msg);
+const char  *HXR(message_suggestion)(hxr_thread *t, hxr_feedback_message *msg);
+
+/// Returns: Where the error was reported from, innermost call first, one
+/// frame per line. This is NULL for messages that aren't errors, and when
+/// stack traces are off (see `HXR_STACK_TRACE_DEPTH`). Like the other text,
+/// it is rendered the first time it is requested; printed messages show it
+/// after their suggestion.
+const char  *HXR(message_stack_trace)(hxr_thread *t, hxr_feedback_message *msg);
+
 
 // Message formatting:
 //
@@ -824,6 +1511,89 @@ size_t  HXR(clear_messages)(hxr_thread *t);
 //
 // Also might need to consider message structure. Maybe.
 
+/// What goes in front of each line of a printed message.
+///
+/// A format is compiled once from a `hxr_message_format_spec` and can then be
+/// used by any number of threads (see `hxr_thread_set_message_format`). Each
+/// spec string is literal text with these directives in it:
+///
+/// * `%D`: the date the message was reported, as YYYY-MM-DD (UTC).
+/// * `%T`: the time the message was reported, as HH:MM:SS (UTC).
+/// * `%I`: both, in ISO 8601 form (ex: 2020-10-03T14:05:09Z).
+/// * `%h`: the hostname.
+/// * `%p`: the process id.
+/// * `%u`, `%g`: the user and group ids of the process.
+/// * `%e`: the name of the executable (without its directory).
+/// * `%c`: the current working directory.
+/// * `%f`, `%l`, `%F`: the file, line, and function that reported the message.
+/// * `%t`: the message type ("error", "warning", ...).
+/// * `%i`: the message id, or nothing if the message doesn't have one.
+/// * `%%`: a literal '%'.
+///
+/// None of these cost a system call per message. The process fields are
+/// looked up once (and once more in a forked child), the working directory
+/// at most once a second, and each thread only renders a timestamp when
+/// the second changes.
+///
+/// Example:
+/// ===
+/// hxr_message_format_spec spec = {0};
+/// spec.first_line   = "%T %e[%p] ";
+/// spec.middle_lines = "| ";
+/// spec.last_line    = "` ";
+/// spec.align_prefixes = 1;
+/// hxr_message_format *fmt = hxr_message_format_compile(t, &spec);
+/// hxr_thread_set_message_format(t, fmt);
+/// ===
+///
+/// prints the `elephant_in_way` message from the README like so:
+/// ===
+/// 14:05:09 sim[4242] elephant.c:132: error: Object did not continue to ...
+/// |                  There is a 6000 kg elephant in front of the ...
+/// `                  Suggestion: Either lure the elephant away with ...
+/// ===
+typedef struct S_HXR_MESSAGE_FORMAT  hxr_message_format;
+HXR__PREFIX_ALIAS(message_format);
+
+typedef struct S_HXR_MESSAGE_FORMAT_SPEC
+{
+	const char  *first_line;    // NULL: no prefix.
+	const char  *middle_lines;  // NULL: same as `first_line`.
+	const char  *last_line;     // NULL: same as `middle_lines`.
+
+	// Prefixes shorter than this are padded with spaces.
+	size_t      min_prefix_width;
+
+	// If nonzero, prefixes are padded with spaces to the length of the
+	// longest of the three, so that message text lines up.
+	uint8_t     align_prefixes;
+
+	// If nonzero, lines longer than this many characters (prefix included)
+	// are wrapped at spaces, or in the middle of a word that is too long to
+	// fit on a line by itself. Characters are counted as UTF-8 code points.
+	size_t      max_line_length;
+}
+hxr_message_format_spec;
+HXR__PREFIX_ALIAS(message_format_spec);
+
+/// Compiles `spec`. The spec strings aren't needed afterwards.
+///
+/// Returns: The format, or NULL if memory for it could not be allocated or
+/// if a spec string has a directive that isn't listed above (which is also
+/// reported as an error message on `t`).
+hxr_message_format *HXR(message_format_compile)(hxr_thread *t, const hxr_message_format_spec *spec);
+
+/// Frees `fmt`. It must not be in use by any thread.
+void HXR(message_format_free)(hxr_thread *t, hxr_message_format *fmt);
+
+/// Sets the format used when this thread prints messages as text
+/// (ex: `hxr_print_messages`, `hxr_fdstream_messages`). NULL, the default,
+/// means no prefixes. `fmt` must outlive its use by the thread. The
+/// asynchronous writer uses the format of the thread that called
+/// `hxr_async_start`, as of that call.
+void                HXR(thread_set_message_format)(hxr_thread *t, hxr_message_format *fmt);
+hxr_message_format *HXR(thread_get_message_format)(hxr_thread *t);
+
 
 
 typedef struct S_HXR__SOURCE_LOCATION
@@ -849,32 +1619,627 @@ static inline hxr_source_location_
 
 #define HXR_STACK_FRAME_PTR_HERE_  (&__func__)
 
+// The address of the calling function's stack frame. What exactly it points
+// at depends on the compiler, but it's the same for every function called
+// from the same place, and lower for the functions those call. NULL when
+// the compiler has no way to get it.
+#if defined(__GNUC__) || defined(__clang__)
+#	define HXR_FRAME_ADDRESS_HERE_  (__builtin_frame_address(0))
+#elif defined(_MSC_VER)
+#	include <intrin.h>
+#	define HXR_FRAME_ADDRESS_HERE_  (_AddressOfReturnAddress())
+#else
+#	define HXR_FRAME_ADDRESS_HERE_  (NULL)
+#endif
+
+// Tells the compiler that `x` is usually zero, so that the code it guards is
+// moved out of the way of the code that follows.
+#if defined(__GNUC__) || defined(__clang__)
+#	define HXR_UNLIKELY_(x)  (__builtin_expect(!!(x), 0))
+#else
+#	define HXR_UNLIKELY_(x)  (x)
+#endif
+
+#if (HXR_ENABLE_FILE_IO) || (HXR_DOCUMENTATION_BUILD)
+/// A compact binary log of messages.
+///
+/// Writing a message to a binary log doesn't format anything: message ids and
+/// callsites are written once and referred to by number afterwards, and text
+/// built with the `_fmt`/`_va` functions is stored as its format string and
+/// argument values. The `hxr-binlog-decode` tool (source/hxr/hxr-binlog-decode.c)
+/// renders a log into the same text that `hxr_print_message` produces.
+///
+/// Logs are append-only and are made of self-describing, length-prefixed,
+/// 8-byte-aligned records, so it's fine to open the same file in append mode
+/// many times, to concatenate logs, and to scan them with mmap.
+/// The record layout is documented in hexer.c (`hxr_binlog_*`).
+///
+/// Example:
+/// ===
+/// FILE *fd = fopen("messages.hxrlog", "ab");
+/// hxr_binlog *log = HXR_BINLOG_OPEN(t, fd);
+/// // ...
+/// hxr_binlog_messages(t, log);
+/// // ...
+/// HXR_BINLOG_CLOSE(t, log);
+/// fclose(fd);
+/// ===
+typedef struct S_HXR_BINLOG  hxr_binlog;
+HXR__PREFIX_ALIAS(binlog);
+
+/// Starts a new session in the binary log `fd`. The file must be open for
+/// writing, and should be opened in binary append mode ("ab").
+///
+/// Returns: The log, or NULL if memory for it could not be allocated.
+#define HXR_BINLOG_OPEN(t, fd) \
+	(HXR(binlog_open_)((t), (fd), HXR_SOURCE_LOCATION_HERE_))
+
+/// Flushes and frees the log. This does not close the file.
+#define HXR_BINLOG_CLOSE(t, log) \
+	(HXR(binlog_close_)((t), (log), HXR_SOURCE_LOCATION_HERE_))
+
+hxr_binlog  *HXR(binlog_open_)(hxr_thread *t, FILE *fd, hxr_source_location_ loc);
+void         HXR(binlog_close_)(hxr_thread *t, hxr_binlog *log, hxr_source_location_ loc);
+
+/// Writes one message to the log.
+///
+/// Returns: 0 on success, -1 if the message could not be written.
+int          HXR(binlog_message)(hxr_thread *t, hxr_binlog *log, hxr_feedback_message *msg);
+
+/// Takes every message out of the thread's queue (like `hxr_msg_next`) and
+/// writes it to the log.
+///
+/// Returns: The number of messages written.
+size_t       HXR(binlog_messages)(hxr_thread *t, hxr_binlog *log);
+#endif
+
+#if (HXR_ENABLE_FD_STREAM) || (HXR_DOCUMENTATION_BUILD)
+/// Buffered text output to a raw file descriptor.
+///
+/// This renders messages the same way `hxr_print_message` does, but instead
+/// of making a `fprintf` call for every piece of a message, it collects the
+/// pieces in a buffer of `HXR_FD_STREAM_BUFFER_SIZE` bytes (long pieces are
+/// referenced where they are instead of copied) and writes them all at once
+/// with `writev`. When that happens is set by the flush policy:
+///
+/// * `HXR_FDSTREAM_FLUSH_EACH_MESSAGE`: after every message. Nothing is
+///     left sitting in the buffer, but it's still one system call per
+///     message instead of one per line.
+/// * `HXR_FDSTREAM_FLUSH_THRESHOLD`: when the buffered text reaches the
+///     threshold (see `hxr_fdstream_set_flush_policy`).
+/// * `HXR_FDSTREAM_FLUSH_EXPLICIT`: only when the buffer is full, when
+///     `hxr_fdstream_flush` is called, and when the stream is closed.
+///
+/// Like the other streams, an `hxr_fdstream` must only be used by one
+/// thread at a time.
+///
+/// Example:
+/// ===
+/// hxr_fdstream *out = HXR_FDSTREAM_OPEN(t, STDERR_FILENO);
+/// hxr_fdstream_set_flush_policy(t, out, HXR_FDSTREAM_FLUSH_EXPLICIT, 0);
+/// // ...
+/// hxr_fdstream_messages(t, out);
+/// // ...
+/// HXR_FDSTREAM_CLOSE(t, out);
+/// ===
+typedef struct S_HXR_FDSTREAM  hxr_fdstream;
+HXR__PREFIX_ALIAS(fdstream);
+
+#define HXR_FDSTREAM_FLUSH_EACH_MESSAGE  (0)
+#define HXR_FDSTREAM_FLUSH_THRESHOLD     (1)
+#define HXR_FDSTREAM_FLUSH_EXPLICIT      (2)
+
+/// Creates a stream that writes to `fd`. The flush policy starts out as
+/// `HXR_FDSTREAM_FLUSH_EACH_MESSAGE`.
+///
+/// Returns: The stream, or NULL if memory for it could not be allocated.
+#define HXR_FDSTREAM_OPEN(t, fd) \
+	(HXR(fdstream_open_)((t), (fd), HXR_SOURCE_LOCATION_HERE_))
+
+/// Flushes and frees the stream. This does not close `fd`.
+#define HXR_FDSTREAM_CLOSE(t, out) \
+	(HXR(fdstream_close_)((t), (out), HXR_SOURCE_LOCATION_HERE_))
+
+hxr_fdstream *HXR(fdstream_open_)(hxr_thread *t, int fd, hxr_source_location_ loc);
+void          HXR(fdstream_close_)(hxr_thread *t, hxr_fdstream *out, hxr_source_location_ loc);
+
+/// Sets when buffered text is written (see `hxr_fdstream`).
+/// `threshold` is only used by `HXR_FDSTREAM_FLUSH_THRESHOLD`; 0 selects
+/// `HXR_FD_STREAM_BUFFER_SIZE`. Text that is already buffered stays buffered.
+/// A `policy` that isn't one of the `HXR_FDSTREAM_FLUSH_*` values is taken
+/// as `HXR_FDSTREAM_FLUSH_EACH_MESSAGE`.
+void          HXR(fdstream_set_flush_policy)(hxr_thread *t, hxr_fdstream *out, int policy, size_t threshold);
+
+/// Writes everything that is buffered.
+///
+/// Returns: 0 on success, -1 if `writev` failed. Once a write has failed,
+/// the stream drops everything given to it and keeps returning -1.
+int           HXR(fdstream_flush)(hxr_thread *t, hxr_fdstream *out);
+
+/// Writes one message to the stream.
+///
+/// Returns: 0 on success, -1 if the message could not be written.
+int           HXR(fdstream_message)(hxr_thread *t, hxr_fdstream *out, hxr_feedback_message *msg);
+
+/// Takes every message out of the thread's queue (like `hxr_msg_next`) and
+/// writes it to the stream. With the `HXR_FDSTREAM_FLUSH_THRESHOLD` and
+/// `HXR_FDSTREAM_FLUSH_EXPLICIT` policies, the whole batch goes out in as
+/// few `writev` calls as the buffer allows.
+///
+/// Returns: The number of messages written.
+size_t        HXR(fdstream_messages)(hxr_thread *t, hxr_fdstream *out);
+#endif
+
+/// Sends every message to several outputs ("sinks") at once.
+///
+/// Each sink has its own filter and its own message format (see
+/// `hxr_sink_spec`). A message is rendered as text at most once per format,
+/// however many sinks use that format: the sinks share one
+/// `hxr_rendered_text`, which is freed when the last of them lets go of it.
+/// Sinks that don't need text (ex: a binary log) never cause any rendering,
+/// and neither does a format that no sink accepting the message uses.
+///
+/// Sinks get each message in the order they were added. Like the streams, a
+/// sink graph must only be used by one thread at a time, and the outputs
+/// given to it must stay open until the graph is freed.
+///
+/// Example:
+/// ===
+/// hxr_sink_spec everything = {0};
+/// everything.format = fmt;
+///
+/// hxr_sink_spec problems = everything;
+/// problems.min_type = HXR_MSG_TYPE_WARNING;
+///
+/// hxr_sink_graph *sinks = hxr_sink_graph_create(t);
+/// hxr_sink_add_file(t, sinks, &everything, log_file);
+/// hxr_sink_add_syslog(t, sinks, &problems);
+/// hxr_sink_add_callback(t, sinks, &problems, &show_in_status_bar, window);
+/// // ...
+/// hxr_sink_graph_messages(t, sinks);  // Each message is rendered once.
+/// // ...
+/// hxr_sink_graph_free(t, sinks);
+/// ===
+typedef struct S_HXR_SINK_GRAPH     hxr_sink_graph;
+HXR__PREFIX_ALIAS(sink_graph);
+
+/// One message rendered as text with one format, shared by every sink that
+/// uses that format. It is reference counted, so a callback sink can keep it
+/// (ex: to hand it to another thread) with `hxr_rendered_text_retain`.
+typedef struct S_HXR_RENDERED_TEXT  hxr_rendered_text;
+HXR__PREFIX_ALIAS(rendered_text);
+
+/// Returns nonzero if the sink should get `msg`.
+typedef int  (*hxr_sink_filter)(hxr_thread*, void *context, hxr_feedback_message *msg);
+
+/// Receives `msg` and its text. `text` is only good until this returns,
+/// unless it is retained.
+typedef void (*hxr_sink_text_handler)(hxr_thread*, void *context,
+	hxr_feedback_message *msg, hxr_rendered_text *text);
+
+typedef struct S_HXR_SINK_SPEC
+{
+	// Messages of a lower HXR_MSG_TYPE_* are skipped. 0: no minimum.
+	uint32_t                 min_type;
+
+	// Optional. Called for messages that pass `min_type`.
+	hxr_sink_filter          filter;
+	void                     *filter_context;
 
+	// The format of the sink's text. NULL: no prefixes. It must outlive the
+	// graph. Sinks with the same format share rendered text.
+	hxr_message_format       *format;
+}
+hxr_sink_spec;
+HXR__PREFIX_ALIAS(sink_spec);
+
+/// Maximum number of sinks in one graph.
+#define HXR_SINK_GRAPH_MAX_SINKS  (16)
+
+/// Returns: A graph with no sinks, or NULL if memory for it could not be
+/// allocated.
+hxr_sink_graph *HXR(sink_graph_create)(hxr_thread *t);
+
+/// Frees `graph`. The outputs its sinks write to are left open.
+void            HXR(sink_graph_free)(hxr_thread *t, hxr_sink_graph *graph);
+
+// The `hxr_sink_add_*` functions add a sink to `graph`. `spec` is copied.
+// Returns: 0 on success, or -1 if `graph` already has
+// HXR_SINK_GRAPH_MAX_SINKS sinks (which is also reported as an error
+// message on `t`).
+
+#if (HXR_ENABLE_FILE_IO) || (HXR_DOCUMENTATION_BUILD)
+/// Text, written to `fd` with one `fwrite` per message.
+int             HXR(sink_add_file)(hxr_thread *t, hxr_sink_graph *graph, const hxr_sink_spec *spec, FILE *fd);
+
+/// The message itself, written to a binary log. `spec->format` is ignored.
+int             HXR(sink_add_binlog)(hxr_thread *t, hxr_sink_graph *graph, const hxr_sink_spec *spec, hxr_binlog *log);
+#endif
+
+#if (HXR_ENABLE_FD_STREAM) || (HXR_DOCUMENTATION_BUILD)
+/// Text, written to `out` according to its flush policy.
+int             HXR(sink_add_fdstream)(hxr_thread *t, hxr_sink_graph *graph, const hxr_sink_spec *spec, hxr_fdstream *out);
+#endif
+
+#if (HXR_ENABLE_SYSLOG) || (HXR_DOCUMENTATION_BUILD)
+/// Text, as one syslog entry per message (through `HXR_VSYSLOG_DEFAULT`).
+/// Errors are logged as LOG_ERR, warnings as LOG_WARNING, and everything
+/// else as LOG_INFO.
+int             HXR(sink_add_syslog)(hxr_thread *t, hxr_sink_graph *graph, const hxr_sink_spec *spec);
+#endif
+
+/// Text, given to `handler`.
+int             HXR(sink_add_callback)(hxr_thread *t, hxr_sink_graph *graph, const hxr_sink_spec *spec,
+	hxr_sink_text_handler handler, void *context);
+
+/// Sends `msg` to every sink whose filter accepts it.
+///
+/// Returns: The number of sinks that took the message, or -1 if it could
+/// not be rendered (memory ran out). Sinks that fail to write still count.
+int             HXR(sink_graph_message)(hxr_thread *t, hxr_sink_graph *graph, hxr_feedback_message *msg);
+
+/// Takes every message out of the thread's queue (like `hxr_msg_next`) and
+/// sends it to the graph's sinks.
+///
+/// Returns: The number of messages taken.
+size_t          HXR(sink_graph_messages)(hxr_thread *t, hxr_sink_graph *graph);
+
+/// The text, null-terminated, and its length in bytes.
+const char     *HXR(rendered_text_str)(const hxr_rendered_text *text);
+size_t          HXR(rendered_text_len)(const hxr_rendered_text *text);
+
+/// Adds a reference to `text`, so that it stays around after the handler
+/// that got it returns. Any thread can do this, and any thread can release it.
+void            HXR(rendered_text_retain)(hxr_rendered_text *text);
+
+/// Drops a reference to `text`. The last one frees it.
+void            HXR(rendered_text_release)(hxr_thread *t, hxr_rendered_text *text);
+
+
+
+
+/// A place where `HXR_ENTER_FUNCTION` is used. Each expansion of the macro
+/// defines one of these as a static variable, so entering the function only
+/// has to pass a pointer to it, and its call count lives right in it.
+/// (That is also why the macro can't go in plain, non-static `inline`
+/// functions; see `HXR_ENTER_FUNCTION`.)
+typedef struct S_HXR_CALLSITE
+{
+	const char  *file;
+	const char  *function;
+	int         line;
+	size_t      func_classification;
+
+	// How many times the function has been entered. This is bumped with a
+	// relaxed load and store instead of an atomic add (which costs more than
+	// recording the rest of the call), so it can come up short when threads
+	// race through the same function. For sampled classes (see
+	// `hxr_set_fnclass_sample_period`), it goes up by the period once per
+	// sampled call, so it is an estimate.
+	size_t      call_count;
+
+	// Set by HeXeR the first time the function is entered.
+	size_t      id;
+
+#if HXR_ENABLE_FRAME_TIMING
+	// Time spent in the function, in ticks (see `hxr_frame_ticks_to_ns`):
+	// in total, and not counting the functions with HXR_ENTER_FUNCTION that
+	// it called. Like `call_count`, these are bumped without atomic adds and
+	// scaled up for sampled classes.
+	uint64_t    inclusive_ticks;
+	uint64_t    exclusive_ticks;
+#endif
+}
+hxr_callsite;
+HXR__PREFIX_ALIAS(callsite);
+
+// Internal-use: the initializer for the callsite that HXR_ENTER_FUNCTION
+// defines. Every field is given, so that it's quiet under
+// `-Wmissing-field-initializers`.
+#if HXR_ENABLE_FRAME_TIMING
+#	define HXR_CALLSITE_INIT_(func_classification) \
+		{ __FILE__, __FUNCTION__, __LINE__, (func_classification), 0, 0, 0, 0 }
+#else
+#	define HXR_CALLSITE_INIT_(func_classification) \
+		{ __FILE__, __FUNCTION__, __LINE__, (func_classification), 0, 0 }
+#endif
 
+// Where the callsites that HXR_ENTER_FUNCTION defines are put. Where the
+// linker can gather them into one section, `hxr_callsite_next` walks that
+// section; elsewhere (and for callsites in other shared objects) it walks
+// the ones that have been entered at least once. The alignment is given so
+// that the compiler doesn't pad them apart (GCC likes to align anything this
+// big to 32 bytes), which would make the section impossible to walk.
+// (MSVC's linker can pad sections too, and not in callsite-sized steps, so
+// it doesn't get one.)
+#if defined(__ELF__) && (defined(__GNUC__) || defined(__clang__))
+#	define HXR_CALLSITE_SECTION_       __attribute__((section("hxr_callsites"), used, aligned(__alignof__(hxr_callsite))))
+#	define HXR_HAVE_CALLSITE_SECTION_  1
+#elif defined(__APPLE__) && (defined(__GNUC__) || defined(__clang__))
+#	define HXR_CALLSITE_SECTION_       __attribute__((section("__DATA,hxr_callsites"), used, aligned(__alignof__(hxr_callsite))))
+#	define HXR_HAVE_CALLSITE_SECTION_  1
+#else
+#	define HXR_CALLSITE_SECTION_
+#	define HXR_HAVE_CALLSITE_SECTION_  0
+#endif
+
+/// Iterates over the process's callsites: the ones in this module's
+/// callsite section, if it has one, and any others that have been entered.
+///
+/// Example:
+/// ===
+/// hxr_callsite *site = NULL;
+/// while ( NULL != (site = hxr_callsite_next(site)) )
+///     printf("%s: %zu calls\n", site->function, site->call_count);
+/// ===
+///
+/// Returns: The callsite after `prev`, or the first one if `prev` is NULL.
+/// NULL after the last one.
+hxr_callsite *HXR(callsite_next)(const hxr_callsite *prev);
 
 // The `frame_id` parameter should be passed a pointer to the calling stack
 // frame's copy of the current thread's `hxr_thread` pointer. Thus, the outer
 // pointer uniquely identifies the stack frame that called `HXR_ENTER_FUNCTION(...)`.
 //
-// The `func_classification` parameter is used to pass information about the
-// nature of the function being annotated. As of 2020-10-03, this function will
-// ignore the `func_classification` parameter, because any processing on those
-// values will already have been completed by macro preprocessing (right now
-// it's just used to turn the HXR_ENTER_FUNCTION expansion on or off based on
-// whether the developer needs a class of functions to be logged or traced at
-// that time).
-void HXR(thread_frame_entrance_)(
-		hxr_thread **frame_id,
-		size_t     func_classification,
-		const char *file_name,
-		const char *function_name,
-		int        line_number);
-
-void HXR(thread_frame_exit_)(
-		hxr_thread **frame_id,
-		const char *file_name,
-		const char *function_name,
-		int        line_number);
+// The `frame_address` parameter should be passed `HXR_FRAME_ADDRESS_HERE_`.
+// It is used to tell how deeply the call is nested (`frame_id` is used when
+// it's NULL, which is less reliable).
+//
+// The `callsite` parameter should be passed the static `hxr_callsite` that
+// the HXR_ENTER_FUNCTION expansion defines. Its `func_classification` is
+// checked against the thread's classes (see
+// `hxr_thread_set_call_history_fnclasses`); classes left out of
+// `HXR_CALL_HISTORY_FNCLASSES`, or off in every thread, never get here.
+//
+// Returns 1 if it pushed a frame for the call, which HXR_RETURN then pops,
+// and 0 if the call wasn't recorded or was nested too deeply to get one.
+int HXR(thread_frame_entrance_)(
+		hxr_thread   **frame_id,
+		const void   *frame_address,
+		hxr_callsite *callsite);
+
+// Internal-use: What HXR_RETURN calls to leave the frame that
+// HXR_ENTER_FUNCTION entered, when `hxr_thread_frame_entrance_` said that
+// it pushed one. The parameters are as above.
+void HXR(thread_frame_exit_)(hxr_thread **frame_id, const void *frame_address);
+
+// Internal-use: How many recorded HXR_ENTER_FUNCTION calls the thread is
+// inside of, as of its last HXR_ENTER_FUNCTION or HXR_RETURN. A function
+// that has since returned with a plain `return` is still counted; its frame
+// is only noticed to be gone when the next call is recorded.
+static inline size_t HXR(thread_frame_depth_)(const hxr_thread *t)
+{
+	return t->frame_depth_;
+}
+
+// Internal-use: The index of the lowest bit that is set in `bits` (not 0).
+// For a constant, like the class passed to HXR_ENTER_FUNCTION, this is
+// worked out at compile time.
+static inline unsigned HXR(lowest_bit_)(size_t bits)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return (unsigned)__builtin_ctzll((unsigned long long)bits);
+#else
+	unsigned index = 0;
+	while ( (bits & 1) == 0 ) {
+		bits >>= 1;
+		index++;
+	}
+	return index;
+#endif
+}
+
+// Internal-use: the function classes that HXR_ENTER_FUNCTION calls
+// `hxr_thread_frame_entrance_` for. It is the process's classes (see
+// `hxr_set_call_history_fnclasses`) plus any class that a thread has turned
+// on for itself, and is read without synchronization: a change can take a
+// little while to be seen on other threads.
+extern size_t  HXR(call_history_fnclasses_);
+
+/// Sets which function classes (`HXR_FNCLASS_*`) are added to call history
+/// and counted in the call-count profile, on every thread that doesn't
+/// override it (see `hxr_thread_set_call_history_fnclasses`).
+///
+/// This can only narrow `HXR_CALL_HISTORY_FNCLASSES`: classes left out of it
+/// are compiled out and stay off. So a build that might need to trace
+/// `HXR_FNCLASS_HOTPATH` functions on a live process would include it in
+/// `HXR_CALL_HISTORY_FNCLASSES`, turn it off at startup, and turn it on
+/// when needed. Each HXR_ENTER_FUNCTION of a class that is off costs a load
+/// and a branch.
+///
+/// By default, this is `HXR_CALL_HISTORY_FNCLASSES`.
+void   HXR(set_call_history_fnclasses)(size_t fnclasses);
+
+/// Returns: The classes set by `hxr_set_call_history_fnclasses`.
+size_t HXR(call_history_fnclasses)(void);
+
+/// Overrides `hxr_set_call_history_fnclasses` on the calling thread: the
+/// classes in `on` are recorded and the classes in `off` aren't, whatever
+/// the process's classes are. The rest follow the process. Pass 0 for both
+/// to stop overriding.
+///
+/// Turning a class on for one thread makes HXR_ENTER_FUNCTIONs of that class
+/// call into HeXeR on every thread (which then ignores the call) for the
+/// rest of the process's life, so it costs a function call in place of a
+/// branch on the other threads.
+void   HXR(thread_set_call_history_fnclasses)(hxr_thread *t, size_t on, size_t off);
+
+/// Samples calls to functions of the classes in `fnclasses` (usually
+/// `HXR_FNCLASS_HOTPATH`): each thread only records one in every `period` of
+/// them, and counts it as `period` calls in the call-count profile (see
+/// `hxr_profile_dump`). The calls in between cost a decrement and a branch,
+/// made inline by HXR_ENTER_FUNCTION, and add nothing to call history; calls
+/// made from them are counted as made by their caller.
+///
+/// There's no randomness: it's every `period`th call on each thread, so a
+/// loop whose body has `period` calls in it would always sample the same
+/// one. A period of 0 or 1 records every call (the default). A function
+/// with more than one class is sampled with the period of its lowest one
+/// (ex: `HXR_FNCLASS_CANT_MESSAGE | HXR_FNCLASS_NORMAL` with NORMAL's).
+void   HXR(set_fnclass_sample_period)(size_t fnclasses, size_t period);
+
+/// Returns: The period set by `hxr_set_fnclass_sample_period` for `fnclass`
+/// (1 if its calls aren't sampled).
+size_t HXR(fnclass_sample_period)(size_t fnclass);
+
+/// One entry of a thread's call history (see `HXR_CALL_HISTORY_MAX`).
+typedef struct S_HXR_CALL_RECORD
+{
+	const char  *file;
+	const char  *function;
+	size_t      line;
+
+	// How many functions with call history (that hadn't returned yet) the
+	// call was made from. Only differences in depth are meaningful.
+	size_t      depth;
+
+	// How many times in a row the call was made. Each time, it made the
+	// calls in the records after it that have a greater depth.
+	uint64_t    count;
+}
+hxr_call_record;
+HXR__PREFIX_ALIAS(call_record);
+
+/// Copies the thread's most recent call history entries, oldest first, to
+/// `records`. At most `max_records` are copied.
+///
+/// Returns: The number of entries copied.
+size_t HXR(thread_call_history)(hxr_thread *t, hxr_call_record *records, size_t max_records);
+
+#if (HXR_ENABLE_FILE_IO) || (HXR_DOCUMENTATION_BUILD)
+/// Prints the thread's call history to `fd`, oldest first, indented by depth
+/// (see `HXR_ENTER_FUNCTION` for what it looks like).
+void   HXR(print_call_history)(hxr_thread *t, FILE *fd);
+#endif
+
+/// Formats for the call-count profile (see `hxr_profile_dump`).
+///
+/// * `HXR_PROFILE_SUMMARY`: The table shown under `HXR_ENTER_FUNCTION`, of
+///     every callsite that was called, busiest first. It is followed by a
+///     table of how many times each function called each other one.
+/// * `HXR_PROFILE_CSV`: The same numbers as comma-separated values, with a
+///     header line. Rows whose `kind` is `callsite` have a callsite's total;
+///     rows whose `kind` is `call` have the number of calls to a callsite
+///     from one caller (which is empty for calls from uninstrumented code).
+///
+///     With `HXR_ENABLE_FRAME_TIMING`, the summary's first table also has
+///     the time spent in each function, in microseconds, with (inclusive)
+///     and without (exclusive) the functions it called. The CSV has them in
+///     nanoseconds, in `inclusive_ns` and `exclusive_ns` columns that are
+///     empty on `call` rows. Time is charged to a call until the next
+///     HXR_ENTER_FUNCTION after it returns (made from its caller or higher),
+///     so a function that returns into a long stretch of uninstrumented code
+///     is charged for that too.
+/// * `HXR_PROFILE_COLLAPSED`: One line per call path, with the functions
+///     separated by semicolons and followed by the number of calls along
+///     that path (ex: `main;foo;foo_inner_loop 50`). This is the "collapsed
+///     stack" format that flame graph tools (flamegraph.pl, inferno,
+///     speedscope) read, so a path's width in the graph is the number of
+///     calls made along it or under it.
+///
+/// Rows and lines are sorted by count, busiest first (ties go by function
+/// name).
+///
+/// Who called whom comes from the call paths, which are only counted when
+/// `HXR_PROFILE_MAX_PATHS` isn't 0 (it is 8192 by default). Without them,
+/// the summary and the CSV only have the callsite totals, and the collapsed
+/// format can't be written.
+#define HXR_PROFILE_SUMMARY    (0)
+#define HXR_PROFILE_CSV        (1)
+#define HXR_PROFILE_COLLAPSED  (2)
+
+#if (HXR_ENABLE_FRAME_TIMING) || (HXR_DOCUMENTATION_BUILD)
+/// Converts a tick count from `hxr_callsite.inclusive_ticks` (or
+/// `exclusive_ticks`) to nanoseconds. The rate is measured against the
+/// monotonic clock over the life of the process, so it is more accurate the
+/// longer the process has been running.
+uint64_t HXR(frame_ticks_to_ns)(uint64_t ticks);
+#endif
+
+#if (HXR_ENABLE_FILE_IO) || (HXR_DOCUMENTATION_BUILD)
+/// Writes the call-count profile of the whole process (all threads) to `fd`,
+/// in one of the `HXR_PROFILE_*` formats. The counts come from every
+/// `HXR_ENTER_FUNCTION` that is compiled in, and keep going up while the
+/// profile is written; a dump is a snapshot, not a reset.
+///
+/// Counts are kept without atomic read-modify-write operations, so calls
+/// made at the same moment on different threads can be missed. They are
+/// meant for finding hot paths, not for exact accounting. Counts for
+/// sampled classes (see `hxr_set_fnclass_sample_period`) are scaled up by
+/// the sampling period.
+///
+/// Returns: 0, or -1 if the profile could not be written (or memory for
+/// sorting it could not be allocated, or `format` is `HXR_PROFILE_COLLAPSED`
+/// and call paths aren't counted).
+int    HXR(profile_dump)(hxr_thread *t, FILE *fd, int format);
+#endif
+
+#if (HXR_ENABLE_FD_STREAM) || (HXR_DOCUMENTATION_BUILD)
+/// Same as `hxr_profile_dump`, but writes to an `hxr_fdstream`. The profile
+/// is flushed along with everything else the stream has buffered.
+int    HXR(fdstream_profile)(hxr_thread *t, hxr_fdstream *out, int format);
+#endif
+
+#if (HXR_ENABLE_CRASH_HANDLER) || (HXR_DOCUMENTATION_BUILD)
+/// Installs handlers for SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT that
+/// write a crash dump before the process dies: the call history of every
+/// thread registered with `hxr_crash_register_thread`, and the messages
+/// that were still waiting in its queue (or still being built). The dump is
+/// written to `fd` if it isn't -1, and copied into `region` (which should
+/// be `region_size` bytes of memory that will outlive the process, such as
+/// a shared mapping of a file) if it isn't NULL.
+///
+/// The dump is text, made of lines that are all `HXR_CRASH_LINE_SIZE`
+/// bytes long (padded with spaces, and ending with a newline), so that it
+/// can be read with any pager and a `region` always holds whole lines. It
+/// looks like this:
+/// ===
+/// hexer crash: signal 11 (SIGSEGV), address 0x0000000000000010
+/// thread 0: 5 calls, 1 pending message
+///   call    main (main.c:12)
+///   call      load_config (config.c:40) x3
+///   call        parse_line (config.c:88)
+///   error   config.c:97 [config.bad_key]: Unknown key "%s".
+/// end of crash dump
+/// ===
+/// Only functions that are safe to call from a signal handler are used, so
+/// message text that hasn't been formatted yet (see
+/// `HXR_DEFER_MESSAGE_FORMATTING`) shows up as its format string. Lines
+/// that don't fit are cut off.
+///
+/// After the dump, whatever handler was there before is put back and the
+/// signal is raised again, so the process still ends the way it would
+/// have (core dump and all). Only the first crash is dumped; another thread
+/// that crashes while it's being written waits (up to 5 seconds) for it to
+/// finish before doing the same.
+///
+/// A stack overflow can only be dumped if the handler has a stack to run
+/// on. If the calling thread doesn't have an alternate signal stack
+/// (`sigaltstack`), this gives it one; other threads need their own.
+///
+/// Calling this again changes where the dump goes.
+///
+/// Returns: 0, or -1 if the handlers could not be installed.
+int    HXR(crash_handler_install)(hxr_thread *t, int fd, void *region, size_t region_size);
+
+/// Puts back the handlers that were there before `hxr_crash_handler_install`.
+void   HXR(crash_handler_uninstall)(hxr_thread *t);
+
+/// The size of every line in a crash dump, newline included.
+#define HXR_CRASH_LINE_SIZE  (128)
+
+/// Adds `t` to the threads in a crash dump. It is taken out again by
+/// `hxr_crash_unregister_thread`, or when `t` is freed.
+///
+/// This doesn't give the calling thread an alternate signal stack: only
+/// the thread that called `hxr_crash_handler_install` gets one. A thread
+/// that should have its stack overflow dumped must set up its own with
+/// `sigaltstack` (the stack belongs to the OS thread, not to `t`).
+///
+/// Returns: 0, or -1 if too many threads (256) are registered already.
+int    HXR(crash_register_thread)(hxr_thread *t);
+void   HXR(crash_unregister_thread)(hxr_thread *t);
+#endif
 
 /// Function classes used to identify distinct uses of HXR_ENTER_FUNCTION.
 /// These MUST be macro definitions. These are expanded in a preprocessor #if
@@ -949,7 +2314,8 @@ void HXR(thread_frame_exit_)(
 /// main.c:               hxr_stop was called
 /// ===
 ///
-/// The call-count profiling information for the above would look like so:
+/// The call-count profiling information for the above (see `hxr_profile_dump`)
+/// would look like so:
 /// ===
 /// Function,    Count,  File,   Line Number
 /// baz,            22,  baz.c,  37
@@ -986,6 +2352,18 @@ void HXR(thread_frame_exit_)(
 ///     That's because these are expanded in a preprocessor #if statement to acheive
 ///     compile-time conditional compilation. C variables will not be interpreted by
 ///     the preprocessor correctly, and thus cannot be used
+///
+/// Each use of this macro defines a static `hxr_callsite` (see `hxr_callsite`)
+/// inside the function. C99 doesn't allow that in an inline definition of a
+/// function with external linkage (a plain `inline` function, as typically
+/// found in headers), so HXR_ENTER_FUNCTION must not be used in one. Make such
+/// functions `static inline` instead, or leave the macro out of them; calls
+/// they make are then recorded as if made by their caller. `static inline`
+/// functions get one callsite per translation unit that uses them, each with
+/// its own call count.
+///
+/// It also declares local variables that `HXR_RETURN` reads, so it can only
+/// be used once per function, and only where a declaration is allowed.
 #	define HXR_ENTER_FUNCTION(t, func_classification) (0)
 // TODO: Update documentation to reflect that having a constant expression is not
 // *necessary*, but is still pretty important for optimization reasons.
@@ -993,11 +2371,22 @@ void HXR(thread_frame_exit_)(
 #else
 
 #	define HXR_ENTER_FUNCTION2(t, func_classification) \
+		const size_t  hxr_frame_fnclass_ = (func_classification); \
+		int           hxr_frame_entered_ = 0; \
 		do { \
-			if ( (func_classification) && (HXR_CALL_HISTORY_FNCLASSES) ) \
-			{
+			(void)hxr_frame_fnclass_; \
+			(void)hxr_frame_entered_; \
+			if ( ((func_classification) & (HXR_CALL_HISTORY_FNCLASSES)) \
+			&&   HXR_UNLIKELY_((func_classification) & HXR(call_history_fnclasses_)) ) \
+			{ \
+				HXR_CALLSITE_SECTION_ static hxr_callsite  hxr_callsite_ = \
+					HXR_CALLSITE_INIT_(func_classification); \
 				HXR_CHECK_AND_ENSURE_THREAD(t); \
-				HXR(thread_frame_entrance_)(&t, (func_classification), __FILE__, __FUNCTION__, __LINE__); \
+				size_t *hxr_countdown_ = &(t)->sample_countdown_[HXR(lowest_bit_)(func_classification)]; \
+				if ( *hxr_countdown_ > 1 ) \
+					(*hxr_countdown_)--; \
+				else \
+					hxr_frame_entered_ = HXR(thread_frame_entrance_)(&t, HXR_FRAME_ADDRESS_HERE_, &hxr_callsite_); \
 			} \
 		} while(0)
 
@@ -1009,22 +2398,49 @@ void HXR(thread_frame_exit_)(
 
 #define HXR_UPDATE_CALL_HISTORY(t) (hxr_update_call_history_(&t, __FILE__, __FUNCTION__, __LINE__))
 
-#if 0
-// TODO: conditionally compile hxr_thread_record_return_?
+/// Returns from a function that started with HXR_ENTER_FUNCTION, and pops
+/// its frame from the thread's call history on the way out.
+///
+/// `HXR_RETURN(t)` is `return;` and `HXR_RETURN(t, val)` is `return (val);`.
+/// Note that `val` is evaluated after the frame is popped, so calls made
+/// from it are recorded at the caller's depth.
+///
+/// A plain `return` is fine too: the frame is popped the next time the
+/// thread enters a function. HXR_RETURN keeps the depth right in between,
+/// and doesn't depend on frame addresses being exact.
+///
+/// HXR_RETURN can only be used in a function that starts with
+/// HXR_ENTER_FUNCTION (which may only be used once per function). It only
+/// pops a frame if HXR_ENTER_FUNCTION pushed one, so a call that wasn't
+/// recorded (its class was off, or it was sampled out) leaves its caller's
+/// frame alone, even if it was inlined into the caller. In a function whose
+/// class isn't in `HXR_CALL_HISTORY_FNCLASSES`, it compiles down to a plain
+/// `return`, and otherwise it costs a load and a branch that is usually
+/// not taken.
+#if HXR_CALL_HISTORY_MAX > 0
+#	define HXR_FRAME_EXIT_(t) \
+		do { \
+			if ( (hxr_frame_fnclass_ & (HXR_CALL_HISTORY_FNCLASSES)) \
+			&&   HXR_UNLIKELY_(hxr_frame_entered_) ) \
+				HXR(thread_frame_exit_)(&t, HXR_FRAME_ADDRESS_HERE_); \
+		} while(0)
+#else
+#	define HXR_FRAME_EXIT_(t)  do {} while(0)
+#endif
+
 #define HXR_RETURN1(t) \
 	do { \
-		hxr_thread_frame_exit_(t, __FILE__, __FUNCTION__, __LINE__); \
+		HXR_FRAME_EXIT_(t); \
 		return; \
 	} while(0)
 
 #define HXR_RETURN2(t, val) \
 	do { \
-		hxr_thread_frame_exit_(t, __FILE__, __FUNCTION__, __LINE__); \
+		HXR_FRAME_EXIT_(t); \
 		return (val); \
 	} while(0)
 
 #define HXR_RETURN(...)  HXR_MACRO_OVERLOAD(HXR_RETURN, __VA_ARGS__)
-#endif
 
 #define HXR_CHECK_AND_ENSURE_THREAD(t) \
 	do { \
@@ -1520,6 +2936,11 @@ typedef struct S_HXR_BLOCK_EVENT_
 	// using the `HXR_BLKEV_PACK_STUFF_(line, event)` macro.
 	uint32_t   stuff;
 
+	// How many HXR_ENTER_FUNCTION calls deep the block began (see
+	// `hxr_thread_frame_depth_`). Only enter events have it; it's 0 in the
+	// others. This fits in what would otherwise be padding.
+	uint32_t   frame_depth;
+
 } hxr_block_event_;
 
 
@@ -1532,6 +2953,7 @@ static inline void HXR(enter_block_)(
 	hxr_block_event_ blkev;
 	blkev.stack_frame_coords = (uintptr_t)stack_frame;
 	blkev.stuff = HXR_BLKEV_PACK_STUFF_(line, HXR_BLKEV_ENTER_);
+	blkev.frame_depth = (uint32_t)HXR(thread_frame_depth_)(t);
 	HXR(add_block_event_)(t, blkev);
 }
 
@@ -1544,6 +2966,7 @@ static inline int HXR(continue_was_used_)(
 	hxr_block_event_ blkev;
 	blkev.stack_frame_coords = (uintptr_t)stack_frame;
 	blkev.stuff = HXR_BLKEV_PACK_STUFF_(line, HXR_BLKEV_EXIT_ | HXR_BLKEV_CONTINUE_);
+	blkev.frame_depth = 0;
 	HXR(add_block_event_)(t, blkev);
 	return 0; // Return false to make the enclosing loop statement terminate.
 }
@@ -1557,6 +2980,7 @@ static inline void HXR(normal_block_exit_)(
 	hxr_block_event_ blkev;
 	blkev.stack_frame_coords = (uintptr_t)stack_frame;
 	blkev.stuff = HXR_BLKEV_PACK_STUFF_(line, HXR_BLKEV_EXIT_ | HXR_BLKEV_END_);
+	blkev.frame_depth = 0;
 	HXR(add_block_event_)(t, blkev);
 }
 
@@ -1622,6 +3046,13 @@ static size_t hxr_debugf_count;
 static int  (hxr_debugf_save*)(const char *str, ...);
 static hxr_allocator *hxr_test_allocator;
 
+// `hxr_test_vdebugf` formats into this first. debugf doesn't get a thread
+// handle, so this can't use the thread's format scratch buffer (see
+// `hxr_scratch_` in hexer.c), but it works the same way: it's kept between
+// calls and doubles when it's too small.
+static char   *hxr_test_debugf_scratch;
+static size_t hxr_test_debugf_scratch_size;
+
 
 // We're going to need this so that we can detect critical internal errors
 // (which would normally just be dumped to the user's stdout/tty/whatever)
@@ -1631,6 +3062,9 @@ static hxr_allocator *hxr_test_allocator;
 // important whenever we are testing any core functionality that
 // has failure modes which call debugf.
 //
+// Each line is counted in `hxr_debugf_count`, and the most recent
+// HXR_DEBUGF_LINE_BUFFER_SZ of them are kept in `hxr_debugf_line_buffer`.
+//
 static int hxr_test_vdebugf(const char *fmtstr, va_list vargs_orig)
 {	
 #define HXR_TEST_STRINGIZE_(str) #str
@@ -1640,10 +3074,12 @@ static int hxr_test_vdebugf(const char *fmtstr, va_list vargs_orig)
 	hxr_vsnprintf = &HXR_VSNPRINTF_DEFAULT;
 	va_list vargs;
 
-	// Figure out how large the formatted string will be.
+	// Format into the scratch buffer. This is the only pass unless the
+	// buffer has to grow.
 	va_copy(vargs, vargs_orig);
-	int sz = hxr_vsnprintf(NULL, 0, fmtstr, vargs);
-	if ( sz <= 0 ) {
+	int sz = hxr_vsnprintf(hxr_test_debugf_scratch, hxr_test_debugf_scratch_size, fmtstr, vargs);
+	va_end(vargs);
+	if ( sz < 0 ) {
 		hxr_debugf_save(
 			HXR_TEST_STRINGIZE(HXR_DEFAULT_VSNPRINTF)
 			" returned %d, but for testing to be done, it needs to "
@@ -1654,32 +3090,46 @@ static int hxr_test_vdebugf(const char *fmtstr, va_list vargs_orig)
 		return -1;
 	}
 
-	// Allocate and format the string.
-	char *buf = hxr_test_allocator->allocate(sz+1);
-	if ( buf == NULL ) {
-		hxr_debugf_save(
-			HXR_TEST_STRINGIZE(HXR_DEFAULT_ALLOCATOR)
-			" returned NULL. This indicates an allocation failure or broken "
-			"allocator. A working allocator and *some* (even a little) "
-			"available memory is necessary to run HeXeR's unittests.");
-		return -1;
+	if ( (size_t)sz >= hxr_test_debugf_scratch_size )
+	{
+		size_t new_size = hxr_test_debugf_scratch_size ? hxr_test_debugf_scratch_size : 256;
+		while ( new_size <= (size_t)sz )
+			new_size *= 2;
+
+		char *buf = hxr_test_allocator->allocate(NULL, new_size);
+		if ( buf == NULL ) {
+			hxr_debugf_save(
+				HXR_TEST_STRINGIZE(HXR_DEFAULT_ALLOCATOR)
+				" returned NULL. This indicates an allocation failure or broken "
+				"allocator. A working allocator and *some* (even a little) "
+				"available memory is necessary to run HeXeR's unittests.");
+			return -1;
+		}
+		if ( hxr_test_debugf_scratch != NULL )
+			hxr_test_allocator->free(NULL, hxr_test_debugf_scratch);
+		hxr_test_debugf_scratch      = buf;
+		hxr_test_debugf_scratch_size = new_size;
+
+		va_copy(vargs, vargs_orig);
+		hxr_vsnprintf(hxr_test_debugf_scratch, hxr_test_debugf_scratch_size, fmtstr, vargs);
+		va_end(vargs);
 	}
 
-	va_copy(vargs, vargs_orig);
-	int rc = hxr_vsnprintf(NULL, 0, fmtstr, vargs);
-	if ( rc <= 0 ) {
-		hxr_debugf_save(
-			HXR_TEST_STRINGIZE(HXR_DEFAULT_VSNPRINTF)
-			" returned %d, but for testing to be done, it needs to "
-			"instead successfully format the string.\n"
-			"It had calculated the size of the formatted string earlier, "
-			"and that came out to be %d bytes (null terminator not included).\n"
-			"The format string was \"%s\"",
-			rc, sz, fmtstr);
-		return -1;
+	// Keep a copy of the line.
+	char *line = hxr_test_allocator->allocate(NULL, (size_t)sz + 1);
+	if ( line != NULL )
+	{
+		for ( size_t i = 0; i <= (size_t)sz; i++ )
+			line[i] = hxr_test_debugf_scratch[i];
+
+		size_t slot = hxr_debugf_count % HXR_DEBUGF_LINE_BUFFER_SZ;
+		if ( hxr_debugf_line_buffer[slot] != NULL )
+			hxr_test_allocator->free(NULL, (void*)hxr_debugf_line_buffer[slot]);
+		hxr_debugf_line_buffer[slot] = line;
 	}
+	hxr_debugf_count++;
 
-	return rc;
+	return sz;
 
 #undef HXR_TEST_STRINGIZE
 #undef HXR_TEST_STRINGIZE_
@@ -2146,7 +3596,8 @@ void HXR(init_unittests)(hxr_thread *t)
 
 static inline void HXR(reify_blocks_as_needed_)(
 	hxr_thread           *t,
-	hxr_block_event_     blkev
+	hxr_block_event_     prior,
+	hxr_block_event_     entering
 	)
 {
 	// A positive result for this test indicates that we called HXR_ENTER_FUNCTION(...)
@@ -2154,7 +3605,7 @@ static inline void HXR(reify_blocks_as_needed_)(
 	// blocks, but on the call stack, and not within the same function.
 	// As long as nesting is going on, we can't reify (or at least, we sacrifice
 	// some error-detection capabilities if we do it in this state).
-	if ( blkev->stack_depth < t->stack_depth )
+	if ( prior.frame_depth < entering.frame_depth )
 		return;
 
 	// This tests asks if we are in a different function.
@@ -2164,9 +3615,12 @@ static inline void HXR(reify_blocks_as_needed_)(
 	// sense to process all of the previous blkev events, as this will
 	// decrease memory usage, and possibly make the reifier's implemention
 	// easier.
-	TODO: strcmp?
-	if ( blkev->begin_loc.func != loc.func
-	||   blkev->begin_loc.file != loc.file )
+	//
+	// A shallower depth means the prior block's function has returned. At
+	// the same depth, `stack_frame_coords` tells the functions apart (it's
+	// unique per function), so there is no need to compare strings.
+	if ( prior.frame_depth != entering.frame_depth
+	||   prior.stack_frame_coords != entering.stack_frame_coords )
 		HXR(reify_blocks_)(t);
 }
 
@@ -0,0 +1,671 @@
+// hxr-binlog-decode: prints the messages in a HeXeR binary log (see
+// `hxr_binlog` in hexer.h) as the same text that `hxr_print_message` would
+// have produced for them.
+//
+// Usage:
+//   hxr-binlog-decode [-i message_id] [-c] file...
+//
+//   -i message_id  Only print messages with this id. Messages are matched by
+//                  their id number, so the ones that don't match are skipped
+//                  without being rendered.
+//   -c             Print the number of matching messages instead of the
+//                  messages themselves.
+//
+// The log is mmap'd and records are walked in place, so it's cheap to scan
+// very large logs.
+//
+// The record layout is documented in hexer.c (`hxr_binlog_*`). The format
+// string parsing below is a trimmed copy of `hxr_fmtspec_parse_`, and the
+// text layout is a copy of `hxr_send_message_`. Keep them in sync.
+//
+// Build:
+//   cc -O2 -o hxr-binlog-decode hxr-binlog-decode.c
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BINLOG_SESSION     (1)
+#define BINLOG_MSGID       (2)
+#define BINLOG_CALLSITE    (3)
+#define BINLOG_MESSAGE     (4)
+#define BINLOG_TEXT        (5)
+
+#define SECTION_NONE       (0)
+#define SECTION_TEXT       (1)
+#define SECTION_FORMAT     (2)
+
+#define BINLOG_VERSION     (2)    // Version 1 logs are the same, minus inline ids.
+#define HEADER_SIZE        (8)
+#define NULL_STRING        ((uint32_t)0xFFFFFFFF)
+#define INLINE_MSGID       ((uint32_t)0xFFFFFFFF)
+
+// Message id handles can't be larger than this. It has to match the
+// writer's; build with the same -DHXR_MESSAGE_ID_TABLE_SIZE if it was changed.
+#ifndef HXR_MESSAGE_ID_TABLE_SIZE
+#define HXR_MESSAGE_ID_TABLE_SIZE  (4096)
+#endif
+
+#define MSG_TYPE_MASK      ((uint32_t)0x0000003F)
+
+// ----- Output buffer -----
+
+typedef struct text
+{
+	char    *buf;
+	size_t  len;
+	size_t  capacity;
+} text;
+
+static void text_reserve(text *out, size_t n)
+{
+	if ( out->len + n <= out->capacity )
+		return;
+	size_t capacity = out->capacity ? out->capacity : 1024;
+	while ( capacity < out->len + n )
+		capacity *= 2;
+	out->buf = realloc(out->buf, capacity);
+	if ( out->buf == NULL ) {
+		fprintf(stderr, "hxr-binlog-decode: out of memory\n");
+		exit(1);
+	}
+	out->capacity = capacity;
+}
+
+static void text_put(text *out, const char *str, size_t len)
+{
+	text_reserve(out, len + 1);
+	memcpy(out->buf + out->len, str, len);
+	out->len += len;
+	out->buf[out->len] = '\0';
+}
+
+static void text_printf(text *out, const char *fmtstr, ...)
+{
+	va_list vargs;
+	va_start(vargs, fmtstr);
+	int len = vsnprintf(NULL, 0, fmtstr, vargs);
+	va_end(vargs);
+	if ( len < 0 )
+		return;
+
+	text_reserve(out, (size_t)len + 1);
+	va_start(vargs, fmtstr);
+	vsnprintf(out->buf + out->len, (size_t)len + 1, fmtstr, vargs);
+	va_end(vargs);
+	out->len += (size_t)len;
+}
+
+// ----- Reading records -----
+
+typedef struct reader
+{
+	const unsigned char  *pos;
+	const unsigned char  *end;
+	int                  bad;
+} reader;
+
+static void read_bytes(reader *r, void *dst, size_t n)
+{
+	if ( r->bad || (size_t)(r->end - r->pos) < n ) {
+		r->bad = 1;
+		memset(dst, 0, n);
+		return;
+	}
+	memcpy(dst, r->pos, n);
+	r->pos += n;
+}
+
+static uint8_t  read_u8(reader *r)  { uint8_t  v; read_bytes(r, &v, sizeof(v)); return v; }
+static uint32_t read_u32(reader *r) { uint32_t v; read_bytes(r, &v, sizeof(v)); return v; }
+static uint64_t read_u64(reader *r) { uint64_t v; read_bytes(r, &v, sizeof(v)); return v; }
+
+static const char *read_str(reader *r)
+{
+	const unsigned char *nul = r->bad ? NULL : memchr(r->pos, '\0', (size_t)(r->end - r->pos));
+	if ( nul == NULL ) {
+		r->bad = 1;
+		return "";
+	}
+	const char *result = (const char*)r->pos;
+	r->pos = nul + 1;
+	return result;
+}
+
+// ----- Format strings (see `hxr_fmtspec_parse_` in hexer.c) -----
+
+enum {
+	ARG_NONE, ARG_INT, ARG_UINT, ARG_LONG, ARG_ULONG, ARG_LLONG, ARG_ULLONG,
+	ARG_INTMAX, ARG_UINTMAX, ARG_SIZE, ARG_PTRDIFF, ARG_DOUBLE, ARG_LDOUBLE,
+	ARG_PTR, ARG_STRING, ARG_INVALID
+};
+
+#define FMTSPEC_MAX  (32)
+
+typedef struct fmtspec
+{
+	const char  *begin;
+	const char  *end;
+	int         arg_class;
+	int         n_stars;
+} fmtspec;
+
+static void fmtspec_parse(const char *pct, fmtspec *spec)
+{
+	const char *p = pct + 1;
+	spec->begin     = pct;
+	spec->arg_class = ARG_INVALID;
+	spec->n_stars   = 0;
+
+	if ( *p == '%' ) {
+		spec->arg_class = ARG_NONE;
+		spec->end = p + 1;
+		return;
+	}
+
+	while ( *p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0' || *p == '\'' )
+		p++;
+
+	if ( *p == '*' ) {
+		spec->n_stars++;
+		p++;
+	} else {
+		while ( '0' <= *p && *p <= '9' )
+			p++;
+	}
+
+	if ( *p == '.' ) {
+		p++;
+		if ( *p == '*' ) {
+			spec->n_stars++;
+			p++;
+		} else {
+			while ( '0' <= *p && *p <= '9' )
+				p++;
+		}
+	}
+
+	char len1 = '\0';
+	char len2 = '\0';
+	if ( *p == 'h' || *p == 'l' || *p == 'j' || *p == 'z' || *p == 't' || *p == 'L' ) {
+		len1 = *p++;
+		if ( (len1 == 'h' || len1 == 'l') && *p == len1 )
+			len2 = *p++;
+	}
+
+	char conv = *p;
+	spec->end = (conv == '\0') ? p : p + 1;
+	if ( spec->end - spec->begin >= FMTSPEC_MAX )
+		return;
+
+	int is_unsigned = (conv != 'd' && conv != 'i' && conv != 'c');
+	switch ( conv )
+	{
+		case 'd': case 'i': case 'c':
+		case 'o': case 'u': case 'x': case 'X':
+			switch ( len1 )
+			{
+				case '\0':
+				case 'h': spec->arg_class = is_unsigned ? ARG_UINT : ARG_INT; break;
+				case 'l':
+					if ( len2 == 'l' )
+						spec->arg_class = is_unsigned ? ARG_ULLONG : ARG_LLONG;
+					else
+						spec->arg_class = is_unsigned ? ARG_ULONG  : ARG_LONG;
+					break;
+				case 'j': spec->arg_class = is_unsigned ? ARG_UINTMAX : ARG_INTMAX; break;
+				case 'z': spec->arg_class = ARG_SIZE;    break;
+				case 't': spec->arg_class = ARG_PTRDIFF; break;
+			}
+			return;
+
+		case 'f': case 'F': case 'e': case 'E':
+		case 'g': case 'G': case 'a': case 'A':
+			spec->arg_class = (len1 == 'L') ? ARG_LDOUBLE : ARG_DOUBLE;
+			return;
+
+		case 'p': spec->arg_class = ARG_PTR;    return;
+		case 's': spec->arg_class = ARG_STRING; return;
+	}
+}
+
+#define RENDER(value) \
+	do { \
+		switch ( spec.n_stars ) { \
+			case 0:  text_printf(out, specstr, value); break; \
+			case 1:  text_printf(out, specstr, stars[0], value); break; \
+			default: text_printf(out, specstr, stars[0], stars[1], value); break; \
+		} \
+	} while(0)
+
+static void render_format(text *out, reader *r, const char *fmtstr)
+{
+	const char *p = fmtstr;
+	while ( *p != '\0' && !r->bad )
+	{
+		const char *pct = strchr(p, '%');
+		if ( pct == NULL ) {
+			text_put(out, p, strlen(p));
+			break;
+		}
+		text_put(out, p, (size_t)(pct - p));
+
+		fmtspec spec;
+		fmtspec_parse(pct, &spec);
+		p = spec.end;
+
+		if ( spec.arg_class == ARG_NONE ) {
+			text_put(out, "%", 1);
+			continue;
+		}
+		if ( spec.arg_class == ARG_INVALID ) {
+			// hexer.c never defers these, so the log is damaged.
+			r->bad = 1;
+			return;
+		}
+
+		char specstr[FMTSPEC_MAX];
+		size_t speclen = (size_t)(spec.end - spec.begin);
+		memcpy(specstr, spec.begin, speclen);
+		specstr[speclen] = '\0';
+
+		int stars[2];
+		for ( int i = 0; i < spec.n_stars; i++ )
+			stars[i] = (int32_t)read_u32(r);
+
+		switch ( spec.arg_class )
+		{
+			case ARG_INT:     RENDER((int)(int64_t)read_u64(r));            break;
+			case ARG_UINT:    RENDER((unsigned int)read_u64(r));            break;
+			case ARG_LONG:    RENDER((long)(int64_t)read_u64(r));           break;
+			case ARG_ULONG:   RENDER((unsigned long)read_u64(r));           break;
+			case ARG_LLONG:   RENDER((long long)(int64_t)read_u64(r));      break;
+			case ARG_ULLONG:  RENDER((unsigned long long)read_u64(r));      break;
+			case ARG_INTMAX:  RENDER((intmax_t)(int64_t)read_u64(r));       break;
+			case ARG_UINTMAX: RENDER((uintmax_t)read_u64(r));               break;
+			case ARG_SIZE:    RENDER((size_t)read_u64(r));                  break;
+			case ARG_PTRDIFF: RENDER((ptrdiff_t)(int64_t)read_u64(r));      break;
+			case ARG_PTR:     RENDER((void*)(uintptr_t)read_u64(r));        break;
+
+			case ARG_DOUBLE:
+			case ARG_LDOUBLE:
+			{
+				double value;
+				read_bytes(r, &value, sizeof(value));
+				if ( spec.arg_class == ARG_LDOUBLE )
+					RENDER((long double)value);
+				else
+					RENDER(value);
+				break;
+			}
+
+			case ARG_STRING:
+			{
+				uint32_t len = read_u32(r);
+				if ( len == NULL_STRING ) {
+					RENDER((const char*)NULL);
+					break;
+				}
+				if ( (size_t)(r->end - r->pos) < len ) {
+					r->bad = 1;
+					return;
+				}
+				char *str = malloc((size_t)len + 1);
+				memcpy(str, r->pos, len);
+				str[len] = '\0';
+				r->pos += len;
+				RENDER(str);
+				free(str);
+				break;
+			}
+		}
+	}
+}
+
+#undef RENDER
+
+// Renders one section of a MESSAGE record into `out`.
+static void read_section(text *out, reader *r)
+{
+	uint8_t kind = read_u8(r);
+	if ( kind == SECTION_TEXT ) {
+		const char *str = read_str(r);
+		text_put(out, str, strlen(str));
+	} else
+	if ( kind == SECTION_FORMAT ) {
+		const char *fmtstr = read_str(r);
+		render_format(out, r, fmtstr);
+	} else
+	if ( kind != SECTION_NONE ) {
+		r->bad = 1;
+	}
+}
+
+// ----- Sessions -----
+
+typedef struct callsite
+{
+	const char  *file;
+	const char  *func;
+	uint32_t    line;
+} callsite;
+
+typedef struct session
+{
+	const char  **msgids;     // Indexed by handle.
+	size_t      n_msgids;
+	callsite    *callsites;   // Indexed by callsite number.
+	size_t      n_callsites;
+	size_t      n_records;    // Since the SESSION record.
+} session;
+
+static void *grow_array(void *array, size_t *count, size_t index, size_t elem_size)
+{
+	if ( index < *count )
+		return array;
+	size_t new_count = *count ? *count : 64;
+	while ( new_count <= index )
+		new_count *= 2;
+	array = realloc(array, new_count * elem_size);
+	if ( array == NULL ) {
+		fprintf(stderr, "hxr-binlog-decode: out of memory\n");
+		exit(1);
+	}
+	memset((char*)array + *count * elem_size, 0, (new_count - *count) * elem_size);
+	*count = new_count;
+	return array;
+}
+
+static void session_reset(session *s)
+{
+	s->n_records = 0;
+	if ( s->msgids != NULL )
+		memset(s->msgids, 0, s->n_msgids * sizeof(const char*));
+	if ( s->callsites != NULL )
+		memset(s->callsites, 0, s->n_callsites * sizeof(callsite));
+}
+
+static const char *type_name(uint32_t type_and_flags)
+{
+	switch ( type_and_flags & MSG_TYPE_MASK )
+	{
+		case 1:  return "info";
+		case 2:  return "warning";
+		case 3:  return "error";
+		default: return "message";
+	}
+}
+
+// Same layout as `hxr_send_section_` in hexer.c.
+static void put_section(text *out, const char *label, const text *section)
+{
+	if ( section->len == 0 )
+		return;
+	text_put(out, label, strlen(label));
+	text_put(out, section->buf, section->len);
+	if ( section->buf[section->len-1] != '\n' )
+		text_put(out, "\n", 1);
+}
+
+typedef struct options
+{
+	const char  *only_id;
+	int         count_only;
+} options;
+
+// Returns the number of matching messages, or -1 if the log is damaged.
+static long decode(const char *path, const unsigned char *data, size_t size, const options *opts)
+{
+	session  s = { NULL, 0, NULL, 0, 0 };
+	text     out = { NULL, 0, 0 };
+	text     summary = { NULL, 0, 0 };
+	text     details = { NULL, 0, 0 };
+	text     suggestion = { NULL, 0, 0 };
+	uint32_t only_handle = 0;
+	int      have_session = 0;
+	long     n_matched = 0;
+	size_t   offset = 0;
+
+	while ( offset + HEADER_SIZE <= size )
+	{
+		uint32_t rec_size;
+		uint16_t kind;
+		memcpy(&rec_size, data + offset, sizeof(rec_size));
+		memcpy(&kind, data + offset + 4, sizeof(kind));
+		if ( rec_size < HEADER_SIZE || rec_size % HEADER_SIZE != 0 || rec_size > size - offset ) {
+			fprintf(stderr, "%s: bad record at offset %zu\n", path, offset);
+			n_matched = -1;
+			break;
+		}
+
+		reader r = { data + offset + HEADER_SIZE, data + offset + rec_size, 0 };
+		offset += rec_size;
+
+		if ( kind == BINLOG_SESSION )
+		{
+			char magic[8];
+			read_bytes(&r, magic, sizeof(magic));
+			uint32_t version = read_u32(&r);
+			uint32_t byte_order = read_u32(&r);
+			if ( r.bad || memcmp(magic, "HXRBLOG", 8) != 0 || version < 1 || version > BINLOG_VERSION ) {
+				fprintf(stderr, "%s: not a HeXeR binary log (or an unsupported version)\n", path);
+				n_matched = -1;
+				break;
+			}
+			if ( byte_order != 0x01020304 ) {
+				fprintf(stderr, "%s: log was written on a machine with a different byte order\n", path);
+				n_matched = -1;
+				break;
+			}
+			session_reset(&s);
+			only_handle = 0;
+			have_session = 1;
+			continue;
+		}
+
+		if ( !have_session ) {
+			fprintf(stderr, "%s: not a HeXeR binary log\n", path);
+			n_matched = -1;
+			break;
+		}
+
+		s.n_records++;
+		switch ( kind )
+		{
+			case BINLOG_MSGID:
+			{
+				uint32_t handle = read_u32(&r);
+				const char *id = read_str(&r);
+				if ( r.bad )
+					break;
+
+				// Handles come from the writer's id table.
+				if ( handle == 0 || handle > HXR_MESSAGE_ID_TABLE_SIZE ) {
+					r.bad = 1;
+					break;
+				}
+				s.msgids = grow_array(s.msgids, &s.n_msgids, handle, sizeof(const char*));
+				s.msgids[handle] = id;
+				if ( opts->only_id != NULL && strcmp(id, opts->only_id) == 0 )
+					only_handle = handle;
+				break;
+			}
+
+			case BINLOG_CALLSITE:
+			{
+				uint32_t index = read_u32(&r);
+				uint32_t line  = read_u32(&r);
+				const char *file = read_str(&r);
+				const char *func = read_str(&r);
+				if ( r.bad )
+					break;
+
+				// Callsites are numbered from 1 as they're defined, each in a
+				// record of its own, so a number can't be larger than the
+				// number of records in the session.
+				if ( index == 0 || index > s.n_records ) {
+					r.bad = 1;
+					break;
+				}
+				s.callsites = grow_array(s.callsites, &s.n_callsites, index, sizeof(callsite));
+				s.callsites[index].file = file;
+				s.callsites[index].func = func;
+				s.callsites[index].line = line;
+				break;
+			}
+
+			case BINLOG_MESSAGE:
+			{
+				uint32_t type_and_flags = read_u32(&r);
+				uint32_t msgid          = read_u32(&r);
+				uint32_t site           = read_u32(&r);
+				uint32_t repeat_count   = read_u32(&r);
+				(void)read_u64(&r); // first_time
+				(void)read_u64(&r); // last_time
+				const char *id = NULL;
+				if ( msgid == INLINE_MSGID )
+					id = read_str(&r);
+				else
+				if ( msgid < s.n_msgids )
+					id = s.msgids[msgid];
+				if ( r.bad )
+					break;
+
+				// Filtering is an integer compare, unless the id wasn't
+				// interned. Nothing gets rendered.
+				if ( opts->only_id != NULL )
+				{
+					int match = (msgid == INLINE_MSGID)
+						? (strcmp(id, opts->only_id) == 0)
+						: (only_handle != 0 && msgid == only_handle);
+					if ( !match )
+						break;
+				}
+				n_matched++;
+				if ( opts->count_only )
+					break;
+
+				summary.len = details.len = suggestion.len = 0;
+				read_section(&summary, &r);
+				read_section(&details, &r);
+				read_section(&suggestion, &r);
+				if ( r.bad )
+					break;
+
+				callsite cs = { "?", "?", 0 };
+				if ( site < s.n_callsites && s.callsites[site].file != NULL )
+					cs = s.callsites[site];
+
+				// Same layout as `hxr_send_message_` in hexer.c.
+				out.len = 0;
+				text_printf(&out, "%s:%zd: %s: ", cs.file, (size_t)cs.line, type_name(type_and_flags));
+				if ( summary.len > 0 )
+					text_put(&out, summary.buf, summary.len);
+				else
+					text_put(&out, "(no summary)", 12);
+				if ( id != NULL )
+					text_printf(&out, " [%s]", id);
+				if ( repeat_count > 1 )
+					text_printf(&out, " (repeated %zd times)", (size_t)repeat_count);
+				text_put(&out, "\n", 1);
+				put_section(&out, "", &details);
+				put_section(&out, "Suggestion: ", &suggestion);
+				fwrite(out.buf, 1, out.len, stdout);
+				break;
+			}
+
+			case BINLOG_TEXT:
+			{
+				const char *str = read_str(&r);
+				if ( !r.bad && opts->only_id == NULL && !opts->count_only )
+					fputs(str, stdout);
+				break;
+			}
+
+			default:
+				// Unknown record kinds are skipped, so that older decoders can
+				// read logs from newer writers.
+				break;
+		}
+
+		if ( r.bad ) {
+			fprintf(stderr, "%s: damaged record (kind %d) ending at offset %zu\n", path, kind, offset);
+			n_matched = -1;
+			break;
+		}
+	}
+
+	free(s.msgids);
+	free(s.callsites);
+	free(out.buf);
+	free(summary.buf);
+	free(details.buf);
+	free(suggestion.buf);
+	return n_matched;
+}
+
+int main(int argc, char *argv[])
+{
+	options opts = { NULL, 0 };
+	int argi = 1;
+	for ( ; argi < argc && argv[argi][0] == '-'; argi++ )
+	{
+		if ( strcmp(argv[argi], "-i") == 0 && argi + 1 < argc )
+			opts.only_id = argv[++argi];
+		else
+		if ( strcmp(argv[argi], "-c") == 0 )
+			opts.count_only = 1;
+		else
+			break;
+	}
+
+	if ( argi >= argc ) {
+		fprintf(stderr, "usage: %s [-i message_id] [-c] file...\n", argv[0]);
+		return 2;
+	}
+
+	int status = 0;
+	for ( ; argi < argc; argi++ )
+	{
+		const char *path = argv[argi];
+		int fd = open(path, O_RDONLY);
+		struct stat st;
+		if ( fd < 0 || fstat(fd, &st) != 0 ) {
+			perror(path);
+			status = 1;
+			if ( fd >= 0 )
+				close(fd);
+			continue;
+		}
+
+		long n = 0;
+		if ( st.st_size > 0 )
+		{
+			void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if ( data == MAP_FAILED ) {
+				perror(path);
+				close(fd);
+				status = 1;
+				continue;
+			}
+			n = decode(path, data, (size_t)st.st_size, &opts);
+			munmap(data, (size_t)st.st_size);
+		}
+		close(fd);
+
+		if ( n < 0 )
+			status = 1;
+		else
+		if ( opts.count_only )
+			printf("%s: %ld\n", path, n);
+	}
+
+	return status;
+}